@@ -0,0 +1,1058 @@
+/*
+ * Module: fleet_sim
+ *
+ * Function: host simulator of a fleet of LMICWrapper endnodes sharing gateways and channels
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ *
+ * Build: fleet_sim target of the host build (extras/host/CMakeLists.txt, see ARDUINOJSON_DIR, CAYENNELPP_DIR
+ * and NANOPB_DIR for the variants), or the raw variant alone from the library root:
+ * 		g++ -std=gnu++11 -O2 -pthread -fwrapv -Iextras/host/stub -Iextras/host -Isrc extras/fleet_sim/fleet_sim.cpp -o fleet_sim
+ *
+ * Usage:
+ * 		fleet_sim [--nodes 10000] [--hours 24] [--period 900] [--confirmed 10] [--gateways 1]
+ * 		          [--radius 2] [--channels 8] [--gw-duty 10] [--threads N] [--seed 1]
+ *
+ * Each node is a real endnode of the library (GenericEndnode subclass) running on its own HostLMIC:
+ * - a reading every period seconds (+/- 10%), given to the typed send() of the endnode:
+ *   RawEndnode always, JsonEndnode (JSON and MessagePack), CayenneLPPEndnode and ProtobufEndnode
+ *   when LEUVILLE_FLEET_JSON, LEUVILLE_FLEET_CAYENNE or LEUVILLE_FLEET_PROTOBUF are defined (nodes use each variant in turn)
+ * - queue, KEEP_RECENT policy, payload size checks, retries of confirmed messages and outcomes are the library ones,
+ *   RX windows and duty cycle are the HostLMIC ones (JOIN takes JOIN_DELAY_MS and is not on the air)
+ *
+ * Radio channel:
+ * - nodes and gateways are placed at random in a disk, log-distance path loss with shadowing
+ * - the data rate of a node is chosen by ADR: fastest one of the default bandwidth with ADR_MARGIN_DB above sensitivity
+ * - frames on the same channel with the same data rate collide unless one is CAPTURE_DB stronger,
+ *   data rates are orthogonal
+ * - a gateway demodulates DEMODULATORS frames at the same time
+ * - acknowledgements are sent in RX1 by the best gateway which still has downlink duty cycle
+ *
+ * Time goes by windows of WINDOW_MS: the nodes run in parallel until the end of the window, then the frames which ended
+ * are resolved together and each HostLMIC receives the answer of the network (completeTx()), before its RX1 window.
+ * Nodes are sharded over a pool of worker threads: LMIC and the library state shared by endnodes are per thread
+ * (LEUVILLE_LORA_SHARED), the node which runs switches them. Each node owns its random generator:
+ * results do not depend on the number of threads.
+ */
+
+#define LEUVILLE_LORA_SHARED thread_local
+
+#include <HostLMIC.h>
+#include <GenericEndnode.h>
+#if defined(LEUVILLE_FLEET_JSON)
+#include <JsonEndnode.h>
+#endif
+#if defined(LEUVILLE_FLEET_CAYENNE)
+#include <CayenneLPPEndnode.h>
+#endif
+#if defined(LEUVILLE_FLEET_PROTOBUF)
+#include <ProtobufEndnode.h>
+#include "fleet_sim.pb.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace leuville {
+namespace lora {
+namespace sim {
+
+using host::HostLMIC;
+using host::HostFrame;
+using host::HostReply;
+
+constexpr uint32_t WINDOW_MS 		= 1000;		// simulation step
+constexpr uint8_t  ACK_PHY_LEN 		= 12;		// MHDR + FHDR + MIC, without FPort
+constexpr float    CAPTURE_DB 		= 6;
+constexpr uint8_t  DEMODULATORS 	= 8;		// SX1301 / SX1302 demodulation paths
+constexpr float    TX_POWER_DBM 	= 14;
+constexpr float    PATH_LOSS_1KM 	= 128;		// dB at 1 km, 868 MHz urban
+constexpr float    PATH_LOSS_EXP 	= 3.5;
+constexpr float    SHADOWING_DB 	= 6;		// standard deviation
+constexpr float    ADR_MARGIN_DB 	= 10;
+
+// the answer to a frame which ended in a window is given before the RX1 window of the node
+static_assert(WINDOW_MS <= host::RX1_DELAY_MS, "WINDOW_MS must not exceed RX1_DELAY_MS");
+
+constexpr uint64_t WINDOW = ms2osticks(WINDOW_MS);
+
+constexpr uint8_t DATA_RATES = sizeof(_modulation) / sizeof(Modulation);
+
+/*
+ * Sensitivity of a LoRa data rate, in dBm: noise floor (6 dB noise figure) + required SNR
+ */
+inline float sensitivity(dr_t dr) {
+	Modulation mod = modulationOf(dr);
+	return -174 + 10 * std::log10(mod._bw * 1000.0f) + 6 - (mod._sf - 4) * 2.5f;
+}
+
+inline double ticksToMs(uint64_t ticks) {
+	return ticks * 1000.0 / OSTICKS_PER_SEC;
+}
+
+/*
+ * splitmix64: 8 bytes of state, so that each node owns its generator
+ */
+class Random {
+public:
+
+	explicit Random(uint64_t seed) : _state(seed) {
+	}
+
+	uint64_t next() {
+		uint64_t z = (_state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+
+	// [0, 1[
+	double uniform() {
+		return (next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	uint32_t below(uint32_t n) {
+		return (uint32_t)(uniform() * n);
+	}
+
+	double gaussian() {
+		double u = 1.0 - uniform();
+		return std::sqrt(-2.0 * std::log(u)) * std::cos(2 * M_PI * uniform());
+	}
+
+private:
+
+	uint64_t _state;
+};
+
+struct Config {
+	uint32_t 	_nodes = 10000;
+	double 		_hours = 24;
+	uint32_t 	_period = 900;		// s
+	double 		_confirmed = 10;	// % of nodes
+	uint8_t 	_gateways = 1;
+	double 		_radius = 2;		// km
+	uint8_t 	_channels = 8;
+	uint16_t 	_gwDutyCycle = 10;	// gateway downlink duty cycle = 1 / _gwDutyCycle
+	unsigned 	_threads = std::max(1u, std::thread::hardware_concurrency());
+	uint64_t 	_seed = 1;
+};
+
+struct Point {
+	double _x;
+	double _y;
+
+	static Point inDisk(Random & random, double radius) {
+		double r = radius * std::sqrt(random.uniform());
+		double a = 2 * M_PI * random.uniform();
+		return Point { r * std::cos(a), r * std::sin(a) };
+	}
+
+	double distance(const Point & other) const {
+		return std::hypot(_x - other._x, _y - other._y);
+	}
+};
+
+// why a frame has not been received
+enum Loss : uint8_t {
+	LOSS_NONE = 0,
+	LOSS_RANGE,
+	LOSS_COLLISION,
+	LOSS_DEMODULATOR,
+	LOSSES
+};
+
+constexpr uint8_t OUTCOMES = LMICWrapper::TX_REJECTED + 1;
+
+/*
+ * One uplink frame on the air, times in ticks since the start of the simulation
+ */
+struct Transmission {
+	uint32_t 	_node;
+	uint32_t 	_seq;			// reading carried
+	uint64_t 	_start;
+	uint64_t 	_end;
+	uint32_t 	_airtime;		// us
+	uint8_t 	_channel;
+	dr_t 		_dr;
+	bool 		_confirmed;
+
+	// outcome
+	bool 		_final = false;
+	int 		_gateway = -1;	// best gateway which received it
+	Loss 		_loss = LOSS_NONE;
+	bool 		_acked = false;
+};
+
+/*
+ * Counters of a node, summed per variant by the report
+ */
+struct Counters {
+	uint64_t _offered = 0;
+	uint64_t _tooLarge = 0;
+	uint64_t _queueDrops = 0;
+	uint64_t _delivered = 0;
+	uint64_t _bytes = 0;		// application bytes of the delivered readings
+	uint64_t _frames = 0;
+	uint64_t _retransmissions = 0;
+	uint64_t _losses[LOSSES] = { 0 };
+	uint64_t _ackRefused = 0;
+	uint64_t _airtime = 0;		// us
+	uint64_t _outcomes[OUTCOMES] = { 0 };
+
+	void add(const Counters & other) {
+		_offered += other._offered;
+		_tooLarge += other._tooLarge;
+		_queueDrops += other._queueDrops;
+		_delivered += other._delivered;
+		_bytes += other._bytes;
+		_frames += other._frames;
+		_retransmissions += other._retransmissions;
+		for (uint8_t i = 0; i < LOSSES; i++) {
+			_losses[i] += other._losses[i];
+		}
+		_ackRefused += other._ackRefused;
+		_airtime += other._airtime;
+		for (uint8_t i = 0; i < OUTCOMES; i++) {
+			_outcomes[i] += other._outcomes[i];
+		}
+	}
+};
+
+/*
+ * Reading of temperature, humidity and battery, seq makes its payload unique among the pending ones
+ */
+struct Sample {
+	uint16_t 	_seq;
+	int16_t 	_temperature;	// 1/100 C
+	uint8_t 	_humidity;		// %
+	uint8_t 	_battery;		// %
+};
+
+/*
+ * Simulation context of one endnode: its HostLMIC, its radio link, its readings and what became of them
+ *
+ * The endnode is the subclass (SimNode): it switches the LMIC context in enter() / leave()
+ * and gives a reading to the typed send() of its endnode class.
+ */
+class Device {
+public:
+
+	Device(uint32_t index, uint8_t variant, const Config & config, const std::vector<Point> & gateways)
+		: _random(config._seed * 0x100000001B3ULL + index), _index(index), _variant(variant),
+		  _period(sec2osticks(config._period)), _channels(config._channels)
+	{
+		Point position = Point::inDisk(_random, config._radius);
+		float best = -1000;
+		for (const Point & gateway : gateways) {
+			double d = std::max(0.01, position.distance(gateway));
+			float rssi = TX_POWER_DBM - PATH_LOSS_1KM - 10 * PATH_LOSS_EXP * std::log10(d) + SHADOWING_DB * _random.gaussian();
+			_rssi.push_back(rssi);
+			best = std::max(best, rssi);
+		}
+		_dr = 0;
+		// ADR uses the data rates of the default bandwidth
+		for (dr_t dr = 0; dr < DATA_RATES; dr++) {
+			if (modulationOf(dr)._bw == modulationOf(0)._bw && sensitivity(dr) + ADR_MARGIN_DB <= best) {
+				_dr = dr;
+			}
+		}
+		_inRange = (best >= sensitivity(0));
+		_confirmed = (_random.uniform() * 100 < config._confirmed);
+		_nextReading = _random.below(_period);
+		_wakeup = 0;
+		_host.setNetwork(&Device::deferAnswer);
+	}
+
+	virtual ~Device() = default;
+
+	/*
+	 * Starts the endnode: begin(), then the data rate chosen by ADR
+	 */
+	void start() {
+		char devEUI[17];
+		snprintf(devEUI, sizeof(devEUI), "0000A06E%08X", (unsigned)_index);
+		enter();
+		endnode().begin(OTAAId("70B3D57E00000001", devEUI, "00112233445566778899AABBCCDDEEFF"), 0x13, false);
+		LMIC_setDrTxpow(_dr, TX_POWER_DBM);
+		leave();
+		updateWakeup();
+	}
+
+	/*
+	 * Time of the next reading or LMIC job, in ticks: the node has nothing to do before
+	 */
+	uint64_t wakeup() const {
+		return _wakeup;
+	}
+
+	/*
+	 * Runs the node until time until (included): readings, then the frame which started appended to out
+	 */
+	void advance(uint64_t until, std::vector<Transmission> & out) {
+		if (_wakeup > until) {
+			return;
+		}
+		enter();
+		while (_nextReading <= until) {
+			runTo(_nextReading);
+			offer();
+			_nextReading += _period - _period / 10 + _random.below(_period / 5 + 1);
+		}
+		runTo(until);
+		// one frame at most: the next one waits for completeTx()
+		if (_host.frames() != _counters._frames) {
+			_counters._frames = _host.frames();
+			out.push_back(transmission(_host.lastFrame()));
+		}
+		leave();
+		updateWakeup();
+	}
+
+	/*
+	 * Outcome of the last frame, given to HostLMIC as the network answer
+	 */
+	void answer(const Transmission & tx) {
+		_counters._losses[tx._loss] += 1;
+		if (tx._confirmed && tx._gateway >= 0 && !tx._acked) {
+			_counters._ackRefused += 1;
+		}
+		Pending * pending = find(tx._seq);
+		if (tx._gateway >= 0 && pending != nullptr && !pending->_delivered) {
+			pending->_delivered = true;
+			_counters._delivered += 1;
+			_counters._bytes += pending->_len;
+			_deliveryLatency.push_back(ticksToMs(tx._end - pending->_enqueueTime));
+		}
+		HostReply reply;
+		reply._ack = tx._acked;
+		_host.completeTx(reply);
+		updateWakeup();
+	}
+
+	/*
+	 * Counters of the endnode, once the simulation is over
+	 */
+	const Counters & counters() {
+		const NodeStats & stats = endnode().stats();
+		_counters._queueDrops = stats._dropsRecent;
+		_counters._retransmissions = stats._retransmissions;
+		return _counters;
+	}
+
+	const std::vector<float> & rssi() const {
+		return _rssi;
+	}
+
+	dr_t dataRate() const {
+		return _dr;
+	}
+
+	bool inRange() const {
+		return _inRange;
+	}
+
+	uint8_t variant() const {
+		return _variant;
+	}
+
+	const std::vector<uint32_t> & deliveryLatency() const {
+		return _deliveryLatency;
+	}
+
+	const std::vector<uint32_t> & queueLatency() const {
+		return _queueLatency;
+	}
+
+protected:
+
+	HostLMIC _host;
+
+	// makes the LMIC context of this node the one of the calling thread
+	virtual void enter() = 0;
+	// saves the LMIC context
+	virtual void leave() = 0;
+
+	virtual LMICWrapper & endnode() = 0;
+
+	// gives the reading to the typed send() of the endnode
+	virtual bool sendReading(const Sample & sample, bool ack) = 0;
+
+	// message just queued by sendReading()
+	virtual const UpstreamMessage * newest() = 0;
+
+	/*
+	 * Called by txOutcome(): the message leaves the queue
+	 */
+	void outcome(const UpstreamMessage & message, LMICWrapper::TxOutcome outcome) {
+		_counters._outcomes[outcome] += 1;
+		for (auto pending = _pending.begin(); pending != _pending.end(); ++pending) {
+			if (pending->matches(message._buf, message._len)) {
+				_queueLatency.push_back(ticksToMs(_host.elapsed() - pending->_enqueueTime));
+				_pending.erase(pending);
+				return;
+			}
+		}
+	}
+
+private:
+
+	/*
+	 * Reading queued by the endnode, as sent
+	 */
+	struct Pending {
+		uint32_t 	_seq;
+		uint64_t 	_enqueueTime;
+		bool 		_delivered;
+		uint8_t 	_len;
+		uint8_t 	_buf[MAX_FRAME_LEN];
+
+		bool matches(const uint8_t * buf, uint8_t len) const {
+			return _len == len && memcmp(_buf, buf, len) == 0;
+		}
+	};
+
+	Random 				_random;
+	uint32_t 			_index;
+	uint8_t 			_variant;
+	uint64_t 			_period;		// ticks
+	uint8_t 			_channels;
+	dr_t 				_dr;
+	bool 				_inRange;
+	bool 				_confirmed;
+	std::vector<float> 	_rssi;			// per gateway
+
+	uint32_t 			_seq = 0;
+	uint64_t 			_nextReading;	// ticks
+	uint64_t 			_wakeup;
+	// readings queued, oldest first: removed by their outcome, or when KEEP_RECENT has dropped them long ago
+	std::deque<Pending> _pending;
+
+	Counters 				_counters;
+	std::vector<uint32_t> 	_deliveryLatency;	// enqueue to first reception, ms
+	std::vector<uint32_t> 	_queueLatency;		// enqueue to removal from the queue (txOutcome()), ms
+
+	/*
+	 * The answer depends on the frames of the other nodes: given by answer() at the end of the window
+	 */
+	static bool deferAnswer(HostLMIC &, const HostFrame &, HostReply &, void *) {
+		return false;
+	}
+
+	void runTo(uint64_t time) {
+		_host.run(endnode(), (ostime_t)(time > _host.elapsed() ? time - _host.elapsed() : 0));
+	}
+
+	void updateWakeup() {
+		_wakeup = _nextReading;
+		ostime_t when;
+		if (_host.nextDeadline(when)) {
+			int64_t job = (int64_t)_host.elapsed() + (int32_t)(when - _host.now());
+			_wakeup = std::min<uint64_t>(_wakeup, std::max<int64_t>(job, 0));
+		}
+	}
+
+	void offer() {
+		Sample sample;
+		sample._seq = (uint16_t)_seq;
+		sample._temperature = 1500 + _random.below(1000);
+		sample._humidity = 30 + _random.below(50);
+		sample._battery = 100 - std::min<uint32_t>(_seq / 100, 100);
+		_counters._offered += 1;
+		if (!sendReading(sample, _confirmed)) {
+			_counters._tooLarge += (endnode().lastSendError() == LMICWrapper::SEND_PAYLOAD_TOO_LARGE ? 1 : 0);
+			_seq += 1;
+			return;
+		}
+		const UpstreamMessage * message = newest();
+		Pending pending { _seq++, _host.elapsed(), false, message->_len };
+		memcpy(pending._buf, message->_buf, message->_len);
+		_pending.push_back(pending);
+		if (_pending.size() > 2 * LEUVILLE_LORA_QUEUE_LEN) {
+			_pending.pop_front();
+		}
+	}
+
+	Pending * find(uint32_t seq) {
+		for (Pending & pending : _pending) {
+			if (pending._seq == seq) {
+				return &pending;
+			}
+		}
+		return nullptr;
+	}
+
+	Transmission transmission(const HostFrame & frame) {
+		Transmission tx;
+		tx._node = _index;
+		tx._seq = UINT32_MAX;
+		for (const Pending & pending : _pending) {
+			if (pending.matches(frame._data, frame._len)) {
+				tx._seq = pending._seq;
+			}
+		}
+		tx._start = _host.elapsed() - (uint32_t)(_host.now() - frame._start);
+		tx._end = tx._start + (uint32_t)(frame._end - frame._start);
+		tx._airtime = frame._airtime;
+		tx._channel = _random.below(_channels);
+		tx._dr = frame._dr;
+		tx._confirmed = frame._confirmed;
+		_counters._airtime += frame._airtime;
+		return tx;
+	}
+};
+
+/*
+ * Device running the endnode class Endnode
+ */
+template <typename Endnode>
+class SimNode : public Device, public Endnode {
+public:
+
+	SimNode(uint32_t index, uint8_t variant, const Config & config, const std::vector<Point> & gateways)
+		: Device(index, variant, config, gateways), Endnode(nullptr)
+	{}
+
+	// the pending jobs of the endnode are released in its own context
+	~SimNode() {
+		enter();
+	}
+
+protected:
+
+	using JobOwner = typename Endnode::JobOwner;
+
+	// pending LMIC jobs of this endnode while another one runs
+	JobOwner _jobs[LEUVILLE_LORA_MAX_JOBS] = {};
+
+	void enter() override {
+		_host.select();
+		std::copy(std::begin(_jobs), std::end(_jobs), Endnode::jobOwners());
+		this->activate();
+	}
+
+	void leave() override {
+		std::copy(std::begin(Endnode::jobOwners()), std::end(Endnode::jobOwners()), _jobs);
+	}
+
+	LMICWrapper & endnode() override {
+		return *this;
+	}
+
+	const UpstreamMessage * newest() override {
+		return this->_messages[0].frontPtr();
+	}
+
+	void txOutcome(const UpstreamMessage & message, LMICWrapper::TxOutcome outcome) override {
+		Device::outcome(message, outcome);
+	}
+};
+
+/*
+ * Endnode variants: temperature in 1/100 C, humidity and battery in %
+ */
+class RawNode final : public SimNode<GenericEndnode<RawCodec, RawNode>> {
+public:
+	using SimNode::SimNode;
+
+protected:
+
+	bool sendReading(const Sample & sample, bool ack) override {
+		uint8_t buf[] = {
+			(uint8_t)sample._seq, (uint8_t)(sample._seq >> 8),
+			(uint8_t)sample._temperature, (uint8_t)(sample._temperature >> 8),
+			sample._humidity, sample._battery
+		};
+		return send(RawPayload { buf, sizeof(buf) }, ack);
+	}
+};
+
+#if defined(LEUVILLE_FLEET_JSON)
+template <JsonWireFormat FORMAT>
+class JsonNode final : public SimNode<BasicJsonEndnode<FORMAT, JsonNode<FORMAT>>> {
+public:
+	using SimNode<BasicJsonEndnode<FORMAT, JsonNode<FORMAT>>>::SimNode;
+
+protected:
+
+	bool sendReading(const Sample & sample, bool ack) override {
+		JsonDocument doc;
+		doc["n"] = sample._seq;
+		doc["temperature"] = sample._temperature / 100.0;
+		doc["humidity"] = sample._humidity;
+		doc["battery"] = sample._battery;
+		return this->send(doc, ack);
+	}
+};
+#endif
+
+#if defined(LEUVILLE_FLEET_CAYENNE)
+class CayenneNode final : public SimNode<CayenneLPPEndnodeT<CayenneNode>> {
+public:
+	using SimNode::SimNode;
+
+protected:
+
+	bool sendReading(const Sample & sample, bool ack) override {
+		CayenneLPP lpp(MAX_FRAME_LEN);
+		lpp.addDigitalInput(0, (uint8_t)sample._seq);
+		lpp.addTemperature(1, sample._temperature / 100.0f);
+		lpp.addRelativeHumidity(2, sample._humidity);
+		lpp.addAnalogInput(3, sample._battery);
+		return send(lpp, ack);
+	}
+};
+#endif
+
+#if defined(LEUVILLE_FLEET_PROTOBUF)
+class ProtobufNode final
+	: public SimNode<ProtobufEndnode<SimReading, SimReading_fields, SimCommand, SimCommand_fields, ProtobufNode>> {
+public:
+	using SimNode::SimNode;
+
+protected:
+
+	bool sendReading(const Sample & sample, bool ack) override {
+		SimReading reading = SimReading_init_zero;
+		reading.seq = sample._seq;
+		reading.temperature = sample._temperature;
+		reading.humidity = sample._humidity;
+		reading.battery = sample._battery;
+		return send(reading, ack);
+	}
+};
+#endif
+
+template <typename Node>
+Device * make(uint32_t index, uint8_t variant, const Config & config, const std::vector<Point> & gateways) {
+	return new Node(index, variant, config, gateways);
+}
+
+struct Variant {
+	const char * _name;
+	Device * (*_make)(uint32_t, uint8_t, const Config &, const std::vector<Point> &);
+};
+
+const Variant _variants[] = {
+	{ "raw", &make<RawNode> },
+#if defined(LEUVILLE_FLEET_PROTOBUF)
+	{ "protobuf", &make<ProtobufNode> },
+#endif
+#if defined(LEUVILLE_FLEET_JSON)
+	{ "json", &make<JsonNode<JsonWireFormat::JSON>> },
+	{ "msgpack", &make<JsonNode<JsonWireFormat::MSGPACK>> },
+#endif
+#if defined(LEUVILLE_FLEET_CAYENNE)
+	{ "cayennelpp", &make<CayenneNode> },
+#endif
+};
+
+constexpr uint8_t VARIANTS = sizeof(_variants) / sizeof(Variant);
+
+/*
+ * Fixed set of threads running the same task over indexes
+ */
+class WorkerPool {
+public:
+
+	/*
+	 * The calling thread is one of the threads
+	 */
+	explicit WorkerPool(unsigned threads) {
+		for (unsigned i = 1; i < threads; i++) {
+			_threads.emplace_back([this] { work(); });
+		}
+	}
+
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_start.notify_all();
+		for (std::thread & thread : _threads) {
+			thread.join();
+		}
+	}
+
+	/*
+	 * Calls task(i) for each i of [0, count[, returns when all calls are done
+	 */
+	void run(unsigned count, const std::function<void(unsigned)> & task) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_task = &task;
+			_count = count;
+			_next = 0;
+			_running = _threads.size();
+			_generation += 1;
+		}
+		_start.notify_all();
+		drain();
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done.wait(lock, [this] { return _running == 0; });
+	}
+
+private:
+
+	std::vector<std::thread> 				_threads;
+	std::mutex 								_mutex;
+	std::condition_variable 				_start;
+	std::condition_variable 				_done;
+	const std::function<void(unsigned)> * 	_task = nullptr;
+	unsigned 								_count = 0;
+	std::atomic<unsigned> 					_next { 0 };
+	size_t 									_running = 0;
+	uint64_t 								_generation = 0;
+	bool 									_stop = false;
+
+	void drain() {
+		for (unsigned i = _next++; i < _count; i = _next++) {
+			(*_task)(i);
+		}
+	}
+
+	void work() {
+		uint64_t generation = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_start.wait(lock, [&] { return _stop || _generation != generation; });
+				if (_stop) {
+					return;
+				}
+				generation = _generation;
+			}
+			drain();
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (--_running == 0) {
+				_done.notify_one();
+			}
+		}
+	}
+};
+
+struct Gateway {
+	Point 			_position;
+	AirtimeBudget 	_downlink;
+};
+
+class Simulator {
+public:
+
+	Simulator(const Config & config)
+		: _config(config), _pool(config._threads)
+	{
+		Random random(config._seed);
+		for (uint8_t i = 0; i < config._gateways; i++) {
+			Point position = (i == 0 ? Point { 0, 0 } : Point::inDisk(random, config._radius));
+			_gateways.push_back(Gateway { position, AirtimeBudget(AirtimeBudget::HOUR_MS * 1000 / config._gwDutyCycle) });
+		}
+		std::vector<Point> positions;
+		for (const Gateway & gateway : _gateways) {
+			positions.push_back(gateway._position);
+		}
+		_nodes.reserve(config._nodes);
+		for (uint32_t i = 0; i < config._nodes; i++) {
+			uint8_t variant = i % VARIANTS;
+			_nodes.emplace_back(_variants[variant]._make(i, variant, config, positions));
+			_nodes.back()->start();
+		}
+		_shards = std::max(1u, std::min(config._threads * 4, config._nodes));
+		_out.resize(_shards);
+		for (dr_t dr = 0; dr < DATA_RATES; dr++) {
+			_maxAirtime = std::max<uint64_t>(_maxAirtime, us2osticks(timeOnAir(dr, maxPayloadLen(dr))) + 1);
+		}
+	}
+
+	void run() {
+		uint64_t duration = (uint64_t)(_config._hours * 3600) * OSTICKS_PER_SEC;
+		for (uint64_t w0 = 0; w0 < duration; w0 += WINDOW) {
+			step(w0 + WINDOW);
+		}
+		_duration = duration;
+	}
+
+	void report(double wallSeconds);
+
+private:
+
+	const Config & 				_config;
+	WorkerPool 					_pool;
+	std::vector<Gateway> 		_gateways;
+	std::vector<std::unique_ptr<Device>> _nodes;
+	unsigned 					_shards;
+	std::vector<std::vector<Transmission>> _out;	// per shard
+	std::vector<Transmission> 	_air;				// sorted by start: pending frames, then ended ones which may overlap them
+	std::vector<size_t> 		_ending;
+	uint64_t 					_maxAirtime = 0;	// ticks
+	uint64_t 					_duration = 0;		// ticks
+	uint64_t 					_channelAirtime[UINT8_MAX + 1] = { 0 };	// us
+
+	void step(uint64_t until) {
+		_pool.run(_shards, [this, until](unsigned shard) {
+			size_t first = (size_t)_nodes.size() * shard / _shards;
+			size_t last = (size_t)_nodes.size() * (shard + 1) / _shards;
+			for (size_t i = first; i < last; i++) {
+				_nodes[i]->advance(until, _out[shard]);
+			}
+		});
+		for (std::vector<Transmission> & out : _out) {
+			_air.insert(_air.end(), out.begin(), out.end());
+			out.clear();
+		}
+		std::sort(_air.begin(), _air.end(), [](const Transmission & a, const Transmission & b) {
+			return a._start < b._start || (a._start == b._start && a._node < b._node);
+		});
+		_ending.clear();
+		for (size_t i = 0; i < _air.size(); i++) {
+			if (!_air[i]._final && _air[i]._end <= until) {
+				_ending.push_back(i);
+			}
+		}
+		// reception: frames do not depend on each other
+		unsigned chunks = (_ending.size() < 256 ? 1 : _shards);
+		_pool.run(chunks, [this, chunks](unsigned chunk) {
+			for (size_t k = _ending.size() * chunk / chunks; k < _ending.size() * (chunk + 1) / chunks; k++) {
+				receive(_ending[k]);
+			}
+		});
+		// acknowledgements, in time order
+		std::sort(_ending.begin(), _ending.end(), [this](size_t a, size_t b) {
+			return _air[a]._end < _air[b]._end;
+		});
+		for (size_t i : _ending) {
+			Transmission & tx = _air[i];
+			tx._final = true;
+			_channelAirtime[tx._channel] += tx._airtime;
+			if (tx._confirmed && tx._gateway >= 0) {
+				acknowledge(tx);
+			}
+			_nodes[tx._node]->answer(tx);
+		}
+		// ended frames are kept as long as a pending frame may overlap them
+		_air.erase(std::remove_if(_air.begin(), _air.end(), [this, until](const Transmission & tx) {
+			return tx._final && tx._end + _maxAirtime <= until;
+		}), _air.end());
+	}
+
+	/*
+	 * Outcome of _air[index] at each gateway, frames which overlap it are all in _air
+	 */
+	void receive(size_t index) {
+		Transmission & tx = _air[index];
+		const Device & node = *_nodes[tx._node];
+		float sens = sensitivity(tx._dr);
+		float best = -1000;
+		Loss result = LOSS_RANGE;
+		for (size_t g = 0; g < _gateways.size(); g++) {
+			float rssi = node.rssi()[g];
+			if (rssi < sens) {
+				continue;
+			}
+			Loss loss = LOSS_NONE;
+			uint8_t busy = 0;
+			for (size_t i = firstOverlap(tx._start); i < _air.size() && _air[i]._start < tx._end; i++) {
+				const Transmission & other = _air[i];
+				if (i == index || other._end <= tx._start) {
+					continue;
+				}
+				float otherRssi = _nodes[other._node]->rssi()[g];
+				if (other._channel == tx._channel && other._dr == tx._dr && rssi - otherRssi < CAPTURE_DB) {
+					loss = LOSS_COLLISION;
+				}
+				if (i < index && otherRssi >= sensitivity(other._dr)) {
+					busy += 1;
+				}
+			}
+			if (loss == LOSS_NONE && busy >= DEMODULATORS) {
+				loss = LOSS_DEMODULATOR;
+			}
+			if (loss == LOSS_NONE && rssi > best) {
+				best = rssi;
+				tx._gateway = g;
+			} else if (loss != LOSS_NONE && (result == LOSS_RANGE || loss < result)) {
+				result = loss;
+			}
+		}
+		tx._loss = (tx._gateway >= 0 ? LOSS_NONE : result);
+	}
+
+	size_t firstOverlap(uint64_t start) const {
+		uint64_t from = (start > _maxAirtime ? start - _maxAirtime : 0);
+		return std::lower_bound(_air.begin(), _air.end(), from, [](const Transmission & tx, uint64_t time) {
+			return tx._start < time;
+		}) - _air.begin();
+	}
+
+	/*
+	 * RX1 acknowledgement by the gateway with the best link among those which have downlink airtime left
+	 */
+	void acknowledge(Transmission & tx) {
+		const Device & node = *_nodes[tx._node];
+		uint32_t airtime = timeOnAir(ACK_PHY_LEN, modulationOf(tx._dr));
+		ostime_t now = (ostime_t)(uint32_t)(tx._end + ms2osticks(host::RX1_DELAY_MS));
+		int best = -1;
+		for (size_t g = 0; g < _gateways.size(); g++) {
+			if (node.rssi()[g] >= sensitivity(tx._dr) && _gateways[g]._downlink.allows(airtime, now)
+				&& (best < 0 || node.rssi()[g] > node.rssi()[best])) {
+				best = g;
+			}
+		}
+		if (best >= 0) {
+			_gateways[best]._downlink.spend(airtime, now);
+			tx._acked = true;
+		}
+	}
+};
+
+static void percentiles(const char * label, std::vector<uint32_t> & values) {
+	if (values.empty()) {
+		printf("%-12s no sample\n", label);
+		return;
+	}
+	auto at = [&](double p) {
+		size_t k = std::min(values.size() - 1, (size_t)(p * values.size()));
+		std::nth_element(values.begin(), values.begin() + k, values.end());
+		return values[k] / 1000.0;
+	};
+	printf("%-12s p50 %.1f s, p90 %.1f s, p99 %.1f s, max %.1f s\n", label, at(0.5), at(0.9), at(0.99),
+		*std::max_element(values.begin(), values.end()) / 1000.0);
+	uint64_t buckets[LEUVILLE_LORA_LATENCY_BUCKETS] = { 0 };
+	for (uint32_t ms : values) {
+		uint8_t bucket = 0;
+		for (uint32_t s = ms / 1000; s > 0 && bucket < LEUVILLE_LORA_LATENCY_BUCKETS - 1; s >>= 1) {
+			bucket += 1;
+		}
+		buckets[bucket] += 1;
+	}
+	printf("%-12s", "");
+	for (uint8_t i = 0; i < LEUVILLE_LORA_LATENCY_BUCKETS; i++) {
+		printf(" %s%lus:%.1f%%", (i == LEUVILLE_LORA_LATENCY_BUCKETS - 1 ? ">=" : "<"),
+			(i == LEUVILLE_LORA_LATENCY_BUCKETS - 1 ? 1UL << (i - 1) : 1UL << i), 100.0 * buckets[i] / values.size());
+	}
+	printf("\n");
+}
+
+static double ratio(uint64_t num, uint64_t den) {
+	return (den == 0 ? 0 : 100.0 * num / den);
+}
+
+void Simulator::report(double wallSeconds) {
+	Counters total;
+	Counters perVariant[VARIANTS];
+	uint32_t perDr[DATA_RATES] = { 0 };
+	uint32_t outOfRange = 0;
+	std::vector<uint32_t> delivery, queue;
+	for (std::unique_ptr<Device> & node : _nodes) {
+		total.add(node->counters());
+		perVariant[node->variant()].add(node->counters());
+		perDr[node->dataRate()] += 1;
+		outOfRange += (node->inRange() ? 0 : 1);
+		delivery.insert(delivery.end(), node->deliveryLatency().begin(), node->deliveryLatency().end());
+		queue.insert(queue.end(), node->queueLatency().begin(), node->queueLatency().end());
+	}
+	double hours = _duration / (3600.0 * OSTICKS_PER_SEC);
+	printf("fleet       %u nodes, %u gateway(s), %u channels, %.1f h simulated in %.1f s (%u threads)\n",
+		_config._nodes, _config._gateways, _config._channels, hours, wallSeconds, _config._threads);
+	printf("data rates ");
+	for (dr_t dr = 0; dr < DATA_RATES; dr++) {
+		printf(" DR%u:%u", dr, perDr[dr]);
+	}
+	printf(", %u nodes out of range\n", outOfRange);
+	printf("messages    %llu offered, %llu too large, %llu dropped by queue overflow, %llu delivered (%.2f%%)\n",
+		(unsigned long long)total._offered, (unsigned long long)total._tooLarge, (unsigned long long)total._queueDrops,
+		(unsigned long long)total._delivered, ratio(total._delivered, total._offered));
+	for (uint8_t v = 0; v < VARIANTS; v++) {
+		const Counters & counters = perVariant[v];
+		printf("  %-10s %llu offered, %llu too large, %llu delivered (%.2f%%), %.1f bytes per reading\n", _variants[v]._name,
+			(unsigned long long)counters._offered, (unsigned long long)counters._tooLarge,
+			(unsigned long long)counters._delivered, ratio(counters._delivered, counters._offered),
+			counters._delivered > 0 ? (double)counters._bytes / counters._delivered : 0.0);
+	}
+	printf("txOutcome   %llu TX_DELIVERED, %llu TX_UNCONFIRMED, %llu TX_MAX_ATTEMPTS, %llu TX_EXPIRED, %llu TX_REJECTED\n",
+		(unsigned long long)total._outcomes[LMICWrapper::TX_DELIVERED], (unsigned long long)total._outcomes[LMICWrapper::TX_UNCONFIRMED],
+		(unsigned long long)total._outcomes[LMICWrapper::TX_MAX_ATTEMPTS], (unsigned long long)total._outcomes[LMICWrapper::TX_EXPIRED],
+		(unsigned long long)total._outcomes[LMICWrapper::TX_REJECTED]);
+	printf("frames      %llu sent, %llu retransmissions, lost: %llu out of range, %llu collisions, %llu demodulators busy, %llu acks refused by gateway duty cycle\n",
+		(unsigned long long)total._frames, (unsigned long long)total._retransmissions,
+		(unsigned long long)total._losses[LOSS_RANGE], (unsigned long long)total._losses[LOSS_COLLISION],
+		(unsigned long long)total._losses[LOSS_DEMODULATOR], (unsigned long long)total._ackRefused);
+	printf("throughput  %.0f messages/h delivered, %.1f application bytes/s\n", total._delivered / hours, total._bytes / (hours * 3600));
+	printf("channel load");
+	for (uint8_t c = 0; c < _config._channels; c++) {
+		printf(" %.2f%%", _channelAirtime[c] / (hours * 36000000.0));
+	}
+	printf(" (airtime / time)\n");
+	percentiles("delivery", delivery);
+	percentiles("queue", queue);
+}
+
+static bool parse(int argc, char ** argv, Config & config) {
+	for (int i = 1; i < argc; i++) {
+		const char * name = argv[i];
+		if (i + 1 >= argc) {
+			return false;
+		}
+		double value = atof(argv[++i]);
+		if (strcmp(name, "--nodes") == 0) {
+			config._nodes = value;
+		} else if (strcmp(name, "--hours") == 0) {
+			config._hours = value;
+		} else if (strcmp(name, "--period") == 0) {
+			config._period = value;
+		} else if (strcmp(name, "--confirmed") == 0) {
+			config._confirmed = value;
+		} else if (strcmp(name, "--gateways") == 0) {
+			config._gateways = value;
+		} else if (strcmp(name, "--radius") == 0) {
+			config._radius = value;
+		} else if (strcmp(name, "--channels") == 0) {
+			config._channels = value;
+		} else if (strcmp(name, "--gw-duty") == 0) {
+			config._gwDutyCycle = value;
+		} else if (strcmp(name, "--threads") == 0) {
+			config._threads = value;
+		} else if (strcmp(name, "--seed") == 0) {
+			config._seed = value;
+		} else {
+			return false;
+		}
+	}
+	return config._nodes > 0 && config._gateways > 0 && config._channels > 0 && config._period > 0
+		&& config._gwDutyCycle > 0 && config._threads > 0;
+}
+
+}
+}
+}
+
+int main(int argc, char ** argv) {
+	using namespace leuville::lora::sim;
+	Config config;
+	if (!parse(argc, argv, config)) {
+		fprintf(stderr, "usage: %s [--nodes N] [--hours H] [--period S] [--confirmed PCT] [--gateways G]"
+			" [--radius KM] [--channels C] [--gw-duty D] [--threads T] [--seed S]\n", argv[0]);
+		return 1;
+	}
+	auto start = std::chrono::steady_clock::now();
+	Simulator simulator(config);
+	simulator.run();
+	std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+	simulator.report(wall.count());
+	return 0;
+}
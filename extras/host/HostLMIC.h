@@ -0,0 +1,682 @@
+/*
+ * Module: HostLMIC
+ *
+ * Function: LMIC simulated on the host: virtual clock, job scheduler, radio, network answers and event injection
+ *
+ * A host program includes this header first, with extras/host/stub and src in its include path:
+ * the stub headers (lmic.h, Arduino.h...) declare the LMIC and Arduino API, HostLMIC implements it.
+ * LMICWrapper then runs unmodified, much faster than real time and deterministically:
+ * the virtual clock only moves when run() jumps to the next job deadline.
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <lmic.h>
+#include <LoRaRegion.h>
+#include <Airtime.h>
+
+#include <chrono>
+
+namespace leuville {
+namespace lora {
+namespace host {
+
+// RX windows after the end of an uplink
+constexpr uint32_t RX1_DELAY_MS 	= 1000;
+constexpr uint32_t RX2_DELAY_MS 	= 2000;
+// end of RX2 when nothing is received
+constexpr uint32_t RX2_END_MS 		= RX2_DELAY_MS + 100;
+// JOIN request to JoinAccept (RX1 of the join, 5 s, plus the frames)
+constexpr uint32_t JOIN_DELAY_MS 	= 6000;
+// loops at the same virtual time after which run() reports a busy loop
+constexpr uint32_t BUSY_LOOPS 		= 1000;
+
+/*
+ * Uplink given to LMIC_setTxData2(), as transmitted
+ */
+struct HostFrame {
+	uint8_t 	_port = 0;
+	uint8_t 	_data[MAX_FRAME_LEN];
+	uint8_t 	_len = 0;
+	bool 		_confirmed = false;
+	dr_t 		_dr = 0;
+	u4_t 		_fcnt = 0;
+	ostime_t 	_start = 0;		// os_getTime() ticks
+	ostime_t 	_end = 0;
+	uint32_t 	_airtime = 0;	// us
+};
+
+/*
+ * Answer of the network to an uplink
+ */
+struct HostReply {
+	bool 			_ack = false;		// confirmed uplinks: acknowledged
+	uint8_t 		_window = 1;		// RX window of the downlink (ack, MAC commands or payload)
+	uint8_t 		_port = 0;			// 0 = no application payload
+	const uint8_t * _data = nullptr;
+	uint8_t 		_len = 0;
+	const uint8_t * _fopts = nullptr;	// MAC commands in FOpts
+	uint8_t 		_foptsLen = 0;
+
+	bool hasDownlink() const {
+		return _ack || _port > 0 || _foptsLen > 0;
+	}
+};
+
+/*
+ * One simulated LMIC: the LMIC state, its clock, its jobs and its radio
+ *
+ * The stub API (os_*, LMIC_*, LMIC, millis()) serves the active HostLMIC of the calling thread,
+ * see select(). Several HostLMIC may be used in turn (fleet simulation), or by several threads.
+ */
+class HostLMIC {
+public:
+
+	/*
+	 * Decides the answer to an uplink at the end of its transmission
+	 *
+	 * Returns false if the answer is not known yet: completeTx() gives it later
+	 */
+	using Network = bool (*)(HostLMIC & lmic, const HostFrame & frame, HostReply & reply, void * context);
+
+	/*
+	 * start = initial os_getTime() value, the clock wraps like the LMIC one
+	 * The first HostLMIC of a thread becomes the active one.
+	 */
+	explicit HostLMIC(ostime_t start = 0) : _ticks((uint32_t)start) {
+		reset();
+		if (selected() == nullptr) {
+			selected() = this;
+		}
+	}
+
+	HostLMIC(const HostLMIC &) = delete;
+	HostLMIC & operator=(const HostLMIC &) = delete;
+
+	~HostLMIC() {
+		if (selected() == this) {
+			selected() = nullptr;
+		}
+	}
+
+	/*
+	 * HostLMIC served by the stub API in the calling thread
+	 */
+	static HostLMIC & active() {
+		static thread_local HostLMIC fallback(0, false);
+		return (selected() != nullptr ? *selected() : fallback);
+	}
+
+	void select() {
+		selected() = this;
+	}
+
+	lmic_t _lmic;
+
+	//----------------------------------------------- virtual clock ---------------------------------------------------------
+
+	ostime_t now() const {
+		return (ostime_t)(uint32_t)_ticks;
+	}
+
+	/*
+	 * Ticks elapsed since construction, never wraps
+	 */
+	uint64_t elapsed() const {
+		return _ticks - _origin;
+	}
+
+	/*
+	 * Moves the clock forward without running jobs
+	 */
+	void advance(ostime_t ticks) {
+		_ticks += (ticks > 0 ? ticks : 0);
+	}
+
+	/*
+	 * Deadline of the next job, false if none
+	 */
+	bool nextDeadline(ostime_t & when) const {
+		if (_jobs == nullptr) {
+			return false;
+		}
+		when = _jobs->deadline;
+		return true;
+	}
+
+	/*
+	 * true if a job may run now
+	 */
+	bool due() const {
+		return _jobs != nullptr && _jobs->deadline - now() <= 0;
+	}
+
+	/*
+	 * Calls node.runLoopOnce() as loop() would, during duration ticks of virtual time:
+	 * each call runs at most one due job. When nothing is due, loop() is called once more at the same time
+	 * (it may set a job), then the clock jumps to the next deadline.
+	 *
+	 * Returns false if the node loops more than BUSY_LOOPS times at the same time (busy loop)
+	 */
+	template <typename Node>
+	bool run(Node & node, ostime_t duration) {
+		uint64_t end = _ticks + (duration > 0 ? duration : 0);
+		uint32_t loops = 0;
+		bool settled = false;
+		for (;;) {
+			node.runLoopOnce();
+			if (++loops > BUSY_LOOPS) {
+				return false;
+			}
+			if (due()) {
+				settled = false;
+				continue;
+			}
+			if (!settled) {
+				settled = true;
+				continue;
+			}
+			ostime_t when;
+			if (!nextDeadline(when) || _ticks + (uint32_t)(when - now()) > end) {
+				_ticks = end;
+				return true;
+			}
+			_ticks += (uint32_t)(when - now());
+			loops = 0;
+			settled = false;
+		}
+	}
+
+	//----------------------------------------------- network ---------------------------------------------------------
+
+	/*
+	 * nullptr = confirmed uplinks are acknowledged in RX1, nothing else is received
+	 */
+	void setNetwork(Network network, void * context = nullptr) {
+		_network = network;
+		_networkContext = context;
+	}
+
+	/*
+	 * Gives the answer to the uplink on the air, when the Network returned false
+	 * EV_TXCOMPLETE follows in the RX window of the answer, or at once if it is over.
+	 */
+	void completeTx(const HostReply & reply) {
+		if (_radio != RADIO_NETWORK) {
+			return;
+		}
+		_reply = reply;
+		_hasReply = true;
+		scheduleCompletion();
+	}
+
+	/*
+	 * true while an uplink waits for completeTx()
+	 */
+	bool waitsForNetwork() const {
+		return _radio == RADIO_NETWORK;
+	}
+
+	/*
+	 * Calls the registered LMIC event callback, as LMIC would
+	 */
+	void inject(ev_t ev) {
+		if (_eventCb == nullptr) {
+			return;
+		}
+		auto start = std::chrono::steady_clock::now();
+		_eventCb(_eventUserData, ev);
+		uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		_events += 1;
+		_eventNs += ns;
+		_eventMaxNs = (ns > _eventMaxNs ? ns : _eventMaxNs);
+	}
+
+	//----------------------------------------------- observations ---------------------------------------------------------
+
+	const HostFrame & lastFrame() const {
+		return _frame;
+	}
+
+	// uplinks transmitted
+	uint32_t frames() const {
+		return _frames;
+	}
+
+	// os_radio(RADIO_RST) calls
+	uint32_t radioResets() const {
+		return _radioResets;
+	}
+
+	// events delivered, host time spent in the event callback (ns)
+	uint32_t events() const {
+		return _events;
+	}
+
+	uint64_t eventNs() const {
+		return _eventNs;
+	}
+
+	uint64_t eventMaxNs() const {
+		return _eventMaxNs;
+	}
+
+	//----------------------------------------------- LMIC API ---------------------------------------------------------
+
+	void setTimedCallback(osjob_t * job, ostime_t time, osjobcb_t cb) {
+		clearCallback(job);
+		job->deadline = time;
+		job->func = cb;
+		osjob_t ** pos = &_jobs;
+		while (*pos != nullptr && (*pos)->deadline - time <= 0) {
+			pos = &(*pos)->next;
+		}
+		job->next = *pos;
+		*pos = job;
+	}
+
+	void clearCallback(osjob_t * job) {
+		for (osjob_t ** pos = &_jobs; *pos != nullptr; pos = &(*pos)->next) {
+			if (*pos == job) {
+				*pos = job->next;
+				return;
+			}
+		}
+	}
+
+	void runloopOnce() {
+		// a duty cycle release in the past follows the clock, it would look like a future one after the wrap
+		if (_lmic.globalDutyAvail - now() < 0) {
+			_lmic.globalDutyAvail = now();
+		}
+		if (due()) {
+			osjob_t * job = _jobs;
+			_jobs = job->next;
+			job->func(job);
+		}
+	}
+
+	void radio(u1_t mode) {
+		_radioResets += (mode == RADIO_RST ? 1 : 0);
+	}
+
+	void registerEventCb(lmic_event_cb_t * cb, void * userData) {
+		_eventCb = cb;
+		_eventUserData = userData;
+	}
+
+	/*
+	 * LMIC_reset(): no session, radio idle, DR_SF7
+	 */
+	void reset() {
+		if (_radio != RADIO_IDLE) {
+			clearCallback(&_lmic.osjob);
+		}
+		_lmic = lmic_t();
+		_lmic.datarate = DR_SF7;
+		_lmic.adrTxPow = 14;
+		_lmic.globalDutyAvail = now();
+		_radio = RADIO_IDLE;
+		_txPending = false;
+	}
+
+	bit_t setupChannel(u1_t channel, u4_t freq, u2_t drmap) {
+		if (channel >= MAX_CHANNELS) {
+			return 0;
+		}
+		_lmic.channelFreq[channel] = freq;
+		_lmic.channelDrMap[channel] = drmap;
+		_lmic.channelMap |= (1 << channel);
+		return 1;
+	}
+
+	bit_t startJoining() {
+		if (_lmic.devaddr != 0 || (_lmic.opmode & OP_JOINING)) {
+			return 0;
+		}
+		_lmic.opmode |= OP_JOINING;
+		inject(EV_JOINING);
+		arm(RADIO_JOIN, now() + ms2osticks(JOIN_DELAY_MS));
+		return 1;
+	}
+
+	void setSession(u4_t netid, devaddr_t devaddr, const u1_t * nwkKey, const u1_t * artKey) {
+		_lmic.netid = netid;
+		_lmic.devaddr = devaddr;
+		memcpy(_nwkKey, nwkKey, sizeof(_nwkKey));
+		memcpy(_artKey, artKey, sizeof(_artKey));
+		_lmic.opmode &= ~OP_JOINING;
+	}
+
+	void getSessionKeys(u4_t * netid, devaddr_t * devaddr, u1_t * nwkKey, u1_t * artKey) {
+		*netid = _lmic.netid;
+		*devaddr = _lmic.devaddr;
+		memcpy(nwkKey, _nwkKey, sizeof(_nwkKey));
+		memcpy(artKey, _artKey, sizeof(_artKey));
+	}
+
+	void unjoinAndRejoin() {
+		_lmic.devaddr = 0;
+		_lmic.opmode &= ~OP_JOINING;
+		startJoining();
+	}
+
+	/*
+	 * Like MCCI LMIC: TX_TOO_LARGE beyond the frame buffer, TX_NOT_FEASIBLE beyond the max payload of the data rate,
+	 * a join first if there is no session, the TX waits for the duty cycle
+	 */
+	lmic_tx_error_t setTxData(u1_t port, const u1_t * data, u1_t dlen, u1_t confirmed) {
+		if (_lmic.opmode & (OP_TXDATA | OP_TXRXPEND)) {
+			return LMIC_ERROR_TX_BUSY;
+		}
+		if (dlen > MAX_FRAME_LEN - LORAWAN_OVERHEAD) {
+			return LMIC_ERROR_TX_TOO_LARGE;
+		}
+		if (dlen > maxPayloadLen(_lmic.datarate)) {
+			return LMIC_ERROR_TX_NOT_FEASIBLE;
+		}
+		_frame._port = port;
+		memcpy(_frame._data, data, dlen);
+		_frame._len = dlen;
+		_frame._confirmed = (confirmed != 0);
+		_lmic.pendTxPort = port;
+		_lmic.opmode |= OP_TXDATA;
+		_txPending = true;
+		if (_lmic.devaddr == 0) {
+			startJoining();
+		} else if (_radio == RADIO_IDLE) {
+			scheduleTx();
+		}
+		return LMIC_ERROR_SUCCESS;
+	}
+
+	void requestNetworkTime(lmic_request_network_time_cb_t * cb, void * userData) {
+		_timeCb = cb;
+		_timeUserData = userData;
+	}
+
+private:
+
+	enum Radio : uint8_t {
+		RADIO_IDLE,
+		RADIO_JOIN,			// JoinAccept due
+		RADIO_TX,			// TX start due (duty cycle)
+		RADIO_TXEND,		// end of TX due: the network answers
+		RADIO_NETWORK,		// waits for completeTx()
+		RADIO_RX			// EV_TXCOMPLETE due
+	};
+
+	// HostLMIC selected in the calling thread, nullptr if none
+	static HostLMIC *& selected() {
+		static thread_local HostLMIC * selected = nullptr;
+		return selected;
+	}
+
+	uint64_t 			_ticks;
+	uint64_t 			_origin = _ticks;
+	osjob_t * 			_jobs = nullptr;
+
+	Radio 				_radio = RADIO_IDLE;
+	bool 				_txPending = false;
+	HostFrame 			_frame;
+	HostReply 			_reply;
+	bool 				_hasReply = false;
+	Network 			_network = nullptr;
+	void * 				_networkContext = nullptr;
+
+	lmic_event_cb_t * 	_eventCb = nullptr;
+	void * 				_eventUserData = nullptr;
+	lmic_request_network_time_cb_t * _timeCb = nullptr;
+	void * 				_timeUserData = nullptr;
+
+	u1_t 				_nwkKey[16] = { 0 };
+	u1_t 				_artKey[16] = { 0 };
+
+	uint32_t 			_frames = 0;
+	uint32_t 			_radioResets = 0;
+	uint32_t 			_events = 0;
+	uint64_t 			_eventNs = 0;
+	uint64_t 			_eventMaxNs = 0;
+
+	// fallback instance, never active by itself
+	HostLMIC(ostime_t start, bool) : _ticks((uint32_t)start) {
+		reset();
+	}
+
+	/*
+	 * The radio is the LMIC.osjob job, like in LMIC: nextWakeup() sees its deadline
+	 */
+	void arm(Radio state, ostime_t when) {
+		_radio = state;
+		setTimedCallback(&_lmic.osjob, when, &HostLMIC::radioJob);
+	}
+
+	static void radioJob(osjob_t *) {
+		active().radioStep();
+	}
+
+	void scheduleTx() {
+		ostime_t start = now();
+		if (_lmic.globalDutyAvail - start > 0) {
+			start = _lmic.globalDutyAvail;
+		}
+		arm(RADIO_TX, start);
+	}
+
+	void scheduleCompletion() {
+		ostime_t when = _frame._end + ms2osticks(RX2_END_MS);
+		if (_hasReply && _reply.hasDownlink()) {
+			when = _frame._end + ms2osticks(_reply._window == 1 ? RX1_DELAY_MS : RX2_DELAY_MS);
+		}
+		arm(RADIO_RX, (when - now() > 0 ? when : now()));
+	}
+
+	void radioStep() {
+		switch (_radio) {
+			case RADIO_JOIN:
+				_radio = RADIO_IDLE;
+				_lmic.opmode &= ~OP_JOINING;
+				_lmic.devaddr = 0x26000000 | (_frames & 0xFFFFFF);
+				_lmic.netid = 0x13;
+				_lmic.seqnoUp = 0;
+				_lmic.seqnoDn = 0;
+				inject(EV_JOINED);
+				if (_txPending && _radio == RADIO_IDLE) {
+					scheduleTx();
+				}
+				break;
+			case RADIO_TX:
+				_lmic.opmode |= OP_TXRXPEND;
+				_frame._dr = _lmic.datarate;
+				_frame._fcnt = _lmic.seqnoUp++;
+				_frame._airtime = timeOnAir(_frame._dr, _frame._len);
+				_frame._start = now();
+				_frame._end = now() + us2osticks(_frame._airtime);
+				_lmic.txend = _frame._end;
+				_lmic.globalDutyAvail = _frame._end + us2osticks(dutyCycleDebt(_frame._airtime));
+				_frames += 1;
+				_hasReply = false;
+				arm(RADIO_TXEND, _frame._end);
+				inject(EV_TXSTART);
+				break;
+			case RADIO_TXEND:
+				_reply = HostReply();
+				_reply._ack = _frame._confirmed;
+				if (_network != nullptr && !_network(*this, _frame, _reply, _networkContext)) {
+					_radio = RADIO_NETWORK;
+					break;
+				}
+				_hasReply = true;
+				scheduleCompletion();
+				break;
+			case RADIO_RX:
+				_radio = RADIO_IDLE;
+				complete();
+				break;
+			default:
+				_radio = RADIO_IDLE;
+				break;
+		}
+	}
+
+	/*
+	 * Builds the received frame (LMIC.frame, dataBeg, dataLen) and reports EV_TXCOMPLETE
+	 * frame = MHDR, DevAddr, FCtrl, FCnt, FOpts, FPort, payload
+	 */
+	void complete() {
+		_lmic.opmode &= ~(OP_TXDATA | OP_TXRXPEND);
+		_txPending = false;
+		_lmic.txrxFlags = 0;
+		_lmic.dataBeg = 0;
+		_lmic.dataLen = 0;
+		const HostReply & reply = _reply;
+		if (_frame._confirmed) {
+			_lmic.txrxFlags |= (reply._ack ? TXRX_ACK : TXRX_NACK);
+		}
+		if (reply.hasDownlink()) {
+			uint8_t foptsLen = min(reply._foptsLen, (uint8_t)15);
+			uint8_t len = min(reply._len, (uint8_t)(MAX_FRAME_LEN - 9 - foptsLen));
+			_lmic.frame[0] = 0x60;
+			memcpy(&_lmic.frame[1], &_lmic.devaddr, 4);
+			_lmic.frame[5] = (reply._ack ? 0x20 : 0) | foptsLen;
+			_lmic.frame[6] = (uint8_t)_lmic.seqnoDn;
+			_lmic.frame[7] = (uint8_t)(_lmic.seqnoDn >> 8);
+			if (foptsLen > 0) {
+				memcpy(&_lmic.frame[8], reply._fopts, foptsLen);
+			}
+			_lmic.dataBeg = 8 + foptsLen;
+			if (reply._port > 0) {
+				_lmic.frame[_lmic.dataBeg++] = reply._port;
+				if (len > 0) {
+					memcpy(&_lmic.frame[_lmic.dataBeg], reply._data, len);
+				}
+				_lmic.dataLen = len;
+				_lmic.txrxFlags |= TXRX_PORT;
+			} else {
+				_lmic.txrxFlags |= TXRX_NOPORT;
+			}
+			_lmic.txrxFlags |= (reply._window == 1 ? TXRX_DNW1 : TXRX_DNW2);
+			_lmic.seqnoDn += 1;
+		}
+		inject(EV_TXCOMPLETE);
+		if (_timeCb != nullptr) {
+			lmic_request_network_time_cb_t * cb = _timeCb;
+			_timeCb = nullptr;
+			cb(_timeUserData, 0);
+		}
+	}
+};
+
+}
+}
+}
+
+//----------------------------------------------- stub API ---------------------------------------------------------
+
+inline lmic_t & hostLMIC() {
+	return leuville::lora::host::HostLMIC::active()._lmic;
+}
+
+inline unsigned long millis() {
+	return leuville::lora::host::HostLMIC::active().elapsed() * 1000 / OSTICKS_PER_SEC;
+}
+
+inline unsigned long micros() {
+	return leuville::lora::host::HostLMIC::active().elapsed() * 1000000 / OSTICKS_PER_SEC;
+}
+
+inline int os_init_ex(const void *) {
+	return 1;
+}
+
+inline ostime_t os_getTime() {
+	return leuville::lora::host::HostLMIC::active().now();
+}
+
+inline void os_setCallback(osjob_t * job, osjobcb_t cb) {
+	leuville::lora::host::HostLMIC::active().setTimedCallback(job, os_getTime(), cb);
+}
+
+inline void os_setTimedCallback(osjob_t * job, ostime_t time, osjobcb_t cb) {
+	leuville::lora::host::HostLMIC::active().setTimedCallback(job, time, cb);
+}
+
+inline void os_clearCallback(osjob_t * job) {
+	leuville::lora::host::HostLMIC::active().clearCallback(job);
+}
+
+inline void os_runloop_once() {
+	leuville::lora::host::HostLMIC::active().runloopOnce();
+}
+
+inline bit_t os_queryTimeCriticalJobs(ostime_t) {
+	return 0;
+}
+
+inline void os_radio(u1_t mode) {
+	leuville::lora::host::HostLMIC::active().radio(mode);
+}
+
+inline int LMIC_registerEventCb(lmic_event_cb_t * cb, void * pUserData) {
+	leuville::lora::host::HostLMIC::active().registerEventCb(cb, pUserData);
+	return 1;
+}
+
+inline void LMIC_reset() {
+	leuville::lora::host::HostLMIC::active().reset();
+}
+
+inline void LMIC_setAdrMode(bit_t enabled) {
+	LMIC.adrEnabled = enabled;
+}
+
+inline void LMIC_setLinkCheckMode(bit_t) {
+}
+
+inline void LMIC_setClockError(u2_t) {
+}
+
+inline bit_t LMIC_setupChannel(u1_t channel, u4_t freq, u2_t drmap, s1_t) {
+	return leuville::lora::host::HostLMIC::active().setupChannel(channel, freq, drmap);
+}
+
+inline void LMIC_setDrTxpow(dr_t dr, s1_t txpow) {
+	LMIC.datarate = dr;
+	LMIC.adrTxPow = txpow;
+}
+
+inline int LMIC_setBatteryLevel(u1_t) {
+	return 1;
+}
+
+inline bit_t LMIC_startJoining() {
+	return leuville::lora::host::HostLMIC::active().startJoining();
+}
+
+inline void LMIC_unjoinAndRejoin() {
+	leuville::lora::host::HostLMIC::active().unjoinAndRejoin();
+}
+
+inline void LMIC_setSession(u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t artKey) {
+	leuville::lora::host::HostLMIC::active().setSession(netid, devaddr, nwkKey, artKey);
+}
+
+inline void LMIC_getSessionKeys(u4_t * netid, devaddr_t * devaddr, xref2u1_t nwkKey, xref2u1_t artKey) {
+	leuville::lora::host::HostLMIC::active().getSessionKeys(netid, devaddr, nwkKey, artKey);
+}
+
+inline lmic_tx_error_t LMIC_setTxData2(u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed) {
+	return leuville::lora::host::HostLMIC::active().setTxData(port, data, dlen, confirmed);
+}
+
+inline void LMIC_requestNetworkTime(lmic_request_network_time_cb_t * cb, void * pUserData) {
+	leuville::lora::host::HostLMIC::active().requestNetworkTime(cb, pUserData);
+}
+
+inline int LMIC_getNetworkTimeReference(lmic_time_reference_t *) {
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Module: HostTest
+ *
+ * Function: minimal checks for the host tests (no test framework needed)
+ *
+ *		int main() {
+ *			CHECK(1 + 1 == 2);
+ *			return report();
+ *		}
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <cstdio>
+
+namespace leuville {
+namespace lora {
+namespace host {
+
+struct Counts {
+	int _checks = 0;
+	int _failures = 0;
+};
+
+inline Counts & counts() {
+	static Counts counts;
+	return counts;
+}
+
+inline bool check(bool ok, const char * what, const char * file, int line) {
+	counts()._checks += 1;
+	if (!ok) {
+		counts()._failures += 1;
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, what);
+	}
+	return ok;
+}
+
+/*
+ * Prints the result, returns the exit code of the test program
+ */
+inline int report() {
+	printf("%d checks, %d failed\n", counts()._checks, counts()._failures);
+	return (counts()._failures == 0 ? 0 : 1);
+}
+
+}
+}
+}
+
+#define CHECK(cond) leuville::lora::host::check((cond), #cond, __FILE__, __LINE__)
@@ -0,0 +1,149 @@
+/*
+ * LMICWrapper (virtual hooks) vs LMICWrapperT<Derived> (CRTP): cost of the event path, measured on the host
+ *
+ *	bench_crtp [events]
+ *
+ * dispatch: EV_TXCOMPLETE with nothing queued, given to the LMIC event callback in a loop:
+ * onUserEvent(), txComplete() and isMACCommand() are called through the hooks, nothing else is done.
+ * round trip: uplinks with a downlink, run by HostLMIC as in bench_queue: the callback time also
+ * includes isTxCompleted(), txOutcome() and downlinkReceived().
+ * Time stamp counter ticks are reported on x86, nanoseconds everywhere.
+ *
+ * The flash side is given by the bench_size target (size of bench_size.cpp built with either API).
+ */
+
+#include <HostLMIC.h>
+#include <LMICWrapper.h>
+
+#include <chrono>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LEUVILLE_BENCH_TSC
+#endif
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+class VirtualNode : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+	using LMICWrapper::eventCallback;
+
+	uint32_t _completed = 0;
+	uint32_t _downlinks = 0;
+
+protected:
+
+	bool isTxCompleted(const UpstreamMessage & message) override {
+		_completed += 1;
+		return LMICWrapper::isTxCompleted(message);
+	}
+
+	void downlinkReceived(const DownstreamMessage & message) override {
+		_downlinks += 1;
+	}
+};
+
+class CrtpNode : public LMICWrapperT<CrtpNode> {
+	friend class LMICWrapperT<CrtpNode>;
+public:
+	using LMICWrapperT::LMICWrapperT;
+	using LMICWrapperT::eventCallback;
+
+	uint32_t _completed = 0;
+	uint32_t _downlinks = 0;
+
+protected:
+
+	bool isTxCompleted(const UpstreamMessage & message) {
+		_completed += 1;
+		return LMICWrapperT::isTxCompleted(message);
+	}
+
+	void downlinkReceived(const DownstreamMessage & message) {
+		_downlinks += 1;
+	}
+};
+
+const uint8_t DOWNLINK[] = { 1, 2, 3, 4 };
+
+/*
+ * Answers each uplink with a 4 bytes downlink
+ */
+bool answer(HostLMIC &, const HostFrame &, HostReply & reply, void *) {
+	reply._port = 1;
+	reply._data = DOWNLINK;
+	reply._len = sizeof(DOWNLINK);
+	return true;
+}
+
+template <typename Node>
+void dispatch(const char * name, long events) {
+	HostLMIC lmic;
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	lmic.run(node, sec2osticks(60));
+	LMIC.dataLen = 0;
+	// the callback only knows the node through its user data, as with LMIC
+	void * volatile userData = &node;
+
+	auto start = std::chrono::steady_clock::now();
+	#if defined(LEUVILLE_BENCH_TSC)
+	uint64_t tsc = __rdtsc();
+	#endif
+	for (long i = 0; i < events; i++) {
+		Node::eventCallback(userData, EV_TXCOMPLETE);
+	}
+	#if defined(LEUVILLE_BENCH_TSC)
+	tsc = __rdtsc() - tsc;
+	#endif
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	printf("  %-8s %6.1f ns", name, ns / events);
+	#if defined(LEUVILLE_BENCH_TSC)
+	printf("   %6.1f TSC ticks", (double)tsc / events);
+	#endif
+	printf("\n");
+}
+
+template <typename Node>
+void roundTrip(const char * name, long messages) {
+	HostLMIC lmic;
+	lmic.setNetwork(&answer, nullptr);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	lmic.run(node, sec2osticks(60));
+	uint32_t joinEvents = lmic.events();
+	uint64_t joinNs = lmic.eventNs();
+
+	uint8_t payload[20] = { 0 };
+	UpstreamMessage message(payload, sizeof(payload));
+	long queued = 0;
+	while (queued < messages) {
+		for (int i = 0; i < LEUVILLE_LORA_QUEUE_LEN && queued < messages; i++, queued++) {
+			node.send(message);
+		}
+		while (node.hasMessageToSend() || node.isRadioBusy()) {
+			lmic.run(node, sec2osticks(3600));
+		}
+	}
+	uint32_t events = lmic.events() - joinEvents;
+	printf("  %-8s %6.1f ns per event, %u uplinks completed, %u downlinks\n", name,
+		   events > 0 ? (double)(lmic.eventNs() - joinNs) / events : 0.0, node._completed, node._downlinks);
+}
+
+int main(int argc, char ** argv) {
+	long events = (argc > 1 ? atol(argv[1]) : 10000000);
+	printf("dispatch (%ld events)\n", events);
+	dispatch<VirtualNode>("virtual", events);
+	dispatch<CrtpNode>("CRTP", events);
+	long messages = events / 100;
+	printf("round trip (%ld uplinks)\n", messages);
+	roundTrip<VirtualNode>("virtual", messages);
+	roundTrip<CrtpNode>("CRTP", messages);
+	return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * JSON text vs MessagePack: payload bytes, time-on-air, encode and decode time, measured on the host
+ *
+ *	bench_json [iterations]
+ *
+ * Built only when ARDUINOJSON_DIR points to an ArduinoJson 7 source tree (the directory holding ArduinoJson.h):
+ *
+ *	cmake -S extras/host -B build -DARDUINOJSON_DIR=.../ArduinoJson/src
+ *
+ * Encode = JsonWire::serialize() of the document, decode = JsonWire::deserialize() of the encoded payload,
+ * which are the calls made by JsonCodec for send() and downlinkReceived().
+ */
+
+#include <HostLMIC.h>
+#include <JsonEndnode.h>
+
+#include <chrono>
+#include <cstdlib>
+
+using namespace leuville::lora;
+
+/*
+ * Representative uplink documents
+ */
+void sensor(JsonDocument & doc) {
+	doc["temp"] = 21.5;
+	doc["hum"] = 48;
+	doc["bat"] = 3.71;
+}
+
+void position(JsonDocument & doc) {
+	doc["lat"] = 48.8566;
+	doc["lon"] = 2.3522;
+	doc["alt"] = 35;
+	doc["fix"] = true;
+}
+
+void series(JsonDocument & doc) {
+	doc["id"] = "node-01";
+	doc["seq"] = 1234;
+	JsonArray values = doc["v"].to<JsonArray>();
+	for (int v : { 12, 15, 11, 18, 20, 17, 14, 13 }) {
+		values.add(v);
+	}
+}
+
+void status(JsonDocument & doc) {
+	doc["status"] = "ok";
+	doc["uptime"] = 86400;
+	doc["errors"] = 0;
+	doc["fw"] = "1.4.2";
+}
+
+struct Result {
+	size_t _len;
+	double _encodeNs;
+	double _decodeNs;
+};
+
+template <JsonWireFormat FORMAT>
+Result measure(const JsonDocument & doc, long iterations) {
+	using Wire = JsonWire<FORMAT>;
+	uint8_t buf[MAX_MESSAGE_LEN];
+	Result result;
+	result._len = Wire::measure(doc);
+
+	size_t total = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) {
+		total += Wire::serialize(doc, buf, sizeof(buf));
+	}
+	auto end = std::chrono::steady_clock::now();
+	result._encodeNs = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+	if (total != result._len * iterations) {
+		printf("encoding failed\n");
+		exit(1);
+	}
+
+	JsonDocument decoded;
+	start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; i++) {
+		if (Wire::deserialize(decoded, buf, result._len)) {
+			printf("decoding failed\n");
+			exit(1);
+		}
+	}
+	end = std::chrono::steady_clock::now();
+	result._decodeNs = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+	return result;
+}
+
+void print(const char * format, const Result & result) {
+	uint8_t len = (uint8_t)min(result._len, (size_t)UINT8_MAX);
+	printf("  %-8s %4zu bytes   SF7 %6.1f ms   SF12 %7.1f ms   encode %6.0f ns   decode %6.0f ns\n",
+		   format, result._len, timeOnAir(DR_SF7, len) / 1000.0, timeOnAir(DR_SF12, len) / 1000.0,
+		   result._encodeNs, result._decodeNs);
+}
+
+int main(int argc, char ** argv) {
+	long iterations = (argc > 1 ? atol(argv[1]) : 100000);
+	struct {
+		const char * _name;
+		void (*_fill)(JsonDocument &);
+	} documents[] = {
+		{ "sensor", sensor },
+		{ "position", position },
+		{ "series", series },
+		{ "status", status }
+	};
+	for (auto & document : documents) {
+		JsonDocument doc;
+		document._fill(doc);
+		Result json = measure<JsonWireFormat::JSON>(doc, iterations);
+		Result msgpack = measure<JsonWireFormat::MSGPACK>(doc, iterations);
+		printf("%s (MessagePack %.0f%% of JSON)\n", document._name, 100.0 * msgpack._len / json._len);
+		print("JSON", json);
+		print("MSGPACK", msgpack);
+	}
+	return 0;
+}
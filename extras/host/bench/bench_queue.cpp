@@ -0,0 +1,59 @@
+/*
+ * Uplink queue throughput and LMIC event latency, measured on the host
+ *
+ *	bench_queue [messages]
+ *
+ * Each round queues LEUVILLE_LORA_QUEUE_LEN messages and runs the endnode until they are all sent:
+ * send(), the send job, LMIC_setTxData2() and the EV_TXCOMPLETE handling are measured together.
+ * Event latency = host time spent in the LMIC event callback (onUserEvent() and txComplete()).
+ */
+
+#include <HostLMIC.h>
+#include <LMICWrapper.h>
+
+#include <chrono>
+#include <cstdlib>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+};
+
+int main(int argc, char ** argv) {
+	long messages = (argc > 1 ? atol(argv[1]) : 100000);
+	HostLMIC lmic;
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	lmic.run(node, sec2osticks(60));
+	uint32_t joinEvents = lmic.events();
+	uint64_t joinNs = lmic.eventNs();
+
+	uint8_t payload[20] = { 0 };
+	UpstreamMessage message(payload, sizeof(payload));
+	long queued = 0;
+	auto start = std::chrono::steady_clock::now();
+	while (queued < messages) {
+		for (int i = 0; i < LEUVILLE_LORA_QUEUE_LEN && queued < messages; i++, queued++) {
+			message._buf[0] = (uint8_t)queued;
+			node.send(message);
+		}
+		while (node.hasMessageToSend() || node.isRadioBusy()) {
+			lmic.run(node, sec2osticks(3600));
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	uint32_t events = lmic.events() - joinEvents;
+	printf("messages          %ld\n", queued);
+	printf("frames            %u\n", lmic.frames());
+	printf("host time         %.3f s (%.0f messages/s)\n", seconds, queued / seconds);
+	printf("simulated time    %.1f h\n", lmic.elapsed() / (3600.0 * OSTICKS_PER_SEC));
+	printf("events            %u, mean %.0f ns, max %llu ns\n", events,
+		   events > 0 ? (double)(lmic.eventNs() - joinNs) / events : 0.0, (unsigned long long)lmic.eventMaxNs());
+	return 0;
+}
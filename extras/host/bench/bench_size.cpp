@@ -0,0 +1,74 @@
+/*
+ * Flash footprint of an endnode, built once with LMICWrapper (virtual hooks) and once with
+ * LMICWrapperT<Derived> (LEUVILLE_BENCH_CRTP defined): the bench_size target prints the size of both objects.
+ *
+ * The node overrides the hooks most sketches override, and runs the usual setup() / loop().
+ */
+
+#include <HostLMIC.h>
+#include <LMICWrapper.h>
+
+using namespace leuville::lora;
+
+#if defined(LEUVILLE_BENCH_CRTP)
+
+class Node : public LMICWrapperT<Node> {
+	friend class LMICWrapperT<Node>;
+public:
+	using LMICWrapperT::LMICWrapperT;
+
+protected:
+
+	bool isTxCompleted(const UpstreamMessage & message) {
+		return LMICWrapperT::isTxCompleted(message);
+	}
+
+	void downlinkReceived(const DownstreamMessage & message) {
+		_lastPort = message._port;
+	}
+
+	void joined(bool ok) {
+		LMICWrapperT::joined(ok);
+	}
+
+	uint8_t _lastPort = 0;
+};
+
+#else
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+protected:
+
+	bool isTxCompleted(const UpstreamMessage & message) override {
+		return LMICWrapper::isTxCompleted(message);
+	}
+
+	void downlinkReceived(const DownstreamMessage & message) override {
+		_lastPort = message._port;
+	}
+
+	void joined(bool ok) override {
+		LMICWrapper::joined(ok);
+	}
+
+	uint8_t _lastPort = 0;
+};
+
+#endif
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+Node node(nullptr);
+
+void setup() {
+	node.begin(id, 0x13);
+}
+
+void loop() {
+	uint8_t payload[] = { 1, 2, 3 };
+	node.send(UpstreamMessage(payload, sizeof(payload)));
+	node.runLoopOnce();
+}
@@ -0,0 +1,160 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for the Arduino core API used by the library (Print, String, F(), PROGMEM, millis())
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using std::min;
+using std::max;
+
+#define PROGMEM
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define memcpy_P memcpy
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+
+#define DEC 10
+#define HEX 16
+
+class __FlashStringHelper;
+
+/*
+ * Arduino String, also a writer for ArduinoJson (serializeJson(doc, string))
+ */
+class String {
+public:
+
+	String(const char * str = "") : _str(str) {
+	}
+
+	const char * c_str() const {
+		return _str.c_str();
+	}
+
+	unsigned int length() const {
+		return _str.length();
+	}
+
+	size_t write(uint8_t c) {
+		_str += (char)c;
+		return 1;
+	}
+
+	size_t write(const uint8_t * buf, size_t len) {
+		_str.append((const char *)buf, len);
+		return len;
+	}
+
+	String & operator+=(const char * str) {
+		_str += str;
+		return *this;
+	}
+
+	bool operator==(const char * str) const {
+		return _str == str;
+	}
+
+private:
+
+	std::string _str;
+};
+
+/*
+ * Arduino Print, writing to a stdio stream
+ */
+class Print {
+public:
+
+	Print(FILE * out = stdout) : _out(out) {
+	}
+
+	virtual ~Print() = default;
+
+	virtual size_t write(uint8_t c) {
+		return fputc(c, _out) == EOF ? 0 : 1;
+	}
+
+	size_t print(const char * str) {
+		return fputs(str, _out) < 0 ? 0 : strlen(str);
+	}
+
+	size_t print(const __FlashStringHelper * str) {
+		return print(reinterpret_cast<const char *>(str));
+	}
+
+	size_t print(const String & str) {
+		return print(str.c_str());
+	}
+
+	size_t print(char c) {
+		return write(c);
+	}
+
+	size_t print(long value, int base = DEC) {
+		return fprintf(_out, base == HEX ? "%lX" : "%ld", value);
+	}
+
+	size_t print(unsigned long value, int base = DEC) {
+		return fprintf(_out, base == HEX ? "%lX" : "%lu", value);
+	}
+
+	size_t print(int value, int base = DEC) {
+		return print((long)value, base);
+	}
+
+	size_t print(unsigned int value, int base = DEC) {
+		return print((unsigned long)value, base);
+	}
+
+	size_t print(unsigned char value, int base = DEC) {
+		return print((unsigned long)value, base);
+	}
+
+	size_t print(double value, int digits = 2) {
+		return fprintf(_out, "%.*f", digits, value);
+	}
+
+	template <typename T>
+	size_t println(T value) {
+		return print(value) + println();
+	}
+
+	template <typename T>
+	size_t println(T value, int format) {
+		return print(value, format) + println();
+	}
+
+	size_t println() {
+		return print("\n");
+	}
+
+private:
+
+	FILE * _out;
+};
+
+// one per translation unit, all on stdout
+static Print Serial;
+
+#ifndef LMIC_PRINTF_TO
+#define LMIC_PRINTF_TO Serial
+#endif
+
+/*
+ * Virtual time of the active HostLMIC (see HostLMIC.h)
+ */
+inline unsigned long millis();
+inline unsigned long micros();
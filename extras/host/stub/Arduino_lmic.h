@@ -0,0 +1,13 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for the MCCI arduino-lmic entry header
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <lmic.h>
@@ -0,0 +1,40 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for the leuville-arduino-utilities member function holder used by JobRegister
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+namespace leuville {
+namespace simple_template_library {
+
+/*
+ * Object + member function without argument
+ */
+template <typename T, typename R>
+class MemberFunction {
+public:
+
+	MemberFunction() {
+	}
+
+	MemberFunction(T * target, R (T::*function)()) : _target(target), _function(function) {
+	}
+
+	R operator()() {
+		return (_target->*_function)();
+	}
+
+private:
+
+	T * 		_target = nullptr;
+	R (T::* 	_function)() = nullptr;
+};
+
+}
+}
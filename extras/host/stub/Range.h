@@ -0,0 +1,46 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for the leuville-arduino-utilities ranges used by the library
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+namespace leuville {
+namespace simple_template_library {
+
+template <typename T>
+struct Range {
+	T _min;
+	T _max;
+
+	constexpr Range(T min, T max) : _min(min), _max(max) {
+	}
+};
+
+/*
+ * Value within a range
+ */
+template <typename T>
+struct RangedValue {
+	Range<T> 	_range;
+	T 			_value;
+};
+
+/*
+ * Linear mapping of value onto range
+ */
+template <typename T, typename U>
+U scaleValue(const RangedValue<T> & value, const Range<U> & range) {
+	if (value._range._max == value._range._min) {
+		return range._min;
+	}
+	return range._min + (U)((value._value - value._range._min) * (range._max - range._min) / (value._range._max - value._range._min));
+}
+
+}
+}
@@ -0,0 +1,543 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for the subset of ArduinoJson 7 used by the codec tests:
+ * flat objects of integers and strings, JSON text and MessagePack.
+ * Only the tests see it: bench_json and fleet_sim use the real library (ARDUINOJSON_DIR).
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Error of deserializeJson() / deserializeMsgPack(): true if the input is not valid
+ */
+class DeserializationError {
+public:
+
+	enum Code {
+		Ok,
+		EmptyInput,
+		IncompleteInput,
+		InvalidInput
+	};
+
+	DeserializationError(Code code = Ok) : _code(code) {
+	}
+
+	explicit operator bool() const {
+		return _code != Ok;
+	}
+
+	bool operator==(Code code) const {
+		return _code == code;
+	}
+
+	Code code() const {
+		return _code;
+	}
+
+private:
+
+	Code _code;
+};
+
+namespace ArduinoJsonStub {
+
+struct Member {
+	std::string _key;
+	bool 		_text;
+	long 		_int;
+	std::string _str;
+};
+
+using Members = std::vector<Member>;
+
+/*
+ * doc[key]: reads the member, or adds it on assignment
+ */
+class MemberRef {
+public:
+
+	MemberRef(Members & members, const char * key) : _members(members), _key(key) {
+	}
+
+	template <typename T, typename = typename std::enable_if<std::is_integral<T>::value>::type>
+	MemberRef & operator=(T value) {
+		Member & m = member();
+		m._text = false;
+		m._int = (long)value;
+		return *this;
+	}
+
+	MemberRef & operator=(const char * value) {
+		Member & m = member();
+		m._text = true;
+		m._str = value;
+		return *this;
+	}
+
+	bool isNull() const {
+		return find() == nullptr;
+	}
+
+	template <typename T>
+	typename std::enable_if<std::is_integral<T>::value, T>::type as() const {
+		const Member * m = find();
+		return (m == nullptr || m->_text ? 0 : (T)m->_int);
+	}
+
+	template <typename T>
+	typename std::enable_if<std::is_same<T, const char *>::value, T>::type as() const {
+		const Member * m = find();
+		return (m == nullptr || !m->_text ? nullptr : m->_str.c_str());
+	}
+
+private:
+
+	const Member * find() const {
+		for (const Member & m : _members) {
+			if (m._key == _key) {
+				return &m;
+			}
+		}
+		return nullptr;
+	}
+
+	Member & member() {
+		for (Member & m : _members) {
+			if (m._key == _key) {
+				return m;
+			}
+		}
+		_members.push_back(Member { _key, false, 0, "" });
+		return _members.back();
+	}
+
+	Members & 	_members;
+	const char* _key;
+};
+
+}
+
+class JsonObject;
+
+/*
+ * Flat object of integers and strings, in insertion order
+ */
+class JsonDocument {
+public:
+
+	ArduinoJsonStub::MemberRef operator[](const char * key) {
+		return ArduinoJsonStub::MemberRef(_members, key);
+	}
+
+	ArduinoJsonStub::MemberRef operator[](const char * key) const {
+		return ArduinoJsonStub::MemberRef(const_cast<ArduinoJsonStub::Members &>(_members), key);
+	}
+
+	template <typename T>
+	T to();
+
+	size_t size() const {
+		return _members.size();
+	}
+
+	void clear() {
+		_members.clear();
+	}
+
+	void shrinkToFit() {
+	}
+
+	const ArduinoJsonStub::Members & members() const {
+		return _members;
+	}
+
+	ArduinoJsonStub::Members & members() {
+		return _members;
+	}
+
+private:
+
+	ArduinoJsonStub::Members _members;
+};
+
+/*
+ * Root object of a JsonDocument
+ */
+class JsonObject {
+public:
+
+	explicit JsonObject(JsonDocument * doc = nullptr) : _doc(doc) {
+	}
+
+	ArduinoJsonStub::MemberRef operator[](const char * key) const {
+		return (*_doc)[key];
+	}
+
+private:
+
+	JsonDocument * _doc;
+};
+
+template <>
+inline JsonObject JsonDocument::to<JsonObject>() {
+	clear();
+	return JsonObject(this);
+}
+
+namespace ArduinoJsonStub {
+
+template <typename Writer>
+size_t put(Writer & writer, uint8_t c) {
+	return writer.write(c);
+}
+
+template <typename Writer>
+size_t putText(Writer & writer, const std::string & str) {
+	size_t n = put(writer, '"');
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			n += put(writer, '\\');
+		}
+		n += put(writer, (uint8_t)c);
+	}
+	return n + put(writer, '"');
+}
+
+template <typename Writer>
+size_t putJson(Writer & writer, const JsonDocument & doc) {
+	size_t n = put(writer, '{');
+	bool first = true;
+	for (const Member & m : doc.members()) {
+		if (!first) {
+			n += put(writer, ',');
+		}
+		first = false;
+		n += putText(writer, m._key);
+		n += put(writer, ':');
+		if (m._text) {
+			n += putText(writer, m._str);
+		} else {
+			char digits[24];
+			int len = snprintf(digits, sizeof(digits), "%ld", m._int);
+			for (int i = 0; i < len; i++) {
+				n += put(writer, digits[i]);
+			}
+		}
+	}
+	return n + put(writer, '}');
+}
+
+// MessagePack big endian value of len bytes
+template <typename Writer>
+size_t putBE(Writer & writer, uint8_t type, uint32_t value, uint8_t len) {
+	size_t n = put(writer, type);
+	for (int i = len - 1; i >= 0; i--) {
+		n += put(writer, (uint8_t)(value >> (8 * i)));
+	}
+	return n;
+}
+
+template <typename Writer>
+size_t putMsgPack(Writer & writer, const std::string & str) {
+	size_t n = (str.size() < 32 ? put(writer, 0xA0 | str.size()) : putBE(writer, 0xD9, str.size(), 1));
+	for (char c : str) {
+		n += put(writer, (uint8_t)c);
+	}
+	return n;
+}
+
+template <typename Writer>
+size_t putMsgPack(Writer & writer, long value) {
+	if (value >= 0) {
+		return (value < 128 ? put(writer, (uint8_t)value)
+			: value < 0x100 ? putBE(writer, 0xCC, value, 1)
+			: value < 0x10000 ? putBE(writer, 0xCD, value, 2)
+			: putBE(writer, 0xCE, value, 4));
+	}
+	return (value >= -32 ? put(writer, (uint8_t)value)
+		: value >= -128 ? putBE(writer, 0xD0, value, 1)
+		: value >= -32768 ? putBE(writer, 0xD1, value, 2)
+		: putBE(writer, 0xD2, value, 4));
+}
+
+template <typename Writer>
+size_t putMsgPack(Writer & writer, const JsonDocument & doc) {
+	size_t count = doc.size();
+	size_t n = (count < 16 ? put(writer, 0x80 | count) : putBE(writer, 0xDE, count, 2));
+	for (const Member & m : doc.members()) {
+		n += putMsgPack(writer, m._key);
+		n += (m._text ? putMsgPack(writer, m._str) : putMsgPack(writer, m._int));
+	}
+	return n;
+}
+
+struct CountingWriter {
+	size_t write(uint8_t) {
+		return 1;
+	}
+};
+
+/*
+ * Input of the deserializers
+ */
+struct Reader {
+	const uint8_t * _p;
+	const uint8_t * _end;
+
+	bool more() const {
+		return _p < _end;
+	}
+
+	uint8_t peek() const {
+		return *_p;
+	}
+
+	uint8_t next() {
+		return *_p++;
+	}
+
+	void skipSpaces() {
+		while (more() && (peek() == ' ' || peek() == '\t' || peek() == '\r' || peek() == '\n')) {
+			_p += 1;
+		}
+	}
+
+	// MessagePack big endian value of len bytes
+	bool readBE(uint8_t len, uint32_t & value) {
+		if (_end - _p < len) {
+			return false;
+		}
+		value = 0;
+		while (len-- > 0) {
+			value = (value << 8) | next();
+		}
+		return true;
+	}
+};
+
+using Code = DeserializationError::Code;
+
+inline Code readJsonText(Reader & in, std::string & str) {
+	if (!in.more() || in.next() != '"') {
+		return DeserializationError::InvalidInput;
+	}
+	while (in.more()) {
+		uint8_t c = in.next();
+		if (c == '"') {
+			return DeserializationError::Ok;
+		}
+		if (c == '\\') {
+			if (!in.more()) {
+				break;
+			}
+			c = in.next();
+		}
+		str += (char)c;
+	}
+	return DeserializationError::IncompleteInput;
+}
+
+inline Code readJsonMember(Reader & in, Member & m) {
+	Code code = readJsonText(in, m._key);
+	if (code != DeserializationError::Ok) {
+		return code;
+	}
+	in.skipSpaces();
+	if (!in.more()) {
+		return DeserializationError::IncompleteInput;
+	}
+	if (in.next() != ':') {
+		return DeserializationError::InvalidInput;
+	}
+	in.skipSpaces();
+	if (!in.more()) {
+		return DeserializationError::IncompleteInput;
+	}
+	if (in.peek() == '"') {
+		m._text = true;
+		return readJsonText(in, m._str);
+	}
+	bool negative = (in.peek() == '-');
+	if (negative) {
+		in.next();
+	}
+	if (!in.more() || in.peek() < '0' || in.peek() > '9') {
+		return (in.more() ? DeserializationError::InvalidInput : DeserializationError::IncompleteInput);
+	}
+	m._text = false;
+	m._int = 0;
+	while (in.more() && in.peek() >= '0' && in.peek() <= '9') {
+		m._int = m._int * 10 + (in.next() - '0');
+	}
+	if (negative) {
+		m._int = -m._int;
+	}
+	return DeserializationError::Ok;
+}
+
+inline Code readJson(Reader & in, Members & members) {
+	in.skipSpaces();
+	if (!in.more()) {
+		return DeserializationError::EmptyInput;
+	}
+	if (in.next() != '{') {
+		return DeserializationError::InvalidInput;
+	}
+	in.skipSpaces();
+	if (in.more() && in.peek() == '}') {
+		return DeserializationError::Ok;
+	}
+	while (in.more()) {
+		Member m { "", false, 0, "" };
+		Code code = readJsonMember(in, m);
+		if (code != DeserializationError::Ok) {
+			return code;
+		}
+		members.push_back(m);
+		in.skipSpaces();
+		if (!in.more()) {
+			break;
+		}
+		uint8_t c = in.next();
+		if (c == '}') {
+			return DeserializationError::Ok;
+		}
+		if (c != ',') {
+			return DeserializationError::InvalidInput;
+		}
+		in.skipSpaces();
+	}
+	return DeserializationError::IncompleteInput;
+}
+
+inline Code readMsgPackText(Reader & in, uint8_t type, std::string & str) {
+	if ((type & 0xE0) != 0xA0 && type != 0xD9) {
+		return DeserializationError::InvalidInput;
+	}
+	uint32_t len = type & 0x1F;
+	if (type == 0xD9 && !in.readBE(1, len)) {
+		return DeserializationError::IncompleteInput;
+	}
+	if ((uint32_t)(in._end - in._p) < len) {
+		return DeserializationError::IncompleteInput;
+	}
+	str.assign((const char *)in._p, len);
+	in._p += len;
+	return DeserializationError::Ok;
+}
+
+inline Code readMsgPackMember(Reader & in, Member & m) {
+	Code code = readMsgPackText(in, in.next(), m._key);
+	if (code != DeserializationError::Ok) {
+		return code;
+	}
+	if (!in.more()) {
+		return DeserializationError::IncompleteInput;
+	}
+	uint8_t type = in.next();
+	uint32_t value = 0;
+	m._text = false;
+	if (type < 0x80 || type >= 0xE0) {
+		m._int = (int8_t)type;
+	} else if (type >= 0xCC && type <= 0xCE) {
+		if (!in.readBE(1 << (type - 0xCC), value)) {
+			return DeserializationError::IncompleteInput;
+		}
+		m._int = (long)value;
+	} else if (type >= 0xD0 && type <= 0xD2) {
+		if (!in.readBE(1 << (type - 0xD0), value)) {
+			return DeserializationError::IncompleteInput;
+		}
+		m._int = (type == 0xD0 ? (int8_t)value : type == 0xD1 ? (int16_t)value : (long)(int32_t)value);
+	} else {
+		m._text = true;
+		return readMsgPackText(in, type, m._str);
+	}
+	return DeserializationError::Ok;
+}
+
+inline Code readMsgPack(Reader & in, Members & members) {
+	if (!in.more()) {
+		return DeserializationError::EmptyInput;
+	}
+	uint8_t type = in.next();
+	if ((type & 0xF0) != 0x80 && type != 0xDE) {
+		return DeserializationError::InvalidInput;
+	}
+	uint32_t count = type & 0x0F;
+	if (type == 0xDE && !in.readBE(2, count)) {
+		return DeserializationError::IncompleteInput;
+	}
+	while (count-- > 0) {
+		if (!in.more()) {
+			return DeserializationError::IncompleteInput;
+		}
+		Member m { "", false, 0, "" };
+		Code code = readMsgPackMember(in, m);
+		if (code != DeserializationError::Ok) {
+			return code;
+		}
+		members.push_back(m);
+	}
+	return DeserializationError::Ok;
+}
+
+}
+
+inline size_t measureJson(const JsonDocument & doc) {
+	ArduinoJsonStub::CountingWriter writer;
+	return ArduinoJsonStub::putJson(writer, doc);
+}
+
+inline size_t measureMsgPack(const JsonDocument & doc) {
+	ArduinoJsonStub::CountingWriter writer;
+	return ArduinoJsonStub::putMsgPack(writer, doc);
+}
+
+/*
+ * Writer = any class with size_t write(uint8_t), String included
+ */
+template <typename Writer>
+size_t serializeJson(const JsonDocument & doc, Writer & writer) {
+	return ArduinoJsonStub::putJson(writer, doc);
+}
+
+template <typename Writer>
+size_t serializeMsgPack(const JsonDocument & doc, Writer & writer) {
+	return ArduinoJsonStub::putMsgPack(writer, doc);
+}
+
+/*
+ * Any previous content of doc is lost, doc is empty if the input is not valid
+ */
+inline DeserializationError deserializeJson(JsonDocument & doc, const uint8_t * input, size_t len) {
+	doc.clear();
+	ArduinoJsonStub::Reader in { input, input + len };
+	DeserializationError::Code code = ArduinoJsonStub::readJson(in, doc.members());
+	if (code != DeserializationError::Ok) {
+		doc.clear();
+	}
+	return code;
+}
+
+inline DeserializationError deserializeMsgPack(JsonDocument & doc, const uint8_t * input, size_t len) {
+	doc.clear();
+	ArduinoJsonStub::Reader in { input, input + len };
+	DeserializationError::Code code = ArduinoJsonStub::readMsgPack(in, doc.members());
+	if (code != DeserializationError::Ok) {
+		doc.clear();
+	}
+	return code;
+}
@@ -0,0 +1,103 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for the subset of CayenneLPP (ElectronicCats) used by the codec tests:
+ * digital inputs and luminosity, decoded with decodeTTN() into the ArduinoJson stub.
+ * Only the tests see it: fleet_sim uses the real library (CAYENNELPP_DIR).
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <ArduinoJson.h>
+
+#define LPP_DIGITAL_INPUT 	0
+#define LPP_LUMINOSITY 		101
+
+#define LPP_DIGITAL_INPUT_SIZE 	1
+#define LPP_LUMINOSITY_SIZE 	2
+
+class CayenneLPP {
+public:
+
+	CayenneLPP(uint8_t size) : _buffer(new uint8_t[size]), _maxsize(size), _cursor(0) {
+	}
+
+	~CayenneLPP() {
+		delete[] _buffer;
+	}
+
+	CayenneLPP(const CayenneLPP &) = delete;
+	CayenneLPP & operator=(const CayenneLPP &) = delete;
+
+	void reset() {
+		_cursor = 0;
+	}
+
+	uint8_t getSize() {
+		return _cursor;
+	}
+
+	uint8_t * getBuffer() {
+		return _buffer;
+	}
+
+	/*
+	 * Returns the new size, 0 if the buffer is full
+	 */
+	uint8_t addDigitalInput(uint8_t channel, uint32_t value) {
+		return add(channel, LPP_DIGITAL_INPUT, value, LPP_DIGITAL_INPUT_SIZE);
+	}
+
+	uint8_t addLuminosity(uint8_t channel, uint32_t lux) {
+		return add(channel, LPP_LUMINOSITY, lux, LPP_LUMINOSITY_SIZE);
+	}
+
+	/*
+	 * Adds "<type>_<channel>" members to root
+	 * Returns the number of fields, 0 if the buffer is not valid
+	 */
+	uint8_t decodeTTN(uint8_t * buffer, uint8_t size, JsonObject root) {
+		uint8_t count = 0;
+		uint8_t index = 0;
+		while (index + 2 <= size) {
+			uint8_t channel = buffer[index];
+			uint8_t type = buffer[index + 1];
+			uint8_t len = (type == LPP_DIGITAL_INPUT ? LPP_DIGITAL_INPUT_SIZE : type == LPP_LUMINOSITY ? LPP_LUMINOSITY_SIZE : 0);
+			if (len == 0 || index + 2 + len > size) {
+				return 0;
+			}
+			uint32_t value = 0;
+			for (uint8_t i = 0; i < len; i++) {
+				value = (value << 8) | buffer[index + 2 + i];
+			}
+			char name[24];
+			snprintf(name, sizeof(name), "%s_%u", (type == LPP_DIGITAL_INPUT ? "digital_input" : "luminosity"), channel);
+			root[name] = value;
+			index += 2 + len;
+			count += 1;
+		}
+		return (index == size ? count : 0);
+	}
+
+private:
+
+	uint8_t add(uint8_t channel, uint8_t type, uint32_t value, uint8_t len) {
+		if (_cursor + 2 + len > _maxsize) {
+			return 0;
+		}
+		_buffer[_cursor++] = channel;
+		_buffer[_cursor++] = type;
+		for (int i = len - 1; i >= 0; i--) {
+			_buffer[_cursor++] = (uint8_t)(value >> (8 * i));
+		}
+		return _cursor;
+	}
+
+	uint8_t * 	_buffer;
+	uint8_t 	_maxsize;
+	uint8_t 	_cursor;
+};
@@ -0,0 +1,51 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for the subset of nanopb used by ProtobufEndnode and the codec tests.
+ * No generator: a message descriptor holds hand-written encode / decode functions
+ * built on the stream functions of pb_encode.h / pb_decode.h, which behave like nanopb's
+ * (same "stream full" error, same sizing stream).
+ * Only the tests see it: fleet_sim uses the real library (NANOPB_DIR).
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+typedef uint8_t pb_byte_t;
+typedef uint_least16_t pb_size_t;
+
+#define PB_SIZE_MAX ((pb_size_t)-1)
+
+typedef enum {
+	PB_WT_VARINT = 0,
+	PB_WT_64BIT = 1,
+	PB_WT_STRING = 2,
+	PB_WT_32BIT = 5
+} pb_wire_type_t;
+
+typedef struct pb_ostream_s pb_ostream_t;
+typedef struct pb_istream_s pb_istream_t;
+
+/*
+ * Message descriptor: Foo_msg, declared extern const like generated code
+ */
+typedef struct pb_msgdesc_s {
+	bool (*encode)(pb_ostream_t * stream, const void * src);
+	bool (*decode)(pb_istream_t * stream, void * dest);
+} pb_msgdesc_t;
+
+#if defined(PB_NO_ERRMSG)
+#define PB_SET_ERROR(stream, msg) ((void)(stream))
+#define PB_GET_ERROR(stream) "(errmsg disabled)"
+#else
+#define PB_SET_ERROR(stream, msg) ((stream)->errmsg = (stream)->errmsg ? (stream)->errmsg : (msg))
+#define PB_GET_ERROR(stream) ((stream)->errmsg ? (stream)->errmsg : "(none)")
+#endif
+
+#define PB_RETURN_ERROR(stream, msg) return (PB_SET_ERROR(stream, msg), false)
@@ -0,0 +1,79 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for nanopb decoding, see pb.h
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <pb.h>
+
+#include <cstring>
+
+struct pb_istream_s {
+	const pb_byte_t * 	buf;
+	size_t 				bytes_left;
+#if !defined(PB_NO_ERRMSG)
+	const char * 		errmsg;
+#endif
+};
+
+inline pb_istream_t pb_istream_from_buffer(const pb_byte_t * buf, size_t msglen) {
+	pb_istream_t stream;
+	stream.buf = buf;
+	stream.bytes_left = msglen;
+#if !defined(PB_NO_ERRMSG)
+	stream.errmsg = nullptr;
+#endif
+	return stream;
+}
+
+inline bool pb_read(pb_istream_t * stream, pb_byte_t * buf, size_t count) {
+	if (count > stream->bytes_left) {
+		PB_RETURN_ERROR(stream, "end-of-stream");
+	}
+	if (buf != nullptr) {
+		memcpy(buf, stream->buf, count);
+	}
+	stream->buf += count;
+	stream->bytes_left -= count;
+	return true;
+}
+
+inline bool pb_decode_varint(pb_istream_t * stream, uint64_t * dest) {
+	uint64_t value = 0;
+	for (uint8_t shift = 0; shift < 64; shift += 7) {
+		pb_byte_t byte;
+		if (!pb_read(stream, &byte, 1)) {
+			return false;
+		}
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			*dest = value;
+			return true;
+		}
+	}
+	PB_RETURN_ERROR(stream, "varint overflow");
+}
+
+/*
+ * eof is set, and false returned, at the end of the message
+ */
+inline bool pb_decode_tag(pb_istream_t * stream, pb_wire_type_t * wire_type, uint32_t * tag, bool * eof) {
+	*eof = (stream->bytes_left == 0);
+	uint64_t value;
+	if (*eof || !pb_decode_varint(stream, &value)) {
+		return false;
+	}
+	*wire_type = (pb_wire_type_t)(value & 7);
+	*tag = (uint32_t)(value >> 3);
+	return true;
+}
+
+inline bool pb_decode(pb_istream_t * stream, const pb_msgdesc_t * fields, void * dest_struct) {
+	return fields->decode(stream, dest_struct);
+}
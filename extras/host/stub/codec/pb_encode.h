@@ -0,0 +1,84 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for nanopb encoding, see pb.h
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <pb.h>
+
+#include <cstring>
+
+/*
+ * buf == nullptr: sizing stream, counts the bytes only
+ */
+struct pb_ostream_s {
+	pb_byte_t * buf;
+	size_t 		max_size;
+	size_t 		bytes_written;
+#if !defined(PB_NO_ERRMSG)
+	const char * errmsg;
+#endif
+};
+
+inline pb_ostream_t pb_ostream_from_buffer(pb_byte_t * buf, size_t bufsize) {
+	pb_ostream_t stream;
+	stream.buf = buf;
+	stream.max_size = bufsize;
+	stream.bytes_written = 0;
+#if !defined(PB_NO_ERRMSG)
+	stream.errmsg = nullptr;
+#endif
+	return stream;
+}
+
+inline bool pb_write(pb_ostream_t * stream, const pb_byte_t * buf, size_t count) {
+	if (count > 0 && stream->buf != nullptr) {
+		if (stream->bytes_written + count > stream->max_size) {
+			PB_RETURN_ERROR(stream, "stream full");
+		}
+		memcpy(stream->buf + stream->bytes_written, buf, count);
+	}
+	stream->bytes_written += count;
+	return true;
+}
+
+inline bool pb_encode_varint(pb_ostream_t * stream, uint64_t value) {
+	pb_byte_t bytes[10];
+	size_t count = 0;
+	do {
+		bytes[count] = (pb_byte_t)(value & 0x7F);
+		value >>= 7;
+		if (value != 0) {
+			bytes[count] |= 0x80;
+		}
+		count += 1;
+	} while (value != 0);
+	return pb_write(stream, bytes, count);
+}
+
+inline bool pb_encode_tag(pb_ostream_t * stream, pb_wire_type_t wiretype, uint32_t field_number) {
+	return pb_encode_varint(stream, ((uint64_t)field_number << 3) | wiretype);
+}
+
+inline bool pb_encode_string(pb_ostream_t * stream, const pb_byte_t * buffer, size_t size) {
+	return pb_encode_varint(stream, size) && pb_write(stream, buffer, size);
+}
+
+inline bool pb_encode(pb_ostream_t * stream, const pb_msgdesc_t * fields, const void * src_struct) {
+	return fields->encode(stream, src_struct);
+}
+
+inline bool pb_get_encoded_size(size_t * size, const pb_msgdesc_t * fields, const void * src_struct) {
+	pb_ostream_t stream = pb_ostream_from_buffer(nullptr, SIZE_MAX);
+	if (!pb_encode(&stream, fields, src_struct)) {
+		return false;
+	}
+	*size = stream.bytes_written;
+	return true;
+}
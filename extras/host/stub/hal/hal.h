@@ -0,0 +1,16 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for the LMIC HAL header: no pins on the host
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <lmic.h>
+
+struct lmic_pinmap {
+};
@@ -0,0 +1,205 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for the LMIC API used by the library (types, constants, LMIC state, os_* and LMIC_* functions)
+ *
+ * The functions are implemented by HostLMIC.h, which a host program includes first.
+ * Names and values follow MCCI arduino-lmic (EU868).
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+typedef uint8_t 	u1_t;
+typedef int8_t 		s1_t;
+typedef uint16_t 	u2_t;
+typedef int16_t 	s2_t;
+typedef uint32_t 	u4_t;
+typedef int32_t 	s4_t;
+typedef int64_t 	s8_t;
+typedef u1_t 		bit_t;
+typedef s4_t 		ostime_t;
+typedef u4_t 		devaddr_t;
+typedef u1_t 		dr_t;
+typedef u1_t 		ev_t;
+typedef int 		lmic_tx_error_t;
+typedef u1_t * 		xref2u1_t;
+typedef const u1_t * xref2cu1_t;
+
+#if !defined(CFG_eu868) && !defined(CFG_us915) && !defined(CFG_au915) && !defined(CFG_as923) && !defined(CFG_kr920) && !defined(CFG_in866)
+#define CFG_eu868 1
+#endif
+
+#if defined(CFG_eu868) || defined(CFG_as923) || defined(CFG_kr920) || defined(CFG_in866)
+#define CFG_LMIC_EU_like 1
+#else
+#define CFG_LMIC_EU_like 0
+#endif
+
+// 255 with LMIC_ENABLE_long_messages
+#ifndef MAX_FRAME_LEN
+#define MAX_FRAME_LEN 64
+#endif
+
+#define MAX_CHANNELS 16
+
+// MCCI default: 16 us per tick
+#define OSTICKS_PER_SEC 62500
+#define ms2osticks(ms) ((ostime_t)(((s8_t)(ms) * OSTICKS_PER_SEC) / 1000))
+#define sec2osticks(sec) ((ostime_t)((s8_t)(sec) * OSTICKS_PER_SEC))
+#define us2osticks(us) ((ostime_t)(((s8_t)(us) * OSTICKS_PER_SEC) / 1000000))
+#define osticks2ms(os) ((s4_t)(((os) * (s8_t)1000) / OSTICKS_PER_SEC))
+#define osticks2us(os) ((s4_t)(((os) * (s8_t)1000000) / OSTICKS_PER_SEC))
+
+enum {
+	LMIC_ERROR_SUCCESS 			= 0,
+	LMIC_ERROR_TX_BUSY 			= -1,
+	LMIC_ERROR_TX_TOO_LARGE 	= -2,
+	LMIC_ERROR_TX_NOT_FEASIBLE 	= -3,
+	LMIC_ERROR_TX_FAILED 		= -4
+};
+
+enum {
+	EV_SCAN_TIMEOUT = 1, EV_BEACON_FOUND, EV_BEACON_MISSED, EV_BEACON_TRACKED, EV_JOINING,
+	EV_JOINED, EV_RFU1, EV_JOIN_FAILED, EV_REJOIN_FAILED, EV_TXCOMPLETE, EV_LOST_TSYNC, EV_RESET,
+	EV_RXCOMPLETE, EV_LINK_DEAD, EV_LINK_ALIVE, EV_SCAN_FOUND, EV_TXSTART, EV_TXCANCELED, EV_RXSTART,
+	EV_JOIN_TXCOMPLETE
+};
+
+enum {
+	TXRX_ACK 	= 0x80,
+	TXRX_NACK 	= 0x40,
+	TXRX_NOPORT = 0x20,
+	TXRX_PORT 	= 0x10,
+	TXRX_LENERR = 0x08,
+	TXRX_PING 	= 0x04,
+	TXRX_DNW2 	= 0x02,
+	TXRX_DNW1 	= 0x01
+};
+
+enum {
+	OP_NONE 	= 0x0000,
+	OP_SCAN 	= 0x0001,
+	OP_TRACK 	= 0x0002,
+	OP_JOINING 	= 0x0004,
+	OP_TXDATA 	= 0x0008,
+	OP_POLL 	= 0x0010,
+	OP_REJOIN 	= 0x0020,
+	OP_SHUTDOWN = 0x0040,
+	OP_TXRXPEND = 0x0080,
+	OP_RNDTX 	= 0x0100,
+	OP_PINGINI 	= 0x0200,
+	OP_PINGABLE = 0x0400,
+	OP_NEXTCHNL = 0x0800,
+	OP_LINKDEAD = 0x1000,
+	OP_TESTMODE = 0x2000,
+	OP_UNJOIN 	= 0x4000
+};
+
+enum {
+	MCMD_DEVS_EXT_POWER 	= 0x00,
+	MCMD_DEVS_BATT_MIN 		= 0x01,
+	MCMD_DEVS_BATT_MAX 		= 0xFE,
+	MCMD_DEVS_BATT_NOINFO 	= 0xFF
+};
+
+enum { DR_SF12 = 0, DR_SF11, DR_SF10, DR_SF9, DR_SF8, DR_SF7, DR_SF7B, DR_FSK, DR_NONE };
+
+enum { BAND_MILLI = 0, BAND_CENTI = 1, BAND_DECI = 2, BAND_AUX = 3 };
+
+#define DR_RANGE_MAP(drlo, drhi) ((u2_t)((0xFFFF << (drlo)) & (0xFFFF ^ (0xFFFE << (drhi)))))
+
+#define RADIO_RST 0
+
+struct osjob_t;
+typedef void (*osjobcb_t)(osjob_t *);
+
+struct osjob_t {
+	osjob_t * 	next;
+	ostime_t 	deadline;
+	osjobcb_t 	func;
+};
+
+typedef void lmic_event_cb_t(void * pUserData, ev_t ev);
+typedef void lmic_request_network_time_cb_t(void * pUserData, int flagSuccess);
+
+struct lmic_time_reference_t {
+	ostime_t 	tLocal;
+	u4_t 		tNetwork;
+};
+
+struct lmic_pinmap;
+
+/*
+ * Subset of the MCCI LMIC state read or written by the library
+ */
+struct lmic_t {
+	osjob_t 	osjob;				// radio job: TX, RX windows, JOIN
+	u2_t 		opmode;
+	ostime_t 	globalDutyAvail;	// no TX before
+	u1_t 		globalDutyRate;
+	ostime_t 	txend;
+	dr_t 		datarate;
+	s1_t 		adrTxPow;
+	u1_t 		adrEnabled;
+	u1_t 		txCnt;
+	u1_t 		txrxFlags;
+	u1_t 		dataBeg;			// payload of the received frame
+	u1_t 		dataLen;
+	u1_t 		frame[MAX_FRAME_LEN];
+	u1_t 		pendTxPort;
+	u4_t 		seqnoUp;
+	u4_t 		seqnoDn;
+	u4_t 		netid;
+	devaddr_t 	devaddr;
+	u1_t 		rxDelay;
+	u1_t 		rx1DrOffset;
+	dr_t 		dn2Dr;
+	u4_t 		dn2Freq;
+	u4_t 		channelFreq[MAX_CHANNELS];
+	u2_t 		channelDrMap[MAX_CHANNELS];
+	u2_t 		channelMap;
+};
+
+/*
+ * LMIC state of the active HostLMIC (see HostLMIC.h): each thread has its own
+ */
+inline lmic_t & hostLMIC();
+#define LMIC (hostLMIC())
+
+// os_* API
+inline int os_init_ex(const void * pinmap);
+inline ostime_t os_getTime();
+inline void os_setCallback(osjob_t * job, osjobcb_t cb);
+inline void os_setTimedCallback(osjob_t * job, ostime_t time, osjobcb_t cb);
+inline void os_clearCallback(osjob_t * job);
+inline void os_runloop_once();
+inline bit_t os_queryTimeCriticalJobs(ostime_t time);
+inline void os_radio(u1_t mode);
+
+// provided by the application (LMICWrapper.h)
+void os_getArtEui(u1_t * buf);
+void os_getDevEui(u1_t * buf);
+void os_getDevKey(u1_t * buf);
+
+// LMIC_* API
+inline int LMIC_registerEventCb(lmic_event_cb_t * cb, void * pUserData);
+inline void LMIC_reset();
+inline void LMIC_setAdrMode(bit_t enabled);
+inline void LMIC_setLinkCheckMode(bit_t enabled);
+inline void LMIC_setClockError(u2_t error);
+inline bit_t LMIC_setupChannel(u1_t channel, u4_t freq, u2_t drmap, s1_t band);
+inline void LMIC_setDrTxpow(dr_t dr, s1_t txpow);
+inline int LMIC_setBatteryLevel(u1_t level);
+inline bit_t LMIC_startJoining();
+inline void LMIC_unjoinAndRejoin();
+inline void LMIC_setSession(u4_t netid, devaddr_t devaddr, xref2u1_t nwkKey, xref2u1_t artKey);
+inline void LMIC_getSessionKeys(u4_t * netid, devaddr_t * devaddr, xref2u1_t nwkKey, xref2u1_t artKey);
+inline lmic_tx_error_t LMIC_setTxData2(u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed);
+inline void LMIC_requestNetworkTime(lmic_request_network_time_cb_t * cb, void * pUserData);
+inline int LMIC_getNetworkTimeReference(lmic_time_reference_t * reference);
@@ -0,0 +1,43 @@
+/*
+ * Module: host
+ *
+ * Function: host stand-in for the leuville-arduino-utilities functions used by the library
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+template <typename T, size_t N>
+constexpr size_t arrayCapacity(const T (&)[N]) {
+	return N;
+}
+
+/*
+ * Hex string with its bytes in reverse order: "10FF" becomes "FF10"
+ */
+inline String loraString(const char * hex) {
+	size_t len = strlen(hex) & ~(size_t)1;
+	String result("");
+	for (size_t pos = len; pos > 0; pos -= 2) {
+		result.write((const uint8_t *)hex + pos - 2, 2);
+	}
+	return result;
+}
+
+/*
+ * "A0FF" gives { 0xA0, 0xFF }
+ */
+inline void hexCharacterStringToBytes(const String & hex, uint8_t * bytes) {
+	auto nibble = [](char c) -> uint8_t {
+		return (c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : 0);
+	};
+	const char * str = hex.c_str();
+	for (unsigned int pos = 0; pos + 1 < hex.length(); pos += 2) {
+		bytes[pos / 2] = (nibble(str[pos]) << 4) | nibble(str[pos + 1]);
+	}
+}
@@ -0,0 +1,29 @@
+// error: declare Derived final
+/*
+ * GenericEndnode: a Derived which does not declare the typed isTxCompleted() must be final,
+ * a subclass overriding it would never be called
+ */
+
+#include <HostLMIC.h>
+#include <GenericEndnode.h>
+
+using namespace leuville::lora;
+
+class Plain : public GenericEndnode<RawCodec, Plain> {
+public:
+	using GenericEndnode::GenericEndnode;
+};
+
+class Sub : public Plain {
+public:
+	using Plain::Plain;
+
+	bool isTxCompleted(const RawPayload & payload, const UpstreamMessage & message) override {
+		return true;
+	}
+};
+
+int main() {
+	Sub node(nullptr);
+	return 0;
+}
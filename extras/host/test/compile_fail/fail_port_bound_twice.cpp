@@ -0,0 +1,27 @@
+// error: FPort bound twice
+/*
+ * PortDispatcher: an FPort bound twice does not compile
+ */
+
+#include <HostLMIC.h>
+#include <GenericEndnode.h>
+#include <PortDispatch.h>
+
+using namespace leuville::lora;
+
+struct Handlers {
+	void first(const RawPayload &, const DownstreamMessage &) {
+	}
+
+	void second(const RawPayload &, const DownstreamMessage &) {
+	}
+};
+
+int main() {
+	using Ports = PortDispatcher<
+		OnPort<10, RawCodec, Handlers, &Handlers::first>,
+		OnPort<10, RawCodec, Handlers, &Handlers::second>
+	>;
+	Handlers handlers;
+	return Ports::dispatch(handlers, DownstreamMessage()) ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+/*
+ * Airtime admission control: the budget counts the messages already queued
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	std::vector<TxOutcome> _outcomes;
+
+	bool sendBytes(uint8_t len, bool ack = false) {
+		uint8_t buf[MAX_MESSAGE_LEN] = { 0 };
+		return send(UpstreamMessage(buf, len, ack));
+	}
+
+protected:
+
+	void txOutcome(const UpstreamMessage &, TxOutcome outcome) override {
+		_outcomes.push_back(outcome);
+	}
+};
+
+struct Network {
+	std::vector<HostFrame> _frames;
+
+	static bool answer(HostLMIC &, const HostFrame & frame, HostReply &, void * context) {
+		static_cast<Network *>(context)->_frames.push_back(frame);
+		return true;
+	}
+};
+
+constexpr uint8_t LEN = 10;
+
+/*
+ * Room for 3 frames: the 4th message is rejected before any of them is sent
+ */
+void testRejectCountsQueued() {
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	uint32_t frame = timeOnAir(LMIC.datarate, LEN);
+	node.setAirtimePolicy(Node::AIRTIME_REJECT, 3 * frame + frame / 2);
+	for (int i = 0; i < 3; i++) {
+		CHECK(node.sendBytes(LEN));
+	}
+	CHECK(node.queuedAirtime() == 3 * frame);
+	CHECK(!node.sendBytes(LEN));
+	CHECK(node.lastSendError() == Node::SEND_AIRTIME_BUDGET);
+	CHECK(node.stats()._dropsAirtime == 1);
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(network._frames.size() == 3);
+	CHECK(node.queuedAirtime() == 0);
+}
+
+/*
+ * Same budget: the messages beyond it are sent unconfirmed, as they are
+ */
+void testDropAck() {
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	uint32_t frame = timeOnAir(LMIC.datarate, LEN);
+	node.setAirtimePolicy(Node::AIRTIME_DROP_ACK, 3 * frame + frame / 2);
+	for (int i = 0; i < 5; i++) {
+		CHECK(node.sendBytes(LEN, true));
+	}
+	CHECK(lmic.run(node, sec2osticks(4 * 3600)));
+	CHECK(network._frames.size() == 5);
+	for (size_t i = 0; i < network._frames.size(); i++) {
+		CHECK(network._frames[i]._confirmed == (i < 3));
+		CHECK(network._frames[i]._len == LEN);
+	}
+	CHECK((node._outcomes == std::vector<Node::TxOutcome> {
+		Node::TX_DELIVERED, Node::TX_DELIVERED, Node::TX_DELIVERED, Node::TX_UNCONFIRMED, Node::TX_UNCONFIRMED }));
+}
+
+int main() {
+	testRejectCountsQueued();
+	testDropAck();
+	return report();
+}
@@ -0,0 +1,222 @@
+/*
+ * ArenaDeque views: one per deque, not disturbed by messages sent from the callbacks
+ */
+
+#define LEUVILLE_LORA_QUEUE_BYTES 256
+#define LEUVILLE_LORA_PRIORITY_CLASSES 2
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+using Arena = ArenaDeque<UpstreamMessage, 256>;
+
+UpstreamMessage message(uint8_t value, uint8_t len) {
+	uint8_t buf[MAX_MESSAGE_LEN];
+	memset(buf, value, len);
+	return UpstreamMessage(buf, len);
+}
+
+void testViewPerDeque() {
+	Arena first, second;
+	CHECK(first.push_front(message(1, 4)));
+	CHECK(second.push_front(message(2, 8)));
+	UpstreamMessage * a = first.backPtr();
+	UpstreamMessage * b = second.backPtr();
+	CHECK(a != b);
+	CHECK(a->_len == 4 && a->_buf[0] == 1);
+	a->_attempts = 3;
+	second.reserve_front()->_len = 1;
+	first.sync();
+	CHECK(first.backPtr()->_attempts == 3);
+	CHECK(first.lengthAt(0) == 4 && second.lengthAt(0) == 8);
+}
+
+/*
+ * The compact record header keeps every member of UpstreamMessage
+ */
+void testRecordHeader() {
+	Arena arena;
+	UpstreamMessage msg = message(7, 5);
+	msg._txrxFlags = TXRX_ACK;
+	msg._ackRequested = true;
+	msg._lmicTxError = LMIC_ERROR_TX_NOT_FEASIBLE;
+	msg._fport = 42;
+	msg._priority = 1;
+	msg._stageTag = 0x55;
+	msg._enqueueTime = -123456;
+	msg._retry = RetryPolicy { 5, RetryPolicy::DEMOTE, 600, 100000 };
+	msg._attempts = 3;
+	msg._demoted = true;
+	msg._backoff = true;
+	msg._nextAttempt = 987654;
+	CHECK(arena.push_front(msg));
+	UpstreamMessage * back = arena.backPtr();
+	CHECK(back->_len == 5 && back->_buf[4] == 7);
+	CHECK(back->_txrxFlags == TXRX_ACK && back->_ackRequested && back->_lmicTxError == LMIC_ERROR_TX_NOT_FEASIBLE);
+	CHECK(back->_fport == 42 && back->_priority == 1 && back->_stageTag == 0x55);
+	CHECK(back->_enqueueTime == -123456 && back->_nextAttempt == 987654);
+	CHECK(back->_retry._maxAttempts == 5 && back->_retry._action == RetryPolicy::DEMOTE && back->_retry._backoff == 600);
+	CHECK(back->_retry._ttl == UINT16_MAX);
+	CHECK(back->_attempts == 3 && back->_demoted && back->_backoff);
+	// 5 payload bytes cost 26 bytes
+	CHECK(ArenaRecord<UpstreamMessage>::LEN == 21);
+	Arena empty;
+	CHECK(empty.fits(9, 9 * 5) && !empty.fits(10, 10 * 5));
+}
+
+uint32_t lengthWeight(uint8_t key, uint8_t len) {
+	return key * 1000 + len;
+}
+
+/*
+ * The running total follows pushes, evictions, pops and erasures, and the key
+ */
+void testWeight() {
+	Arena arena;
+	CHECK(arena.weight(1) == 0);
+	arena.setWeight(&lengthWeight);
+	uint32_t total = 0;
+	for (uint8_t i = 1; i <= 4; i++) {
+		CHECK(arena.push_front(message(i, i * 10)));
+		total += 1000 + i * 10;
+	}
+	CHECK(arena.weight(1) == total);
+	CHECK(arena.push_front(message(5, 60)));	// evicts 1
+	CHECK(arena.size() == 4);
+	total += 1060 - 1010;
+	CHECK(arena.weight(1) == total);
+	CHECK(arena.erase(1));	// 3
+	CHECK(arena.pop_front());	// 5
+	CHECK(arena.weight(1) == 1020 + 1040);
+	CHECK(arena.weight(2) == 2020 + 2040);
+	CHECK(arena.pop_back() && arena.weight(2) == 2040);
+}
+
+/*
+ * erase() keeps the order of the other records, also across the end of the ring
+ */
+void testErase() {
+	// 6 records fill the ring
+	const uint8_t len = 256 / 6 - ArenaRecord<UpstreamMessage>::LEN;
+	Arena arena;
+	for (uint8_t i = 1; i <= 6; i++) {
+		CHECK(arena.push_front(message(i, len)));
+	}
+	CHECK(arena.pop_back() && arena.pop_back());
+	for (uint8_t i = 7; i <= 8; i++) {
+		CHECK(arena.push_front(message(i, len)));
+	}
+	// 3 .. 8, the last ones wrapped
+	CHECK(!arena.erase(6));
+	CHECK(arena.erase(2));
+	CHECK(arena.erase(3));
+	CHECK(arena.erase(0));
+	const uint8_t expected[] = { 4, 6, 8 };
+	CHECK(arena.size() == sizeof(expected));
+	for (uint8_t pos = 0; pos < arena.size(); pos++) {
+		UpstreamMessage * msg = arena.backPtr(pos);
+		CHECK(msg->_len == len && msg->_buf[0] == expected[pos] && msg->_buf[len - 1] == expected[pos]);
+	}
+	CHECK(arena.push_front(message(9, len)));
+	CHECK(arena.frontPtr()->_buf[0] == 9);
+}
+
+/*
+ * Sends a message from isTxCompleted() and txOutcome(), through reserve() / commit() which use the view
+ */
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	std::vector<uint8_t> _delivered;
+	int _echoes = 0;
+	int _rejected = 0;
+
+	bool sendBytes(uint8_t value, uint8_t len, uint8_t priority = 0) {
+		UpstreamMessage msg = message(value, len);
+		msg._priority = priority;
+		return send(msg);
+	}
+
+protected:
+
+	bool isTxCompleted(const UpstreamMessage & msg) override {
+		echo(msg._buf[0]);
+		return LMICWrapper::isTxCompleted(msg);
+	}
+
+	void txOutcome(const UpstreamMessage & msg, TxOutcome outcome) override {
+		_delivered.push_back(msg._buf[0]);
+		echo(msg._buf[0]);
+	}
+
+private:
+
+	// answers each original message (value < 100) once per callback, in its class
+	void echo(uint8_t value) {
+		if (value >= 100 || _echoes >= 40) {
+			return;
+		}
+		_echoes += 1;
+		UpstreamMessage * slot = reserve(false, 1, value % 2);
+		if (slot == nullptr) {
+			_rejected += 1;
+			return;
+		}
+		memset(slot->_buf, 100 + value, 20);
+		slot->_len = 20;
+		if (!commit()) {
+			_rejected += 1;
+		}
+	}
+};
+
+void testCallbacksSend() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	// class 0 full: the answers sent by the callbacks cannot evict the message being completed
+	uint8_t value = 0;
+	while (node.sendBytes(value * 2, 20)) {
+		value += 1;
+		if (node.stats()._dropsRecent > 0) {
+			break;
+		}
+	}
+	CHECK(node.sendBytes(1, 20, 1));
+	CHECK(node.sendBytes(3, 20, 1));
+	uint16_t dropsRecent = node.stats()._dropsRecent;
+	CHECK(lmic.run(node, sec2osticks(4 * 3600)));
+	CHECK(!node.hasMessageToSend());
+	CHECK(node.stats()._dropsRecent == dropsRecent);
+	// each original message delivered once: class 1 first, then class 0 in order
+	std::vector<uint8_t> originals;
+	for (uint8_t v : node._delivered) {
+		if (v < 100) {
+			originals.push_back(v);
+		}
+	}
+	CHECK(originals.size() >= 4 && originals[0] == 1 && originals[1] == 3);
+	for (size_t i = 3; i < originals.size(); i++) {
+		CHECK(originals[i] == originals[i - 1] + 2);
+	}
+	CHECK(node._rejected > 0);
+	CHECK(node._delivered.size() == originals.size() + node._echoes - node._rejected);
+}
+
+int main() {
+	testViewPerDeque();
+	testRecordHeader();
+	testWeight();
+	testErase();
+	testCallbacksSend();
+	return report();
+}
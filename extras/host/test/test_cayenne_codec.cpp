@@ -0,0 +1,143 @@
+/*
+ * CayenneLPPCodec: buffers of exactly maxPayload bytes are sent, longer ones are SEND_PAYLOAD_TOO_LARGE;
+ * uplinks and downlinks are decoded to Json documents
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <CayenneLPPEndnode.h>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+class Node : public CayenneLPPEndnode {
+public:
+	using CayenneLPPEndnode::CayenneLPPEndnode;
+
+	int 			_downlinks = 0;
+	JsonDocument 	_downlink;
+
+protected:
+	void downlinkReceived(const JsonDocument & message, const DownstreamMessage & rawMessage) override {
+		_downlinks += 1;
+		_downlink = message;
+	}
+};
+
+/*
+ * Fills lpp with len bytes (len >= 16): at least 2 luminosity fields (4 bytes), then digital inputs (3 bytes)
+ * Channel i holds i (digital input) or 100 * i (luminosity)
+ * Returns the number of fields
+ */
+uint8_t fill(CayenneLPP & lpp, uint8_t len) {
+	lpp.reset();
+	uint8_t channel = 0;
+	while (channel < 2 || (len - lpp.getSize()) % 3 != 0) {
+		lpp.addLuminosity(channel, 100 * channel);
+		channel += 1;
+	}
+	while (lpp.getSize() < len) {
+		lpp.addDigitalInput(channel, channel);
+		channel += 1;
+	}
+	return channel;
+}
+
+/*
+ * true if doc holds the count fields written by fill()
+ */
+bool filled(const JsonDocument & doc, uint8_t count) {
+	char last[24];
+	snprintf(last, sizeof(last), "digital_input_%u", count - 1);
+	return doc.size() == count
+		&& doc["luminosity_0"].as<int>() == 0
+		&& doc["luminosity_1"].as<int>() == 100
+		&& doc[last].as<int>() == count - 1;
+}
+
+/*
+ * The buffer is copied only if it fits maxPayload
+ */
+void testCodecLimit() {
+	CayenneLPP lpp(MAX_MESSAGE_LEN);
+	Message message;
+	uint8_t count = fill(lpp, 20);
+	CHECK(lpp.getSize() == 20);
+	CHECK(CayenneLPPCodec::encode(lpp, message, 20) == LMICWrapper::SEND_OK);
+	CHECK(message._len == 20 && memcmp(message._buf, lpp.getBuffer(), 20) == 0);
+	JsonDocument decoded;
+	CHECK(CayenneLPPCodec::decodeUplink(message._buf, message._len, decoded));
+	CHECK(filled(decoded, count));
+	fill(lpp, 21);
+	CHECK(CayenneLPPCodec::encode(lpp, message, 20) == LMICWrapper::SEND_PAYLOAD_TOO_LARGE);
+}
+
+/*
+ * send() gives maxMessageLen() to the codec: exactly maxMessageLen() bytes are sent, one more byte is refused
+ */
+void testSendLimit() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	uint8_t maxPayload = node.maxMessageLen();
+	CayenneLPP lpp(MAX_MESSAGE_LEN);
+	fill(lpp, maxPayload + 1);
+	CHECK(!node.send(lpp));
+	CHECK(node.lastSendError() == LMICWrapper::SEND_PAYLOAD_TOO_LARGE);
+	uint8_t count = fill(lpp, maxPayload);
+	CHECK(node.send(lpp));
+	CHECK(lmic.run(node, sec2osticks(600)));
+	CHECK(lmic.frames() == 1 && lmic.lastFrame()._len == maxPayload);
+	JsonDocument sent;
+	CHECK(CayenneLPPCodec::decodeUplink(lmic.lastFrame()._data, lmic.lastFrame()._len, sent));
+	CHECK(filled(sent, count));
+}
+
+/*
+ * Answers each uplink with the downlink given as context
+ */
+bool answer(HostLMIC &, const HostFrame & frame, HostReply & reply, void * context) {
+	const Message & downlink = *(const Message *)context;
+	reply._port = 1;
+	reply._data = downlink._buf;
+	reply._len = downlink._len;
+	return true;
+}
+
+/*
+ * Returns the document delivered to the endnode for a downlink of len bytes
+ */
+JsonDocument received(const uint8_t * buf, uint8_t len) {
+	Message downlink;
+	memcpy(downlink._buf, buf, len);
+	downlink._len = len;
+	HostLMIC lmic;
+	lmic.setNetwork(&answer, &downlink);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	CayenneLPP lpp(MAX_MESSAGE_LEN);
+	fill(lpp, 20);
+	CHECK(node.send(lpp));
+	CHECK(lmic.run(node, sec2osticks(600)));
+	CHECK(node._downlinks == 1);
+	return node._downlink;
+}
+
+/*
+ * A downlink is decoded to the fields which were encoded, an invalid one is delivered as an empty document
+ */
+void testDownlink() {
+	CayenneLPP lpp(MAX_MESSAGE_LEN);
+	uint8_t count = fill(lpp, 30);
+	CHECK(filled(received(lpp.getBuffer(), lpp.getSize()), count));
+	CHECK(received(lpp.getBuffer(), lpp.getSize() - 1).size() == 0);
+}
+
+int main() {
+	testCodecLimit();
+	testSendLimit();
+	testDownlink();
+	return report();
+}
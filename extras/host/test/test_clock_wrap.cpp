@@ -0,0 +1,117 @@
+/*
+ * os_getTime() wraps after 2^31 ticks: TTL, backoff, latency and airtime budget across the wrap
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+// 20 s before the wrap
+constexpr ostime_t BEFORE_WRAP = INT32_MAX - sec2osticks(20);
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	std::vector<TxOutcome> _outcomes;
+
+protected:
+
+	void txOutcome(const UpstreamMessage &, TxOutcome outcome) override {
+		_outcomes.push_back(outcome);
+	}
+};
+
+/*
+ * Nacks the first confirmed uplinks
+ */
+struct Network {
+	std::vector<HostFrame> _frames;
+	int _nacks = 0;
+
+	static bool answer(HostLMIC &, const HostFrame & frame, HostReply & reply, void * context) {
+		Network & network = *static_cast<Network *>(context);
+		network._frames.push_back(frame);
+		if (network._nacks > 0) {
+			network._nacks -= 1;
+			reply._ack = false;
+		}
+		return true;
+	}
+};
+
+void testRetryAcrossWrap() {
+	HostLMIC lmic(BEFORE_WRAP);
+	Network network;
+	network._nacks = 2;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	node.setRetryPolicy(RetryPolicy { 0, RetryPolicy::DROP, 10, 3600 });
+	uint8_t buf[] = { 1 };
+	node.send(UpstreamMessage(buf, sizeof(buf), true));
+	CHECK(lmic.run(node, sec2osticks(600)));
+
+	// not expired, delivered by the third frame, the last one after the wrap
+	CHECK((node._outcomes == std::vector<Node::TxOutcome> { Node::TX_DELIVERED }));
+	CHECK(network._frames.size() == 3);
+	CHECK(network._frames.front()._start > 0 && network._frames.back()._start < 0);
+
+	// backoff: 10 s then 20 s after the end of the RX windows
+	for (size_t i = 1; i < network._frames.size(); i++) {
+		ostime_t gap = network._frames[i]._start - network._frames[i - 1]._end;
+		ostime_t backoff = sec2osticks(10 << (i - 1)) + ms2osticks(RX2_END_MS);
+		CHECK(gap >= backoff && gap < backoff + sec2osticks(1));
+	}
+
+	// about 40 s from send() to the acknowledgement: [32 s, 64 s[ bucket
+	const NodeStats & stats = node.stats();
+	CHECK(stats._latency[6] == 1);
+	CHECK(stats._latency[LEUVILLE_LORA_LATENCY_BUCKETS - 1] == 0);
+}
+
+void testTtlAcrossWrap() {
+	HostLMIC lmic(BEFORE_WRAP);
+	Network network;
+	network._nacks = 100;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	node.setRetryPolicy(RetryPolicy { 0, RetryPolicy::DROP, 30, 120 });
+	uint8_t buf[] = { 1 };
+	node.send(UpstreamMessage(buf, sizeof(buf), true));
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(node._outcomes.empty());
+	CHECK(node.hasMessageToSend());
+	CHECK(lmic.run(node, sec2osticks(600)));
+	CHECK((node._outcomes == std::vector<Node::TxOutcome> { Node::TX_EXPIRED }));
+}
+
+void testAirtimeBudgetAcrossWrap() {
+	AirtimeBudget budget(1000000);	// 1 s per hour
+	ostime_t now = INT32_MAX - sec2osticks(1);
+	budget.spend(1000000, now);
+	CHECK(!budget.allows(1000, now));
+	now += sec2osticks(1800);
+	CHECK(now < 0);
+	CHECK(budget.allows(400000, now));
+	CHECK(!budget.allows(600000, now));
+	uint32_t wait = budget.waitTime(1000000, now);
+	CHECK(wait > 1799000 && wait < 1801000);
+	now += sec2osticks(2 * 3600);
+	CHECK(budget.available(now) == 1000000);
+}
+
+int main() {
+	testRetryAcrossWrap();
+	testTtlAcrossWrap();
+	testAirtimeBudgetAcrossWrap();
+	return report();
+}
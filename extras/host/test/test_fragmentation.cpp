@@ -0,0 +1,167 @@
+/*
+ * Fragment sets: sized for the PayloadStage, queued all or none, rejections counted
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+using Payload = std::vector<uint8_t>;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	std::vector<TxOutcome> _outcomes;
+
+	uint8_t queued() {
+		return _messages.size();
+	}
+
+protected:
+
+	void txOutcome(const UpstreamMessage &, TxOutcome outcome) override {
+		_outcomes.push_back(outcome);
+	}
+};
+
+/*
+ * Decodes the DeltaStage frames, then reassembles the fragments
+ */
+struct Network {
+	DeltaDecoder _decoder;
+	FragmentReassembler<> _fragments;
+	std::vector<Payload> _payloads;
+	uint8_t _maxLen = 0;
+
+	static bool answer(HostLMIC &, const HostFrame & frame, HostReply &, void * context) {
+		Network & network = *static_cast<Network *>(context);
+		network._maxLen = max(network._maxLen, frame._len);
+		uint8_t out[UINT8_MAX];
+		uint8_t outLen;
+		if (network._decoder.decode(frame._data, frame._len, out, outLen) && network._fragments.add(out, outLen)) {
+			const uint8_t * payload = network._fragments.payload();
+			network._payloads.emplace_back(payload, payload + network._fragments.length());
+		}
+		return true;
+	}
+};
+
+Payload payload(uint16_t len) {
+	Payload data(len);
+	for (uint16_t i = 0; i < len; i++) {
+		data[i] = (uint8_t)(i * 7);
+	}
+	return data;
+}
+
+/*
+ * The sequence number added by DeltaStage fits in each fragment frame
+ */
+void testStageOverhead() {
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	DeltaStage stage;
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	LMIC_setDrTxpow(DR_SF12, 14);
+	node.setPayloadStage(&stage);
+	Payload data = payload(200);
+	CHECK(node.sendFragmented(data.data(), data.size()));
+	CHECK(lmic.run(node, sec2osticks(4 * 3600)));
+	CHECK(!node._outcomes.empty());
+	for (Node::TxOutcome outcome : node._outcomes) {
+		CHECK(outcome == Node::TX_DELIVERED);
+	}
+	CHECK(network._maxLen == maxPayloadLen(DR_SF12));
+	CHECK(network._payloads == std::vector<Payload> { data });
+	CHECK(node.stats()._rejected == 0);
+}
+
+/*
+ * KEEP_RECENT: a set larger than the whole queue is rejected, the queue is left as is
+ */
+void testLargerThanQueue() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	LMIC_setDrTxpow(DR_SF12, 14);
+	uint8_t buf[] = { 1 };
+	node.send(UpstreamMessage(buf, sizeof(buf)));
+	Payload data = payload(LEUVILLE_LORA_QUEUE_LEN * maxPayloadLen(DR_SF12));
+	CHECK(!node.sendFragmented(data.data(), data.size()));
+	CHECK(node.lastSendError() == Node::SEND_PAYLOAD_TOO_LARGE);
+	CHECK(node.stats()._rejected == 1);
+	CHECK(node.stats()._dropsOld == 0 && node.stats()._dropsRecent == 0);
+	CHECK(node.queued() == 1);
+}
+
+/*
+ * KEEP_OLD: a set which does not fit in the room left is not queued at all
+ */
+void testAllOrNone() {
+	HostLMIC lmic;
+	Node node(nullptr, Node::KEEP_OLD);
+	node.begin(id, 0x13, false);
+	LMIC_setDrTxpow(DR_SF12, 14);
+	uint8_t buf[] = { 1 };
+	for (int i = 0; i < LEUVILLE_LORA_QUEUE_LEN - 2; i++) {
+		CHECK(node.send(UpstreamMessage(buf, sizeof(buf))));
+	}
+	Payload data = payload(3 * (maxPayloadLen(DR_SF12) - FRAGMENT_HEADER_LEN));
+	CHECK(!node.sendFragmented(data.data(), data.size()));
+	CHECK(node.lastSendError() == Node::SEND_QUEUE_FULL);
+	CHECK(node.stats()._dropsOld == 1 && node.stats()._rejected == 0);
+	CHECK(node.queued() == LEUVILLE_LORA_QUEUE_LEN - 2);
+	Payload small = payload(2 * (maxPayloadLen(DR_SF12) - FRAGMENT_HEADER_LEN) - 1);
+	CHECK(node.sendFragmented(small.data(), small.size()));
+	CHECK(node.queued() == LEUVILLE_LORA_QUEUE_LEN);
+}
+
+/*
+ * Fragment of payload id: header, then len bytes
+ */
+Payload fragment(uint8_t id, uint8_t index, uint8_t count, uint8_t len) {
+	Payload data = payload(FRAGMENT_HEADER_LEN + len);
+	data[0] = id;
+	data[1] = index;
+	data[2] = count;
+	return data;
+}
+
+/*
+ * A chunk which does not match the first one, or which overflows MAX_LEN, drops its payload and frees its slot
+ */
+void testReassemblerDrops() {
+	FragmentReassembler<32, 1> mismatch;
+	CHECK(!mismatch.add(fragment(1, 0, 3, 8).data(), FRAGMENT_HEADER_LEN + 8));
+	CHECK(!mismatch.add(fragment(1, 1, 3, 9).data(), FRAGMENT_HEADER_LEN + 9));
+	CHECK(mismatch.dropped() == 1);
+	// the slot is free: another payload does not drop anything
+	CHECK(!mismatch.add(fragment(2, 0, 2, 8).data(), FRAGMENT_HEADER_LEN + 8));
+	CHECK(mismatch.add(fragment(2, 1, 2, 3).data(), FRAGMENT_HEADER_LEN + 3));
+	CHECK(mismatch.dropped() == 1 && mismatch.length() == 10);
+
+	FragmentReassembler<16, 1> overflow;
+	CHECK(!overflow.add(fragment(1, 1, 3, 10).data(), FRAGMENT_HEADER_LEN + 10));
+	CHECK(overflow.dropped() == 1);
+	CHECK(!overflow.add(fragment(2, 1, 2, 3).data(), FRAGMENT_HEADER_LEN + 3));
+	CHECK(overflow.add(fragment(2, 0, 2, 10).data(), FRAGMENT_HEADER_LEN + 10));
+	CHECK(overflow.dropped() == 1 && overflow.length() == 12);
+}
+
+int main() {
+	testStageOverhead();
+	testLargerThanQueue();
+	testAllOrNone();
+	testReassemblerDrops();
+	return report();
+}
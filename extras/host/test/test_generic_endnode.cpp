@@ -0,0 +1,99 @@
+/*
+ * GenericEndnode: completed uplinks are decoded only if the typed isTxCompleted() may be overridden
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <GenericEndnode.h>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+/*
+ * RawCodec which counts the decoded uplinks
+ */
+struct CountingCodec : RawCodec {
+
+	static int _uplinks;
+
+	static bool decodeUplink(const uint8_t * buf, uint8_t len, RawPayload & dest) {
+		_uplinks += 1;
+		return RawCodec::decodeUplink(buf, len, dest);
+	}
+};
+
+int CountingCodec::_uplinks = 0;
+
+// no Derived: always decoded
+class Untyped : public GenericEndnode<CountingCodec> {
+public:
+	using GenericEndnode::GenericEndnode;
+};
+
+// default typed policy: never decoded, final since no subclass may override it
+class Plain final : public GenericEndnode<CountingCodec, Plain> {
+public:
+	using GenericEndnode::GenericEndnode;
+};
+
+// typed policy, public
+class Typed : public GenericEndnode<CountingCodec, Typed> {
+public:
+	using GenericEndnode::GenericEndnode;
+
+	int _completions = 0;
+
+	bool isTxCompleted(const RawPayload & payload, const UpstreamMessage & message) override {
+		_completions += (payload._len == message._len ? 1 : 0);
+		return GenericEndnode::isTxCompleted(payload, message);
+	}
+};
+
+// typed policy, protected
+class Friend : public GenericEndnode<CountingCodec, Friend> {
+	friend class GenericEndnode<CountingCodec, Friend>;
+public:
+	using GenericEndnode::GenericEndnode;
+
+protected:
+	bool isTxCompleted(const RawPayload & payload, const UpstreamMessage & message) override {
+		return GenericEndnode::isTxCompleted(payload, message);
+	}
+};
+
+static_assert(Untyped::hasTypedTxCompletion(), "");
+static_assert(!Plain::hasTypedTxCompletion(), "");
+static_assert(Typed::hasTypedTxCompletion(), "");
+static_assert(Friend::hasTypedTxCompletion(), "");
+
+/*
+ * Sends count uplinks, returns the number of decoded ones
+ */
+template <typename Node>
+int decodedUplinks(Node & node, int count) {
+	HostLMIC lmic;
+	node.begin(id, 0x13, false);
+	CountingCodec::_uplinks = 0;
+	uint8_t buf[] = { 1, 2, 3 };
+	for (int i = 0; i < count; i++) {
+		CHECK(node.send(RawPayload { buf, sizeof(buf) }));
+	}
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK(!node.hasMessageToSend());
+	return CountingCodec::_uplinks;
+}
+
+int main() {
+	Untyped untyped(nullptr);
+	CHECK(decodedUplinks(untyped, 3) == 3);
+	Plain plain(nullptr);
+	CHECK(decodedUplinks(plain, 3) == 0);
+	Typed typed(nullptr);
+	CHECK(decodedUplinks(typed, 3) == 3);
+	CHECK(typed._completions == 3);
+	Friend befriended(nullptr);
+	CHECK(decodedUplinks(befriended, 3) == 3);
+	return report();
+}
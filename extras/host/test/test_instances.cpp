@@ -0,0 +1,97 @@
+/*
+ * Several endnodes in one program: each LMIC job reaches the endnode which set it
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	osjob_t _jobs[2];
+	std::vector<osjob_t *> _completed;
+
+protected:
+
+	void completeJob(osjob_t * job) override {
+		_completed.push_back(job);
+	}
+};
+
+/*
+ * Same hook, resolved at compile time
+ */
+class StaticNode : public LMICWrapperT<StaticNode> {
+public:
+	using LMICWrapperT<StaticNode>::LMICWrapperT;
+
+	osjob_t _job;
+	std::vector<osjob_t *> _completed;
+
+	void completeJob(osjob_t * job) {
+		_completed.push_back(job);
+	}
+};
+
+/*
+ * Runs the LMIC jobs, whichever endnode set them
+ */
+struct Scheduler {
+	void runLoopOnce() {
+		os_runloop_once();
+	}
+};
+
+/*
+ * Interleaved jobs of two LMICWrapper and a LMICWrapperT, some at the same time
+ */
+void testOwnJobs() {
+	HostLMIC lmic;
+	Node first(nullptr);
+	Node second(nullptr);
+	StaticNode third(nullptr);
+	ostime_t now = lmic.now();
+	CHECK(first.setCallbackAt(&first._jobs[0], now + sec2osticks(1)));
+	CHECK(second.setCallbackAt(&second._jobs[0], now + sec2osticks(1)));
+	CHECK(third.setCallbackAt(&third._job, now + sec2osticks(2)));
+	CHECK(second.setCallbackAt(&second._jobs[1], now + sec2osticks(3)));
+	CHECK(first.setCallbackAt(&first._jobs[1], now + sec2osticks(4)));
+	CHECK(first.pendingJobs() == 2 && second.pendingJobs() == 2 && third.pendingJobs() == 1);
+	Scheduler scheduler;
+	CHECK(lmic.run(scheduler, sec2osticks(10)));
+	CHECK((first._completed == std::vector<osjob_t *> { &first._jobs[0], &first._jobs[1] }));
+	CHECK((second._completed == std::vector<osjob_t *> { &second._jobs[0], &second._jobs[1] }));
+	CHECK((third._completed == std::vector<osjob_t *> { &third._job }));
+	CHECK(first.pendingJobs() == 0 && second.pendingJobs() == 0 && third.pendingJobs() == 0);
+}
+
+/*
+ * A destroyed endnode takes its pending jobs away, the jobs of the others still run
+ */
+void testDestroyedNode() {
+	HostLMIC lmic;
+	Node first(nullptr);
+	ostime_t now = lmic.now();
+	{
+		Node second(nullptr);
+		CHECK(second.setCallbackAt(&second._jobs[0], now + sec2osticks(1)));
+		CHECK(first.setCallbackAt(&first._jobs[0], now + sec2osticks(2)));
+	}
+	Scheduler scheduler;
+	CHECK(lmic.run(scheduler, sec2osticks(10)));
+	CHECK((first._completed == std::vector<osjob_t *> { &first._jobs[0] }));
+	CHECK(first.pendingJobs() == 0);
+}
+
+int main() {
+	testOwnJobs();
+	testDestroyedNode();
+	return report();
+}
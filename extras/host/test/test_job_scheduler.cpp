@@ -0,0 +1,153 @@
+/*
+ * JobScheduler: periodic jobs without phase drift, wakeups shared within jitter windows, pending job accounting
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <JobRegister.h>
+#include <LMICWrapper.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	enum { JOB_A, JOB_B, JOB_C, JOB_COUNT };
+
+	JobScheduler<Node, JOB_COUNT> _jobs { this };
+	std::vector<ostime_t> _runs[JOB_COUNT];
+	ostime_t _stall = 0;	// the next run of JOB_A takes this long
+
+	void begin() {
+		_jobs.define(JOB_A, this, &Node::runA);
+		_jobs.define(JOB_B, this, &Node::runB);
+		_jobs.define(JOB_C, this, &Node::runC);
+		LMICWrapper::begin(id, 0x13, false);
+	}
+
+	void runA() {
+		_runs[JOB_A].push_back(os_getTime());
+		HostLMIC::active().advance(_stall);
+		_stall = 0;
+	}
+
+	void runB() {
+		_runs[JOB_B].push_back(os_getTime());
+	}
+
+	void runC() {
+		_runs[JOB_C].push_back(os_getTime());
+	}
+
+protected:
+
+	void completeJob(osjob_t * job) override {
+		if (!_jobs.dispatch(job)) {
+			LMICWrapper::completeJob(job);
+		}
+	}
+};
+
+/*
+ * Each run of a periodic job is due one period after the previous due time, not after the run:
+ * a late run (long job) skips the missed periods and keeps the phase
+ */
+void testPeriodicPhase() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	node.begin();
+	ostime_t start = lmic.now();
+	const ostime_t period = sec2osticks(60);
+	CHECK(node._jobs.schedulePeriodic(Node::JOB_A, 60000));
+	CHECK(lmic.run(node, 2 * period + sec2osticks(1)));
+	node._stall = sec2osticks(150);
+	CHECK(lmic.run(node, 5 * period));
+	const std::vector<ostime_t> & runs = node._runs[Node::JOB_A];
+	// 60, 120, 180 (stalls until 330), 330 (due at 240), then 360, 420: 270 and 300 skipped
+	CHECK(runs.size() >= 6);
+	if (runs.size() >= 6) {
+		CHECK(runs[0] - start == period && runs[1] - start == 2 * period && runs[2] - start == 3 * period);
+		CHECK(runs[3] - start == sec2osticks(330));
+		CHECK(runs[4] - start == 6 * period && runs[5] - start == 7 * period);
+	}
+	CHECK(node._jobs.isScheduled(Node::JOB_A));
+	CHECK(node.pendingJobs() == 1);
+}
+
+/*
+ * A job set within the jitter window of another one shares its wakeup,
+ * a job outside of the windows runs alone, at the end of its own window
+ */
+void testCoalescing() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	node.begin();
+	ostime_t start = lmic.now();
+	CHECK(node._jobs.schedulePeriodic(Node::JOB_A, 60000, 10000));
+	CHECK(node._jobs.schedule(Node::JOB_B, 65000));
+	CHECK(node._jobs.schedule(Node::JOB_C, 20000, 5000));
+	CHECK(node.pendingJobs() == 3);
+	CHECK(lmic.run(node, sec2osticks(150)));
+	const std::vector<ostime_t> & a = node._runs[Node::JOB_A];
+	const std::vector<ostime_t> & b = node._runs[Node::JOB_B];
+	const std::vector<ostime_t> & c = node._runs[Node::JOB_C];
+	CHECK(c.size() == 1 && c[0] - start == sec2osticks(25));
+	CHECK(b.size() == 1 && b[0] - start == sec2osticks(65));
+	CHECK(a.size() == 2);
+	if (a.size() == 2) {
+		// moved into the window of B, next run due 120 s after start (not after the run), at the end of its window
+		CHECK(a[0] == b[0]);
+		CHECK(a[1] - start == sec2osticks(130));
+	}
+	// a job arriving inside an armed window is set at its fire time
+	ostime_t now = lmic.now();
+	CHECK(node._jobs.schedule(Node::JOB_B, 0, 60000));
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(b.size() == 2 && a.size() == 3 && b[1] == a[2]);
+	CHECK(a.size() == 3 && a[2] - now < sec2osticks(60));
+}
+
+/*
+ * Cancelling or clearing a job which is not pending leaves the count of pending jobs unchanged
+ */
+void testPendingCount() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	node.begin();
+	CHECK(node.pendingJobs() == 0);
+	node._jobs.cancel(Node::JOB_A);
+	node.unsetCallback(&node._jobs[Node::JOB_B]);
+	CHECK(node.pendingJobs() == 0);
+	CHECK(node._jobs.schedule(Node::JOB_A, 1000));
+	CHECK(node._jobs.schedule(Node::JOB_A, 2000));
+	CHECK(node.pendingJobs() == 1);
+	CHECK(node._jobs.schedule(Node::JOB_B, 5000));
+	CHECK(node.pendingJobs() == 2);
+	node._jobs.cancel(Node::JOB_B);
+	node._jobs.cancel(Node::JOB_B);
+	CHECK(node.pendingJobs() == 1 && !node._jobs.isScheduled(Node::JOB_B));
+	CHECK(lmic.run(node, sec2osticks(10)));
+	CHECK(node._runs[Node::JOB_A].size() == 1 && node._runs[Node::JOB_B].empty());
+	CHECK(node.pendingJobs() == 0 && !node._jobs.isScheduled(Node::JOB_A));
+	// already run
+	node._jobs.cancel(Node::JOB_A);
+	node.unsetCallback(&node._jobs[Node::JOB_A]);
+	CHECK(node.pendingJobs() == 0);
+	CHECK(node._jobs.schedulePeriodic(Node::JOB_C, 1000));
+	CHECK(node.pendingJobs() == 1);
+	node._jobs.cancel(Node::JOB_C);
+	CHECK(node.pendingJobs() == 0);
+}
+
+int main() {
+	testPeriodicPhase();
+	testCoalescing();
+	testPendingCount();
+	return report();
+}
@@ -0,0 +1,157 @@
+/*
+ * JsonCodec, JSON and MessagePack: documents of exactly maxPayload bytes are sent without terminating NUL,
+ * longer ones are SEND_PAYLOAD_TOO_LARGE; uplinks and downlinks are decoded back
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <JsonEndnode.h>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+template <JsonWireFormat FORMAT>
+class Node : public BasicJsonEndnode<FORMAT> {
+public:
+	using BasicJsonEndnode<FORMAT>::BasicJsonEndnode;
+
+	int 			_downlinks = 0;
+	JsonDocument 	_downlink;
+
+protected:
+	void downlinkReceived(const JsonDocument & message, const DownstreamMessage & rawMessage) override {
+		_downlinks += 1;
+		_downlink = message;
+	}
+};
+
+/*
+ * { "id": 7, "text": "aaa..." } of len bytes once serialized with FORMAT
+ * The text is shortened while its MessagePack header grows (str8 from 32 characters)
+ */
+template <JsonWireFormat FORMAT>
+JsonDocument document(size_t len) {
+	JsonDocument doc;
+	doc["id"] = 7;
+	doc["text"] = "";
+	std::string text(len - JsonWire<FORMAT>::measure(doc), 'a');
+	doc["text"] = text.c_str();
+	while (JsonWire<FORMAT>::measure(doc) > len) {
+		text.resize(text.size() - (JsonWire<FORMAT>::measure(doc) - len));
+		doc["text"] = text.c_str();
+	}
+	return doc;
+}
+
+template <JsonWireFormat FORMAT>
+bool same(const JsonDocument & a, const JsonDocument & b) {
+	return JsonWire<FORMAT>::measure(a) == JsonWire<FORMAT>::measure(b)
+		&& a["id"].template as<int>() == b["id"].template as<int>()
+		&& strcmp(a["text"].template as<const char *>(), b["text"].template as<const char *>()) == 0;
+}
+
+/*
+ * The writer is bounded by maxPayload: no byte is kept for a NUL
+ */
+template <JsonWireFormat FORMAT>
+void testCodecLimit() {
+	using Codec = JsonCodec<FORMAT>;
+	Message message;
+	CHECK(Codec::encode(document<FORMAT>(20), message, 20) == LMICWrapper::SEND_OK);
+	CHECK(message._len == 20);
+	CHECK(Codec::encode(document<FORMAT>(21), message, 20) == LMICWrapper::SEND_PAYLOAD_TOO_LARGE);
+	CHECK(message._len == 0);
+	CHECK(Codec::encode(document<FORMAT>(MAX_MESSAGE_LEN), message, MAX_MESSAGE_LEN) == LMICWrapper::SEND_OK);
+	CHECK(message._len == MAX_MESSAGE_LEN);
+	JsonDocument decoded;
+	CHECK(Codec::decodeUplink(message._buf, message._len, decoded));
+	CHECK(same<FORMAT>(decoded, document<FORMAT>(MAX_MESSAGE_LEN)));
+}
+
+/*
+ * send() gives maxMessageLen() to the codec: exactly maxMessageLen() bytes are sent, one more byte is refused
+ */
+template <JsonWireFormat FORMAT>
+void testSendLimit() {
+	HostLMIC lmic;
+	Node<FORMAT> node(nullptr);
+	node.begin(id, 0x13, false);
+	uint8_t maxPayload = node.maxMessageLen();
+	CHECK(node.send(document<FORMAT>(maxPayload)));
+	CHECK(!node.send(document<FORMAT>(maxPayload + 1)));
+	CHECK(node.lastSendError() == LMICWrapper::SEND_PAYLOAD_TOO_LARGE);
+	CHECK(lmic.run(node, sec2osticks(600)));
+	CHECK(lmic.frames() == 1 && lmic.lastFrame()._len == maxPayload);
+	JsonDocument sent;
+	CHECK(JsonCodec<FORMAT>::decodeUplink(lmic.lastFrame()._data, lmic.lastFrame()._len, sent));
+	CHECK(same<FORMAT>(sent, document<FORMAT>(maxPayload)));
+}
+
+/*
+ * Answers each uplink with the downlink given as context
+ */
+bool answer(HostLMIC &, const HostFrame & frame, HostReply & reply, void * context) {
+	const Message & downlink = *(const Message *)context;
+	reply._port = 1;
+	reply._data = downlink._buf;
+	reply._len = downlink._len;
+	return true;
+}
+
+/*
+ * Returns the document delivered to the endnode for a downlink of len bytes
+ */
+template <JsonWireFormat FORMAT>
+JsonDocument received(const uint8_t * buf, uint8_t len) {
+	Message downlink;
+	memcpy(downlink._buf, buf, len);
+	downlink._len = len;
+	HostLMIC lmic;
+	lmic.setNetwork(&answer, &downlink);
+	Node<FORMAT> node(nullptr);
+	node.begin(id, 0x13, false);
+	CHECK(node.send(document<FORMAT>(20)));
+	CHECK(lmic.run(node, sec2osticks(600)));
+	CHECK(node._downlinks == 1);
+	return node._downlink;
+}
+
+/*
+ * A downlink is decoded to the document which was encoded, an invalid one is delivered as an empty document
+ */
+template <JsonWireFormat FORMAT>
+void testDownlink() {
+	Message message;
+	CHECK(JsonCodec<FORMAT>::encode(document<FORMAT>(30), message, MAX_MESSAGE_LEN) == LMICWrapper::SEND_OK);
+	CHECK(same<FORMAT>(received<FORMAT>(message._buf, message._len), document<FORMAT>(30)));
+	CHECK(received<FORMAT>(message._buf, message._len - 1).size() == 0);
+}
+
+/*
+ * MessagePack downlinks as sent by the application server, not by JsonWire
+ */
+void testMsgPackDownlink() {
+	// { "id": -100000, "text": "ok" }, id as int32
+	const uint8_t packed[] = { 0x82, 0xA2, 'i', 'd', 0xD2, 0xFF, 0xFE, 0x79, 0x60, 0xA4, 't', 'e', 'x', 't', 0xA2, 'o', 'k' };
+	JsonDocument doc = received<JsonWireFormat::MSGPACK>(packed, sizeof(packed));
+	CHECK(doc.size() == 2);
+	CHECK(doc["id"].as<long>() == -100000);
+	CHECK(strcmp(doc["text"].as<const char *>(), "ok") == 0);
+	// JSON text is not MessagePack
+	const char text[] = "{\"id\":7}";
+	CHECK(received<JsonWireFormat::MSGPACK>((const uint8_t *)text, sizeof(text) - 1).size() == 0);
+	CHECK(received<JsonWireFormat::JSON>((const uint8_t *)text, sizeof(text) - 1)["id"].as<int>() == 7);
+}
+
+int main() {
+	testCodecLimit<JsonWireFormat::JSON>();
+	testSendLimit<JsonWireFormat::JSON>();
+	testDownlink<JsonWireFormat::JSON>();
+	testCodecLimit<JsonWireFormat::MSGPACK>();
+	testSendLimit<JsonWireFormat::MSGPACK>();
+	testDownlink<JsonWireFormat::MSGPACK>();
+	testMsgPackDownlink();
+	return report();
+}
@@ -0,0 +1,322 @@
+/*
+ * LMICWrapper driven by HostLMIC: JOIN, FIFO order, duty cycle, confirmed uplinks, aggregation, downlinks, events
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <chrono>
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	int _joins = 0;
+	int _unjoins = 0;
+	std::vector<uint8_t> _downlink;
+	std::vector<uint8_t> _delivered;	// first byte of the messages completed by isTxCompleted()
+
+	bool sendByte(uint8_t value, bool ack = false, uint8_t priority = 0) {
+		uint8_t buf[] = { value };
+		UpstreamMessage message(buf, 1, ack);
+		message._priority = priority;
+		return send(message);
+	}
+
+	bool sendBytes(uint8_t value, uint8_t len, bool ack = false) {
+		uint8_t buf[MAX_MESSAGE_LEN];
+		memset(buf, value, len);
+		return send(UpstreamMessage(buf, len, ack));
+	}
+
+protected:
+
+	void joined(bool ok) override {
+		(ok ? _joins : _unjoins) += 1;
+	}
+
+	void txOutcome(const UpstreamMessage & message, TxOutcome outcome) override {
+		if (outcome == TX_DELIVERED) {
+			_delivered.push_back(message._buf[0]);
+		}
+	}
+
+	void downlinkReceived(const DownstreamMessage & message) override {
+		_downlink.assign(message._buf, message._buf + message._len);
+		_downlink.insert(_downlink.begin(), message._port);
+	}
+};
+
+/*
+ * Records the frames, acknowledges confirmed uplinks but the first nacks ones
+ */
+struct Network {
+	std::vector<HostFrame> _frames;
+	int _nacks = 0;
+	uint8_t _downlinkPort = 0;
+	uint8_t _downlink[2] = { 0xCA, 0xFE };
+
+	static bool answer(HostLMIC &, const HostFrame & frame, HostReply & reply, void * context) {
+		Network & network = *static_cast<Network *>(context);
+		network._frames.push_back(frame);
+		if (frame._confirmed && network._nacks > 0) {
+			network._nacks -= 1;
+			reply._ack = false;
+		}
+		if (network._downlinkPort > 0) {
+			reply._port = network._downlinkPort;
+			reply._data = network._downlink;
+			reply._len = sizeof(network._downlink);
+			network._downlinkPort = 0;
+		}
+		return true;
+	}
+};
+
+void testJoinAndFifo() {
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	for (uint8_t i = 1; i <= 3; i++) {
+		CHECK(node.sendByte(i));
+	}
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK(node._joins == 1);
+	CHECK(network._frames.size() == 3);
+	for (size_t i = 0; i < network._frames.size(); i++) {
+		CHECK(network._frames[i]._data[0] == i + 1);
+		CHECK(network._frames[i]._fcnt == i);
+	}
+	CHECK(!node.hasMessageToSend());
+	CHECK(node.stats()._frames == 3);
+	CHECK(lmic.radioResets() >= 1);
+}
+
+void testDutyCycle() {
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	LMIC_setDrTxpow(DR_SF12, 14);
+	for (uint8_t i = 1; i <= 3; i++) {
+		node.sendByte(i);
+	}
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK(network._frames.size() == 3);
+	for (size_t i = 1; i < network._frames.size(); i++) {
+		const HostFrame & prev = network._frames[i - 1];
+		ostime_t silence = network._frames[i]._start - prev._end;
+		CHECK(silence >= us2osticks(dutyCycleDebt(prev._airtime)));
+	}
+	CHECK(node.stats()._dutyWait > 0);
+}
+
+void testConfirmedRetry() {
+	HostLMIC lmic;
+	Network network;
+	network._nacks = 2;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	node.sendByte(7, true);
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK(network._frames.size() == 3);
+	CHECK(node.stats()._confirmed == 3);
+	CHECK(node.stats()._acknowledged == 1);
+	CHECK(node.stats()._retransmissions == 2);
+	CHECK(!node.hasMessageToSend());
+}
+
+/*
+ * A confirmed message in backoff does not delay the next message of its class
+ */
+void testBackoffSkipped() {
+	HostLMIC lmic;
+	Network network;
+	network._nacks = 1;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	node.setRetryPolicy(RetryPolicy { 0, RetryPolicy::DROP, 600 });
+	node.sendByte(1, true);
+	node.sendByte(2);
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK(network._frames.size() == 3);
+	if (network._frames.size() == 3) {
+		// 2 sent during the backoff of 1, then 1 again
+		CHECK(network._frames[0]._data[0] == 1 && network._frames[1]._data[0] == 2 && network._frames[2]._data[0] == 1);
+		CHECK(network._frames[1]._start - network._frames[0]._end < sec2osticks(60));
+		CHECK(network._frames[2]._start - network._frames[0]._end >= sec2osticks(600));
+	}
+	CHECK(!node.hasMessageToSend());
+}
+
+/*
+ * Queued messages packed as [len][bytes]... up to the max payload of the data rate (51 bytes at SF12),
+ * the frame confirmed if one of them is; each message completed once
+ */
+void testAggregation() {
+	HostLMIC lmic;
+	Network network;
+	network._nacks = 1;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	LMIC_setDrTxpow(DR_SF12, 14);
+	node.setAggregation(true);
+	for (uint8_t i = 1; i <= 5; i++) {
+		CHECK(node.sendBytes(i, 10, i == 2));
+	}
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	// 1 to 4, not acknowledged: 1 is completed, the frame stops at 2 which is sent again with the next ones
+	CHECK(network._frames.size() == 2);
+	for (size_t f = 0; f < network._frames.size(); f++) {
+		const HostFrame & frame = network._frames[f];
+		CHECK(frame._len == 44 && frame._confirmed);
+		for (uint8_t i = 0; i < 4; i++) {
+			uint8_t value = f + i + 1;
+			CHECK(frame._data[i * 11] == 10 && frame._data[i * 11 + 1] == value && frame._data[i * 11 + 10] == value);
+		}
+	}
+	CHECK((node._delivered == std::vector<uint8_t> { 1, 2, 3, 4, 5 }));
+	CHECK(node.stats()._acknowledged == 1);
+	CHECK(!node.hasMessageToSend());
+}
+
+void testPriority() {
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	node.sendByte(1, false, 0);
+	node.sendByte(2, false, LEUVILLE_LORA_PRIORITY_CLASSES - 1);
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK(network._frames.size() == 2);
+	CHECK(network._frames[0]._data[0] == (LEUVILLE_LORA_PRIORITY_CLASSES > 1 ? 2 : 1));
+}
+
+void testDownlink() {
+	HostLMIC lmic;
+	Network network;
+	network._downlinkPort = 10;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	node.sendByte(1);
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK((node._downlink == std::vector<uint8_t> { 10, 0xCA, 0xFE }));
+}
+
+/*
+ * The network answers later, with completeTx()
+ */
+void testDeferredAnswer() {
+	HostLMIC lmic;
+	lmic.setNetwork([](HostLMIC &, const HostFrame &, HostReply &, void *) { return false; });
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	node.sendByte(1, true);
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(lmic.waitsForNetwork());
+	CHECK(node.isRadioBusy());
+	HostReply reply;
+	reply._ack = true;
+	lmic.completeTx(reply);
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(node.stats()._acknowledged == 1);
+	CHECK(!node.hasMessageToSend());
+}
+
+void testInjectedEvents() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	node.startJoining();
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(node._joins == 1);
+	lmic.inject(EV_LINK_DEAD);
+	CHECK(node._unjoins == 1);
+	CHECK(LMIC.opmode & OP_JOINING);
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(node._joins == 2);
+	CHECK(lmic.events() > 0);
+}
+
+/*
+ * Same inputs, same frames; a simulated day takes much less than a real day
+ */
+std::vector<HostFrame> day() {
+	HostLMIC lmic;
+	lmic.select();
+	Network network;
+	network._nacks = 5;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	for (int minute = 0; minute < 24 * 60; minute += 10) {
+		node.sendByte(minute % 256, minute % 60 == 0);
+		CHECK(lmic.run(node, sec2osticks(600)));
+	}
+	return network._frames;
+}
+
+void testDeterminism() {
+	auto start = std::chrono::steady_clock::now();
+	std::vector<HostFrame> first = day();
+	std::vector<HostFrame> second = day();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	CHECK(first.size() >= 24 * 6);
+	CHECK(first.size() == second.size());
+	for (size_t i = 0; i < first.size() && i < second.size(); i++) {
+		CHECK(first[i]._start == second[i]._start && first[i]._data[0] == second[i]._data[0]);
+	}
+	CHECK(elapsed < std::chrono::seconds(10));
+}
+
+void testBusyLoopDetection() {
+	// a job which sets itself again at once
+	struct Spinner {
+		osjob_t _job;
+		Spinner() {
+			os_setCallback(&_job, &spin);
+		}
+		~Spinner() {
+			os_clearCallback(&_job);
+		}
+		static void spin(osjob_t * job) {
+			os_setCallback(job, &spin);
+		}
+		void runLoopOnce() {
+			os_runloop_once();
+		}
+	};
+	HostLMIC lmic;
+	Spinner spinner;
+	CHECK(!lmic.run(spinner, sec2osticks(1)));
+}
+
+int main() {
+	testJoinAndFifo();
+	testDutyCycle();
+	testConfirmedRetry();
+	testBackoffSkipped();
+	testAggregation();
+	testPriority();
+	testDownlink();
+	testDeferredAnswer();
+	testInjectedEvents();
+	testDeterminism();
+	testBusyLoopDetection();
+	return report();
+}
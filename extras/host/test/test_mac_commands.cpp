@@ -0,0 +1,241 @@
+/*
+ * MAC commands: payload length of each CID, decoded fields, unknown and truncated commands, FOpts of a downlink
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <string>
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+/*
+ * Records each callback as "name:field,field..."
+ */
+class Recorder : public MACCommandCallbacks<Recorder> {
+public:
+	std::vector<std::string> _calls;
+
+	void record(const char * name, std::initializer_list<uint32_t> fields) {
+		std::string call(name);
+		char sep = ':';
+		for (uint32_t field : fields) {
+			call += sep + std::to_string(field);
+			sep = ',';
+		}
+		_calls.push_back(call);
+	}
+
+	void linkCheckAnswered(uint8_t margin, uint8_t gwCount) {
+		record("LinkCheckAns", { margin, gwCount });
+	}
+
+	void linkADRRequested(uint8_t dataRate, uint8_t txPower, uint16_t chMask, uint8_t chMaskCntl, uint8_t nbTrans) {
+		record("LinkADRReq", { dataRate, txPower, chMask, chMaskCntl, nbTrans });
+	}
+
+	void dutyCycleRequested(uint8_t maxDCycle) {
+		record("DutyCycleReq", { maxDCycle });
+	}
+
+	void rxParamSetupRequested(uint8_t rx1DrOffset, uint8_t rx2DataRate, uint32_t frequency) {
+		record("RXParamSetupReq", { rx1DrOffset, rx2DataRate, frequency });
+	}
+
+	void devStatusRequested() {
+		record("DevStatusReq", { });
+	}
+
+	void newChannelRequested(uint8_t chIndex, uint32_t frequency, uint8_t minDr, uint8_t maxDr) {
+		record("NewChannelReq", { chIndex, frequency, minDr, maxDr });
+	}
+
+	void rxTimingSetupRequested(uint8_t delay) {
+		record("RXTimingSetupReq", { delay });
+	}
+
+	void txParamSetupRequested(bool downlinkDwellTime, bool uplinkDwellTime, uint8_t maxEIRP) {
+		record("TxParamSetupReq", { downlinkDwellTime, uplinkDwellTime, maxEIRP });
+	}
+
+	void dlChannelRequested(uint8_t chIndex, uint32_t frequency) {
+		record("DlChannelReq", { chIndex, frequency });
+	}
+
+	void deviceTimeAnswered(uint32_t seconds, uint8_t fraction) {
+		record("DeviceTimeAns", { seconds, fraction });
+	}
+
+	void pingSlotInfoAnswered() {
+		record("PingSlotInfoAns", { });
+	}
+
+	void pingSlotChannelRequested(uint32_t frequency, uint8_t dataRate) {
+		record("PingSlotChannelReq", { frequency, dataRate });
+	}
+
+	void beaconTimingAnswered(uint16_t delay, uint8_t channel) {
+		record("BeaconTimingAns", { delay, channel });
+	}
+
+	void beaconFreqRequested(uint32_t frequency) {
+		record("BeaconFreqReq", { frequency });
+	}
+};
+
+/*
+ * Payload lengths of LoRaWAN 1.0.4 and Class B, RFU CIDs unknown
+ */
+void testLengths() {
+	const uint8_t expected[][2] = {
+		{ 0x02, 2 }, { 0x03, 4 }, { 0x04, 1 }, { 0x05, 4 }, { 0x06, 0 }, { 0x07, 5 }, { 0x08, 1 },
+		{ 0x09, 1 }, { 0x0A, 4 }, { 0x0D, 5 }, { 0x10, 0 }, { 0x11, 4 }, { 0x12, 3 }, { 0x13, 3 }
+	};
+	int known = 0;
+	for (uint16_t cid = 0; cid <= 0xFF; cid++) {
+		uint8_t len = MAC_UNKNOWN;
+		for (const uint8_t * entry : expected) {
+			len = (entry[0] == cid ? entry[1] : len);
+		}
+		CHECK(macCommandLen(cid) == len);
+		known += (len != MAC_UNKNOWN ? 1 : 0);
+	}
+	CHECK(known == 14);
+	CHECK(strcmp(reinterpret_cast<const char *>(macCommandName(MAC_LINK_CHECK_ANS)), "LinkCheckAns") == 0);
+	CHECK(strcmp(reinterpret_cast<const char *>(macCommandName(MAC_DL_CHANNEL_REQ)), "DlChannelReq") == 0);
+	CHECK(strcmp(reinterpret_cast<const char *>(macCommandName(MAC_DEVICE_TIME_ANS)), "DeviceTimeAns") == 0);
+	CHECK(strcmp(reinterpret_cast<const char *>(macCommandName(MAC_BEACON_FREQ_REQ)), "BeaconFreqReq") == 0);
+	CHECK(strcmp(reinterpret_cast<const char *>(macCommandName(0x0B)), "Unknown") == 0);
+}
+
+/*
+ * Fields of every command, little-endian, frequencies in Hz
+ */
+void testFields() {
+	const uint8_t data[] = {
+		0x02, 20, 3,
+		0x03, 0x52, 0x07, 0x01, 0x23,
+		0x04, 0xF7,
+		0x05, 0x23, 0xD2, 0xAD, 0x84,				// 869.525 MHz
+		0x06,
+		0x07, 3, 0xC8, 0x85, 0x84, 0x50,			// 868.5 MHz
+		0x08, 0x00,
+		0x09, 0x3D,
+		0x0A, 4, 0xF8, 0x7D, 0x84,					// 868.3 MHz
+		0x0D, 0x78, 0x56, 0x34, 0x12, 0x80,
+		0x10,
+		0x11, 0xF8, 0x7D, 0x84, 0xF3,
+		0x12, 0x34, 0x12, 7,
+		0x13, 0xC8, 0x85, 0x84
+	};
+	Recorder recorder;
+	CHECK(recorder.dispatchMACCommands(data, sizeof(data)));
+	const std::vector<std::string> expected = {
+		"LinkCheckAns:20,3",
+		"LinkADRReq:5,2,263,2,3",
+		"DutyCycleReq:7",
+		"RXParamSetupReq:2,3,869525000",
+		"DevStatusReq",
+		"NewChannelReq:3,868500000,0,5",
+		"RXTimingSetupReq:1",
+		"TxParamSetupReq:1,1,13",
+		"DlChannelReq:4,868300000",
+		"DeviceTimeAns:305419896,128",
+		"PingSlotInfoAns",
+		"PingSlotChannelReq:868300000,3",
+		"BeaconTimingAns:4660,7",
+		"BeaconFreqReq:868500000"
+	};
+	CHECK(recorder._calls == expected);
+}
+
+/*
+ * Parsing stops before a truncated or unknown command: the commands before it are dispatched
+ */
+void testTruncated() {
+	const uint8_t data[] = { 0x06, 0x02, 20, 3, 0x03, 0x52, 0x07, 0x01 };
+	for (uint8_t len = 0; len <= sizeof(data); len++) {
+		Recorder recorder;
+		bool complete = recorder.dispatchMACCommands(data, len);
+		CHECK(complete == (len == 0 || len == 1 || len == 4));
+		CHECK(recorder._calls.size() == (len == 0 ? 0 : len < 4 ? 1 : 2));
+	}
+	const uint8_t unknown[] = { 0x06, 0x80, 0x06 };
+	Recorder recorder;
+	CHECK(!recorder.dispatchMACCommands(unknown, sizeof(unknown)));
+	CHECK(recorder._calls == std::vector<std::string> { "DevStatusReq" });
+	int visits = 0;
+	CHECK(!forEachMACCommand(data, 7, [&visits](uint8_t, const uint8_t *, uint8_t) { visits += 1; }));
+	CHECK(visits == 2);
+}
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	uint8_t _margin = 0;
+	uint8_t _gwCount = 0;
+	int _devStatus = 0;
+
+	void linkCheckAnswered(uint8_t margin, uint8_t gwCount) override {
+		_margin = margin;
+		_gwCount = gwCount;
+	}
+
+	void devStatusRequested() override {
+		_devStatus += 1;
+	}
+};
+
+/*
+ * Each frame is answered with the FOpts of the network
+ */
+struct Network {
+	const uint8_t * _fopts = nullptr;
+	uint8_t _foptsLen = 0;
+
+	static bool answer(HostLMIC &, const HostFrame &, HostReply & reply, void * context) {
+		Network & network = *static_cast<Network *>(context);
+		reply._fopts = network._fopts;
+		reply._foptsLen = network._foptsLen;
+		return true;
+	}
+};
+
+/*
+ * MAC commands of the FOpts of a downlink reach the MACCommandHandler callbacks of LMICWrapper
+ * A truncated FOpts dispatches the complete commands only.
+ */
+void testDownlinkFOpts() {
+	HostLMIC lmic;
+	Network network;
+	const uint8_t fopts[] = { MAC_DEV_STATUS_REQ, MAC_LINK_CHECK_ANS, 12, 2 };
+	network._fopts = fopts;
+	network._foptsLen = sizeof(fopts);
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	uint8_t buf[] = { 1 };
+	node.send(UpstreamMessage(buf, 1));
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(node._devStatus == 1 && node._margin == 12 && node._gwCount == 2);
+	const uint8_t truncated[] = { MAC_DEV_STATUS_REQ, MAC_LINK_CHECK_ANS, 30 };
+	network._fopts = truncated;
+	network._foptsLen = sizeof(truncated);
+	node.send(UpstreamMessage(buf, 1));
+	CHECK(lmic.run(node, sec2osticks(300)));
+	CHECK(node._devStatus == 2 && node._margin == 12 && node._gwCount == 2);
+}
+
+int main() {
+	testLengths();
+	testFields();
+	testTruncated();
+	testDownlinkFOpts();
+	return report();
+}
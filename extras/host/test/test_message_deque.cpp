@@ -0,0 +1,99 @@
+/*
+ * MessageDeque: items built in the staging item shared by the classes of a PriorityDeque
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+using Deque = MessageDeque<UpstreamMessage, 3>;
+
+UpstreamMessage message(uint8_t value) {
+	uint8_t buf[] = { value };
+	return UpstreamMessage(buf, 1);
+}
+
+/*
+ * No spare slot: SIZ items, the staging item is shared
+ */
+void testFootprint() {
+	CHECK(sizeof(Deque) < 4 * sizeof(UpstreamMessage));
+	CHECK(sizeof(PriorityDeque<Deque, 3>) <= 3 * sizeof(Deque) + sizeof(UpstreamMessage));
+	Deque alone;
+	CHECK(alone.reserve_front() == nullptr && !alone.commit_front() && alone.empty());
+}
+
+/*
+ * commit_front() stores the reserved item; without commit_front(), the items are untouched
+ */
+void testReserveCommit() {
+	PriorityDeque<Deque, 2> queues(Deque::KEEP_FRONT);
+	CHECK(queues[0].reserve_front() == queues[1].reserve_front());
+	*queues[1].reserve_front() = message(1);
+	CHECK(queues[1].commit_front());
+	*queues[0].reserve_front() = message(2);
+	CHECK(queues[0].commit_front());
+	CHECK(queues[1].size() == 1 && queues[1].backPtr()->_buf[0] == 1);
+	CHECK(queues[0].size() == 1 && queues[0].backPtr()->_buf[0] == 2);
+	// reserved, not committed
+	*queues[1].reserve_front() = message(3);
+	CHECK(queues[1].size() == 1 && queues[1].backPtr()->_buf[0] == 1);
+	CHECK(queues.size() == 2);
+}
+
+/*
+ * A full deque: KEEP_FRONT evicts the back item at commit_front(), KEEP_BACK rejects the item
+ */
+void testFull() {
+	PriorityDeque<Deque, 2> queues(Deque::KEEP_FRONT);
+	queues[1].setPolicy(Deque::KEEP_BACK);
+	for (uint8_t i = 0; i < 3; i++) {
+		CHECK(queues[0].push_front(message(i)));
+		CHECK(queues[1].push_front(message(i)));
+	}
+	*queues[0].reserve_front() = message(3);
+	CHECK(queues[0].size() == 3 && queues[0].backPtr()->_buf[0] == 0);
+	CHECK(queues[0].commit_front());
+	CHECK(queues[0].size() == 3 && queues[0].backPtr()->_buf[0] == 1 && queues[0].frontPtr()->_buf[0] == 3);
+	*queues[1].reserve_front() = message(3);
+	CHECK(!queues[1].commit_front());
+	CHECK(queues[1].size() == 3 && queues[1].backPtr()->_buf[0] == 0 && queues[1].frontPtr()->_buf[0] == 2);
+	// wrap around the ring
+	for (uint8_t i = 4; i < 10; i++) {
+		*queues[0].reserve_front() = message(i);
+		CHECK(queues[0].commit_front());
+	}
+	for (uint8_t pos = 0; pos < 3; pos++) {
+		CHECK(queues[0].backPtr(pos)->_buf[0] == 7 + pos);
+	}
+}
+
+/*
+ * size() counts up to CLASSES * 255 items, empty() checks each class
+ */
+void testSize() {
+	static PriorityDeque<MessageDeque<UpstreamMessage, 200>, 2> queues;
+	CHECK(queues.empty() && queues.size() == 0);
+	for (uint8_t i = 0; i < 200; i++) {
+		CHECK(queues[0].push_front(message(i)));
+		CHECK(queues[1].push_front(message(i)));
+	}
+	CHECK(!queues.empty() && queues.size() == 400);
+	while (queues[0].pop_back()) {
+	}
+	CHECK(!queues.empty() && queues.size() == 200);
+	while (queues[1].pop_back()) {
+	}
+	CHECK(queues.empty());
+}
+
+int main() {
+	testFootprint();
+	testReserveCommit();
+	testFull();
+	testSize();
+	return report();
+}
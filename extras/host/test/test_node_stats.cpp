@@ -0,0 +1,117 @@
+/*
+ * NodeStats: serialize() / deserialize() round trip, image sent by sendStats()
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+bool same(const NodeStats & a, const NodeStats & b) {
+	bool equal = a._maxDepth == b._maxDepth && a._dropsRecent == b._dropsRecent && a._dropsOld == b._dropsOld
+		&& a._dropsAirtime == b._dropsAirtime && a._frames == b._frames && a._retransmissions == b._retransmissions
+		&& a._confirmed == b._confirmed && a._acknowledged == b._acknowledged && a._dropsRetry == b._dropsRetry
+		&& a._logErrors == b._logErrors && a._rejected == b._rejected && a._dutyWait == b._dutyWait;
+	for (uint8_t i = 0; i < NodeStats::TX_ERRORS; i++) {
+		equal = equal && a._txErrors[i] == b._txErrors[i];
+	}
+	for (uint8_t i = 0; i < LEUVILLE_LORA_LATENCY_BUCKETS; i++) {
+		equal = equal && a._latency[i] == b._latency[i];
+	}
+	return equal;
+}
+
+/*
+ * Every counter gets a distinct value, with both bytes (and all 4 bytes of _dutyWait) set
+ */
+NodeStats filled() {
+	NodeStats stats;
+	uint16_t value = 0x0102;
+	stats._maxDepth = 0xA5;
+	for (uint16_t * counter : { &stats._dropsRecent, &stats._dropsOld, &stats._dropsAirtime, &stats._frames, &stats._retransmissions,
+			&stats._confirmed, &stats._acknowledged, &stats._dropsRetry, &stats._logErrors, &stats._rejected }) {
+		*counter = (value += 0x1111);
+	}
+	for (uint16_t & counter : stats._txErrors) {
+		counter = (value += 0x1111);
+	}
+	stats._dutyWait = 0xF1E2D3C4;
+	for (uint16_t & counter : stats._latency) {
+		counter = (value += 0x1111);
+	}
+	return stats;
+}
+
+void testRoundTrip() {
+	NodeStats stats = filled();
+	uint8_t buf[NodeStats::SIZE + 4];
+	CHECK(stats.serialize(buf, sizeof(buf)) == NodeStats::SIZE);
+	CHECK(buf[0] == NodeStats::VERSION && buf[1] == LEUVILLE_LORA_LATENCY_BUCKETS && buf[2] == 0xA5);
+	// little-endian
+	CHECK(buf[3] == 0x13 && buf[4] == 0x12);
+	NodeStats decoded;
+	CHECK(!same(stats, decoded));
+	CHECK(decoded.deserialize(buf, NodeStats::SIZE));
+	CHECK(same(stats, decoded));
+	// what the image holds is what was counted
+	uint8_t again[NodeStats::SIZE];
+	CHECK(decoded.serialize(again, sizeof(again)) == NodeStats::SIZE && memcmp(buf, again, sizeof(again)) == 0);
+}
+
+/*
+ * A buffer too small, an image truncated or of another layout
+ */
+void testRejected() {
+	NodeStats stats = filled();
+	uint8_t buf[NodeStats::SIZE];
+	CHECK(stats.serialize(buf, NodeStats::SIZE - 1) == 0);
+	CHECK(stats.serialize(buf, sizeof(buf)) == NodeStats::SIZE);
+	NodeStats decoded;
+	CHECK(!decoded.deserialize(buf, NodeStats::SIZE - 1));
+	buf[0] = NodeStats::VERSION + 1;
+	CHECK(!decoded.deserialize(buf, sizeof(buf)));
+	buf[0] = NodeStats::VERSION;
+	buf[1] = LEUVILLE_LORA_LATENCY_BUCKETS + 1;
+	CHECK(!decoded.deserialize(buf, sizeof(buf)));
+	CHECK(same(decoded, NodeStats()));
+}
+
+/*
+ * The frame of sendStats() holds the counters at the time of the call, at SF12 too
+ */
+void testSendStats() {
+	HostLMIC lmic;
+	std::vector<HostFrame> frames;
+	lmic.setNetwork([](HostLMIC &, const HostFrame & frame, HostReply &, void * context) {
+		static_cast<std::vector<HostFrame> *>(context)->push_back(frame);
+		return true;
+	}, &frames);
+	LMICWrapper node(nullptr);
+	node.begin(id, 0x13, false);
+	uint8_t buf[] = { 1, 2, 3 };
+	node.send(UpstreamMessage(buf, sizeof(buf), true));
+	CHECK(lmic.run(node, sec2osticks(60)));
+	NodeStats expected = node.stats();
+	// the image fits the smallest EU868 payload
+	LMIC_setDrTxpow(DR_SF12, 14);
+	CHECK(node.sendStats());
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(frames.size() == 2 && frames[1]._dr == DR_SF12);
+	NodeStats received;
+	CHECK(frames.size() == 2 && frames[1]._len == NodeStats::SIZE && received.deserialize(frames[1]._data, frames[1]._len));
+	CHECK(same(received, expected));
+	CHECK(received._frames == 1 && received._confirmed == 1 && received._acknowledged == 1);
+}
+
+int main() {
+	testRoundTrip();
+	testRejected();
+	testSendStats();
+	return report();
+}
@@ -0,0 +1,160 @@
+/*
+ * PayloadStage in LMICWrapper: DeltaStage / DeltaDecoder round trip, airtime deferral, unsendable messages
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+using Payload = std::vector<uint8_t>;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	std::vector<TxOutcome> _outcomes;
+
+	bool sendPayload(const Payload & payload, bool ack = false) {
+		UpstreamMessage message((uint8_t *)payload.data(), payload.size(), ack);
+		return send(message);
+	}
+
+protected:
+
+	void txOutcome(const UpstreamMessage &, TxOutcome outcome) override {
+		_outcomes.push_back(outcome);
+	}
+};
+
+/*
+ * Decodes the DeltaStage frames (split first if aggregated), acknowledges confirmed uplinks
+ */
+struct Network {
+	DeltaDecoder _decoder;
+	bool _aggregated = false;
+	std::vector<Payload> _payloads;
+	std::vector<uint8_t> _seqs;
+	int _errors = 0;
+
+	void decode(const uint8_t * data, uint8_t len) {
+		uint8_t out[UINT8_MAX];
+		uint8_t outLen;
+		if (!_decoder.decode(data, len, out, outLen)) {
+			_errors += 1;
+			return;
+		}
+		_seqs.push_back(data[0] & 0x7F);
+		_payloads.emplace_back(out, out + outLen);
+	}
+
+	static bool answer(HostLMIC &, const HostFrame & frame, HostReply &, void * context) {
+		Network & network = *static_cast<Network *>(context);
+		if (!network._aggregated) {
+			network.decode(frame._data, frame._len);
+			return true;
+		}
+		for (uint8_t pos = 0; pos < frame._len; pos += 1 + frame._data[pos]) {
+			network.decode(&frame._data[pos + 1], frame._data[pos]);
+		}
+		return true;
+	}
+};
+
+/*
+ * Slowly changing sensor readings
+ */
+Payload reading(int i) {
+	return Payload { 0x01, (uint8_t)(20 + i / 8), 0x02, (uint8_t)(60 - i / 5), 0x03, 0x10, (uint8_t)(i / 3), 0x04, 0x00, 0x2A };
+}
+
+void roundTrip(bool aggregated) {
+	HostLMIC lmic;
+	Network network;
+	network._aggregated = aggregated;
+	lmic.setNetwork(&Network::answer, &network);
+	DeltaStage stage;
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	node.setPayloadStage(&stage);
+	node.setAggregation(aggregated);
+	std::vector<Payload> sent;
+	for (int i = 0; i < 60; i++) {
+		sent.push_back(reading(i));
+		node.sendPayload(sent.back(), i % 4 == 0);
+		CHECK(lmic.run(node, sec2osticks(aggregated ? 5 : 120)));
+	}
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK(network._errors == 0);
+	CHECK(node.stats()._dropsRecent == 0 && node._outcomes.size() == sent.size());
+	CHECK(aggregated ? lmic.frames() < sent.size() : lmic.frames() == sent.size());
+	CHECK(network._payloads == sent);
+	for (size_t i = 1; i < network._seqs.size(); i++) {
+		CHECK(network._seqs[i] == ((network._seqs[i - 1] + 1) & 0x7F));
+	}
+}
+
+/*
+ * Frames deferred by the airtime budget do not consume sequence numbers
+ */
+void testAirtimeDeferral() {
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	DeltaStage stage;
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	node.setPayloadStage(&stage);
+	node.setAirtimePolicy(Node::AIRTIME_DEFER, 100000);	// 100 ms per hour
+	std::vector<Payload> sent;
+	for (int i = 0; i < 6; i++) {
+		sent.push_back(reading(i));
+		node.sendPayload(sent.back());
+	}
+	CHECK(lmic.run(node, sec2osticks(4 * 3600)));
+	CHECK(network._payloads == sent);
+	CHECK((network._seqs == std::vector<uint8_t> { 0, 1, 2, 3, 4, 5 }));
+}
+
+/*
+ * A message too large for the data rate is dropped, the next ones are sent
+ */
+void testUnsendable(bool withStage) {
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(withStage ? &Network::answer : nullptr, &network);
+	DeltaStage stage;
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	LMIC_setDrTxpow(DR_SF12, 14);
+	if (withStage) {
+		node.setPayloadStage(&stage);
+	}
+	Payload large(withStage ? maxPayloadLen(DR_SF12) : MAX_MESSAGE_LEN, 0x55);
+	node.sendPayload(large);
+	node.sendPayload(reading(0));
+	CHECK(lmic.run(node, sec2osticks(600)));
+	CHECK((node._outcomes == std::vector<Node::TxOutcome> { Node::TX_REJECTED, Node::TX_DELIVERED }));
+	CHECK(lmic.frames() == 1);
+	CHECK(!node.hasMessageToSend());
+	CHECK(node.stats()._txErrors[-LMIC_ERROR_TX_TOO_LARGE - 1] == 1);
+	if (withStage) {
+		CHECK((network._payloads == std::vector<Payload> { reading(0) }));
+		CHECK(network._seqs == std::vector<uint8_t> { 0 });
+	}
+}
+
+int main() {
+	roundTrip(false);
+	roundTrip(true);
+	testAirtimeDeferral();
+	testUnsendable(true);
+	testUnsendable(false);
+	return report();
+}
@@ -0,0 +1,93 @@
+/*
+ * PortDispatcher: a downlink is decoded by the codec of its FPort only, unbound FPorts fall through
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <GenericEndnode.h>
+#include <PortDispatch.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+/*
+ * RawCodec which counts its decoded downlinks, one counter per ID
+ */
+template <int ID>
+struct CountingCodec : RawCodec {
+
+	static int & decoded() {
+		static int count = 0;
+		return count;
+	}
+
+	static bool decodeDownlink(const uint8_t * buf, uint8_t len, RawPayload & dest) {
+		decoded() += 1;
+		return RawCodec::decodeDownlink(buf, len, dest);
+	}
+};
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	std::vector<int> _calls;	// handler of each downlink: FPort, or -port if not bound
+
+	bool sendByte(uint8_t value) {
+		uint8_t buf[] = { value };
+		return send(UpstreamMessage(buf, 1));
+	}
+
+protected:
+
+	void configReceived(const RawPayload & payload, const DownstreamMessage & message) {
+		_calls.push_back(10);
+	}
+
+	void commandReceived(const RawPayload & payload, const DownstreamMessage & message) {
+		_calls.push_back(payload._len == 2 ? 11 : 0);
+	}
+
+	void downlinkReceived(const DownstreamMessage & message) override {
+		using Ports = PortDispatcher<
+			OnPort<10, CountingCodec<10>, Node, &Node::configReceived>,
+			OnPort<11, CountingCodec<11>, Node, &Node::commandReceived>
+		>;
+		if (!Ports::dispatch(*this, message)) {
+			_calls.push_back(-message._port);
+		}
+	}
+};
+
+static_assert(distinctPorts(10, 11, 12), "");
+static_assert(!distinctPorts(10, 11, 10), "");
+
+/*
+ * Answers each uplink with a downlink on the FPort given by its payload
+ */
+bool answer(HostLMIC &, const HostFrame & frame, HostReply & reply, void *) {
+	static const uint8_t payload[] = { 0xCA, 0xFE };
+	reply._port = frame._data[0];
+	reply._data = payload;
+	reply._len = sizeof(payload);
+	return true;
+}
+
+int main() {
+	HostLMIC lmic;
+	lmic.setNetwork(&answer);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	for (uint8_t port : { 11, 12, 10, 11 }) {
+		CHECK(node.sendByte(port));
+		CHECK(lmic.run(node, sec2osticks(600)));
+	}
+	CHECK((node._calls == std::vector<int> { 11, -12, 10, 11 }));
+	CHECK(CountingCodec<10>::decoded() == 1);
+	CHECK(CountingCodec<11>::decoded() == 2);
+	return report();
+}
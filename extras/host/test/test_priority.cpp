@@ -0,0 +1,143 @@
+/*
+ * Priority classes: alarms overtake queued telemetry, overflow policy of each class, backoff across classes
+ */
+
+#define LEUVILLE_LORA_PRIORITY_CLASSES 3
+#define LEUVILLE_LORA_QUEUE_LEN 3
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	bool sendByte(uint8_t value, uint8_t priority, bool ack = false) {
+		uint8_t buf[] = { value };
+		UpstreamMessage message(buf, 1, ack);
+		message._priority = priority;
+		return send(message);
+	}
+};
+
+/*
+ * Records the frames, the first nacks confirmed uplinks are not acknowledged
+ */
+struct Network {
+	std::vector<HostFrame> _frames;
+	int _nacks = 0;
+
+	static bool answer(HostLMIC &, const HostFrame & frame, HostReply & reply, void * context) {
+		Network & network = *static_cast<Network *>(context);
+		network._frames.push_back(frame);
+		if (frame._confirmed && network._nacks > 0) {
+			network._nacks -= 1;
+			reply._ack = false;
+		}
+		return true;
+	}
+
+	std::vector<uint8_t> payloads() const {
+		std::vector<uint8_t> values;
+		for (const HostFrame & frame : _frames) {
+			values.push_back(frame._data[0]);
+		}
+		return values;
+	}
+};
+
+/*
+ * An alarm queued while telemetry waits for the duty cycle is the next frame
+ */
+void testAlarmOvertakes() {
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	LMIC_setDrTxpow(DR_SF12, 14);
+	for (uint8_t i = 1; i <= 3; i++) {
+		CHECK(node.sendByte(i, Node::PRIORITY_NORMAL));
+	}
+	CHECK(lmic.run(node, sec2osticks(30)));
+	CHECK(network._frames.size() == 1);
+	CHECK(node.sendByte(0xA1, Node::PRIORITY_ALARM));
+	// above the highest class: alarm too
+	CHECK(node.sendByte(0xA2, 7));
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK((network.payloads() == std::vector<uint8_t> { 1, 0xA1, 0xA2, 2, 3 }));
+	CHECK(!node.hasMessageToSend());
+}
+
+/*
+ * A full KEEP_RECENT class drops its oldest message, a full KEEP_OLD class rejects the new one,
+ * each without touching the other classes
+ */
+void testOverflowPerClass() {
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.setOverflowPolicy(Node::PRIORITY_ALARM, Node::KEEP_OLD);
+	node.begin(id, 0x13, false);
+	for (uint8_t i = 1; i <= 4; i++) {
+		CHECK(node.sendByte(i, Node::PRIORITY_NORMAL));
+	}
+	CHECK(node.stats()._dropsRecent == 1);
+	for (uint8_t i = 1; i <= 3; i++) {
+		CHECK(node.sendByte(0xA0 + i, Node::PRIORITY_ALARM));
+	}
+	CHECK(!node.sendByte(0xA4, Node::PRIORITY_ALARM));
+	CHECK(node.lastSendError() == Node::SEND_QUEUE_FULL);
+	CHECK(node.reserve(false, 1, Node::PRIORITY_ALARM) == nullptr);
+	CHECK(node.stats()._dropsOld == 2);
+	// the middle class is still empty
+	UpstreamMessage * high = node.reserve(false, 1, Node::PRIORITY_HIGH);
+	CHECK(high != nullptr);
+	if (high != nullptr) {
+		high->_buf[0] = 0xB1;
+		high->_len = 1;
+		CHECK(node.commit());
+	}
+	CHECK(node.stats()._dropsRecent == 1);
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK((network.payloads() == std::vector<uint8_t> { 0xA1, 0xA2, 0xA3, 0xB1, 2, 3, 4 }));
+}
+
+/*
+ * An alarm in backoff lets the telemetry go, then is sent again
+ */
+void testBackoffAcrossClasses() {
+	HostLMIC lmic;
+	Network network;
+	network._nacks = 1;
+	lmic.setNetwork(&Network::answer, &network);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	node.setRetryPolicy(RetryPolicy { 0, RetryPolicy::DROP, 600 });
+	node.sendByte(0xA1, Node::PRIORITY_ALARM, true);
+	node.sendByte(1, Node::PRIORITY_NORMAL);
+	node.sendByte(2, Node::PRIORITY_NORMAL);
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK((network.payloads() == std::vector<uint8_t> { 0xA1, 1, 2, 0xA1 }));
+	if (network._frames.size() == 4) {
+		CHECK(network._frames[2]._start - network._frames[0]._end < sec2osticks(600));
+		CHECK(network._frames[3]._start - network._frames[0]._end >= sec2osticks(600));
+	}
+	CHECK(!node.hasMessageToSend());
+}
+
+int main() {
+	testAlarmOvertakes();
+	testOverflowPerClass();
+	testBackoffAcrossClasses();
+	return report();
+}
@@ -0,0 +1,169 @@
+/*
+ * ProtobufCodec: messages of exactly maxPayload bytes are sent, longer ones are SEND_PAYLOAD_TOO_LARGE,
+ * other nanopb errors are SEND_ENCODING_FAILED; uplinks and downlinks are decoded back
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <ProtobufEndnode.h>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+/*
+ * As generated by nanopb for
+ * 		message Sample { uint32 id = 1; bytes data = 2 [(nanopb).max_size = 60]; }
+ */
+typedef struct {
+	pb_size_t size;
+	pb_byte_t bytes[60];
+} Sample_data_t;
+
+typedef struct {
+	uint32_t 		id;
+	Sample_data_t 	data;
+} Sample;
+
+bool encodeSample(pb_ostream_t * stream, const void * src) {
+	const Sample & sample = *(const Sample *)src;
+	if (sample.data.size > sizeof(sample.data.bytes)) {
+		PB_RETURN_ERROR(stream, "bytes size exceeded");
+	}
+	return (sample.id == 0 || (pb_encode_tag(stream, PB_WT_VARINT, 1) && pb_encode_varint(stream, sample.id)))
+		&& (sample.data.size == 0 || (pb_encode_tag(stream, PB_WT_STRING, 2) && pb_encode_string(stream, sample.data.bytes, sample.data.size)));
+}
+
+bool decodeSample(pb_istream_t * stream, void * dest) {
+	Sample & sample = *(Sample *)dest;
+	sample = Sample {};
+	pb_wire_type_t type;
+	uint32_t tag;
+	bool eof;
+	while (pb_decode_tag(stream, &type, &tag, &eof)) {
+		uint64_t value;
+		if (!pb_decode_varint(stream, &value)) {
+			return false;
+		}
+		if (tag == 1 && type == PB_WT_VARINT) {
+			sample.id = (uint32_t)value;
+		} else if (tag == 2 && type == PB_WT_STRING) {
+			if (value > sizeof(sample.data.bytes)) {
+				PB_RETURN_ERROR(stream, "bytes overflow");
+			}
+			sample.data.size = (pb_size_t)value;
+			if (!pb_read(stream, sample.data.bytes, sample.data.size)) {
+				return false;
+			}
+		} else {
+			PB_RETURN_ERROR(stream, "invalid wire_type");
+		}
+	}
+	return eof;
+}
+
+extern const pb_msgdesc_t Sample_msg;
+const pb_msgdesc_t Sample_msg = { &encodeSample, &decodeSample };
+
+using Codec = ProtobufCodec<Sample, &Sample_msg, Sample, &Sample_msg>;
+
+class Node : public ProtobufEndnode<Sample, &Sample_msg, Sample, &Sample_msg> {
+public:
+	using ProtobufEndnode::ProtobufEndnode;
+
+	int 	_downlinks = 0;
+	Sample 	_downlink {};
+
+protected:
+	void downlinkReceived(const Sample & message, const DownstreamMessage & rawMessage) override {
+		_downlinks += 1;
+		_downlink = message;
+	}
+};
+
+/*
+ * id 1 and len bytes of data: 4 + len bytes encoded
+ */
+Sample sample(uint8_t len) {
+	Sample s {};
+	s.id = 1;
+	s.data.size = len;
+	for (uint8_t i = 0; i < len && i < sizeof(s.data.bytes); i++) {
+		s.data.bytes[i] = i;
+	}
+	return s;
+}
+
+bool same(const Sample & a, const Sample & b) {
+	return a.id == b.id && a.data.size == b.data.size && memcmp(a.data.bytes, b.data.bytes, a.data.size) == 0;
+}
+
+/*
+ * The stream is bounded by maxPayload, its overflow is the only SEND_PAYLOAD_TOO_LARGE
+ */
+void testCodecLimit() {
+	Message message;
+	CHECK(Codec::encode(sample(16), message, 20) == LMICWrapper::SEND_OK);
+	CHECK(message._len == 20);
+	CHECK(Codec::encode(sample(17), message, 20) == LMICWrapper::SEND_PAYLOAD_TOO_LARGE);
+	CHECK(message._len == 0);
+	Sample invalid = sample(16);
+	invalid.data.size = 61;
+	CHECK(Codec::encode(invalid, message, 20) == LMICWrapper::SEND_ENCODING_FAILED);
+	CHECK(Codec::encode(invalid, message, MAX_MESSAGE_LEN) == LMICWrapper::SEND_ENCODING_FAILED);
+}
+
+/*
+ * send() gives maxMessageLen() to the codec: exactly maxMessageLen() bytes are sent, one more byte is refused
+ */
+void testSendLimit() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	uint8_t maxPayload = node.maxMessageLen();
+	CHECK(node.send(sample(maxPayload - 4)));
+	CHECK(!node.send(sample(maxPayload - 3)));
+	CHECK(node.lastSendError() == LMICWrapper::SEND_PAYLOAD_TOO_LARGE);
+	CHECK(lmic.run(node, sec2osticks(600)));
+	CHECK(lmic.frames() == 1 && lmic.lastFrame()._len == maxPayload);
+	Sample sent;
+	CHECK(Codec::decodeUplink(lmic.lastFrame()._data, lmic.lastFrame()._len, sent));
+	CHECK(same(sent, sample(maxPayload - 4)));
+}
+
+/*
+ * Answers each uplink with a Sample downlink
+ */
+bool answer(HostLMIC &, const HostFrame & frame, HostReply & reply, void *) {
+	static Message downlink;
+	Codec::encode(sample(8), downlink, MAX_MESSAGE_LEN);
+	reply._port = 1;
+	reply._data = downlink._buf;
+	reply._len = downlink._len;
+	return true;
+}
+
+/*
+ * A downlink is decoded to the Sample which was encoded, an invalid one is not delivered
+ */
+void testDownlink() {
+	HostLMIC lmic;
+	lmic.setNetwork(&answer);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	CHECK(node.send(sample(2)));
+	CHECK(lmic.run(node, sec2osticks(600)));
+	CHECK(node._downlinks == 1);
+	CHECK(same(node._downlink, sample(8)));
+	const uint8_t truncated[] = { 0x08, 0x01, 0x12, 0x08, 0x00 };
+	Sample decoded;
+	CHECK(!Codec::decodeDownlink(truncated, sizeof(truncated), decoded));
+}
+
+int main() {
+	testCodecLimit();
+	testSendLimit();
+	testDownlink();
+	return report();
+}
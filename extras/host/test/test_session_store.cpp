@@ -0,0 +1,204 @@
+/*
+ * StorageSessionStore with FileStorage: session resumed after a reset, downlink counter kept, saves spread over the pages
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+const char * PATH = "test_session_store.bin";
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	int _joins = 0;
+
+	bool sendByte(uint8_t value) {
+		uint8_t buf[] = { value };
+		return send(UpstreamMessage(buf, 1));
+	}
+
+protected:
+
+	void joined(bool ok) override {
+		_joins += (ok ? 1 : 0);
+	}
+};
+
+/*
+ * Records the frames, sends a downlink in answer to the first ones
+ */
+struct Network {
+	std::vector<HostFrame> _frames;
+	int _downlinks = 0;
+	uint8_t _data[1] = { 0x42 };
+
+	static bool answer(HostLMIC &, const HostFrame & frame, HostReply & reply, void * context) {
+		Network & network = *static_cast<Network *>(context);
+		network._frames.push_back(frame);
+		if (network._downlinks > 0) {
+			network._downlinks -= 1;
+			reply._port = 10;
+			reply._data = network._data;
+			reply._len = sizeof(network._data);
+		}
+		return true;
+	}
+};
+
+/*
+ * Storage which counts the erasures of each page
+ */
+class CountingStorage : public Storage {
+public:
+
+	CountingStorage(Storage & storage) : _erasures(storage.size() / storage.pageSize()), _storage(storage) {
+	}
+
+	virtual uint32_t size() override {
+		return _storage.size();
+	}
+
+	virtual uint16_t pageSize() override {
+		return _storage.pageSize();
+	}
+
+	virtual bool read(uint32_t addr, uint8_t * dest, uint16_t len) override {
+		return _storage.read(addr, dest, len);
+	}
+
+	virtual bool write(uint32_t addr, const uint8_t * src, uint16_t len) override {
+		return _storage.write(addr, src, len);
+	}
+
+	virtual bool erase(uint32_t addr) override {
+		_erasures[addr / _storage.pageSize()] += 1;
+		return _storage.erase(addr);
+	}
+
+	std::vector<int> _erasures;
+
+private:
+
+	Storage & _storage;
+};
+
+/*
+ * The node joins, sends 10 uplinks (less than LEUVILLE_LORA_FCNT_GAP) and receives 2 downlinks, then resets
+ */
+void testResume() {
+	remove(PATH);
+	u4_t seqnoUp, seqnoDn;
+	devaddr_t devAddr;
+	{
+		HostLMIC lmic;
+		Network network;
+		network._downlinks = 2;
+		lmic.setNetwork(&Network::answer, &network);
+		FileStorage storage(PATH);
+		StorageSessionStore store(storage);
+		Node node(nullptr);
+		node.setSessionStore(&store);
+		node.begin(id, 0x13, false);
+		for (uint8_t i = 0; i < 10; i++) {
+			node.sendByte(i);
+			CHECK(lmic.run(node, sec2osticks(60)));
+		}
+		CHECK(node._joins == 1);
+		CHECK(network._frames.size() == 10);
+		seqnoUp = LMIC.seqnoUp;
+		seqnoDn = LMIC.seqnoDn;
+		devAddr = LMIC.devaddr;
+		CHECK(seqnoDn == 2);
+	}
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	FileStorage storage(PATH);
+	StorageSessionStore store(storage);
+	Node node(nullptr);
+	node.setSessionStore(&store);
+	node.begin(id, 0x13, false);
+	// resumed without JOIN: counters not reused, downlinks up to the last one rejected
+	CHECK(node._joins == 1);
+	CHECK(!(LMIC.opmode & OP_JOINING));
+	CHECK(LMIC.devaddr == devAddr);
+	CHECK(LMIC.seqnoDn == seqnoDn);
+	node.sendByte(1);
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(network._frames.size() == 1);
+	CHECK(network._frames.size() == 1 && network._frames[0]._fcnt >= seqnoUp);
+}
+
+/*
+ * Saves spread over the pages, each load gives the last save
+ */
+void testRotation() {
+	remove(PATH);
+	FileStorage file(PATH, 4 * 512, 512);
+	CountingStorage storage(file);
+	StorageSessionStore store(storage, 0, 4);
+	LoRaWanSession session;
+	CHECK(!store.load(session));
+	const int SAVES = 100;
+	for (int i = 1; i <= SAVES; i++) {
+		session._seqnoUp = i;
+		CHECK(store.save(session));
+		LoRaWanSession loaded;
+		CHECK(store.load(loaded) && loaded._seqnoUp == (u4_t)i);
+	}
+	// a page holds several records, erased in turn
+	const int perPage = 512 / (sizeof(LoRaWanSession) + 7);
+	int erasures = 0;
+	for (int count : storage._erasures) {
+		CHECK(count > 0);
+		erasures += count;
+	}
+	CHECK(erasures <= SAVES / perPage + 1);
+	// another store on the same pages finds the last record
+	StorageSessionStore other(storage, 0, 4);
+	LoRaWanSession loaded;
+	CHECK(other.load(loaded) && loaded._seqnoUp == SAVES);
+}
+
+/*
+ * clear() hides the session, once; a record of another layout is not loaded
+ */
+void testClear() {
+	remove(PATH);
+	FileStorage file(PATH, 2 * 512, 512);
+	CountingStorage storage(file);
+	StorageSessionStore store(storage);
+	LoRaWanSession session;
+	CHECK(store.save(session));
+	store.clear();
+	CHECK(!store.load(session));
+	uint8_t before[32], after[32];
+	CHECK(storage.read(0, before, sizeof(before)));
+	store.clear();
+	CHECK(storage.read(0, after, sizeof(after)) && memcmp(before, after, sizeof(before)) == 0);
+	CHECK(store.save(session));
+	CHECK(store.load(session));
+	// newer record of another size, as another firmware would write it
+	uint8_t record[8] = { 0x5E, 1, 0xFF, 0xFF, 0, 0, 0 };
+	record[7] = crc8(0, record, 7);
+	CHECK(storage.erase(512) && storage.write(512, record, sizeof(record)));
+	StorageSessionStore other(storage);
+	CHECK(!other.load(session));
+}
+
+int main() {
+	testResume();
+	testRotation();
+	testClear();
+	remove(PATH);
+	return report();
+}
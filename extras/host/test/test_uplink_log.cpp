@@ -0,0 +1,162 @@
+/*
+ * UplinkLog in LMICWrapper: queue restored after a reset, records of another format skipped, write failures counted
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+#include <vector>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+const char * PATH = "test_uplink_log.bin";
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	bool sendBytes(uint8_t value, uint8_t len) {
+		uint8_t buf[MAX_MESSAGE_LEN];
+		memset(buf, value, len);
+		return send(UpstreamMessage(buf, len));
+	}
+};
+
+struct Network {
+	std::vector<HostFrame> _frames;
+
+	static bool answer(HostLMIC &, const HostFrame & frame, HostReply &, void * context) {
+		static_cast<Network *>(context)->_frames.push_back(frame);
+		return true;
+	}
+};
+
+void testRestore() {
+	remove(PATH);
+	{
+		FileStorage storage(PATH);
+		UplinkLog log(storage);
+		Node node(nullptr);
+		CHECK(node.setUplinkLog(&log));
+		for (uint8_t i = 1; i <= 3; i++) {
+			CHECK(node.sendBytes(i, i));
+		}
+		node.persist();
+		CHECK(node.stats()._logErrors == 0);
+	}
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	FileStorage storage(PATH);
+	UplinkLog log(storage);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	CHECK(node.setUplinkLog(&log));
+	CHECK(node.stats()._logErrors == 0);
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK(network._frames.size() == 3);
+	for (size_t i = 0; i < network._frames.size(); i++) {
+		CHECK(network._frames[i]._len == i + 1 && network._frames[i]._data[0] == i + 1);
+	}
+}
+
+/*
+ * A message delivered while an older one waits for its backoff is removed from the middle of the log
+ */
+void testEraseReplayed() {
+	remove(PATH);
+	{
+		HostLMIC lmic;
+		lmic.setNetwork([](HostLMIC &, const HostFrame &, HostReply & reply, void *) {
+			reply._ack = false;
+			return true;
+		});
+		FileStorage storage(PATH);
+		UplinkLog log(storage);
+		Node node(nullptr);
+		node.begin(id, 0x13, false);
+		CHECK(node.setUplinkLog(&log));
+		node.setRetryPolicy(RetryPolicy { 0, RetryPolicy::DROP, 3600 });
+		uint8_t buf[] = { 1 };
+		CHECK(node.send(UpstreamMessage(buf, sizeof(buf), true)));
+		CHECK(node.sendBytes(2, 2));
+		CHECK(node.sendBytes(3, 3));
+		CHECK(lmic.run(node, sec2osticks(600)));
+		CHECK(lmic.frames() == 3);
+		node.persist();
+		CHECK(node.stats()._logErrors == 0);
+	}
+	HostLMIC lmic;
+	Network network;
+	lmic.setNetwork(&Network::answer, &network);
+	FileStorage storage(PATH);
+	UplinkLog log(storage);
+	Node node(nullptr);
+	node.begin(id, 0x13, false);
+	CHECK(node.setUplinkLog(&log));
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK(network._frames.size() == 1);
+	CHECK(network._frames.size() == 1 && network._frames[0]._len == 1 && network._frames[0]._confirmed);
+}
+
+/*
+ * A PUSH record written with another UpstreamMessage layout is not replayed
+ */
+void testOtherFormat() {
+	remove(PATH);
+	{
+		FileStorage storage(PATH);
+		UplinkLog log(storage);
+		CHECK(log.open());
+		uint8_t record[40] = { 0x7F, 38 };
+		CHECK(log.append(UplinkLog::PUSH, record, sizeof(record)));
+		CHECK(log.commit());
+	}
+	{
+		FileStorage storage(PATH);
+		UplinkLog log(storage);
+		Node node(nullptr);
+		CHECK(node.setUplinkLog(&log));
+		CHECK(node.stats()._logErrors == 1);
+		CHECK(!node.hasMessageToSend());
+		CHECK(node.sendBytes(1, 1));
+		node.persist();
+	}
+	// superseded by the snapshot written after the replay
+	FileStorage storage(PATH);
+	UplinkLog log(storage);
+	Node node(nullptr);
+	CHECK(node.setUplinkLog(&log));
+	CHECK(node.stats()._logErrors == 0);
+	CHECK(node.hasMessageToSend());
+}
+
+/*
+ * Two small pages cannot hold a snapshot of a full queue: the records lost are counted, the queue is unchanged
+ */
+void testLogFull() {
+	remove(PATH);
+	FileStorage storage(PATH, 2 * 512, 512);
+	UplinkLog log(storage);
+	Node node(nullptr);
+	CHECK(node.setUplinkLog(&log));
+	for (uint8_t i = 0; i < LEUVILLE_LORA_QUEUE_LEN; i++) {
+		CHECK(node.sendBytes(i, 50));
+	}
+	node.persist();
+	CHECK(node.stats()._logErrors > 0);
+	CHECK(node.stats()._dropsRecent == 0);
+}
+
+int main() {
+	testRestore();
+	testEraseReplayed();
+	testOtherFormat();
+	testLogFull();
+	remove(PATH);
+	return report();
+}
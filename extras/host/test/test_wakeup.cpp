@@ -0,0 +1,169 @@
+/*
+ * nextWakeup() and sleepInterval(): pending jobs, LMIC radio job, duty cycle release, standby once per idle period
+ */
+
+#include <HostLMIC.h>
+#include <HostTest.h>
+#include <LMICWrapper.h>
+
+using namespace leuville::lora;
+using namespace leuville::lora::host;
+
+const OTAAId id("70B3D57E00000001", "0000A06E00000001", "00112233445566778899AABBCCDDEEFF");
+
+class Node : public LMICWrapper {
+public:
+	using LMICWrapper::LMICWrapper;
+
+	osjob_t _first;
+	osjob_t _second;
+	int _completed = 0;
+
+	bool sendByte(uint8_t value) {
+		uint8_t buf[] = { value };
+		return send(UpstreamMessage(buf, 1));
+	}
+
+	ostime_t wakeup() {
+		ostime_t when = 0;
+		CHECK(nextWakeup(when));
+		return when;
+	}
+
+protected:
+
+	void completeJob(osjob_t * job) override {
+		_completed += 1;
+	}
+};
+
+/*
+ * Starts the endnode and joins: the radio job is planned during JOIN
+ */
+void join(HostLMIC & lmic, Node & node) {
+	node.begin(id, 0x13, false);
+	node.startJoining();
+	CHECK(node.isRadioBusy() && node.wakeup() == LMIC.osjob.deadline);
+	CHECK(!node.isIdle());
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(node.isIdle());
+}
+
+/*
+ * Joined, nothing queued, no job: only an external event wakes the endnode up
+ */
+void testNothingPlanned() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	join(lmic, node);
+	ostime_t when;
+	CHECK(!node.nextWakeup(when));
+	CHECK(node.sleepInterval() == Node::SLEEP_UNTIL_EVENT);
+	CHECK(node.isIdle());
+}
+
+/*
+ * The earliest pending job of the endnode, a late job is due now
+ */
+void testPendingJobs() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	join(lmic, node);
+	ostime_t now = lmic.now();
+	CHECK(node.setCallbackAt(&node._first, now + sec2osticks(20)));
+	CHECK(node.setCallbackAt(&node._second, now + sec2osticks(5)));
+	CHECK(node.wakeup() == now + sec2osticks(5));
+	CHECK(node.sleepInterval() == 5000);
+	node.unsetCallback(&node._second);
+	CHECK(node.wakeup() == now + sec2osticks(20));
+	CHECK(node.sleepInterval() == 20000);
+	CHECK(node.isIdle());
+	lmic.advance(sec2osticks(30));
+	CHECK(node.wakeup() == lmic.now());
+	CHECK(node.sleepInterval() == 0);
+	CHECK(!node.isIdle());
+	CHECK(lmic.run(node, sec2osticks(1)));
+	CHECK(node._completed == 1);
+	CHECK(node.sleepInterval() == Node::SLEEP_UNTIL_EVENT);
+}
+
+/*
+ * An uplink on the air: the LMIC radio job, before a later job of the endnode
+ */
+void testRadioJob() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	join(lmic, node);
+	CHECK(node.setCallbackAt(&node._first, lmic.now() + sec2osticks(60)));
+	node.sendByte(1);
+	// send job, then TX start
+	for (int i = 0; i < 3 && !(LMIC.opmode & OP_TXRXPEND); i++) {
+		node.runLoopOnce();
+	}
+	CHECK(lmic.frames() == 1);
+	CHECK(node.isRadioBusy());
+	CHECK(node.wakeup() == lmic.lastFrame()._end && LMIC.osjob.deadline == lmic.lastFrame()._end);
+	CHECK(node.sleepInterval() == (unsigned long)osticks2ms(lmic.lastFrame()._end - lmic.now()));
+	CHECK(!node.isIdle());
+	node.unsetCallback(&node._first);
+}
+
+/*
+ * A message waiting for the duty cycle: its release, or an earlier job
+ */
+void testDutyCycleRelease() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	join(lmic, node);
+	LMIC_setDrTxpow(DR_SF12, 14);
+	node.sendByte(1);
+	CHECK(lmic.run(node, sec2osticks(30)));
+	CHECK(lmic.frames() == 1 && !node.isRadioBusy());
+	ostime_t release = LMIC.globalDutyAvail;
+	CHECK(release - lmic.now() > sec2osticks(60));
+	node.sendByte(2);
+	CHECK(node.wakeup() == release);
+	CHECK(node.sleepInterval() == (unsigned long)osticks2ms(release - lmic.now()));
+	CHECK(node.setCallbackAt(&node._first, lmic.now() + sec2osticks(10)));
+	CHECK(node.wakeup() == lmic.now() + sec2osticks(10));
+	node.unsetCallback(&node._first);
+	// the send job waits for the release, set in ms by setCallback()
+	node.runLoopOnce();
+	CHECK(release - node.wakeup() >= 0 && release - node.wakeup() < ms2osticks(1));
+	CHECK(lmic.run(node, sec2osticks(3600)));
+	CHECK(lmic.frames() == 2 && lmic.lastFrame()._start == release);
+}
+
+/*
+ * The radio is put to sleep once when the endnode becomes idle, not at each loop
+ */
+void testStandbyOncePerIdle() {
+	HostLMIC lmic;
+	Node node(nullptr);
+	join(lmic, node);
+	uint32_t resets = lmic.radioResets();
+	for (int i = 0; i < 10; i++) {
+		node.runLoopOnce();
+	}
+	CHECK(lmic.radioResets() == resets);
+	node.sendByte(1);
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(lmic.radioResets() == resets + 1);
+	// a job run by the endnode does not wake the radio up
+	CHECK(node.setCallbackAt(&node._first, lmic.now() + sec2osticks(10)));
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(node._completed == 1);
+	CHECK(lmic.radioResets() == resets + 1);
+	node.sendByte(2);
+	CHECK(lmic.run(node, sec2osticks(60)));
+	CHECK(lmic.radioResets() == resets + 2);
+}
+
+int main() {
+	testNothingPlanned();
+	testPendingJobs();
+	testRadioJob();
+	testDutyCycleRelease();
+	testStandbyOncePerIdle();
+	return report();
+}
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+#
+# Decodes the "T:" lines printed by EventTrace::dump() (LMICWrapper::eventTrace())
+#
+# usage: trace_decode.py [--ticks-per-sec N] [serial log file]    (stdin by default)
+#
+# Record = 10 bytes, little-endian: ticks (4), opmode (2), event, arg, queue depth, txrxFlags
+
+import argparse
+import struct
+import sys
+
+OSTICKS_PER_SEC = 62500    # MCCI LMIC default (US_PER_OSTICK_EXPONENT 4), --ticks-per-sec if changed
+
+LMIC_EVENTS = [
+    "zero",
+    "EV_SCAN_TIMEOUT", "EV_BEACON_FOUND",
+    "EV_BEACON_MISSED", "EV_BEACON_TRACKED", "EV_JOINING",
+    "EV_JOINED", "EV_RFU1", "EV_JOIN_FAILED", "EV_REJOIN_FAILED",
+    "EV_TXCOMPLETE", "EV_LOST_TSYNC", "EV_RESET",
+    "EV_RXCOMPLETE", "EV_LINK_DEAD", "EV_LINK_ALIVE", "EV_SCAN_FOUND",
+    "EV_TXSTART", "EV_TXCANCELED", "EV_RXSTART", "EV_JOIN_TXCOMPLETE",
+]
+
+WRAPPER_EVENTS = {
+    0x80: "QUEUED", 0x81: "TXDATA", 0x82: "TXERROR", 0x83: "DOWNLINK", 0x84: "MAC", 0x85: "OUTCOME",
+}
+
+OPMODE = {
+    0x0001: "SCAN", 0x0002: "TRACK", 0x0004: "JOINING", 0x0008: "TXDATA",
+    0x0010: "POLL", 0x0020: "REJOIN", 0x0040: "SHUTDOWN", 0x0080: "TXRXPEND",
+    0x0100: "RNDTX", 0x0200: "PINGINI", 0x0400: "PINGABLE", 0x0800: "NEXTCHNL",
+    0x1000: "LINKDEAD", 0x2000: "TESTMODE", 0x4000: "UNJOIN",
+}
+
+TXRX = {
+    0x80: "ACK", 0x40: "NACK", 0x20: "NOPORT", 0x10: "PORT",
+    0x08: "LENERR", 0x04: "PING", 0x02: "DNW2", 0x01: "DNW1",
+}
+
+
+def flags(value, names):
+    return "|".join(name for bit, name in names.items() if value & bit) or "-"
+
+
+def event_name(event):
+    if event < len(LMIC_EVENTS):
+        return LMIC_EVENTS[event]
+    return WRAPPER_EVENTS.get(event, "0x%02X" % event)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decodes the T: lines of EventTrace::dump()")
+    parser.add_argument("log", nargs="?", help="serial log file, stdin by default")
+    parser.add_argument("--ticks-per-sec", type=int, default=OSTICKS_PER_SEC,
+                        help="OSTICKS_PER_SEC of the firmware (default %d)" % OSTICKS_PER_SEC)
+    args = parser.parse_args()
+    ticks_per_sec = args.ticks_per_sec
+    source = open(args.log) if args.log else sys.stdin
+    previous = None
+    for line in source:
+        line = line.strip()
+        if not line.startswith("T:"):
+            continue
+        try:
+            data = bytes.fromhex(line[2:])
+        except ValueError:
+            continue
+        if len(data) != 10:
+            continue
+        ticks, opmode, event, arg, depth, txrx = struct.unpack("<IHBBBB", data)
+        delta = "" if previous is None else "+%.3fs" % (((ticks - previous) & 0xFFFFFFFF) / ticks_per_sec)
+        previous = ticks
+        print("%10.3fs %9s  %-20s arg=%-3d depth=%-3d opmode=%s txrx=%s" % (
+            ticks / ticks_per_sec, delta, event_name(event), arg, depth, flags(opmode, OPMODE), flags(txrx, TXRX)))
+
+
+if __name__ == "__main__":
+    main()
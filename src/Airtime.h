@@ -0,0 +1,153 @@
+/*
+ * Module: Airtime
+ *
+ * Function: time-on-air of LoRaWAN frames and hourly airtime budget
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <LoRaRegion.h>
+
+// duty cycle = 1 / LEUVILLE_LORA_DUTY_CYCLE (1% in most EU868 sub-bands)
+#ifndef LEUVILLE_LORA_DUTY_CYCLE
+#define LEUVILLE_LORA_DUTY_CYCLE 100
+#endif
+
+namespace leuville {
+namespace lora {
+
+// MHDR + DevAddr + FCtrl + FCnt + FPort + MIC, without FOpts
+constexpr uint8_t LORAWAN_OVERHEAD = 13;
+
+/*
+ * LoRa symbol time of a modulation, in microseconds
+ */
+constexpr uint32_t symbolTime(Modulation mod) {
+	return (1UL << mod._sf) * 1000 / mod._bw;
+}
+
+/*
+ * LoRa payload symbols: num / den rounded up, coding rate 4/5, 8 symbols at least
+ */
+constexpr int32_t payloadSymbols(int32_t num, int32_t den) {
+	return (num > 0 ? (num + den - 1) / den : 0) * 5 + 8;
+}
+
+/*
+ * LoRa time-on-air of a PHY payload, tSym = symbolTime(), low data rate optimization from 16 ms symbols
+ */
+constexpr uint32_t loraTimeOnAir(uint8_t phyLen, uint8_t sf, uint32_t tSym) {
+	return (49 * tSym) / 4 + payloadSymbols(8 * phyLen - 4 * sf + 28 + 16, 4 * (sf - 2 * (tSym >= 16000 ? 1 : 0))) * tSym;
+}
+
+/*
+ * Time-on-air of a PHY payload of phyLen bytes, in microseconds
+ *
+ * LoRa (Semtech AN1200.13): 8 preamble symbols, explicit header, CRC on, coding rate 4/5,
+ * low data rate optimization when a symbol lasts 16 ms or more.
+ * FSK 50 kbps: 5 preamble bytes, 3 sync bytes, length byte and CRC.
+ * Single return statements: constexpr functions of C++11.
+ */
+constexpr uint32_t timeOnAir(uint8_t phyLen, Modulation mod) {
+	return (mod._sf == 0 ? (5 + 3 + 1 + phyLen + 2) * 8 * 20UL : loraTimeOnAir(phyLen, mod._sf, symbolTime(mod)));
+}
+
+/*
+ * Time-on-air of an uplink carrying len application bytes at data rate dr, in microseconds
+ */
+constexpr uint32_t timeOnAir(dr_t dr, uint8_t len, uint8_t foptsLen = 0) {
+	return timeOnAir(LORAWAN_OVERHEAD + foptsLen + len, modulationOf(dr));
+}
+
+/*
+ * Silence imposed by the duty cycle after airtime microseconds of transmission, in microseconds
+ */
+constexpr uint32_t dutyCycleDebt(uint32_t airtime, uint16_t dutyCycle = LEUVILLE_LORA_DUTY_CYCLE) {
+	return airtime * (dutyCycle - 1);
+}
+
+/*
+ * Token bucket of airtime, refilled at budget microseconds per hour
+ *
+ * The bucket starts full and holds at most one hour of budget.
+ * Times are os_getTime() ticks: only their differences are used, the wrap of the LMIC clock is harmless.
+ */
+class AirtimeBudget {
+public:
+
+	static constexpr uint32_t HOUR_MS = 3600000UL;
+	static constexpr ostime_t HOUR_TICKS = 3600 * (ostime_t)OSTICKS_PER_SEC;
+
+	AirtimeBudget(uint32_t budget = HOUR_MS * 1000 / LEUVILLE_LORA_DUTY_CYCLE)
+		: _budget(budget), _level(budget)
+	{}
+
+	uint32_t budget() const {
+		return _budget;
+	}
+
+	void setBudget(uint32_t budget) {
+		_budget = budget;
+		_level = (_level < budget ? _level : budget);
+	}
+
+	/*
+	 * Airtime which may be spent now, in microseconds
+	 */
+	uint32_t available(ostime_t now) {
+		refill(now);
+		return _level;
+	}
+
+	bool allows(uint32_t airtime, ostime_t now) {
+		return airtime <= available(now);
+	}
+
+	void spend(uint32_t airtime, ostime_t now) {
+		refill(now);
+		_level = (airtime < _level ? _level - airtime : 0);
+	}
+
+	/*
+	 * ms to wait until airtime may be spent
+	 * Airtime larger than the budget waits for a full bucket.
+	 */
+	uint32_t waitTime(uint32_t airtime, ostime_t now) {
+		if (airtime > _budget) {
+			airtime = _budget;
+		}
+		if (allows(airtime, now)) {
+			return 0;
+		}
+		return (uint32_t)(((uint64_t)(airtime - _level) * HOUR_MS + _budget - 1) / _budget);
+	}
+
+private:
+
+	uint32_t 	_budget;
+	uint32_t 	_level;
+	ostime_t 	_last = 0;
+	uint32_t 	_remainder = 0;	// refill below 1 us, kept for the next call
+	bool 		_started = false;
+
+	void refill(ostime_t now) {
+		if (_started) {
+			// a negative difference is more than 2^31 ticks: the bucket is full anyway
+			ostime_t elapsed = now - _last;
+			elapsed = (elapsed >= 0 && elapsed < HOUR_TICKS ? elapsed : HOUR_TICKS);
+			uint64_t refill = (uint64_t)elapsed * _budget + _remainder;
+			uint64_t level = _level + refill / HOUR_TICKS;
+			_remainder = refill % HOUR_TICKS;
+			_level = (level < _budget ? level : _budget);
+		}
+		_started = true;
+		_last = now;
+	}
+};
+
+}
+}
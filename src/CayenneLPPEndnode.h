@@ -11,16 +11,74 @@
 
 #pragma once
 
-#include <LMICWrapper.h>
+#include <GenericEndnode.h>
 #include <CayenneLPP.h>
 
 namespace leuville {
 namespace lora {
 
-class CayenneLPPEndnode: public LMICWrapper {
+/*
+ * Build JsonDocument from (uint8_t *) buffer containing CayenneLPP data
+ * Returns false (and an empty document) if the buffer is not valid CayenneLPP
+ */
+inline bool jsonFromLPP(const uint8_t * buffer, uint8_t len, JsonDocument & doc) {
+	JsonObject root = doc.to<JsonObject>();
+	CayenneLPP lpp(len);
+	if (lpp.decodeTTN(const_cast<uint8_t*>(buffer), len, root)) {
+		doc.shrinkToFit();
+		return true;
+	}
+	doc.clear();
+	return false;
+}
+
+/*
+ * GenericEndnode codec for CayenneLPP
+ * Completed uplinks and downlinks are decoded to JsonDocument
+ */
+struct CayenneLPPCodec {
+
+	using Source = CayenneLPP;
+	using Uplink = JsonDocument;
+	using Downlink = JsonDocument;
+
+	static constexpr bool ACK = false;
+
+	/*
+	 * The buffer must not exceed the max payload of the current data rate, unless fragmentation is enabled
+	 */
+	static LMICWrapper::SendError encode(const CayenneLPP & doc, Message & dest, uint8_t maxPayload) {
+		CayenneLPP & lpp = const_cast<CayenneLPP&>(doc);
+		if (lpp.getSize() > maxPayload) {
+			return LMICWrapper::SEND_PAYLOAD_TOO_LARGE;
+		}
+		memcpy(dest._buf, lpp.getBuffer(), lpp.getSize());
+		dest._len = lpp.getSize();
+		return LMICWrapper::SEND_OK;
+	}
+
+	static bool decodeUplink(const uint8_t * buf, uint8_t len, JsonDocument & doc) {
+		return jsonFromLPP(buf, len, doc);
+	}
+
+	/*
+	 * A downlink which is not valid is delivered as an empty document
+	 */
+	static bool decodeDownlink(const uint8_t * buf, uint8_t len, JsonDocument & doc) {
+		jsonFromLPP(buf, len, doc);
+		return true;
+	}
+};
+
+/*
+ * ENDNODE base class exchanging CayenneLPP buffers
+ * Derived = optional endnode class, see GenericEndnode
+ */
+template <typename Derived = void>
+class CayenneLPPEndnodeT: public GenericEndnode<CayenneLPPCodec, Derived> {
 public:
 
-	using LMICWrapper::LMICWrapper;
+	using GenericEndnode<CayenneLPPCodec, Derived>::GenericEndnode;
 
     /*
 	 * Serialize Json -> String
@@ -43,62 +101,13 @@ public:
 	 * Build JsonDocument from (uint8_t *) buffer containing CayenneLPP data
 	 */
 	JsonDocument jsonFrom(uint8_t * buffer, uint8_t len) {
-      	JsonDocument doc{};
-		JsonObject root = doc.to<JsonObject>();
-		CayenneLPP lpp(len);
-		if (lpp.decodeTTN(buffer, len, root)) {
- 			doc.shrinkToFit();
-		} else {
-			doc.clear();
-		}
+		JsonDocument doc{};
+		jsonFromLPP(buffer, len, doc);
 		return doc;
 	}
-
-    /*
-	 * Send CayenneLPP message
-	 */
-	virtual bool send(const CayenneLPP & doc, bool ack = false) {
-		CayenneLPP & lpp = const_cast<CayenneLPP&>(doc);
-        UpstreamMessage payload(lpp.getBuffer(), lpp.getSize(), ack);
-		return LMICWrapper::send(payload);
-	}
-
-	/*
-	 * Default send completion policy
-     *
-     * Override if needed
-	 */
-	virtual bool isTxCompleted(const JsonDocument & doc, const UpstreamMessage & rawMessage) {
-		return LMICWrapper::isTxCompleted(rawMessage);
-	};
-
-	/*
-	 * Downlink message arrival callback
-     *
-     * Override if needed
-	 */
-	virtual void downlinkReceived(const JsonDocument & message, const DownstreamMessage & rawMessage) {
-	}
-
-protected:
-
-	/*
-	 * Convenience method to rebuild JsonDocument from UpstreamMessage containing CayenneLPP data
-	 */
-	virtual bool isTxCompleted(const UpstreamMessage & message) override {
-        JsonDocument doc = jsonFrom((uint8_t*)message._buf, message._len);
-		return isTxCompleted(doc, message);
-	};
-
-	/*
-	 * Convenience method to rebuild JsonDocument from DownstreamMessage containing CayenneLPP data
-	 */
-	virtual void downlinkReceived(const DownstreamMessage & message) override {
-		JsonDocument doc = jsonFrom((uint8_t*)message._buf, message._len);
-		downlinkReceived(doc, message);
-	}
-
 };
 
+using CayenneLPPEndnode = CayenneLPPEndnodeT<>;
+
 }
 }
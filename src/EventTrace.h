@@ -0,0 +1,195 @@
+/*
+ * Module: EventTrace
+ *
+ * Function: binary trace of LMIC and LMICWrapper events, cheap enough to stay always on
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+// number of records kept by the trace (power of 2)
+#ifndef LEUVILLE_LORA_TRACE_LEN
+#define LEUVILLE_LORA_TRACE_LEN 32
+#endif
+
+namespace leuville {
+namespace lora {
+
+/*
+ * Trace event ids: LMIC ev_t values (1..20), then LMICWrapper events
+ */
+enum TraceEvent : uint8_t {
+	TRACE_QUEUED	= 0x80,		// message queued, arg = priority class
+	TRACE_TXDATA	= 0x81,		// frame given to LMIC, arg = number of messages
+	TRACE_TXERROR	= 0x82,		// LMIC_setTxData2() failed, arg = -error
+	TRACE_DOWNLINK	= 0x83,		// application downlink, arg = length
+	TRACE_MAC		= 0x84,		// MAC commands received, arg = FOpts length
+	TRACE_OUTCOME	= 0x85		// message removed from the queue, arg = LMICWrapper::TxOutcome
+};
+
+/*
+ * Event names, stored in flash
+ * LMIC events first (index = ev_t), then LMICWrapper events (index = 21 + id - 0x80)
+ */
+constexpr uint8_t TRACE_NAME_LEN = 19;
+
+const char _traceNames[][TRACE_NAME_LEN] PROGMEM = {
+	"zero",
+	"EV_SCAN_TIMEOUT", "EV_BEACON_FOUND",
+	"EV_BEACON_MISSED", "EV_BEACON_TRACKED", "EV_JOINING",
+	"EV_JOINED", "EV_RFU1", "EV_JOIN_FAILED", "EV_REJOIN_FAILED",
+	"EV_TXCOMPLETE", "EV_LOST_TSYNC", "EV_RESET",
+	"EV_RXCOMPLETE", "EV_LINK_DEAD", "EV_LINK_ALIVE", "EV_SCAN_FOUND",
+	"EV_TXSTART", "EV_TXCANCELED", "EV_RXSTART", "EV_JOIN_TXCOMPLETE",
+	"QUEUED", "TXDATA", "TXERROR", "DOWNLINK", "MAC", "OUTCOME",
+	"unknown"
+};
+
+inline const __FlashStringHelper * traceEventName(uint8_t event) {
+	constexpr uint8_t LMIC_EVENTS = 21;
+	constexpr uint8_t COUNT = sizeof(_traceNames) / TRACE_NAME_LEN;
+	uint8_t index = (event < LMIC_EVENTS ? event
+		: event >= TRACE_QUEUED && event - TRACE_QUEUED + LMIC_EVENTS < COUNT - 1 ? event - TRACE_QUEUED + LMIC_EVENTS
+		: COUNT - 1);
+	return reinterpret_cast<const __FlashStringHelper *>(_traceNames[index]);
+}
+
+/*
+ * One trace record
+ */
+struct TraceRecord {
+	uint32_t 	_ticks;			// os_getTime()
+	uint16_t 	_opmode;		// LMIC.opmode
+	uint8_t 	_event;			// ev_t or TraceEvent
+	uint8_t 	_arg;			// see TraceEvent
+	uint8_t 	_depth;			// uplink queue size
+	uint8_t 	_txrxFlags;		// LMIC.txrxFlags
+
+	// dump format: little-endian fields in declaration order
+	static constexpr uint8_t DUMP_LEN = 10;
+};
+
+/*
+ * Interrupts disabled while it lives, on SAMD: PRIMASK is restored, not set, so it may nest
+ * Elsewhere it does nothing
+ */
+class TraceCriticalSection {
+#if defined(ARDUINO_ARCH_SAMD)
+public:
+	TraceCriticalSection() : _primask(__get_PRIMASK()) {
+		__disable_irq();
+	}
+
+	~TraceCriticalSection() {
+		__set_PRIMASK(_primask);
+	}
+
+private:
+	uint32_t _primask;
+#endif
+};
+
+/*
+ * Ring of the last LEN records
+ *
+ * record() does not block nor allocate. On SAMD its few stores run with interrupts disabled,
+ * so that an ISR may record as well. Elsewhere a single writer (the LMIC run loop) is expected:
+ * record() must not be called from an ISR.
+ * Readers copy records out and may race with the writer only on the oldest record.
+ */
+template <uint16_t LEN = LEUVILLE_LORA_TRACE_LEN>
+class EventTrace {
+public:
+
+	static_assert(LEN > 0 && (LEN & (LEN - 1)) == 0, "LEN must be a power of 2");
+
+	void record(uint32_t ticks, uint8_t event, uint8_t arg, uint16_t opmode, uint8_t depth, uint8_t txrxFlags) {
+		TraceCriticalSection section;
+		uint32_t head = _head;
+		TraceRecord & rec = _ring[head & (LEN - 1)];
+		rec._ticks = ticks;
+		rec._opmode = opmode;
+		rec._event = event;
+		rec._arg = arg;
+		rec._depth = depth;
+		rec._txrxFlags = txrxFlags;
+		_head = head + 1;
+	}
+
+	/*
+	 * Total number of records since start, including overwritten ones
+	 */
+	uint32_t recorded() const {
+		return _head;
+	}
+
+	void clear() {
+		_head = 0;
+	}
+
+	/*
+	 * Calls visit(const TraceRecord &) from the oldest record to the newest
+	 */
+	template <typename F>
+	void forEach(F visit) const {
+		uint32_t head = _head;
+		for (uint32_t i = (head > LEN ? head - LEN : 0); i < head; i++) {
+			TraceRecord rec = _ring[i & (LEN - 1)];
+			visit(rec);
+		}
+	}
+
+	/*
+	 * Prints one line per record: "T:" then the DUMP_LEN bytes of the record in hex
+	 * (see extras/trace_decode.py)
+	 */
+	void dump(Print & out) const {
+		forEach([&out](const TraceRecord & rec) {
+			uint8_t bytes[TraceRecord::DUMP_LEN] = {
+				(uint8_t)rec._ticks, (uint8_t)(rec._ticks >> 8), (uint8_t)(rec._ticks >> 16), (uint8_t)(rec._ticks >> 24),
+				(uint8_t)rec._opmode, (uint8_t)(rec._opmode >> 8),
+				rec._event, rec._arg, rec._depth, rec._txrxFlags
+			};
+			out.print(F("T:"));
+			for (uint8_t b : bytes) {
+				if (b < 0x10) {
+					out.print('0');
+				}
+				out.print(b, HEX);
+			}
+			out.println();
+		});
+	}
+
+	/*
+	 * Prints the records in plain text, with event names
+	 */
+	void print(Print & out) const {
+		forEach([&out](const TraceRecord & rec) {
+			out.print(rec._ticks);
+			out.print(' ');
+			out.print(traceEventName(rec._event));
+			out.print(F(" arg="));
+			out.print(rec._arg);
+			out.print(F(" opmode=0x"));
+			out.print(rec._opmode, HEX);
+			out.print(F(" depth="));
+			out.print(rec._depth);
+			out.print(F(" flags=0x"));
+			out.println(rec._txrxFlags, HEX);
+		});
+	}
+
+private:
+
+	TraceRecord 		_ring[LEN];
+	volatile uint32_t 	_head = 0;
+};
+
+}
+}
@@ -0,0 +1,208 @@
+/*
+ * Module: Fragmentation
+ *
+ * Function: uplink payloads split into fragments sized to the data rate, and their reassembly
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+// no Arduino dependency: FragmentReassembler is also built on the host (tests, network side)
+#include <stdint.h>
+#include <string.h>
+
+// FPort of the fragments queued by LMICWrapper::sendFragmented()
+#ifndef LEUVILLE_LORA_FRAGMENT_FPORT
+#define LEUVILLE_LORA_FRAGMENT_FPORT 201
+#endif
+
+// default max payload rebuilt by FragmentReassembler, in bytes
+#ifndef LEUVILLE_LORA_FRAGMENT_MAX_LEN
+#define LEUVILLE_LORA_FRAGMENT_MAX_LEN 2048
+#endif
+
+namespace leuville {
+namespace lora {
+
+/*
+ * Fragment = header (payload id, fragment index, fragment count) + chunk
+ *
+ * The chunks are the consecutive slices of [FPort of the payload][payload]:
+ * the first chunk starts with the original FPort, all chunks but the last have the same length.
+ * A payload is split into at most 255 fragments.
+ */
+constexpr uint8_t FRAGMENT_HEADER_LEN = 3;
+
+/*
+ * Number of fragments of fragmentLen bytes (header included) needed by a payload of len bytes
+ *
+ * Returns 0 if fragmentLen cannot hold a chunk
+ */
+inline uint16_t fragmentCount(uint16_t len, uint8_t fragmentLen) {
+	if (fragmentLen <= FRAGMENT_HEADER_LEN) {
+		return 0;
+	}
+	uint8_t chunk = fragmentLen - FRAGMENT_HEADER_LEN;
+	return ((uint32_t)len + chunk) / chunk;
+}
+
+/*
+ * Writes fragment index of payload into dest (fragmentLen bytes at most)
+ *
+ * Returns the length of the fragment
+ */
+inline uint8_t writeFragment(uint8_t * dest, uint8_t fragmentLen, uint8_t id, uint8_t index, uint8_t count,
+							 uint8_t fport, const uint8_t * payload, uint16_t len) {
+	uint8_t chunk = fragmentLen - FRAGMENT_HEADER_LEN;
+	dest[0] = id;
+	dest[1] = index;
+	dest[2] = count;
+	uint8_t pos = FRAGMENT_HEADER_LEN;
+	uint32_t start = (uint32_t)index * chunk;
+	uint32_t end = start + chunk;
+	for (uint32_t k = start; k < end && k <= len; k++) {
+		dest[pos++] = (k == 0 ? fport : payload[k - 1]);
+	}
+	return pos;
+}
+
+/*
+ * Rebuilds the payloads sent by LMICWrapper::sendFragmented(), from the LEUVILLE_LORA_FRAGMENT_FPORT frames
+ *
+ * Fragments may arrive in any order and more than once; SLOTS payloads are rebuilt at the same time,
+ * the one which has not received a fragment for the longest time is dropped when another payload starts.
+ * Payloads longer than MAX_LEN bytes, or with chunks of different lengths, are dropped.
+ */
+template <uint16_t MAX_LEN = LEUVILLE_LORA_FRAGMENT_MAX_LEN, uint8_t SLOTS = 4>
+class FragmentReassembler {
+public:
+
+	/*
+	 * Adds a fragment (application payload of a LEUVILLE_LORA_FRAGMENT_FPORT frame)
+	 *
+	 * Returns true if it completes a payload: see fport(), payload() and length(),
+	 * which are valid until the next call
+	 */
+	bool add(const uint8_t * fragment, uint8_t len) {
+		if (len <= FRAGMENT_HEADER_LEN) {
+			return false;
+		}
+		uint8_t id = fragment[0];
+		uint8_t index = fragment[1];
+		uint8_t count = fragment[2];
+		if (count == 0 || index >= count) {
+			return false;
+		}
+		Slot & slot = slotOf(id, count);
+		if (slot._received[index / 8] & (1 << (index % 8))) {
+			return false;
+		}
+		const uint8_t * chunk = fragment + FRAGMENT_HEADER_LEN;
+		uint8_t chunkLen = len - FRAGMENT_HEADER_LEN;
+		if (index == count - 1) {
+			memcpy(slot._last, chunk, chunkLen);
+			slot._lastLen = chunkLen;
+		} else {
+			if (slot._chunk == 0) {
+				slot._chunk = chunkLen;
+			}
+			if (chunkLen != slot._chunk || (uint32_t)(index + 1) * chunkLen > MAX_LEN + 1) {
+				slot._used = false;
+				_dropped += 1;
+				return false;
+			}
+			memcpy(slot._data + index * chunkLen, chunk, chunkLen);
+		}
+		slot._received[index / 8] |= (1 << (index % 8));
+		slot._missing -= 1;
+		if (slot._missing > 0) {
+			return false;
+		}
+		slot._used = false;
+		uint32_t start = (uint32_t)(count - 1) * slot._chunk;
+		if (start + slot._lastLen > MAX_LEN + 1) {
+			_dropped += 1;
+			return false;
+		}
+		memcpy(slot._data + start, slot._last, slot._lastLen);
+		_done = &slot;
+		_length = start + slot._lastLen - 1;
+		return true;
+	}
+
+	uint8_t fport() const {
+		return _done->_data[0];
+	}
+
+	const uint8_t * payload() const {
+		return _done->_data + 1;
+	}
+
+	uint16_t length() const {
+		return _length;
+	}
+
+	/*
+	 * Number of payloads dropped before completion
+	 */
+	uint32_t dropped() const {
+		return _dropped;
+	}
+
+private:
+
+	struct Slot {
+		bool 		_used = false;
+		uint8_t 	_id = 0;
+		uint8_t 	_count = 0;
+		uint8_t 	_missing = 0;
+		uint8_t 	_chunk = 0;			// length of all chunks but the last, 0 = unknown
+		uint8_t 	_lastLen = 0;
+		uint32_t 	_stamp = 0;			// add() counter, to find the oldest slot
+		uint8_t 	_received[32];		// bit per fragment index
+		uint8_t 	_last[UINT8_MAX];	// last chunk, placed once _chunk is known
+		uint8_t 	_data[MAX_LEN + 1];	// FPort + payload
+	};
+
+	Slot 			_slots[SLOTS];
+	const Slot * 	_done = nullptr;
+	uint16_t 		_length = 0;
+	uint32_t 		_stamp = 0;
+	uint32_t 		_dropped = 0;
+
+	/*
+	 * Slot of a payload, a new one is started if needed
+	 */
+	Slot & slotOf(uint8_t id, uint8_t count) {
+		Slot * oldest = &_slots[0];
+		for (Slot & slot : _slots) {
+			if (slot._used && slot._id == id && slot._count == count) {
+				slot._stamp = ++_stamp;
+				return slot;
+			}
+			if (!slot._used && oldest->_used) {
+				oldest = &slot;
+			} else if (slot._used == oldest->_used && slot._stamp < oldest->_stamp) {
+				oldest = &slot;
+			}
+		}
+		if (oldest->_used) {
+			_dropped += 1;
+		}
+		oldest->_used = true;
+		oldest->_id = id;
+		oldest->_count = count;
+		oldest->_missing = count;
+		oldest->_chunk = 0;
+		oldest->_lastLen = 0;
+		oldest->_stamp = ++_stamp;
+		memset(oldest->_received, 0, sizeof(oldest->_received));
+		return *oldest;
+	}
+};
+
+}
+}
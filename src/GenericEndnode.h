@@ -15,71 +15,204 @@
 namespace leuville {
 namespace lora {
 
-template <typename T>
-uint8_t * bufferOf(const T &);
-
-template <typename T>
-size_t * sizeOf(const T &);
-
-template <typename T>
+/*
+ * ENDNODE base class exchanging typed messages, encoded by a Codec policy
+ *
+ * Codec provides types and static functions, which are inlined:
+ *
+ * struct Codec {
+ *     using Source = ...;		// type given to send()
+ *     using Uplink = ...;		// type given to the typed isTxCompleted()
+ *     using Downlink = ...;	// type given to the typed downlinkReceived()
+ *     static constexpr bool ACK = ...;	// default ack request of send()
+ *
+ *     // encodes src into dest._buf / dest._len, maxPayload = max payload of the current data rate (MAX_MESSAGE_LEN with fragmentation)
+ *     static LMICWrapper::SendError encode(const Source & src, Message & dest, uint8_t maxPayload);
+ *     static bool decodeUplink(const uint8_t * buf, uint8_t len, Uplink & dest);
+ *     static bool decodeDownlink(const uint8_t * buf, uint8_t len, Downlink & dest);
+ * };
+ *
+ * See ProtobufEndnode, JsonEndnode, CayenneLPPEndnode and RawCodec below.
+ *
+ * Derived (optional) = the endnode class, which lets a completed uplink skip its decoding
+ * when Derived does not declare the typed isTxCompleted(): this is checked at compile time.
+ * Derived declares it public, or declares GenericEndnode<Codec, Derived> friend.
+ * Only Derived itself is checked: a Derived which does not declare the typed isTxCompleted()
+ * must be final, so that no subclass may override it unnoticed (static_assert).
+ * Without Derived, each completed uplink is decoded for the typed isTxCompleted().
+ *
+ * 		class Node final : public GenericEndnode<RawCodec, Node> { ... };
+ */
+template <typename Codec, typename Derived = void>
 class GenericEndnode: public LMICWrapper {
 public:
- 
+
+	using Source = typename Codec::Source;
+	using Uplink = typename Codec::Uplink;
+	using Downlink = typename Codec::Downlink;
+
 	using LMICWrapper::LMICWrapper;
 
 	/*
-	 * Build high-level T object from uint8_t buffer
+	 * Encodes payload directly into an UpstreamMessage slot of the double-ended queue managed by LMICWrapper.
+	 * Back of this deque is sent after call to runLoopOnce()
+	 *
+	 * Returns false if not queued, see lastSendError()
 	 */
-	virtual T deserialize(uint8_t * buffer, uint8_t len) = 0;
+	virtual bool send(const Source & payload, bool ack = Codec::ACK, uint8_t fport = 1, uint8_t priority = 0) {
+		UpstreamMessage * message = reserve(ack, fport, priority);
+		if (message == nullptr) {
+			return false;
+		}
+		SendError error = Codec::encode(payload, *message, maxMessageLen());
+		if (error != SEND_OK) {
+			rollback(error);
+			return false;
+		}
+		return commit();
+	}
 
 	/*
-	 * Fill uint8_t buffer with T object
-	 * 
-	 * Returns size of buffer
+	 * Default send completion policy
+	 *
+	 * Message is decoded before
+	 * Override if needed
 	 */
-	virtual uint8_t serialize(conts T & object, uint8_t * buffer) = 0;
+	virtual bool isTxCompleted(const Uplink & message, const UpstreamMessage & rawMessage) {
+		return LMICWrapper::isTxCompleted(rawMessage);
+	}
 
-    /*
-	 * Push a message built fron Json document to the front of the FIFO waiting queue
+	/*
+	 * Downlink message arrival callback, called if the downlink could be decoded
+	 *
+	 * Override if needed
 	 */
-	virtual bool send(const T & doc, bool ack = false) {
-		T doc = serialize()
-        UpstreamMessage payload(bufferOf(doc), sizeOf(doc), ack);
-		return LMICWrapper::send(payload);
+	virtual void downlinkReceived(const Downlink & message, const DownstreamMessage & rawMessage) {
 	}
 
 	/*
-	 * Default send completion policy
-     *
-     * Override if needed
+	 * true if the typed isTxCompleted() may be overridden: always without Derived
 	 */
-	virtual bool isTxCompleted(const JsonDocument & doc, bool ack) {
-		return ack;
-	};
+	static constexpr bool hasTypedTxCompletion() {
+		return TypedTxCompletion<Derived>::value;
+	}
+
+protected:
 
 	/*
-	 * Downlink message arrival callback
-     *
-     * Override if needed
+	 * Send completion policy
+	 * message is decoded to its original format, unless the typed policy is known to be the default one
 	 */
-	virtual void downlinkReceived(const JsonDocument &) {
+	virtual bool isTxCompleted(const UpstreamMessage & message) override {
+		static_assert(hasTypedTxCompletion() || __is_final(Derived),
+			"Derived does not declare the typed isTxCompleted(): declare Derived final, or declare it");
+		return completion(message, Bool<hasTypedTxCompletion()>());
 	}
 
-protected:
+	virtual void downlinkReceived(const DownstreamMessage & message) override {
+		Downlink payload{};
+		if (Codec::decodeDownlink(message._buf, message._len, payload)) {
+			downlinkReceived(payload, message);
+		}
+	}
+
+private:
+
+	template <bool B>
+	struct Bool {
+	};
+
+	bool completion(const UpstreamMessage & message, Bool<false>) {
+		return LMICWrapper::isTxCompleted(message);
+	}
 
-	virtual bool isTxCompleted(const UpstreamMessage & message, bool ack) override final {
-        JsonDocument doc;
-        deserializeJson(doc, message._buf);
-		return isTxCompleted(doc, ack);
+	bool completion(const UpstreamMessage & message, Bool<true>) {
+		Uplink payload{};
+		Codec::decodeUplink(message._buf, message._len, payload);
+		return isTxCompleted(payload, message);
+	}
+
+	/*
+	 * Class of the typed isTxCompleted() found in a class scope: Derived if it declares one
+	 * Not defined, only used by decltype
+	 */
+	template <typename C>
+	static C * ownerOf(bool (C::*)(const Uplink &, const UpstreamMessage &));
+
+	// Derived declares only the raw isTxCompleted()
+	static void ownerOf(...);
+
+	template <typename A, typename B>
+	struct Same {
+		static constexpr bool value = false;
+	};
+
+	template <typename A>
+	struct Same<A, A> {
+		static constexpr bool value = true;
+	};
+
+	template <typename D, typename = void>
+	struct TypedTxCompletion {
+		static constexpr bool value = Same<decltype(ownerOf(&D::isTxCompleted)), D *>::value;
 	};
 
-	virtual void downlinkReceived(const DownstreamMessage & message) override final {
-        JsonDocument doc;
-        deserializeJson(doc, message._buf);
-        downlinkReceived(doc);
+	template <typename Unused>
+	struct TypedTxCompletion<void, Unused> {
+		static constexpr bool value = true;
+	};
+
+};
+
+/*
+ * Payload view: bytes sent or received as is
+ */
+struct RawPayload {
+	const uint8_t * _buf;
+	uint8_t 		_len;
+
+	// RawPayload { buf, len } in C++11 as well
+	constexpr RawPayload(const uint8_t * buf = nullptr, uint8_t len = 0)
+		: _buf(buf), _len(len)
+	{
+	}
+};
+
+/*
+ * GenericEndnode codec without encoding
+ * Decoded payloads are views over the raw message, valid during the callback
+ */
+struct RawCodec {
+
+	using Source = RawPayload;
+	using Uplink = RawPayload;
+	using Downlink = RawPayload;
+
+	static constexpr bool ACK = false;
+
+	static LMICWrapper::SendError encode(const RawPayload & src, Message & dest, uint8_t maxPayload) {
+		if (src._len > maxPayload) {
+			return LMICWrapper::SEND_PAYLOAD_TOO_LARGE;
+		}
+		memcpy(dest._buf, src._buf, src._len);
+		dest._len = src._len;
+		return LMICWrapper::SEND_OK;
 	}
 
+	static bool decodeUplink(const uint8_t * buf, uint8_t len, RawPayload & dest) {
+		dest._buf = buf;
+		dest._len = len;
+		return true;
+	}
+
+	static bool decodeDownlink(const uint8_t * buf, uint8_t len, RawPayload & dest) {
+		dest._buf = buf;
+		dest._len = len;
+		return true;
+	}
 };
 
+using RawEndnode = GenericEndnode<RawCodec>;
+
 }
 }
@@ -3,7 +3,6 @@
 #include <Arduino.h>
 #include <lmic.h>
 #include <MemberFunction.h>
-#include <ArrayMap.h>
 
 namespace lstl = leuville::simple_template_library;
 using namespace lstl;
@@ -16,6 +15,7 @@ using Callback = MemberFunction<T,void>;
 
 /*
  * Stores a function map (osjob_t, member function pointer)
+ * The callback of a job is found from its index in the register, without search
  * 
  * Intended for use with LMICWrapper::setCallback()
  */
@@ -26,13 +26,27 @@ class JobRegister {
 
     private:
 
-        osjob_t                                     _jobs[SIZ];
-        ArrayMap<osjob_t*, Callback<T>, false, SIZ> _callbacks;
+        osjob_t         _jobs[SIZ];
+        Callback<T>     _callbacks[SIZ];
 
     public:
 
         void define(uint8_t pos, T * target, MemberFuncPtr ptrF) {
-            _callbacks.put(&(_jobs[pos]), Callback<T>(target, ptrF));        
+            _callbacks[pos] = Callback<T>(target, ptrF);
+        }
+
+        /*
+         * true if job is one of the jobs of this register
+         */
+        bool contains(const osjob_t * job) const {
+            return job >= _jobs && job < _jobs + SIZ;
+        }
+
+        /*
+         * index of a job of this register, see contains()
+         */
+        uint8_t indexOf(const osjob_t * job) const {
+            return job - _jobs;
         }
 
         osjob_t & operator[](uint8_t pos) {
@@ -40,7 +54,7 @@ class JobRegister {
         }
 
         Callback<T> & operator[](osjob_t * job) {
-            return _callbacks[job];
+            return _callbacks[indexOf(job)];
         }
 
         /*
@@ -75,5 +89,135 @@ class JobRegister {
 
 };
 
+/*
+ * Time window of a job managed by JobScheduler, in os_getTime() ticks
+ */
+struct JobWindow {
+	ostime_t 	_due = 0;		// earliest run time
+	ostime_t 	_fire = 0;		// run time given to LMIC, within [_due, _due + _jitter]
+	ostime_t 	_jitter = 0;	// accepted delay after _due
+	ostime_t 	_period = 0;	// 0 for a one-shot job
+	bool 		_armed = false;
+};
+
+/*
+ * JobRegister which arms its jobs itself: one-shot or periodic jobs, each one with a jitter window
+ *
+ * Jobs whose windows overlap are set at the same time, so that they are run by a single wakeup.
+ * Periodic jobs are armed again before their callback is called, their due times do not drift.
+ *
+ * node is the endnode which sets the LMIC jobs (LMICWrapper or LMICWrapperT subclass);
+ * its completeJob() has to call dispatch():
+ *
+ *	virtual void completeJob(osjob_t* job) override {
+ *		if (!_jobs.dispatch(job)) {
+ *			LMICWrapper::completeJob(job);
+ *		}
+ *	}
+ */
+template <typename T, uint8_t SIZ = 10>
+class JobScheduler : public JobRegister<T, SIZ> {
+public:
+
+	JobScheduler(T * node): _node(node) {
+	}
+
+	/*
+	 * One-shot job run between delay and delay + jitter ms from now
+	 *
+	 * Returns false if the job could not be set, see LMICWrapper::setCallback()
+	 */
+	bool schedule(uint8_t pos, uint32_t delay, uint32_t jitter = 0) {
+		return arm(pos, os_getTime() + ms2osticks(delay), 0, ms2osticks(jitter));
+	}
+
+	/*
+	 * Periodic job run every period ms, first run after one period
+	 * Each run may be delayed by up to jitter ms to share a wakeup with another job
+	 *
+	 * Returns false if the job could not be set, see LMICWrapper::setCallback()
+	 */
+	bool schedulePeriodic(uint8_t pos, uint32_t period, uint32_t jitter = 0) {
+		ostime_t ticks = ms2osticks(period);
+		return arm(pos, os_getTime() + ticks, ticks, ms2osticks(jitter));
+	}
+
+	/*
+	 * Stops a one-shot or periodic job
+	 */
+	void cancel(uint8_t pos) {
+		_windows[pos]._armed = false;
+		_windows[pos]._period = 0;
+		_node->unsetCallback(&(*this)[pos]);
+	}
+
+	bool isScheduled(uint8_t pos) const {
+		return _windows[pos]._armed;
+	}
+
+	/*
+	 * Runs the callback of job, to be called from completeJob()
+	 * A job set by setCallback() instead of this scheduler is run too
+	 *
+	 * Returns false if job does not belong to this scheduler
+	 */
+	bool dispatch(osjob_t * job) {
+		if (!this->contains(job)) {
+			return false;
+		}
+		uint8_t pos = this->indexOf(job);
+		JobWindow & window = _windows[pos];
+		if (window._armed && window._period > 0) {
+			ostime_t due = window._due + window._period;
+			ostime_t late = os_getTime() - due;
+			if (late > 0) {
+				// periods missed (long job, radio busy): skip them, keep the phase
+				due += (late / window._period + 1) * window._period;
+			}
+			arm(pos, due, window._period, window._jitter);
+		} else {
+			window._armed = false;
+		}
+		(*this)[job]();
+		return true;
+	}
+
+protected:
+
+	T * 		_node;
+	JobWindow 	_windows[SIZ];
+
+	/*
+	 * Sets a job at the earliest time of its window already used by another job,
+	 * or at the end of its window; then moves to this time the jobs whose windows contain it
+	 */
+	bool arm(uint8_t pos, ostime_t due, ostime_t period, ostime_t jitter) {
+		JobWindow & window = _windows[pos];
+		window._due = due;
+		window._period = period;
+		window._jitter = jitter;
+		window._fire = due + jitter;
+		for (uint8_t i = 0; i < SIZ; i++) {
+			const JobWindow & other = _windows[i];
+			if (i != pos && other._armed && other._fire - due >= 0 && other._fire - window._fire < 0) {
+				window._fire = other._fire;
+			}
+		}
+		window._armed = _node->setCallbackAt(&(*this)[pos], window._fire);
+		if (!window._armed) {
+			return false;
+		}
+		for (uint8_t i = 0; i < SIZ; i++) {
+			JobWindow & other = _windows[i];
+			if (i != pos && other._armed && other._fire - window._fire > 0 && other._due - window._fire <= 0) {
+				other._fire = window._fire;
+				_node->setCallbackAt(&(*this)[i], other._fire);
+			}
+		}
+		return true;
+	}
+
+};
+
+}
 }
-}
\ No newline at end of file
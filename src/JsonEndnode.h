@@ -10,69 +10,178 @@
 
 #pragma once
 
-#include <LMICWrapper.h>
+#include <GenericEndnode.h>
 #include <ArduinoJson.h>
 
 namespace leuville {
 namespace lora {
 
-class JsonEndnode: public LMICWrapper {
-public:
+/*
+ * Over-the-air encoding of Json documents
+ * MSGPACK is much more compact than JSON text
+ */
+enum class JsonWireFormat : uint8_t {
+	JSON,
+	MSGPACK
+};
 
-	using LMICWrapper::LMICWrapper;
+/*
+ * Json document <-> wire format
+ */
+template <JsonWireFormat FORMAT>
+struct JsonWire {
 
-    /*
-	 * Serialize Json -> String
-	 */
-	String stringFrom(const JsonDocument & doc) {
-		String message;
-		serializeJson(doc, message);
-		return message;
+	static size_t measure(const JsonDocument & doc) {
+		return measure(doc, Format<FORMAT>());
 	}
 
-    /*
-	 * Push a message built fron Json document to the front of the FIFO waiting queue
+	/*
+	 * Serializes doc into buf, without terminating NUL
+	 *
+	 * Returns the number of bytes written, 0 if doc does not fit in size bytes
 	 */
-	virtual bool send(const JsonDocument & doc, bool ack = false) {
-        String msg;
-        serializeJson(doc, msg);
-        const char * content = msg.c_str();
-        UpstreamMessage payload((uint8_t*)content, strlen(content)+1, ack);
-		return LMICWrapper::send(payload);
+	static size_t serialize(const JsonDocument & doc, uint8_t * buf, size_t size) {
+		BufferWriter writer { buf, size, 0, false };
+		size_t len = serialize(doc, writer, Format<FORMAT>());
+		return (writer._full || len != writer._len ? 0 : len);
+	}
+
+	static DeserializationError deserialize(JsonDocument & doc, const uint8_t * buf, uint8_t len) {
+		return deserialize(doc, buf, len, Format<FORMAT>());
 	}
 
+private:
+
+	template <JsonWireFormat F>
+	struct Format {
+	};
+
 	/*
-	 * Default send completion policy
-     *
-     * Override if needed
+	 * ArduinoJson writer into a fixed buffer: unlike serializeJson(doc, char*, size), no byte is kept for a NUL
+	 * _full is set by the first byte which does not fit
 	 */
-	virtual bool isTxCompleted(const JsonDocument & doc, const UpstreamMessage & rawMessage) {
-		return LMICWrapper::isTxCompleted(rawMessage);
+	struct BufferWriter {
+		uint8_t * 	_buf;
+		size_t 		_size;
+		size_t 		_len;
+		bool 		_full;
+
+		size_t write(uint8_t c) {
+			if (_len >= _size) {
+				_full = true;
+				return 0;
+			}
+			_buf[_len++] = c;
+			return 1;
+		}
+
+		size_t write(const uint8_t * src, size_t n) {
+			size_t done = 0;
+			while (done < n && write(src[done]) == 1) {
+				done += 1;
+			}
+			return done;
+		}
 	};
 
+	static size_t measure(const JsonDocument & doc, Format<JsonWireFormat::JSON>) {
+		return measureJson(doc);
+	}
+
+	static size_t measure(const JsonDocument & doc, Format<JsonWireFormat::MSGPACK>) {
+		return measureMsgPack(doc);
+	}
+
+	static size_t serialize(const JsonDocument & doc, BufferWriter & writer, Format<JsonWireFormat::JSON>) {
+		return serializeJson(doc, writer);
+	}
+
+	static size_t serialize(const JsonDocument & doc, BufferWriter & writer, Format<JsonWireFormat::MSGPACK>) {
+		return serializeMsgPack(doc, writer);
+	}
+
+	static DeserializationError deserialize(JsonDocument & doc, const uint8_t * buf, uint8_t len, Format<JsonWireFormat::JSON>) {
+		return deserializeJson(doc, buf, len);
+	}
+
+	static DeserializationError deserialize(JsonDocument & doc, const uint8_t * buf, uint8_t len, Format<JsonWireFormat::MSGPACK>) {
+		return deserializeMsgPack(doc, buf, len);
+	}
+};
+
+/*
+ * GenericEndnode codec for Json documents
+ * FORMAT = encoding used over the air, for uplinks and downlinks
+ */
+template <JsonWireFormat FORMAT>
+struct JsonCodec {
+
+	using Source = JsonDocument;
+	using Uplink = JsonDocument;
+	using Downlink = JsonDocument;
+
+	using Wire = JsonWire<FORMAT>;
+
+	static constexpr bool ACK = false;
+
 	/*
-	 * Downlink message arrival callback
-     *
-     * Override if needed
+	 * The document is serialized once, in place, with the wire format and without terminating NUL.
+	 * The writer is bounded by maxPayload, the max payload of the current data rate (MAX_MESSAGE_LEN if fragmentation
+	 * is enabled): a document which does not fit is SEND_PAYLOAD_TOO_LARGE.
 	 */
-	virtual void downlinkReceived(const JsonDocument & message, const DownstreamMessage & rawMessage) {
+	static LMICWrapper::SendError encode(const JsonDocument & doc, Message & dest, uint8_t maxPayload) {
+		dest._len = Wire::serialize(doc, dest._buf, min((size_t)maxPayload, sizeof(dest._buf)));
+		return (dest._len > 0 ? LMICWrapper::SEND_OK : LMICWrapper::SEND_PAYLOAD_TOO_LARGE);
 	}
 
-protected:
-
-	virtual bool isTxCompleted(const UpstreamMessage & message) override final {
-        JsonDocument doc;
-        deserializeJson(doc, message._buf);
-		return isTxCompleted(doc, message);
-	};
+	static bool decodeUplink(const uint8_t * buf, uint8_t len, JsonDocument & doc) {
+		return !Wire::deserialize(doc, buf, len);
+	}
 
-	virtual void downlinkReceived(const DownstreamMessage & message) override final {
-        JsonDocument doc;
-        deserializeJson(doc, message._buf);
-        downlinkReceived(doc, message);
+	/*
+	 * A downlink which is not valid is delivered as an empty document
+	 */
+	static bool decodeDownlink(const uint8_t * buf, uint8_t len, JsonDocument & doc) {
+		if (Wire::deserialize(doc, buf, len)) {
+			doc.clear();
+		}
+		return true;
 	}
+};
+
+/*
+ * ENDNODE base class exchanging Json documents
+ * FORMAT = encoding used over the air, for uplinks and downlinks
+ * Derived = optional endnode class, see GenericEndnode
+ */
+template <JsonWireFormat FORMAT, typename Derived = void>
+class BasicJsonEndnode: public GenericEndnode<JsonCodec<FORMAT>, Derived> {
+public:
+
+	using Wire = JsonWire<FORMAT>;
+
+	using GenericEndnode<JsonCodec<FORMAT>, Derived>::GenericEndnode;
 
+    /*
+	 * Serialize Json -> String
+	 */
+	String stringFrom(const JsonDocument & doc) {
+		String message;
+		serializeJson(doc, message);
+		return message;
+	}
 };
 
+/*
+ * JsonEndnode sends JSON text, or MessagePack if LEUVILLE_JSON_MSGPACK is defined
+ */
+#if defined(LEUVILLE_JSON_MSGPACK)
+using JsonEndnode = BasicJsonEndnode<JsonWireFormat::MSGPACK>;
+#else
+using JsonEndnode = BasicJsonEndnode<JsonWireFormat::JSON>;
+#endif
+
+using MsgPackEndnode = BasicJsonEndnode<JsonWireFormat::MSGPACK>;
+
 }
 }
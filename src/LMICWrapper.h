@@ -16,12 +16,47 @@
 
 #include <misc-util.h>
 #include <Range.h>
-#include <ArrayDeque.h>
+
+#include <MessageDeque.h>
+#include <LoRaRegion.h>
+#include <Airtime.h>
+#include <PayloadStage.h>
+#include <NodeStats.h>
+#include <EventTrace.h>
+#include <MACCommands.h>
+#include <Fragmentation.h>
+#include <UplinkLog.h>
+#include <SessionStore.h>
 
 #ifndef LEUVILLE_LORA_QUEUE_LEN
 #define LEUVILLE_LORA_QUEUE_LEN 10
 #endif
 
+// number of uplink priority classes, each one has its own queue of LEUVILLE_LORA_QUEUE_LEN messages
+#ifndef LEUVILLE_LORA_PRIORITY_CLASSES
+#define LEUVILLE_LORA_PRIORITY_CLASSES 1
+#endif
+
+// if defined, each priority class stores its messages as variable-size records
+// in a ring of LEUVILLE_LORA_QUEUE_BYTES bytes, instead of LEUVILLE_LORA_QUEUE_LEN full-size messages
+// #define LEUVILLE_LORA_QUEUE_BYTES 512
+
+// max number of LMIC jobs pending at the same time, all endnodes together
+#ifndef LEUVILLE_LORA_MAX_JOBS
+#define LEUVILLE_LORA_MAX_JOBS 16
+#endif
+
+// storage of the state shared by all endnodes (active endnode, OTAA keys given to LMIC, pending jobs):
+// a host program which simulates endnodes in several threads defines it as thread_local
+#ifndef LEUVILLE_LORA_SHARED
+#define LEUVILLE_LORA_SHARED
+#endif
+
+// upper bound of the exponential backoff between two transmissions of a message, in s (see RetryPolicy)
+#ifndef LEUVILLE_LORA_MAX_BACKOFF
+#define LEUVILLE_LORA_MAX_BACKOFF 3600
+#endif
+
 namespace lstl = leuville::simple_template_library;
 
 using namespace lstl;
@@ -133,23 +168,156 @@ struct Message {
 };
 
 /*
- * UpStream message = message buffer + ack request
+ * What happens to a message which isTxCompleted() keeps in the FIFO
+ *
+ * Each transmission is followed by a backoff (_backoff s, doubled each time, up to LEUVILLE_LORA_MAX_BACKOFF).
+ * After _maxAttempts transmissions, the message is dropped, or sent once more unconfirmed (DEMOTE).
+ * A message still queued _ttl s after it was queued is dropped. Ages are measured with os_getTime(),
+ * whose differences span 2^31 ticks (9.5 hours at 62500 ticks/s): older messages count as expired.
+ * 0 = no limit, no backoff: the message is sent again until completed.
+ */
+struct RetryPolicy {
+	enum : uint8_t {
+		DROP = 0,
+		DEMOTE
+	};
+
+	uint8_t 	_maxAttempts;
+	uint8_t 	_action;
+	uint16_t 	_backoff;	// s
+	uint32_t 	_ttl;		// s
+
+	// RetryPolicy { maxAttempts, action, backoff, ttl } in C++11 as well
+	constexpr RetryPolicy(uint8_t maxAttempts = 0, uint8_t action = DROP, uint16_t backoff = 0, uint32_t ttl = 0)
+		: _maxAttempts(maxAttempts), _action(action), _backoff(backoff), _ttl(ttl)
+	{
+	}
+
+	bool defined() const {
+		return _maxAttempts != 0 || _backoff != 0 || _ttl != 0;
+	}
+};
+
+/*
+ * UpStream message = message buffer + ack request + FPort + priority class
+ *
+ * Higher priority messages are sent first (see LEUVILLE_LORA_PRIORITY_CLASSES)
  */
 struct UpstreamMessage : Message {
 	bool 			_ackRequested = false;
 	lmic_tx_error_t _lmicTxError = 0; // set after send 
+	uint8_t			_fport = 1;
+	uint8_t			_priority = 0;
+	uint8_t			_stageTag = 0;	// set by the PayloadStage when sent
+	ostime_t		_enqueueTime = 0;	// os_getTime(), set when queued
+	RetryPolicy		_retry;				// LMICWrapper::setRetryPolicy() if not defined when queued
+	uint8_t			_attempts = 0;		// transmissions not completed by isTxCompleted()
+	bool			_demoted = false;	// sent unconfirmed after _retry._maxAttempts or by AIRTIME_DROP_ACK
+	bool			_backoff = false;	// no transmission before _nextAttempt
+	ostime_t		_nextAttempt = 0;	// os_getTime(), end of the backoff if _backoff
 
 	UpstreamMessage() {}
 	UpstreamMessage(uint8_t* buf, uint8_t len, bool ackRequested = false, u1_t txrxFlags = 0, lmic_tx_error_t lmicTxError = 0)
 		: Message(buf, len, txrxFlags), _ackRequested(ackRequested), _lmicTxError(lmicTxError)
 	{}
+
+	/*
+	 * Resets everything but the buffer content
+	 */
+	void init(bool ackRequested = false, uint8_t fport = 1, uint8_t priority = 0) {
+		_len = 0;
+		_txrxFlags = 0;
+		_ackRequested = ackRequested;
+		_lmicTxError = 0;
+		_fport = fport;
+		_priority = priority;
+		_stageTag = 0;
+		_enqueueTime = 0;
+		_retry = RetryPolicy();
+		_attempts = 0;
+		_demoted = false;
+		_backoff = false;
+		_nextAttempt = 0;
+	}
+};
+
+/*
+ * ArenaDeque record header of an UpstreamMessage: 21 bytes instead of the 32 bytes of its members
+ *
+ * [_len][flags][_txrxFlags][_lmicTxError][_fport][_priority][_stageTag][_attempts]
+ * [_retry._maxAttempts][_retry._backoff, 2 bytes][_retry._ttl, 2 bytes][_enqueueTime, 4 bytes][_nextAttempt, 4 bytes]
+ * _ttl is capped to 65535 s: a message counts as expired after 2^31 ticks (9.5 hours) anyway.
+ */
+template <>
+struct ArenaRecord<UpstreamMessage> {
+	static constexpr uint16_t LEN = 21;
+
+	enum : uint8_t {
+		ACK_REQUESTED	= 0x01,
+		DEMOTED			= 0x02,
+		BACKOFF			= 0x04,
+		DEMOTE			= 0x08		// _retry._action
+	};
+
+	static void pack(const UpstreamMessage & msg, uint8_t * dest) {
+		uint16_t ttl = (msg._retry._ttl > UINT16_MAX ? UINT16_MAX : msg._retry._ttl);
+		dest[0] = msg._len;
+		dest[1] = (msg._ackRequested ? ACK_REQUESTED : 0) | (msg._demoted ? DEMOTED : 0) | (msg._backoff ? BACKOFF : 0)
+			| (msg._retry._action == RetryPolicy::DEMOTE ? DEMOTE : 0);
+		dest[2] = msg._txrxFlags;
+		dest[3] = (uint8_t)(int8_t)msg._lmicTxError;
+		dest[4] = msg._fport;
+		dest[5] = msg._priority;
+		dest[6] = msg._stageTag;
+		dest[7] = msg._attempts;
+		dest[8] = msg._retry._maxAttempts;
+		memcpy(dest + 9, &msg._retry._backoff, 2);
+		memcpy(dest + 11, &ttl, 2);
+		memcpy(dest + 13, &msg._enqueueTime, 4);
+		memcpy(dest + 17, &msg._nextAttempt, 4);
+	}
+
+	static void unpack(const uint8_t * src, UpstreamMessage & msg) {
+		uint16_t ttl;
+		msg._len = src[0];
+		msg._ackRequested = (src[1] & ACK_REQUESTED) != 0;
+		msg._demoted = (src[1] & DEMOTED) != 0;
+		msg._backoff = (src[1] & BACKOFF) != 0;
+		msg._retry._action = (src[1] & DEMOTE ? RetryPolicy::DEMOTE : RetryPolicy::DROP);
+		msg._txrxFlags = src[2];
+		msg._lmicTxError = (int8_t)src[3];
+		msg._fport = src[4];
+		msg._priority = src[5];
+		msg._stageTag = src[6];
+		msg._attempts = src[7];
+		msg._retry._maxAttempts = src[8];
+		memcpy(&msg._retry._backoff, src + 9, 2);
+		memcpy(&ttl, src + 11, 2);
+		msg._retry._ttl = ttl;
+		memcpy(&msg._enqueueTime, src + 13, 4);
+		memcpy(&msg._nextAttempt, src + 17, 4);
+	}
 };
 
 /*
- * Downstream message = message buffer
+ * Downstream message = view over the payload of the received frame (LMIC.frame) + FPort + flags
+ *
+ * Nothing is copied: _buf is only valid during the downlinkReceived() call,
+ * LMIC reuses its frame buffer for the next exchange. Copy the payload to keep it.
  */
-struct DownstreamMessage : Message {
-	using Message::Message;
+struct DownstreamMessage {
+	const uint8_t * _buf = nullptr;
+	uint8_t 		_len = 0;
+	uint8_t 		_port = 0;
+	u1_t 			_txrxFlags = 0;
+
+	DownstreamMessage() {}
+	DownstreamMessage(const uint8_t* buf, uint8_t len, u1_t txrxFlags = 0, uint8_t port = 0)
+		: _buf(buf), _len(len), _port(port), _txrxFlags(txrxFlags)
+	{}
+	bool isAcknowledged() const {
+		return (_txrxFlags & TXRX_ACK) != 0;
+	}
 };
 
 constexpr uint32_t _1mn = 60;
@@ -157,59 +325,253 @@ constexpr uint32_t _1h 	= 60 * _1mn;
 constexpr uint32_t _24h = 24 * _1h;
 constexpr uint32_t _7d 	= 7 * _24h;
 
-// forward for friendship
-void onLMICEvent(void *pUserData, ev_t ev);
+/*
+ * OTAA keys given to LMIC by os_getArtEui(), os_getDevEui() and os_getDevKey():
+ * keys of the active endnode, see LMICWrapperT::activate()
+ * A static of an inline function: one pointer in the program, whatever the translation units.
+ */
+inline const OTAAId *& otaaId() {
+	static LEUVILLE_LORA_SHARED const OTAAId * id = nullptr;
+	return id;
+}
 
 /*
- * LMIC base class
- * - contains singleton reference needed by LMIC callbacks (delegation)
- * - manages LoRaWAN OTAA keys
+ * Types and constants shared by LMICWrapper and LMICWrapperT<>
  */
-class LMICWrapper {
+class LMICWrapperBase {
 public:
 
-	/*
-	 * Returns singleton
-	 */
-	static LMICWrapper & node() { 
-		return *_node; 
-	}
-
 	// for battery management
 	static constexpr Range<u1_t> _rangeLora {MCMD_DEVS_BATT_MIN, MCMD_DEVS_BATT_MAX};
 
-	using LMICdeque = ArrayDeque<UpstreamMessage, true, LEUVILLE_LORA_QUEUE_LEN>;
+	#if defined(LEUVILLE_LORA_QUEUE_BYTES)
+	using LMICdeque = PriorityDeque<ArenaDeque<UpstreamMessage, LEUVILLE_LORA_QUEUE_BYTES>, LEUVILLE_LORA_PRIORITY_CLASSES>;
+	#else
+	using LMICdeque = PriorityDeque<MessageDeque<UpstreamMessage, LEUVILLE_LORA_QUEUE_LEN>, LEUVILLE_LORA_PRIORITY_CLASSES>;
+	#endif
 
 	enum {
 		KEEP_RECENT	= LMICdeque::KEEP_FRONT,
 		KEEP_OLD 	= LMICdeque::KEEP_BACK
 	};
 
-	friend void leuville::lora::onLMICEvent(void *pUserData, ev_t ev);
-	friend void ::os_getArtEui(u1_t* buf);
-	friend void ::os_getDevEui(u1_t* buf);
-	friend void ::os_getDevKey(u1_t* buf);
+	// why the last send() failed, see lastSendError()
+	enum SendError : uint8_t {
+		SEND_OK = 0,
+		SEND_QUEUE_FULL,
+		SEND_ENCODING_FAILED,
+		SEND_PAYLOAD_TOO_LARGE,
+		SEND_AIRTIME_BUDGET
+	};
+
+	// priority classes, values above LEUVILLE_LORA_PRIORITY_CLASSES-1 use the highest class
+	enum {
+		PRIORITY_NORMAL	= 0,
+		PRIORITY_HIGH	= 1,
+		PRIORITY_ALARM	= 2
+	};
+
+	// final outcome of a message, see txOutcome()
+	enum TxOutcome : uint8_t {
+		TX_DELIVERED = 0,		// completed by isTxCompleted()
+		TX_UNCONFIRMED,			// demoted by its RetryPolicy or AIRTIME_DROP_ACK, then completed unconfirmed
+		TX_MAX_ATTEMPTS,		// dropped after RetryPolicy::_maxAttempts
+		TX_EXPIRED,				// dropped after RetryPolicy::_ttl
+		TX_REJECTED				// dropped: too large for a frame at the current data rate (PayloadStage or LMIC)
+	};
+
+	// sleepInterval() when nothing is planned: only an external event wakes the endnode up
+	static constexpr unsigned long SLEEP_UNTIL_EVENT = ~0UL;
+
+	// what send() does with a message which would exceed the airtime budget, see setAirtimePolicy()
+	enum AirtimePolicy : uint8_t {
+		AIRTIME_UNLIMITED = 0,
+		AIRTIME_REJECT,
+		AIRTIME_DEFER,
+		AIRTIME_DROP_ACK
+	};
+
+protected:
+
+	// LMIC jobs pending for this endnode, see isReadyForStandby()
+	uint8_t _jobCount = 0;
+
+	/*
+	 * Endnode which registered each pending LMIC job: LMIC job callbacks only receive the osjob_t
+	 */
+	struct JobOwner {
+		osjob_t * 			_job;
+		LMICWrapperBase * 	_owner;
+	};
+
+	using JobOwners = JobOwner[LEUVILLE_LORA_MAX_JOBS];
+
+	static JobOwners & jobOwners() {
+		static LEUVILLE_LORA_SHARED JobOwners owners;
+		return owners;
+	}
+
+	/*
+	 * Records a job armed by owner, a job armed again is only counted once
+	 *
+	 * Returns false if LEUVILLE_LORA_MAX_JOBS jobs are already pending
+	 */
+	static bool setJobOwner(osjob_t * job, LMICWrapperBase * owner) {
+		JobOwner * free = nullptr;
+		for (JobOwner & entry : jobOwners()) {
+			if (entry._job == job) {
+				entry._owner->_jobCount -= 1;
+				free = &entry;
+				break;
+			}
+			if (entry._job == nullptr && free == nullptr) {
+				free = &entry;
+			}
+		}
+		if (free == nullptr) {
+			return false;
+		}
+		free->_job = job;
+		free->_owner = owner;
+		owner->_jobCount += 1;
+		return true;
+	}
+
+	/*
+	 * Forgets a pending job, returns its owner (nullptr if the job is not pending)
+	 */
+	static LMICWrapperBase * releaseJob(osjob_t * job) {
+		for (JobOwner & entry : jobOwners()) {
+			if (entry._job == job) {
+				entry._job = nullptr;
+				entry._owner->_jobCount -= 1;
+				return entry._owner;
+			}
+		}
+		return nullptr;
+	}
+
+	/*
+	 * Clears the pending jobs of an endnode
+	 */
+	static void releaseJobs(LMICWrapperBase * owner) {
+		for (JobOwner & entry : jobOwners()) {
+			if (entry._job != nullptr && entry._owner == owner) {
+				os_clearCallback(entry._job);
+				entry._job = nullptr;
+			}
+		}
+		owner->_jobCount = 0;
+	}
+};
+
+/*
+ * LMIC base class, static polymorphism (CRTP)
+ * - routes LMIC events and jobs to their endnode, several endnodes may live in the same program
+ * - manages LoRaWAN OTAA keys
+ * - reports received MAC commands through the MACBase callbacks
+ *
+ * Hooks (initLMIC, completeJob, onUserEvent, joined, txComplete, isTxCompleted, txOutcome, downlinkReceived,
+ * isMACCommand, macCommandReceived, hasMessageToSend, isReadyForStandby, network time functions)
+ * are called on Derived and resolved at compile time: Derived hides the ones it needs,
+ * and makes them public or declares LMICWrapperT<Derived> friend. No vtable is involved.
+ *
+ * 		class Node : public LMICWrapperT<Node> {
+ * 			friend class LMICWrapperT<Node>;
+ * 			...
+ * 		protected:
+ * 			bool isTxCompleted(const UpstreamMessage & message) { ... }
+ * 		};
+ *
+ * LMICWrapper is the same class with virtual hooks.
+ */
+template <typename Derived, typename MACBase = MACCommandCallbacks<Derived>>
+class LMICWrapperT : public LMICWrapperBase, public MACBase {
+public:
+
+	/*
+	 * Returns the last endnode constructed or activated
+	 */
+	static Derived & node() { 
+		return static_cast<Derived&>(*_node); 
+	}
 
 	/*
 	 * Constructor
 	 */
-	LMICWrapper(const lmic_pinmap *pinmap,  uint8_t policy = KEEP_RECENT)
+	LMICWrapperT(const lmic_pinmap *pinmap,  uint8_t policy = KEEP_RECENT)
 		: _pinmap(pinmap), _messages(policy)
 	{
-		LMICWrapper::_node = this;
+		_node = this;
+		_messages.setWeight(&frameAirtime);
 	}
 
-	virtual ~LMICWrapper() = default;
+	LMICWrapperT(const LMICWrapperT &) = delete;
+	LMICWrapperT & operator=(const LMICWrapperT &) = delete;
+
+	~LMICWrapperT() {
+		releaseJobs(this);
+		if (otaaId() == &_env) {
+			otaaId() = nullptr;
+		}
+		if (_node == this) {
+			_node = nullptr;
+		}
+	}
 
 	/*
 	 * Initializes LMIC
+	 *
+	 * If a session has been saved by the SessionStore, it is resumed and no JOIN is needed.
 	 */
-	virtual void begin(const OTAAId& env, u4_t network, bool adr = true) {
+	void begin(const OTAAId& env, u4_t network, bool adr = true) {
 		_env = env;
 		os_init_ex(_pinmap);
-		LMIC_registerEventCb(&leuville::lora::onLMICEvent, nullptr);
+		activate();
 		LMIC_reset();
-		initLMIC(network, adr);
+		derived().initLMIC(network, adr);
+		restoreSession();
+	}
+
+	/*
+	 * Makes this endnode the one served by LMIC: LMIC events and OTAA key requests reach it
+	 * Called by begin()
+	 *
+	 * LMIC runs one LoRaWAN session at a time: with several endnodes (simulation), the context
+	 * of LMIC must be switched along with this call. Jobs always reach the endnode which set them.
+	 */
+	void activate() {
+		otaaId() = &_env;
+		_node = this;
+		LMIC_registerEventCb(&LMICWrapperT::eventCallback, this);
+	}
+
+	/*
+	 * Makes the LoRaWAN session persistent, to be called before begin()
+	 *
+	 * The session is saved after JOIN, after each downlink accepted by LMIC (its counter must not go back,
+	 * or a replayed downlink would be accepted), each time LEUVILLE_LORA_FCNT_GAP uplinks have been sent,
+	 * and cleared when LMIC loses it (reset, link dead).
+	 */
+	void setSessionStore(SessionStore * store) {
+		_sessionStore = store;
+	}
+
+	/*
+	 * Saves the current session, returns false if there is no store or no session
+	 */
+	bool saveSession() {
+		if (_sessionStore == nullptr || !_joined) {
+			return false;
+		}
+		LoRaWanSession session;
+		session.capture();
+		if (!_sessionStore->save(session)) {
+			return false;
+		}
+		_fcntLimit = session._seqnoUp;
+		_seqnoDn = session._seqnoDn;
+		return true;
 	}
 
 	/*
@@ -217,32 +579,70 @@ public:
 	 *
 	 * interval = number of milliseconds from now
 	 * exec time = current time + interval
+	 *
+	 * Returns false if LEUVILLE_LORA_MAX_JOBS jobs are already pending
 	 */
-	virtual void setCallback(osjob_t* job, unsigned long interval = 0) final {
-		_sendJobRequested = (job == & _sendJob);
-		auto now = os_getTime();
-		auto when = now + ms2osticks(interval);
-		when = (job == &_sendJob ? max(now + ms2osticks(dutyCycleWaitTimeInterval()),when) : when);
-		_jobCount += 1;
-		os_setTimedCallback(job, when, LMICWrapper::jobCallback);
+	bool setCallback(osjob_t* job, unsigned long interval = 0) {
+		if (job == &_sendJob) {
+			unsigned long wait = dutyCycleWaitTimeInterval();
+			_stats._dutyWait += (wait > interval ? wait - interval : 0);
+			interval = max(wait, interval);
+		}
+		return setCallbackAt(job, os_getTime() + ms2osticks(interval));
+	}
+
+	bool setCallback(osjob_t& job, unsigned long interval = 0) {
+		return setCallback(&job, interval);
 	}
 
-	virtual void setCallback(osjob_t& job, unsigned long interval = 0) final {
-		setCallback(&job, interval);
+	/*
+	 * Add a job to the callback list managed by LMIC, at a given time (os_getTime() ticks)
+	 *
+	 * A job already pending is moved, and still counted once.
+	 * Returns false if LEUVILLE_LORA_MAX_JOBS jobs are already pending
+	 */
+	bool setCallbackAt(osjob_t* job, ostime_t when) {
+		if (!setJobOwner(job, this)) {
+			return false;
+		}
+		_sendJobRequested = _sendJobRequested || (job == &_sendJob);
+		os_setTimedCallback(job, when, LMICWrapperT::jobCallback);
+		return true;
 	}
 
 	/*
-	 * Clear a callback job
+	 * Clear a callback job, nothing is done if it is not pending
 	 */
-	virtual void unsetCallback(osjob_t* job) final {
-		_jobCount -= 1;
-		os_clearCallback(job);
+	void unsetCallback(osjob_t* job) {
+		if (releaseJob(job) != nullptr) {
+			os_clearCallback(job);
+		}
+		_sendJobRequested = _sendJobRequested && (job != &_sendJob);
 	}
 
-	virtual void unsetCallback(osjob_t& job) final {
+	void unsetCallback(osjob_t& job) {
 		unsetCallback(&job);
 	}
 
+	/*
+	 * Returns true if job has been set by setCallback() and not performed or cleared yet
+	 */
+	bool isPending(const osjob_t* job) const {
+		for (const JobOwner & entry : jobOwners()) {
+			if (entry._job == job) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*
+	 * Number of LMIC jobs pending for this endnode
+	 */
+	uint8_t pendingJobs() const {
+		return _jobCount;
+	}
+
 	/*
 	 * Return the time interval you have to wait to be able to send a message
 	 * according to the duty cycle.
@@ -250,171 +650,817 @@ public:
 	 * Returns a number of ms
 	 */
 	unsigned long dutyCycleWaitTimeInterval() {
-		unsigned long now = osticks2ms(os_getTime());
-		unsigned long when = osticks2ms(LMIC.globalDutyAvail);
-		when = (when <= now ? 0 : when-now);  
-		return when;
+		ostime_t wait = LMIC.globalDutyAvail - os_getTime();
+		return (wait > 0 ? osticks2ms(wait) : 0);
 	}
 
 	/*
 	 * Must be called from loop()
 	 *
 	 * setup a job to send message if needed
-	 * put radio to sleep if nothing to do
+	 * put radio to sleep once each time the endnode becomes idle, see isIdle()
 	 */
-	virtual void runLoopOnce() final {
-		if (!_sendJobRequested && hasMessageToSend() && !isRadioBusy()) {
+	void runLoopOnce() {
+		if (!_sendJobRequested && derived().hasMessageToSend() && !isRadioBusy()) {
 			setCallback(&_sendJob);
 		}
 		os_runloop_once();
-		if (isReadyForStandby()) {
+		bool idle = isIdle();
+		if (idle && !_idle) {
+			persist();
 			os_radio(RADIO_RST);
 		}
+		_idle = idle;
+	}
+
+	/*
+	 * Computes the next time (os_getTime() ticks) this endnode has something to do:
+	 * its pending jobs, the LMIC radio job (TX, RX windows, JOIN) and the duty cycle release of a waiting message.
+	 * A time already reached is returned as os_getTime().
+	 *
+	 * Returns false if nothing is planned
+	 */
+	bool nextWakeup(ostime_t & when) {
+		bool planned = false;
+		when = 0;
+		auto plan = [&](ostime_t time) {
+			if (!planned || time - when < 0) {
+				when = time;
+			}
+			planned = true;
+		};
+		for (const JobOwner & entry : jobOwners()) {
+			if (entry._job != nullptr && entry._owner == this) {
+				plan(entry._job->deadline);
+			}
+		}
+		if (isRadioBusy()) {
+			plan(LMIC.osjob.deadline);
+		}
+		if (!_sendJobRequested && derived().hasMessageToSend()) {
+			plan(LMIC.globalDutyAvail);
+		}
+		ostime_t now = os_getTime();
+		if (planned && when - now < 0) {
+			when = now;
+		}
+		return planned;
+	}
+
+	/*
+	 * Returns the time in ms the MCU may sleep until nextWakeup(), 0 if something is due now,
+	 * or SLEEP_UNTIL_EVENT if nothing is planned
+	 */
+	unsigned long sleepInterval() {
+		ostime_t when;
+		if (!nextWakeup(when)) {
+			return SLEEP_UNTIL_EVENT;
+		}
+		return osticks2ms(when - os_getTime());
 	}
 
 	/*
-	 * Push a message to the front of the FIFO waiting queue
+	 * Returns true if nothing is due now: joined, radio idle, next wakeup in the future or none
+	 */
+	bool isIdle() {
+		ostime_t when;
+		return _joined && !isRadioBusy() && (!nextWakeup(when) || when - os_getTime() > 0);
+	}
+
+	/*
+	 * Push a message to the front of the FIFO waiting queue of its priority class
 	 *
 	 * If FIFO is full, oldest message is removed if policy is KEEP_RECENT then current message is queued
 	 * 
 	 * Returns true if message queued, false otherwise
 	 */
-	virtual bool send(const UpstreamMessage & message) {
-		return _messages.push_front(message);
+	bool send(const UpstreamMessage & message) {
+		rollback();
+		if (needsFragments(message)) {
+			return queueFragments(message, message._buf, message._len);
+		}
+		if (!admit(message)) {
+			return false;
+		}
+		uint8_t cls = LMICdeque::classOf(message._priority);
+		uint8_t size = _messages[cls].size();
+		return checkQueued(cls, size, _messages[cls].push_front(message));
 	}
 
 	/*
-	 * Returns true is there at least one message waiting to be sent
+	 * Returns the reason why the last send() or commit() returned false
 	 */
-	virtual bool hasMessageToSend() {
-		return(_messages.size() > 0);
+	SendError lastSendError() const {
+		return _sendError;
 	}
 
-	/* 
-	 * Start JOIN sequence
+	/*
+	 * Zero-copy enqueue, step 1
+	 *
+	 * Returns a message slot of the FIFO to be filled in place (_buf and _len),
+	 * or nullptr if the FIFO of this priority is full and its policy is KEEP_OLD.
+	 * The message is queued by commit() and forgotten by rollback().
+	 * No other message may be sent between reserve() and commit()/rollback().
+	 * Messages queued this way do not go through send(const UpstreamMessage&).
 	 */
-	virtual void startJoining() {
-		LMIC_startJoining();
+	UpstreamMessage * reserve(bool ackRequested = false, uint8_t fport = 1, uint8_t priority = 0) {
+		rollback();
+		uint8_t cls = LMICdeque::classOf(priority);
+		if (_messages[cls].full() && _messages[cls].policy() == KEEP_OLD) {
+			_sendError = SEND_QUEUE_FULL;
+			_stats._dropsOld += 1;
+			return nullptr;
+		}
+		_reserved = _messages[cls].reserve_front();
+		_reserved->init(ackRequested, fport, priority);
+		return _reserved;
 	}
 
 	/*
-	 * Returns true if LMIC radio is pending
+	 * Zero-copy enqueue, step 2
+	 *
+	 * Returns true if the reserved message is queued, false otherwise
 	 */
-	bool isRadioBusy() {
-		return (LMIC.opmode & OP_TXRXPEND) || (LMIC.opmode & OP_TXDATA) || (LMIC.opmode & OP_POLL) || (LMIC.opmode & OP_JOINING);
+	bool commit() {
+		if (_reserved != nullptr && needsFragments(*_reserved)) {
+			UpstreamMessage message = *_reserved;
+			return queueFragments(message, message._buf, message._len);
+		}
+		if (_reserved == nullptr || !admit(*_reserved)) {
+			_reserved = nullptr;
+			return false;
+		}
+		uint8_t cls = LMICdeque::classOf(_reserved->_priority);
+		uint8_t size = _messages[cls].size();
+		_reserved = nullptr;
+		return checkQueued(cls, size, _messages[cls].commit_front());
 	}
 
 	/*
-	 * Return true if the device can be put in standby mode.
+	 * Zero-copy enqueue: cancels reserve()
+	 *
+	 * error is reported by lastSendError()
 	 */
-	virtual bool isReadyForStandby() {
-		return _joined && (_jobCount == 0) && !hasMessageToSend() && !isRadioBusy();
+	void rollback(SendError error = SEND_OK) {
+		_reserved = nullptr;
+		_sendError = error;
 	}
-	
+
 	/*
-	 * Returns LoRaWan session keys (netid, netaddr, nwskey, appskey) 
+	 * Set the overflow policy (KEEP_RECENT or KEEP_OLD) of a priority class
 	 */
-	const LoRaWanSessionKeys & getSessionKeys() {
-		return _sessionKeys;
+	void setOverflowPolicy(uint8_t priority, uint8_t policy) {
+		_messages.setPolicy(priority, policy);
 	}
 
-	//----------------------------------------------- LMIC_ENABLE_DeviceTimeReq ---------------------------------------------------------
-	#if defined(LMIC_ENABLE_DeviceTimeReq)
 	/*
-	 * This method should be called to get the network time
-	 * update done by call to virtual method updateSystemTime(uint32_t)
+	 * Enables or disables uplink aggregation
+	 *
+	 * When enabled, each frame is a container of as many queued messages as fit
+	 * in the max payload of the current data rate, oldest first.
+	 * Each message is prefixed by its length: [len][bytes][len][bytes]...
+	 * The frame is confirmed if one of its messages requests an ack.
+	 * The application server must always decode frames as containers in this mode,
+	 * even if they hold a single message.
 	 */
-	virtual void requestNetworkTime() {		
-		if (_joined) {
-			LMIC_requestNetworkTime(LMICWrapper::networkTimeCallback, nullptr);
-		}
-	} 
+	void setAggregation(bool enabled) {
+		_aggregate = enabled;
+	}
+
+	bool isAggregationEnabled() const {
+		return _aggregate;
+	}
 
 	/*
-	 * May be overriden to update system time when network time is received
+	 * Enables fragmentation: send() and commit() split a message longer than the max payload
+	 * of the current data rate, like sendFragmented()
 	 */
-	virtual void updateSystemTime(uint32_t networkTime) {
+	void setFragmentation(bool enabled) {
+		_fragmentation = enabled;
+	}
+
+	bool isFragmentationEnabled() const {
+		return _fragmentation;
 	}
 
 	/*
-	 * Returns true is system time has been synced with network time less than a given delay
+	 * Queues a payload of any length as fragments sized to the current data rate (see Fragmentation.h),
+	 * sent on LEUVILLE_LORA_FRAGMENT_FPORT. FragmentReassembler rebuilds the payload and its FPort.
+	 *
+	 * All fragments are queued, or none: lastSendError() tells why.
+	 * Returns false if not queued
 	 */
-	virtual bool isSystemTimeSynced() {
-		return systemTimeAge() < _24h;
+	bool sendFragmented(const uint8_t * payload, uint16_t len, bool ack = false, uint8_t fport = 1, uint8_t priority = 0) {
+		UpstreamMessage model;
+		model.init(ack, fport, priority);
+		return queueFragments(model, payload, len);
 	}
 
 	/*
-	 * Returns when the system time has been given a chance to be updated by network time
-     *
-	 * ie last time a DeviceTimeReq received a successful answer
+	 * Max length of a message given to send(): the max payload of the current data rate
+	 * (less the length byte if aggregation is enabled and the overhead of the PayloadStage),
+	 * or MAX_MESSAGE_LEN if fragmentation is enabled
 	 */
-	virtual uint32_t systemTimeAge() {
-		return (_networkTimeSyncTicks == 0 ? UINT32_MAX : osticks2ms(os_getTime() - _networkTimeSyncTicks) / 1000);
+	uint8_t maxMessageLen() {
+		return _fragmentation ? MAX_MESSAGE_LEN : fragmentLen();
 	}
-	#endif
-	//----------------------------------------------- LMIC_ENABLE_DeviceTimeReq ---------------------------------------------------------
 
 	/*
-	 * Set battery level for DevStatusAns
+	 * Makes the uplink queue persistent
 	 *
-	 */ 
-	template <typename T>
-	u1_t setBatteryLevel(const RangedValue<T> & rangedValue) {
-		return LMIC_setBatteryLevel(
-			scaleValue(rangedValue, _rangeLora)
-		);
+	 * The log is replayed into the queue, then every push and pop of the queue is logged.
+	 * Should be called from setup(), after setOverflowPolicy() if used,
+	 * since the replay applies the overflow policies again.
+	 * Records written by a firmware with another UpstreamMessage layout are skipped
+	 * and counted in stats()._logErrors, like the records which cannot be written.
+	 *
+	 * Returns false if the log cannot be used
+	 */
+	bool setUplinkLog(UplinkLog * log) {
+		_log = nullptr;
+		if (log == nullptr || !log->open()) {
+			return false;
+		}
+		uint16_t errors = _stats._logErrors;
+		log->replay([this](uint8_t type, const uint8_t * data, uint8_t len) {
+			replayLog(type, data, len);
+		});
+		_log = log;
+		if (_stats._logErrors != errors) {
+			// skipped records must not be replayed again with the next ones
+			snapshotLog();
+		}
+		return true;
 	}
 
 	/*
-	 * Set battery level for DevStatusAns
+	 * Writes pending log records, logging the queue again first if the log is filling up
 	 *
-	 * level expected to be between MCMD_DEVS_BATT_MIN and MCMD_DEVS_BATT_MAX
+	 * Called by runLoopOnce() before standby
 	 */
-	u1_t setLoraBatteryLevel(u1_t level) {
-		if (level >= MCMD_DEVS_BATT_MIN && level <= MCMD_DEVS_BATT_MAX)
-			return LMIC_setBatteryLevel(level);
-		else
-			return setNoPowerInfo();
+	void persist() {
+		if (_log != nullptr) {
+			if (_log->needsSnapshot()) {
+				snapshotLog();
+			}
+			if (!_log->commit()) {
+				_stats._logErrors += 1;
+			}
+		}
 	}
 
 	/*
-	 * Set battery level for DevStatusAns : MCMD_DEVS_EXT_POWER
+	 * Returns the max application payload allowed by the current data rate
+	 * and by the LMIC frame buffer (MAX_FRAME_LEN, 64 bytes by default)
 	 */
-	u1_t setExternalPower() {
-		return LMIC_setBatteryLevel(MCMD_DEVS_EXT_POWER);
+	uint8_t maxPayloadLen() {
+		return min(leuville::lora::maxPayloadLen(LMIC.datarate), (uint8_t)(MAX_FRAME_LEN - LORAWAN_OVERHEAD));
 	}
 
 	/*
-	 * Set battery level for DevStatusAns : MCMD_DEVS_BATT_NOINFO
+	 * Performance counters
 	 */
-	u1_t setNoPowerInfo() {
-		return LMIC_setBatteryLevel(MCMD_DEVS_BATT_NOINFO);
+	const NodeStats & stats() const {
+		return _stats;
 	}
 
-protected:
+	void resetStats() {
+		_stats.reset();
+	}
 
-	// singleton
-	static LMICWrapper* _node;
+	/*
+	 * Last LMIC and LMICWrapper events, see EventTrace::dump() and EventTrace::print()
+	 * Should be printed from loop(), outside of LMIC callbacks.
+	 */
+	const EventTrace<> & eventTrace() const {
+		return _trace;
+	}
 
-	// device pinmap
+	/*
+	 * Queues the counters as an unconfirmed uplink (see NodeStats::serialize())
+	 *
+	 * Typed endnodes see this message in their isTxCompleted(), like any other.
+	 */
+	bool sendStats(uint8_t fport = LEUVILLE_LORA_STATS_FPORT, uint8_t priority = 0) {
+		static_assert(NodeStats::SIZE <= MAX_FRAME_LEN - LORAWAN_OVERHEAD, "NodeStats exceeds a frame, lower LEUVILLE_LORA_LATENCY_BUCKETS");
+		UpstreamMessage * message = reserve(false, fport, priority);
+		if (message == nullptr) {
+			return false;
+		}
+		message->_len = _stats.serialize(message->_buf, MAX_MESSAGE_LEN);
+		return commit();
+	}
+
+	/*
+	 * Sets the stage which encodes payloads when they are sent (nullptr = payloads sent as queued)
+	 */
+	void setPayloadStage(PayloadStage * stage) {
+		_stage = stage;
+	}
+
+	/*
+	 * Time-on-air of a message sent alone at the current data rate, in microseconds
+	 */
+	uint32_t airtimeOf(const UpstreamMessage & message) {
+		return timeOnAir(LMIC.datarate, message._len);
+	}
+
+	/*
+	 * Silence imposed by the duty cycle once message is sent at the current data rate, in ms
+	 */
+	uint32_t dutyCycleDebtOf(const UpstreamMessage & message) {
+		return dutyCycleDebt(airtimeOf(message)) / 1000;
+	}
+
+	/*
+	 * Airtime admission control
+	 *
+	 * budget = airtime allowed per hour, in microseconds (36 s = 1% by default)
+	 * Except with AIRTIME_UNLIMITED, a frame is sent only when the budget holds its airtime.
+	 * A message which would exceed the budget when queued, counting the airtime of the messages
+	 * already queued and not sent yet (see queuedAirtime()), is:
+	 * - AIRTIME_REJECT: not queued, lastSendError() returns SEND_AIRTIME_BUDGET
+	 * - AIRTIME_DEFER: queued, it waits for the budget
+	 * - AIRTIME_DROP_ACK: queued with its ack request dropped (no retransmission, no downlink),
+	 *   it waits for the budget; the data rate and payload are unchanged
+	 */
+	void setAirtimePolicy(AirtimePolicy policy, uint32_t budget = AirtimeBudget::HOUR_MS * 1000 / LEUVILLE_LORA_DUTY_CYCLE) {
+		_airtimePolicy = policy;
+		_airtime.setBudget(budget);
+	}
+
+	/*
+	 * Default RetryPolicy, given to the messages queued without their own
+	 *
+	 * Default: no limit, a message is sent again until isTxCompleted() returns true.
+	 */
+	void setRetryPolicy(const RetryPolicy & policy) {
+		_retryPolicy = policy;
+	}
+
+	/*
+	 * Airtime (us) of the queued messages not given to LMIC yet, one frame each at the current data rate
+	 *
+	 * The queues keep the total up to date, it is computed again when the data rate changes.
+	 */
+	uint32_t queuedAirtime() {
+		uint32_t airtime = _messages.weight(LMIC.datarate);
+		LMICdeque::queue_type & queue = _messages[_txClass];
+		for (uint8_t i = 0; i < _txCount && _txPos + i < queue.size(); i++) {
+			airtime -= timeOnAir(LMIC.datarate, queue.lengthAt(_txPos + i));
+		}
+		return airtime;
+	}
+
+	/*
+	 * Airtime spent by uplinks, whatever the policy
+	 */
+	AirtimeBudget & airtimeBudget() {
+		return _airtime;
+	}
+
+	/*
+	 * Returns true is there at least one message waiting to be sent
+	 */
+	bool hasMessageToSend() {
+		return(_messages.size() > 0);
+	}
+
+	/* 
+	 * Start JOIN sequence
+	 */
+	void startJoining() {
+		LMIC_startJoining();
+	}
+
+	/*
+	 * Returns true if LMIC radio is pending
+	 */
+	bool isRadioBusy() {
+		return (LMIC.opmode & OP_TXRXPEND) || (LMIC.opmode & OP_TXDATA) || (LMIC.opmode & OP_POLL) || (LMIC.opmode & OP_JOINING);
+	}
+
+	/*
+	 * Return true if the device can be put in standby mode.
+	 */
+	bool isReadyForStandby() {
+		return _joined && (_jobCount == 0) && !derived().hasMessageToSend() && !isRadioBusy();
+	}
+	
+	/*
+	 * Returns LoRaWan session keys (netid, netaddr, nwskey, appskey) 
+	 */
+	const LoRaWanSessionKeys & getSessionKeys() {
+		return _sessionKeys;
+	}
+
+	//----------------------------------------------- LMIC_ENABLE_DeviceTimeReq ---------------------------------------------------------
+	#if defined(LMIC_ENABLE_DeviceTimeReq)
+	/*
+	 * This method should be called to get the network time
+	 * update done by call to updateSystemTime(uint32_t)
+	 */
+	void requestNetworkTime() {		
+		if (_joined) {
+			LMIC_requestNetworkTime(LMICWrapperT::networkTimeCallback, this);
+		}
+	} 
+
+	/*
+	 * May be overriden to update system time when network time is received
+	 */
+	void updateSystemTime(uint32_t networkTime) {
+	}
+
+	/*
+	 * Returns true is system time has been synced with network time less than a given delay
+	 */
+	bool isSystemTimeSynced() {
+		return derived().systemTimeAge() < _24h;
+	}
+
+	/*
+	 * Returns when the system time has been given a chance to be updated by network time
+     *
+	 * ie last time a DeviceTimeReq received a successful answer
+	 */
+	uint32_t systemTimeAge() {
+		return (_networkTimeSyncTicks == 0 ? UINT32_MAX : osticks2ms(os_getTime() - _networkTimeSyncTicks) / 1000);
+	}
+	#endif
+	//----------------------------------------------- LMIC_ENABLE_DeviceTimeReq ---------------------------------------------------------
+
+	/*
+	 * Set battery level for DevStatusAns
+	 *
+	 */ 
+	template <typename T>
+	u1_t setBatteryLevel(const RangedValue<T> & rangedValue) {
+		return LMIC_setBatteryLevel(
+			scaleValue(rangedValue, _rangeLora)
+		);
+	}
+
+	/*
+	 * Set battery level for DevStatusAns
+	 *
+	 * level expected to be between MCMD_DEVS_BATT_MIN and MCMD_DEVS_BATT_MAX
+	 */
+	u1_t setLoraBatteryLevel(u1_t level) {
+		if (level >= MCMD_DEVS_BATT_MIN && level <= MCMD_DEVS_BATT_MAX)
+			return LMIC_setBatteryLevel(level);
+		else
+			return setNoPowerInfo();
+	}
+
+	/*
+	 * Set battery level for DevStatusAns : MCMD_DEVS_EXT_POWER
+	 */
+	u1_t setExternalPower() {
+		return LMIC_setBatteryLevel(MCMD_DEVS_EXT_POWER);
+	}
+
+	/*
+	 * Set battery level for DevStatusAns : MCMD_DEVS_BATT_NOINFO
+	 */
+	u1_t setNoPowerInfo() {
+		return LMIC_setBatteryLevel(MCMD_DEVS_BATT_NOINFO);
+	}
+
+protected:
+
+	// last endnode constructed or activated, see node()
+	static LEUVILLE_LORA_SHARED LMICWrapperT * _node;
+
+	Derived & derived() {
+		return static_cast<Derived&>(*this);
+	}
+
+	// device pinmap
 	const lmic_pinmap *_pinmap;
 
 	// LoRaWAN environment
 	OTAAId _env;
 	LoRaWanSessionKeys _sessionKeys;
 
-	// active osjob counter
-	int _jobCount = 0;
-
 	osjob_t _sendJob;
 	bool _sendJobRequested = false;
 
+	// idle state seen by the last runLoopOnce()
+	bool _idle = false;
+
 	// LoRaWAN JOIN done ?
 	bool _joined = false;
 
+	// persistent LoRaWAN session
+	SessionStore * _sessionStore = nullptr;
+	// uplink counter reserved by the last session save
+	u4_t _fcntLimit = 0;
+	// downlink counter of the last session save
+	u4_t _seqnoDn = 0;
+
+	/*
+	 * Resumes the saved session, if any
+	 */
+	bool restoreSession() {
+		LoRaWanSession session;
+		if (_sessionStore == nullptr || !_sessionStore->load(session)) {
+			return false;
+		}
+		session.restore();
+		_joined = true;
+		_sessionKeys.set();
+		// counters up to the restored one may have been used: reserve new ones
+		saveSession();
+		derived().joined(true);
+		return true;
+	}
+
 	// FIFO messages waiting to be sent
 	LMICdeque _messages;		
 
+	// several messages per frame ?
+	bool _aggregate = false;
+
+	// messages longer than the max payload split by send() ?
+	bool _fragmentation = false;
+	// id of the next fragmented payload
+	uint8_t _fragmentId = 0;
+
+	// number of messages carried by the pending frame
+	uint8_t _txCount = 0;
+	// priority class of these messages
+	uint8_t _txClass = 0;
+	// position of the first one, from the back of the FIFO: older messages wait for their backoff
+	uint8_t _txPos = 0;
+
+	// message slot given by reserve()
+	UpstreamMessage * _reserved = nullptr;
+
+	SendError _sendError = SEND_OK;
+
+	PayloadStage * _stage = nullptr;
+
+	NodeStats _stats;
+
+	EventTrace<> _trace;
+
+	void trace(uint8_t event, uint8_t arg = 0) {
+		_trace.record(os_getTime(), event, arg, LMIC.opmode, (uint8_t)min(_messages.size(), (uint16_t)UINT8_MAX), LMIC.txrxFlags);
+	}
+
+	AirtimePolicy _airtimePolicy = AIRTIME_UNLIMITED;
+	AirtimeBudget _airtime;
+
+	// depth of the callbacks given a queued message (isTxCompleted(), txOutcome()):
+	// messages they send must not evict it, nor may the view of an ArenaDeque be trusted after them
+	uint8_t _callbacks = 0;
+
+	// given to the messages queued without their own RetryPolicy
+	RetryPolicy _retryPolicy;
+
+	/*
+	 * ItemWeight of the queued messages: airtime (us) of a frame of len bytes at data rate dr
+	 */
+	static uint32_t frameAirtime(uint8_t dr, uint8_t len) {
+		return timeOnAir((dr_t)dr, len);
+	}
+
+	/*
+	 * ms elapsed since a past os_getTime() value
+	 * Only the tick difference is converted: it spans 2^31 ticks, older times give UINT32_MAX.
+	 */
+	static uint32_t elapsedMs(ostime_t since) {
+		ostime_t elapsed = os_getTime() - since;
+		return (elapsed >= 0 ? (uint32_t)osticks2ms(elapsed) : UINT32_MAX);
+	}
+
+	/*
+	 * Returns false if message must be rejected for lack of airtime,
+	 * or because it would evict a message given to a callback (see _callbacks)
+	 */
+	bool admit(const UpstreamMessage & message) {
+		if (_callbacks > 0 && !_messages[LMICdeque::classOf(message._priority)].fits(1, message._len)) {
+			_sendError = SEND_QUEUE_FULL;
+			_stats._dropsOld += 1;
+			return false;
+		}
+		if (_airtimePolicy == AIRTIME_REJECT && !_airtime.allows(queuedAirtime() + airtimeOf(message), os_getTime())) {
+			_sendError = SEND_AIRTIME_BUDGET;
+			_stats._dropsAirtime += 1;
+			return false;
+		}
+		return true;
+	}
+
+	/*
+	 * Length of the fragments: an aggregated frame adds a length byte, the PayloadStage its overhead
+	 */
+	uint8_t fragmentLen() {
+		return maxPayloadLen() - (_aggregate ? 1 : 0) - (_stage != nullptr ? _stage->overhead() : 0);
+	}
+
+	bool needsFragments(const UpstreamMessage & message) {
+		return _fragmentation && message._len > fragmentLen();
+	}
+
+	/*
+	 * Queues all the fragments of a payload, or none
+	 * model gives the ack request, FPort, priority class and RetryPolicy
+	 *
+	 * The whole set is checked first (size, queue room, airtime), then queued without admit():
+	 * the fragments cannot be refused one by one.
+	 */
+	bool queueFragments(const UpstreamMessage & model, const uint8_t * payload, uint16_t len) {
+		rollback();
+		uint8_t fragmentLen = this->fragmentLen();
+		uint16_t count = fragmentCount(len, fragmentLen);
+		uint8_t cls = LMICdeque::classOf(model._priority);
+		uint16_t bytes = len + 1 + count * FRAGMENT_HEADER_LEN;
+		if (count == 0 || count > UINT8_MAX || !_messages[cls].fits(count, bytes, true)) {
+			// larger than the queue itself, whatever its content
+			rollback(SEND_PAYLOAD_TOO_LARGE);
+			_stats._rejected += 1;
+			return false;
+		}
+		bool evict = (_messages[cls].policy() == KEEP_RECENT && _callbacks == 0);
+		if (!_messages[cls].fits(count, bytes, evict)) {
+			rollback(SEND_QUEUE_FULL);
+			_stats._dropsOld += 1;
+			return false;
+		}
+		uint8_t lastLen = FRAGMENT_HEADER_LEN + (len + 1 - (count - 1) * (fragmentLen - FRAGMENT_HEADER_LEN));
+		uint32_t airtime = (count - 1) * timeOnAir(LMIC.datarate, fragmentLen) + timeOnAir(LMIC.datarate, lastLen);
+		if (_airtimePolicy == AIRTIME_REJECT && !_airtime.allows(queuedAirtime() + airtime, os_getTime())) {
+			rollback(SEND_AIRTIME_BUDGET);
+			_stats._dropsAirtime += 1;
+			return false;
+		}
+		uint8_t id = _fragmentId++;
+		for (uint8_t index = 0; index < count; index++) {
+			UpstreamMessage * fragment = _messages[cls].reserve_front();
+			fragment->init(model._ackRequested, LEUVILLE_LORA_FRAGMENT_FPORT, model._priority);
+			fragment->_retry = model._retry;
+			fragment->_len = writeFragment(fragment->_buf, fragmentLen, id, index, count, model._fport, payload, len);
+			uint8_t size = _messages[cls].size();
+			checkQueued(cls, size, _messages[cls].commit_front());
+		}
+		return true;
+	}
+
+	/*
+	 * Returns true if a frame of len bytes must wait for the airtime budget
+	 * The send job is then scheduled when the budget allows it.
+	 */
+	bool deferForAirtime(uint8_t len) {
+		if (_airtimePolicy == AIRTIME_UNLIMITED) {
+			return false;
+		}
+		uint32_t wait = _airtime.waitTime(timeOnAir(LMIC.datarate, len), os_getTime());
+		if (wait > 0) {
+			setCallback(&_sendJob, wait);
+		}
+		return wait > 0;
+	}
+
+	/*
+	 * A push into a full KEEP_RECENT FIFO drops its oldest messages,
+	 * which may belong to the pending frame
+	 *
+	 * size = size of the FIFO before the push
+	 */
+	bool checkQueued(uint8_t cls, uint8_t size, bool queued) {
+		_sendError = (queued ? SEND_OK : SEND_QUEUE_FULL);
+		if (!queued) {
+			_stats._dropsOld += 1;
+			return false;
+		}
+		uint8_t dropped = size + 1 - _messages[cls].size();
+		_stats._dropsRecent += dropped;
+		_stats.depth(_messages.size());
+		if (cls == _txClass) {
+			// back messages dropped: the skipped ones, then those of the pending frame
+			uint8_t skipped = min(dropped, _txPos);
+			_txPos -= skipped;
+			dropped -= skipped;
+			_txCount = (dropped < _txCount ? _txCount - dropped : 0);
+		}
+		trace(TRACE_QUEUED, cls);
+		UpstreamMessage * front = _messages[cls].frontPtr();
+		front->_enqueueTime = os_getTime();
+		if (!front->_retry.defined()) {
+			front->_retry = _retryPolicy;
+		}
+		// front is queued: queuedAirtime() counts it
+		if (_airtimePolicy == AIRTIME_DROP_ACK && front->_ackRequested && !_airtime.allows(queuedAirtime(), os_getTime())) {
+			front->_ackRequested = false;
+			front->_demoted = true;
+		}
+		_messages[cls].sync(_messages[cls].size() - 1);
+		if (_log != nullptr) {
+			logMessage(UplinkLog::PUSH, cls, *front);
+			if (_log->needsSnapshot()) {
+				snapshotLog();
+			}
+		}
+		return queued;
+	}
+
+	/*
+	 * Removes a message of a priority class, pos counted from the back (0 = oldest)
+	 */
+	void popMessage(uint8_t cls, uint8_t pos = 0) {
+		if (pos == 0) {
+			if (_messages[cls].pop_back()) {
+				appendLog(UplinkLog::POP | (cls << 4));
+			}
+		} else if (_messages[cls].erase(pos)) {
+			appendLog(UplinkLog::ERASE | (cls << 4), &pos, 1);
+		}
+	}
+
+	// persistent copy of the FIFO
+	UplinkLog * _log = nullptr;
+
+	// UpstreamMessage members which follow _buf
+	static constexpr uint8_t UPSTREAM_META = sizeof(UpstreamMessage) - MAX_MESSAGE_LEN;
+
+	// format of the PUSH records, to increase when the meaning of the UpstreamMessage members changes
+	static constexpr uint8_t LOG_FORMAT = 1;
+
+	// PUSH record = [LOG_FORMAT][UPSTREAM_META][UpstreamMessage members which follow _buf][payload]
+	static constexpr uint8_t LOG_HEADER = 2;
+
+	static uint8_t * metaOf(const UpstreamMessage & message) {
+		return (uint8_t*)&message + MAX_MESSAGE_LEN;
+	}
+
+	/*
+	 * A record which cannot be written is counted: the log is full or the storage failed
+	 */
+	void appendLog(uint8_t type, const uint8_t * data1 = nullptr, uint8_t len1 = 0, const uint8_t * data2 = nullptr, uint8_t len2 = 0) {
+		if (_log != nullptr && !_log->append(type, data1, len1, data2, len2)) {
+			_stats._logErrors += 1;
+		}
+	}
+
+	void logMessage(uint8_t type, uint8_t cls, const UpstreamMessage & message) {
+		uint8_t record[LOG_HEADER + UPSTREAM_META] = { LOG_FORMAT, UPSTREAM_META };
+		memcpy(record + LOG_HEADER, metaOf(message), UPSTREAM_META);
+		appendLog(type | (cls << 4), record, sizeof(record), message._buf, message._len);
+	}
+
+	/*
+	 * Logs the whole FIFO, so that older log pages may be reused
+	 */
+	void snapshotLog() {
+		appendLog(UplinkLog::BEGIN);
+		for (uint8_t cls = 0; cls < LMICdeque::classes(); cls++) {
+			for (uint8_t pos = 0; pos < _messages[cls].size(); pos++) {
+				logMessage(UplinkLog::PUSH, cls, *_messages[cls].backPtr(pos));
+			}
+		}
+		appendLog(UplinkLog::END);
+	}
+
+	/*
+	 * Applies a log record to the FIFO
+	 */
+	void replayLog(uint8_t type, const uint8_t * data, uint8_t len) {
+		uint8_t cls = type >> 4;
+		switch (type & 0x0F) {
+			case UplinkLog::BEGIN:
+				for (uint8_t i = 0; i < LMICdeque::classes(); i++) {
+					while (_messages[i].pop_back());
+				}
+				break;
+			case UplinkLog::PUSH:
+				// written by another firmware: the members of UpstreamMessage may differ
+				if (len < LOG_HEADER + UPSTREAM_META || data[0] != LOG_FORMAT || data[1] != UPSTREAM_META
+					|| len - LOG_HEADER - UPSTREAM_META > MAX_MESSAGE_LEN) {
+					_stats._logErrors += 1;
+				} else {
+					UpstreamMessage * slot = _messages[cls].reserve_front();
+					memcpy(metaOf(*slot), data + LOG_HEADER, UPSTREAM_META);
+					memcpy(slot->_buf, data + LOG_HEADER + UPSTREAM_META, len - LOG_HEADER - UPSTREAM_META);
+					slot->_enqueueTime = os_getTime();	// time of the previous run is meaningless
+					slot->_backoff = false;
+					_messages[cls].commit_front();
+				}
+				break;
+			case UplinkLog::POP:
+				_messages[cls].pop_back();
+				break;
+			case UplinkLog::ERASE:
+				if (len == 1) {
+					_messages[cls].erase(data[0]);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
 	//----------------------------------------------- LMIC_ENABLE_DeviceTimeReq ---------------------------------------------------------
 	#if defined(LMIC_ENABLE_DeviceTimeReq)
 	osjob_t _timeJob;
@@ -425,7 +1471,7 @@ protected:
 	/*
 	 * Network time callback
 	 */
-	static void networkTimeCallback(void *paramUserUTCTime, int flagSuccess) {
+	static void networkTimeCallback(void *pUserData, int flagSuccess) {
 		if (flagSuccess == 0)
 			return;
 
@@ -457,9 +1503,10 @@ protected:
 		uint32_t requestDelaySec = osticks2ms(ticksNow - ticksRequestSent) / 1000;
 		newTime += requestDelaySec;
 
-		// time effective update is done by instance (polymorphism)
-		LMICWrapper::_node->updateSystemTime(newTime);
-		LMICWrapper::_node->_networkTimeSyncTicks = ticksNow;
+		// time effective update is done by instance
+		LMICWrapperT * node = static_cast<LMICWrapperT*>(pUserData);
+		node->derived().updateSystemTime(newTime);
+		node->_networkTimeSyncTicks = ticksNow;
 	}
 	#endif
 	//----------------------------------------------- LMIC_ENABLE_DeviceTimeReq ---------------------------------------------------------
@@ -467,7 +1514,7 @@ protected:
 	/*
 	 * Set ADR, channels and clock error
 	 */
-	virtual void initLMIC(u4_t network = 0, bool adr = true) {
+	void initLMIC(u4_t network = 0, bool adr = true) {
 		LMIC_setAdrMode(adr ? 1 : 0);
 		if (!adr) {
 			#if defined(CFG_eu868)
@@ -487,10 +1534,22 @@ protected:
 	}
 
 	/*
-	 * Main LMIC job callback
+	 * Main LMIC job callback, delegates to the endnode which set the job
 	 */
 	static void jobCallback(osjob_t* job) { 
-		LMICWrapper::_node->performJob(job); 
+		LMICWrapperT * node = static_cast<LMICWrapperT*>(releaseJob(job));
+		if (node != nullptr) {
+			node->performJob(job);
+		}
+	}
+
+	/*
+	 * LMIC event callback, pUserData = this
+	 */
+	static void eventCallback(void *pUserData, ev_t ev) {
+		LMICWrapperT * node = static_cast<LMICWrapperT*>(pUserData);
+		node->trace(ev);
+		node->derived().onUserEvent(ev);
 	}
 
 	/*
@@ -498,60 +1557,242 @@ protected:
 	 * This job has been previously registered with setCallback()
 	 * If other callbacks are used, override completeJob()
 	 */
-	virtual void performJob(osjob_t* job) final {
-		_jobCount -= 1;
+	void performJob(osjob_t* job) {
 		if (job == &_sendJob) {
 			_sendJobRequested = false;
 			lmicSend();
 		#if defined(LMIC_ENABLE_DeviceTimeReq)
 		} else if (job == &_timeJob) {
-			requestNetworkTime();
+			derived().requestNetworkTime();
 		#endif
 		} else {
-			completeJob(job);
+			derived().completeJob(job);
 		}
 	}
 
 	/*
 	 * This method should be overriden by subclass if other callbacks are used
 	 */
-	virtual void completeJob(osjob_t* job) {
+	void completeJob(osjob_t* job) {
 	}
 
 	/*
 	 * Calls LMIC_setTxData2() if message to send
 	 * request a network time update if delay exceeded
 	 */
-	virtual lmic_tx_error_t lmicSend() final {
+	lmic_tx_error_t lmicSend() {
 		if (isRadioBusy())
 			return LMIC_ERROR_TX_BUSY;
-		UpstreamMessage * msg = _messages.backPtr(); 
-		if (msg != nullptr) {
-			msg->_lmicTxError = LMIC_setTxData2(1, msg->_buf, msg->_len, msg->_ackRequested);
-			return msg->_lmicTxError;
+		_txCount = 0;
+		dropExpired();
+		ostime_t backoff = 0;
+		UpstreamMessage * msg = nextToSend(backoff);
+		if (msg == nullptr) {
+			if (_messages.empty()) {
+				return LMIC_ERROR_TX_FAILED;
+			}
+			setCallback(&_sendJob, osticks2ms(backoff) + 1);	// rounded up: not before the end of the first backoff
+			return LMIC_ERROR_TX_BUSY;
+		}
+		if (_aggregate) {
+			return lmicSendAggregate();
+		}
+		uint8_t frame[MAX_MESSAGE_LEN];
+		uint8_t * payload = msg->_buf;	// LMIC_setTxData2() takes a mutable buffer (xref2u1_t)
+		uint8_t len = msg->_len;
+		uint32_t checkpoint = 0;
+		if (_stage != nullptr) {
+			checkpoint = _stage->checkpoint();
+			payload = frame;
+			len = _stage->encode(msg->_buf, msg->_len, frame, maxPayloadLen(), msg->_stageTag);
+			if (len == 0) {
+				_stage->restore(checkpoint);
+				frameSent(LMIC_ERROR_TX_TOO_LARGE, 0);
+				reject(LMIC_ERROR_TX_TOO_LARGE);
+				return LMIC_ERROR_TX_TOO_LARGE;
+			}
+		}
+		if (deferForAirtime(len)) {
+			restoreStage(checkpoint);
+			return LMIC_ERROR_TX_BUSY;
+		}
+		lmic_tx_error_t error = LMIC_setTxData2(msg->_fport, payload, len, msg->_ackRequested);
+		if (error != LMIC_ERROR_SUCCESS) {
+			restoreStage(checkpoint);
+		}
+		msg = _messages[_txClass].backPtr(_txPos);	// LMIC events may have reached the endnode
+		msg->_lmicTxError = error;
+		_messages[_txClass].sync(_txPos);
+		_txCount = (error == LMIC_ERROR_SUCCESS ? 1 : 0);
+		frameSent(error, len);
+		if (isUnsendable(error)) {
+			reject(error);
+		}
+		return error;
+	}
+
+	/*
+	 * First message which may be sent: highest class first, oldest first within a class,
+	 * messages waiting for their backoff are skipped. Sets _txClass and _txPos.
+	 *
+	 * Returns nullptr if there is none, backoff = ticks until the end of the first backoff
+	 */
+	UpstreamMessage * nextToSend(ostime_t & backoff) {
+		const ostime_t now = os_getTime();
+		bool waiting = false;
+		for (uint8_t cls = LMICdeque::classes(); cls > 0; cls--) {
+			LMICdeque::queue_type & queue = _messages[cls - 1];
+			for (uint8_t pos = 0; pos < queue.size(); pos++) {
+				UpstreamMessage * msg = queue.backPtr(pos);
+				if (msg->_backoff) {
+					ostime_t left = msg->_nextAttempt - now;
+					if (left > 0) {
+						backoff = (waiting ? min(backoff, left) : left);
+						waiting = true;
+						continue;
+					}
+					msg->_backoff = false;
+					queue.sync(pos);
+				}
+				_txClass = cls - 1;
+				_txPos = pos;
+				return msg;
+			}
+		}
+		return nullptr;
+	}
+
+	/*
+	 * Packs as many messages as possible (from the first one to send) into one frame of maxPayloadLen() bytes
+	 * Only messages of the same priority class and FPort share a frame, the first message in backoff ends it.
+	 * Each message goes through the PayloadStage, if any.
+	 * A message which does not fit alone in a frame is dropped (TX_REJECTED).
+	 */
+	lmic_tx_error_t lmicSendAggregate() {
+		LMICdeque::queue_type & queue = _messages[_txClass];
+		uint8_t frame[MAX_MESSAGE_LEN];
+		uint8_t len = 0;
+		uint8_t count = 0;
+		uint8_t fport = 0;
+		bool ack = false;
+		uint8_t tags[MAX_MESSAGE_LEN / 2];
+		const uint8_t maxLen = maxPayloadLen();
+		const uint32_t checkpoint = (_stage != nullptr ? _stage->checkpoint() : 0);
+		for (UpstreamMessage * msg = queue.backPtr(_txPos); msg != nullptr && count < sizeof(tags); msg = queue.backPtr(_txPos + count)) {
+			if (count > 0 && (msg->_fport != fport || msg->_backoff)) {
+				break;
+			}
+			uint8_t encoded[MAX_MESSAGE_LEN];
+			const uint8_t * payload = msg->_buf;
+			uint8_t payloadLen = msg->_len;
+			uint32_t before = 0;
+			if (_stage != nullptr) {
+				before = _stage->checkpoint();
+				payload = encoded;
+				payloadLen = _stage->encode(msg->_buf, msg->_len, encoded, maxLen - 1, tags[count]);
+			}
+			if ((_stage != nullptr && payloadLen == 0) || len + 1 + payloadLen > maxLen) {
+				restoreStage(before);
+				break;
+			}
+			fport = msg->_fport;
+			frame[len++] = payloadLen;
+			memcpy(&frame[len], payload, payloadLen);
+			len += payloadLen;
+			ack = ack || msg->_ackRequested;
+			count += 1;
+		}
+		if (count == 0) {
+			frameSent(LMIC_ERROR_TX_TOO_LARGE, 0);
+			reject(LMIC_ERROR_TX_TOO_LARGE);
+			return LMIC_ERROR_TX_TOO_LARGE;
+		}
+		if (deferForAirtime(len)) {
+			restoreStage(checkpoint);
+			return LMIC_ERROR_TX_BUSY;
+		}
+		lmic_tx_error_t error = LMIC_setTxData2(fport, frame, len, ack);
+		if (error != LMIC_ERROR_SUCCESS) {
+			restoreStage(checkpoint);
+		}
+		for (uint8_t i = 0; i < count; i++) {
+			UpstreamMessage * msg = queue.backPtr(_txPos + i);
+			msg->_lmicTxError = error;
+			if (_stage != nullptr) {
+				msg->_stageTag = tags[i];
+			}
+			queue.sync(_txPos + i);
+		}
+		_txCount = (error == LMIC_ERROR_SUCCESS ? count : 0);
+		frameSent(error, len);
+		if (isUnsendable(error)) {
+			reject(error);
+		}
+		return error;
+	}
+
+	void restoreStage(uint32_t checkpoint) {
+		if (_stage != nullptr) {
+			_stage->restore(checkpoint);
+		}
+	}
+
+	/*
+	 * LMIC_setTxData2() errors which sending again would not fix
+	 */
+	static bool isUnsendable(lmic_tx_error_t error) {
+		return error == LMIC_ERROR_TX_TOO_LARGE || error == LMIC_ERROR_TX_NOT_FEASIBLE;
+	}
+
+	/*
+	 * Drops the first message to send (_txClass, _txPos), which cannot be sent:
+	 * it would otherwise be sent again at each loop and block its class
+	 */
+	void reject(lmic_tx_error_t error) {
+		UpstreamMessage * msg = _messages[_txClass].backPtr(_txPos);
+		msg->_lmicTxError = error;
+		_stats._rejected += 1;
+		finish(*msg, TX_REJECTED);
+		popMessage(_txClass, _txPos);
+	}
+
+	/*
+	 * Accounts for a frame of len bytes given to LMIC_setTxData2()
+	 */
+	void frameSent(lmic_tx_error_t error, uint8_t len) {
+		if (error == LMIC_ERROR_SUCCESS) {
+			_airtime.spend(timeOnAir(LMIC.datarate, len), os_getTime());
+			_stats._frames += 1;
+			trace(TRACE_TXDATA, _txCount);
+		} else {
+			_stats.txError(error);
+			trace(TRACE_TXERROR, -error);
 		}
-		return LMIC_ERROR_TX_FAILED;
 	}
 
 	/*
 	 * LMIC event callback
 	 */
-	virtual void onUserEvent(ev_t ev) {
+	void onUserEvent(ev_t ev) {
 		switch (ev) {
 			case EV_JOINED:
 				_joined = true;
 				_sessionKeys.set();
+				saveSession();
 				#if defined(LMIC_ENABLE_DeviceTimeReq)
-				requestNetworkTime();
+				derived().requestNetworkTime();
 				#endif 
-				joined(true);
+				derived().joined(true);
 				break;
 			case EV_JOIN_FAILED:
 			case EV_REJOIN_FAILED:
 			case EV_RESET:
 			case EV_LINK_DEAD:
 				_joined = false;
-				joined(false);
+				if (_sessionStore != nullptr) {
+					_sessionStore->clear();
+				}
+				derived().joined(false);
 				#if defined(LMIC_ENABLE_DeviceTimeReq)
 				unsetCallback(&_timeJob);
 				#endif
@@ -559,9 +1800,12 @@ protected:
 				LMIC_unjoinAndRejoin();
 				break;
 			case EV_TXCOMPLETE:
-				txComplete();
+				derived().txComplete();
+				if (_joined && (LMIC.seqnoUp >= _fcntLimit || LMIC.seqnoDn != _seqnoDn)) {
+					saveSession();
+				}
 				#if defined(LMIC_ENABLE_DeviceTimeReq)
-				if (! isSystemTimeSynced() && _joined) {
+				if (! derived().isSystemTimeSynced() && _joined) {
 					setCallback(&_timeJob);
 				}
 				#endif
@@ -575,49 +1819,161 @@ protected:
 	 * Called if endnode is joined or not
 	 * May be overriden
 	 */
-	virtual void joined(bool ok) {
+	void joined(bool ok) {
 	}
 
 	/*
 	 * Called by onEvent() calback
 	 *
-	 * removes sent message from the FIFO to avoid another transmission
+	 * removes sent messages from the FIFO to avoid another transmission
+	 * An aggregated frame stops at its first message not completed, which is sent again.
 	 */
-	virtual void txComplete() { 
-		UpstreamMessage *ptr = _messages.backPtr();
-		if (ptr != nullptr) {
+	void txComplete() { 
+		LMICdeque::queue_type & queue = _messages[_txClass];
+		for (; _txCount > 0; _txCount--) {
+			UpstreamMessage *ptr = queue.backPtr(_txPos);
+			if (ptr == nullptr) {
+				break;
+			}
 			ptr->_txrxFlags = LMIC.txrxFlags;
-			if (isTxCompleted(*ptr)) {
-				_messages.pop_back(); // message is removed from FIFO
+			queue.sync(_txPos);
+			if (_stage != nullptr) {
+				_stage->completed(ptr->_buf, ptr->_len, ptr->_stageTag, ptr->isAcknowledged());
 			}
-		}
-		// check if downlink message (RX Window) or MAC command
-		if (isMACCommand(LMIC.frame)) {  
-			macCommandReceived(LMIC.frame);
-		} else if (LMIC.dataLen > 0) {
-			uint8_t buf[MAX_FRAME_LEN];
-			for (uint8_t i = 0; i < LMIC.dataLen; i++) {
-				buf[i] = (uint8_t)LMIC.frame[LMIC.dataBeg + i];
+			if (ptr->_ackRequested) {
+				_stats._confirmed += 1;
+				_stats._acknowledged += (ptr->isAcknowledged() ? 1 : 0);
+			}
+			_callbacks += 1;
+			bool completed = derived().isTxCompleted(*ptr);
+			_callbacks -= 1;
+			ptr = queue.backPtr(_txPos);	// the callback may have sent a message through the view
+			if (!completed) {
+				if (!retry(*ptr)) {
+					queue.sync(_txPos);
+					_stats._retransmissions += 1;
+					break;
+				}
+				popMessage(_txClass, _txPos); // dropped by its RetryPolicy, next messages of the frame are checked
+				continue;
 			}
-			downlinkReceived(DownstreamMessage(buf, LMIC.dataLen, LMIC.txrxFlags));
+			_stats.latency(elapsedMs(ptr->_enqueueTime));
+			finish(*ptr, ptr->_demoted ? TX_UNCONFIRMED : TX_DELIVERED);
+			popMessage(_txClass, _txPos); // message is removed from FIFO
+		}
+		_txCount = 0;
+		// check if downlink message (RX Window) and/or MAC commands
+		if (derived().isMACCommand(LMIC.frame)) {  
+			trace(TRACE_MAC, LMIC.frame[5] & 0x0F);
+			parseMACCommands(LMIC.frame);
+			derived().macCommandReceived(LMIC.frame);
+		}
+		if (downlinkPort() > 0 && LMIC.dataLen > 0) {
+			trace(TRACE_DOWNLINK, LMIC.dataLen);
+			derived().downlinkReceived(DownstreamMessage(LMIC.frame + LMIC.dataBeg, LMIC.dataLen, LMIC.txrxFlags, downlinkPort()));
 		} 
 	}
 
 	/*
-	 * Check if frame is MAC command 
+	 * Applies the RetryPolicy of a message not completed by isTxCompleted()
+	 *
+	 * Returns true if the message has to be removed from the FIFO
 	 */
-	virtual bool isMACCommand(uint8_t *frame) {
-		uint8_t fctrl = frame[5];
-		uint8_t foptsLen = fctrl & 0x0F;
-	    uint8_t fportIndex = 8 + foptsLen;
-    	uint8_t fport = frame[fportIndex];
-		return (fport == 0) || (foptsLen > 0); 
+	bool retry(UpstreamMessage & message) {
+		const RetryPolicy & policy = message._retry;
+		message._attempts += (message._attempts < UINT8_MAX ? 1 : 0);
+		if (isExpired(message)) {
+			finish(message, TX_EXPIRED);
+			return true;
+		}
+		if (policy._maxAttempts > 0 && message._attempts >= policy._maxAttempts) {
+			if (policy._action == RetryPolicy::DEMOTE && message._ackRequested) {
+				message._ackRequested = false;
+				message._demoted = true;
+				return false;
+			}
+			finish(message, TX_MAX_ATTEMPTS);
+			return true;
+		}
+		if (policy._backoff > 0) {
+			uint32_t backoff = (uint32_t)policy._backoff << min(message._attempts - 1, 15);
+			message._nextAttempt = os_getTime() + sec2osticks(min(backoff, (uint32_t)LEUVILLE_LORA_MAX_BACKOFF));
+			message._backoff = true;
+		}
+		return false;
+	}
+
+	bool isExpired(const UpstreamMessage & message) {
+		return message._retry._ttl > 0 && elapsedMs(message._enqueueTime) / 1000 >= message._retry._ttl;
+	}
+
+	/*
+	 * Removes the expired messages from the back of the FIFOs
+	 */
+	void dropExpired() {
+		for (uint8_t cls = 0; cls < LMICdeque::classes(); cls++) {
+			for (UpstreamMessage * msg = _messages[cls].backPtr(); msg != nullptr && isExpired(*msg); msg = _messages[cls].backPtr()) {
+				finish(*msg, TX_EXPIRED);
+				popMessage(cls);
+			}
+		}
+	}
+
+	/*
+	 * Reports the final outcome of a message, before it is removed from the FIFO
+	 */
+	void finish(const UpstreamMessage & message, TxOutcome outcome) {
+		_stats._dropsRetry += (outcome == TX_EXPIRED || outcome == TX_MAX_ATTEMPTS ? 1 : 0);
+		trace(TRACE_OUTCOME, outcome);
+		_callbacks += 1;
+		derived().txOutcome(message, outcome);
+		_callbacks -= 1;
+	}
+
+	/*
+	 * Final outcome of a message, called before it is removed from the FIFO
+	 *
+	 * Override if needed
+	 */
+	void txOutcome(const UpstreamMessage & message, TxOutcome outcome) {
+	}
+
+	/*
+	 * Returns true if a downlink has been received in RX1 or RX2: LMIC.frame holds it
+	 */
+	bool hasDownlink() {
+		return (LMIC.txrxFlags & (TXRX_DNW1 | TXRX_DNW2)) != 0;
+	}
+
+	/*
+	 * FPort of the received downlink, -1 if the frame has no FPort
+	 */
+	int downlinkPort() {
+		return (hasDownlink() && (LMIC.txrxFlags & TXRX_PORT) ? LMIC.frame[LMIC.dataBeg - 1] : -1);
+	}
+
+	/*
+	 * Check if the received downlink carries MAC commands, in FOpts or as FPort 0 payload
+	 */
+	bool isMACCommand(uint8_t *frame) {
+		uint8_t foptsLen = frame[5] & 0x0F;
+		return hasDownlink() && (foptsLen > 0 || downlinkPort() == 0);
+	}
+
+	/*
+	 * Dispatches the MAC commands of the received downlink to the MACCommandHandler callbacks
+	 */
+	void parseMACCommands(const uint8_t *frame) {
+		this->dispatchMACCommands(frame + 8, frame[5] & 0x0F);
+		if (downlinkPort() == 0) {
+			this->dispatchMACCommands(frame + LMIC.dataBeg, LMIC.dataLen);
+		}
 	}
 
 	/*
 	 * Default send completion policy
 	 */
-	virtual bool isTxCompleted(const UpstreamMessage & message) {
+	bool isTxCompleted(const UpstreamMessage & message) {
 		return message._ackRequested ? message.isAcknowledged() : true;
 	};
 
@@ -625,117 +1981,43 @@ protected:
 	 * Downlink message arrival callback
 	 * 
 	 * Override if needed
+	 * The message is a view over LMIC.frame, valid until this callback returns.
 	 */
-	virtual void downlinkReceived(const DownstreamMessage&) {
+	void downlinkReceived(const DownstreamMessage&) {
 	}
 
 	/*
 	 * MAC request arrival callback
 	 * 
 	 * Override if needed
+	 * Called from the LMIC event: printing here delays LMIC, the reception is recorded
+	 * by eventTrace() and decodeFOpts() may be called later from loop().
 	 */
-	virtual void macCommandReceived(uint8_t *frame) {
-		#if defined(LMIC_DEBUG_LEVEL) && LMIC_DEBUG_LEVEL > 0
-		decodeFOpts(LMIC.frame);
-		#endif
+	void macCommandReceived(uint8_t *frame) {
 	}
 
 	#if defined(LMIC_DEBUG_LEVEL) && LMIC_DEBUG_LEVEL > 0
-	String _evNames[21] = {
-		"zero",
-		"EV_SCAN_TIMEOUT", "EV_BEACON_FOUND",
-		"EV_BEACON_MISSED", "EV_BEACON_TRACKED", "EV_JOINING",
-		"EV_JOINED", "EV_RFU1", "EV_JOIN_FAILED", "EV_REJOIN_FAILED",
-		"EV_TXCOMPLETE", "EV_LOST_TSYNC", "EV_RESET",
-		"EV_RXCOMPLETE", "EV_LINK_DEAD", "EV_LINK_ALIVE", "EV_SCAN_FOUND",
-		"EV_TXSTART", "EV_TXCANCELED", "EV_RXSTART", "EV_JOIN_TXCOMPLETE"
-	};
-
-	const char* getMACCommandName(uint8_t cid) {
-		switch (cid) {
-		  case 0x02: return "LinkCheckAns";
-		  case 0x03: return "LinkADRReq";
-		  case 0x04: return "DutyCycleReq";
-		  case 0x05: return "RXParamSetupReq";
-		  case 0x06: return "DevStatusAns";
-		  case 0x07: return "NewChannelReq";
-		  case 0x08: return "RXTimingSetupReq";
-		  case 0x09: return "TxParamSetupReq";
-		  case 0x0A: return "DiChannelAns";
-		  case 0x0D: return "DeviceTimeReq";
-		  case 0x10: return "PingSlotInfoReq";
-		  case 0x11: return "PingSlotChannelAns";
-		  case 0x13: return "BeaconFreqAns";
-		  default: return "Unknown / specific";
-		}
-	  }
-	  
 	void decodeFOpts(uint8_t* frame) {
-		uint8_t fctrl = frame[5];
-		uint8_t foptsLen = fctrl & 0x0F;
-		uint8_t foptsStart = 8;
-	  
+		uint8_t foptsLen = frame[5] & 0x0F;
 		if (foptsLen == 0) {
-		  LMIC_PRINTF_TO.println(F("No MAC commands in FOpts"));
-		  return;
+			LMIC_PRINTF_TO.println(F("No MAC commands in FOpts"));
+			return;
 		}
-	  
 		LMIC_PRINTF_TO.print(F("FOpts ("));
 		LMIC_PRINTF_TO.print(foptsLen);
 		LMIC_PRINTF_TO.println(F(" bytes) :"));
-	  
-		uint8_t i = 0;
-		while (i < foptsLen) {
-		  uint8_t cid = frame[foptsStart + i];
-		  LMIC_PRINTF_TO.print(" → CID 0x");
-		  LMIC_PRINTF_TO.print(cid, HEX);
-		  LMIC_PRINTF_TO.print(" : ");
-		  LMIC_PRINTF_TO.println(getMACCommandName(cid));
-		  i++;
-	  
-		  // Décodage des arguments selon CID
-		  switch (cid) {
-			case 0x02: // LinkCheckAns (margin + gateway count)
-			  if (i + 1 < foptsLen) {
-				uint8_t margin = frame[foptsStart + i];
-				uint8_t gwcnt = frame[foptsStart + i + 1];
-				LMIC_PRINTF_TO.print("   Margin: "); LMIC_PRINTF_TO.println(margin);
-				LMIC_PRINTF_TO.print("   Gateways: "); LMIC_PRINTF_TO.println(gwcnt);
-				i += 2;
-			  }
-			  break;
-	  
-			case 0x03: // LinkADRReq (4 bytes)
-			  if (i + 3 < foptsLen) {
-				LMIC_PRINTF_TO.print("   DataRate_TXPower: 0x"); LMIC_PRINTF_TO.println(frame[foptsStart + i], HEX);
-				LMIC_PRINTF_TO.print("   ChMask: 0x");
-				LMIC_PRINTF_TO.print(frame[foptsStart + i+1], HEX);
-				LMIC_PRINTF_TO.print(" 0x");
-				LMIC_PRINTF_TO.println(frame[foptsStart + i+2], HEX);
-				LMIC_PRINTF_TO.print("   Redundancy: 0x"); LMIC_PRINTF_TO.println(frame[foptsStart + i+3], HEX);
-				i += 4;
-			  }
-			  break;
-	  
-			case 0x04: // DutyCycleReq (1 byte)
-			  if (i < foptsLen) {
-				LMIC_PRINTF_TO.print("   MaxDutyCycle: "); LMIC_PRINTF_TO.println(frame[foptsStart + i], HEX);
-				i += 1;
-			  }
-			  break;
-	  
-			case 0x06: // DevStatusAns (battery + margin)
-			  if (i + 1 < foptsLen) {
-				LMIC_PRINTF_TO.print("   Battery: "); LMIC_PRINTF_TO.println(frame[foptsStart + i]);
-				LMIC_PRINTF_TO.print("   Margin: "); LMIC_PRINTF_TO.println((int8_t)frame[foptsStart + i + 1]); // signed
-				i += 2;
-			  }
-			  break;
-	  
-			default:
-			  LMIC_PRINTF_TO.println("   (undefined)");
-			  break;
-		  }
+		bool complete = forEachMACCommand(frame + 8, foptsLen, [](uint8_t cid, const uint8_t * args, uint8_t len) {
+			LMIC_PRINTF_TO.print(F(" → CID 0x"));
+			LMIC_PRINTF_TO.print(cid, HEX);
+			LMIC_PRINTF_TO.print(F(" : "));
+			LMIC_PRINTF_TO.println(macCommandName(cid));
+			for (uint8_t i = 0; i < len; i++) {
+				LMIC_PRINTF_TO.print(F("   0x"));
+				LMIC_PRINTF_TO.println(args[i], HEX);
+			}
+		});
+		if (!complete) {
+			LMIC_PRINTF_TO.println(F("   (undefined)"));
 		}
 	}
 	  
@@ -756,27 +2038,108 @@ protected:
 	#endif 
 };
 
-/*
- * LoRaWAN endnode singleton
- */
-LMICWrapper * LMICWrapper::_node = nullptr;
+template <typename Derived, typename MACBase>
+LEUVILLE_LORA_SHARED LMICWrapperT<Derived, MACBase> * LMICWrapperT<Derived, MACBase>::_node = nullptr;
 
 /*
- * LMIC use event callback
+ * LMIC base class, dynamic polymorphism: hooks of LMICWrapperT<> are virtual
+ * - reports received MAC commands through the MACCommandHandler callbacks
  */
-void onLMICEvent(void *pUserData, ev_t ev) { 
-	LMICWrapper::_node->onUserEvent(ev); 
-}
+class LMICWrapper : public LMICWrapperT<LMICWrapper, MACCommandHandler> {
+public:
+
+	friend class LMICWrapperT<LMICWrapper, MACCommandHandler>;
+
+	using Base = LMICWrapperT<LMICWrapper, MACCommandHandler>;
+
+	LMICWrapper(const lmic_pinmap *pinmap,  uint8_t policy = KEEP_RECENT)
+		: Base(pinmap, policy)
+	{}
+
+	virtual ~LMICWrapper() = default;
+
+	virtual void begin(const OTAAId& env, u4_t network, bool adr = true) {
+		Base::begin(env, network, adr);
+	}
+
+	virtual bool send(const UpstreamMessage & message) {
+		return Base::send(message);
+	}
+
+	virtual bool hasMessageToSend() {
+		return Base::hasMessageToSend();
+	}
+
+	virtual void startJoining() {
+		Base::startJoining();
+	}
+
+	virtual bool isReadyForStandby() {
+		return Base::isReadyForStandby();
+	}
+
+	#if defined(LMIC_ENABLE_DeviceTimeReq)
+	virtual void requestNetworkTime() {
+		Base::requestNetworkTime();
+	}
+
+	virtual void updateSystemTime(uint32_t networkTime) {
+	}
+
+	virtual bool isSystemTimeSynced() {
+		return Base::isSystemTimeSynced();
+	}
+
+	virtual uint32_t systemTimeAge() {
+		return Base::systemTimeAge();
+	}
+	#endif
+
+protected:
+
+	virtual void initLMIC(u4_t network = 0, bool adr = true) {
+		Base::initLMIC(network, adr);
+	}
+
+	virtual void completeJob(osjob_t* job) {
+	}
+
+	virtual void onUserEvent(ev_t ev) {
+		Base::onUserEvent(ev);
+	}
+
+	virtual void joined(bool ok) {
+	}
+
+	virtual void txComplete() {
+		Base::txComplete();
+	}
+
+	virtual bool isMACCommand(uint8_t *frame) {
+		return Base::isMACCommand(frame);
+	}
+
+	virtual bool isTxCompleted(const UpstreamMessage & message) {
+		return Base::isTxCompleted(message);
+	}
+
+	virtual void txOutcome(const UpstreamMessage & message, TxOutcome outcome) {
+	}
+
+	virtual void downlinkReceived(const DownstreamMessage& message) {
+	}
+
+	virtual void macCommandReceived(uint8_t *frame) {
+	}
+};
 
 }
 }
 
 /*
  * LMIC callbacks
- * call delegation to LMICWrapper singleton
+ * OTAA keys of the last started endnode
  */
-void os_getArtEui (u1_t* buf) 	{ memcpy_P(buf, leuville::lora::LMICWrapper::_node->_env._appEUI, 8);}
-void os_getDevEui (u1_t* buf) 	{ memcpy_P(buf, leuville::lora::LMICWrapper::_node->_env._devEUI, 8);}
-void os_getDevKey (u1_t* buf) 	{ memcpy_P(buf, leuville::lora::LMICWrapper::_node->_env._appKEY, 16);}
-
-
+void os_getArtEui (u1_t* buf) 	{ memcpy_P(buf, leuville::lora::otaaId()->_appEUI, 8);}
+void os_getDevEui (u1_t* buf) 	{ memcpy_P(buf, leuville::lora::otaaId()->_devEUI, 8);}
+void os_getDevKey (u1_t* buf) 	{ memcpy_P(buf, leuville::lora::otaaId()->_appKEY, 16);}
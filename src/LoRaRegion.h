@@ -0,0 +1,70 @@
+/*
+ * Module: LoRaRegion
+ *
+ * Function: regional parameters needed by LMICWrapper (LoRaWAN Regional Parameters 1.0.3)
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <lmic.h>
+
+namespace leuville {
+namespace lora {
+
+/*
+ * Maximum application payload size (N, without FOpts) per data rate
+ *
+ * Unknown data rates and regions fall back to 51 bytes, which is
+ * the smallest common value for the slowest data rates.
+ */
+#if defined(CFG_eu868)
+constexpr uint8_t _maxPayloadLen[] = { 51, 51, 51, 115, 222, 222, 222, 222 };
+#elif defined(CFG_us915)
+constexpr uint8_t _maxPayloadLen[] = { 11, 53, 125, 242, 242 };
+#elif defined(CFG_au915)
+constexpr uint8_t _maxPayloadLen[] = { 51, 51, 51, 115, 242, 242, 242 };
+#elif defined(CFG_as923)
+constexpr uint8_t _maxPayloadLen[] = { 59, 59, 59, 123, 230, 230, 230, 230 };
+#elif defined(CFG_kr920) || defined(CFG_in866)
+constexpr uint8_t _maxPayloadLen[] = { 51, 51, 51, 115, 242, 242 };
+#else
+constexpr uint8_t _maxPayloadLen[] = { 51 };
+#endif
+
+constexpr uint8_t maxPayloadLen(dr_t dr) {
+	return (dr < sizeof(_maxPayloadLen) ? _maxPayloadLen[dr] : 51);
+}
+
+/*
+ * Modulation of a data rate: LoRa spreading factor and bandwidth (kHz)
+ * _sf = 0 stands for FSK 50 kbps
+ *
+ * Unknown data rates and regions fall back to SF12 / 125 kHz, the slowest modulation.
+ */
+struct Modulation {
+	uint8_t 	_sf;
+	uint16_t 	_bw;
+};
+
+#if defined(CFG_eu868) || defined(CFG_as923)
+constexpr Modulation _modulation[] = { {12, 125}, {11, 125}, {10, 125}, {9, 125}, {8, 125}, {7, 125}, {7, 250}, {0, 0} };
+#elif defined(CFG_us915)
+constexpr Modulation _modulation[] = { {10, 125}, {9, 125}, {8, 125}, {7, 125}, {8, 500} };
+#elif defined(CFG_au915)
+constexpr Modulation _modulation[] = { {12, 125}, {11, 125}, {10, 125}, {9, 125}, {8, 125}, {7, 125}, {8, 500} };
+#elif defined(CFG_kr920) || defined(CFG_in866)
+constexpr Modulation _modulation[] = { {12, 125}, {11, 125}, {10, 125}, {9, 125}, {8, 125}, {7, 125} };
+#else
+constexpr Modulation _modulation[] = { {12, 125} };
+#endif
+
+constexpr Modulation modulationOf(dr_t dr) {
+	return (dr < sizeof(_modulation) / sizeof(Modulation) ? _modulation[dr] : Modulation {12, 125});
+}
+
+}
+}
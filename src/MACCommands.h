@@ -0,0 +1,302 @@
+/*
+ * Module: MACCommands
+ *
+ * Function: parser of the LoRaWAN 1.0.x MAC commands received by an end-device
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace leuville {
+namespace lora {
+
+/*
+ * Network to end-device MAC commands (LoRaWAN 1.0.4 and Class B)
+ */
+enum MACCommand : uint8_t {
+	MAC_LINK_CHECK_ANS			= 0x02,
+	MAC_LINK_ADR_REQ			= 0x03,
+	MAC_DUTY_CYCLE_REQ			= 0x04,
+	MAC_RX_PARAM_SETUP_REQ		= 0x05,
+	MAC_DEV_STATUS_REQ			= 0x06,
+	MAC_NEW_CHANNEL_REQ			= 0x07,
+	MAC_RX_TIMING_SETUP_REQ		= 0x08,
+	MAC_TX_PARAM_SETUP_REQ		= 0x09,
+	MAC_DL_CHANNEL_REQ			= 0x0A,
+	MAC_DEVICE_TIME_ANS			= 0x0D,
+	MAC_PING_SLOT_INFO_ANS		= 0x10,
+	MAC_PING_SLOT_CHANNEL_REQ	= 0x11,
+	MAC_BEACON_TIMING_ANS		= 0x12,
+	MAC_BEACON_FREQ_REQ			= 0x13
+};
+
+constexpr uint8_t MAC_UNKNOWN = 0xFF;
+
+/*
+ * Payload length of each command, indexed by CID (MAC_UNKNOWN = RFU or proprietary)
+ */
+constexpr uint8_t _macCommandLen[] = {
+	MAC_UNKNOWN, MAC_UNKNOWN,
+	2, 4, 1, 4, 0, 5, 1, 1, 4,			// 0x02 - 0x0A
+	MAC_UNKNOWN, MAC_UNKNOWN,
+	5,									// 0x0D
+	MAC_UNKNOWN, MAC_UNKNOWN,
+	0, 4, 3, 3							// 0x10 - 0x13
+};
+
+constexpr uint8_t macCommandLen(uint8_t cid) {
+	return (cid < sizeof(_macCommandLen) ? _macCommandLen[cid] : MAC_UNKNOWN);
+}
+
+const char _macCommandNames[][20] PROGMEM = {
+	"Unknown", "LinkCheckAns", "LinkADRReq", "DutyCycleReq", "RXParamSetupReq",
+	"DevStatusReq", "NewChannelReq", "RXTimingSetupReq", "TxParamSetupReq", "DlChannelReq",
+	"DeviceTimeAns", "PingSlotInfoAns", "PingSlotChannelReq", "BeaconTimingAns", "BeaconFreqReq"
+};
+
+inline const __FlashStringHelper * macCommandName(uint8_t cid) {
+	uint8_t index = (cid >= MAC_LINK_CHECK_ANS && cid <= MAC_DL_CHANNEL_REQ ? cid - 1
+		: cid == MAC_DEVICE_TIME_ANS ? 10
+		: cid >= MAC_PING_SLOT_INFO_ANS && cid <= MAC_BEACON_FREQ_REQ ? cid - MAC_PING_SLOT_INFO_ANS + 11
+		: 0);
+	return reinterpret_cast<const __FlashStringHelper *>(_macCommandNames[index]);
+}
+
+/*
+ * Calls visit(cid, args, len) for each command of a FOpts field or of a FPort 0 payload
+ * args points into data: nothing is copied.
+ *
+ * Parsing stops at the first command of unknown length (RFU or proprietary) or truncated.
+ * Returns true if all bytes have been parsed.
+ */
+template <typename F>
+bool forEachMACCommand(const uint8_t * data, uint8_t len, F visit) {
+	uint8_t pos = 0;
+	while (pos < len) {
+		uint8_t cid = data[pos];
+		uint8_t argLen = macCommandLen(cid);
+		if (argLen == MAC_UNKNOWN || pos + 1 + argLen > len) {
+			return false;
+		}
+		visit(cid, data + pos + 1, argLen);
+		pos += 1 + argLen;
+	}
+	return true;
+}
+
+/*
+ * 24 bits frequency of a MAC command, unit = 100 Hz
+ */
+inline uint32_t macCommandFrequency(const uint8_t * bytes) {
+	return (bytes[0] | (bytes[1] << 8) | ((uint32_t)bytes[2] << 16)) * 100;
+}
+
+/*
+ * Calls the typed callback of handler matching one command
+ *
+ * H = MACCommandHandler, or any class with the same callbacks (see MACCommandCallbacks)
+ */
+template <typename H>
+void dispatchMACCommand(H & handler, uint8_t cid, const uint8_t * args) {
+	switch (cid) {
+		case MAC_LINK_CHECK_ANS:
+			handler.linkCheckAnswered(args[0], args[1]);
+			break;
+		case MAC_LINK_ADR_REQ:
+			handler.linkADRRequested(args[0] >> 4, args[0] & 0x0F, args[1] | (args[2] << 8), (args[3] >> 4) & 0x07, args[3] & 0x0F);
+			break;
+		case MAC_DUTY_CYCLE_REQ:
+			handler.dutyCycleRequested(args[0] & 0x0F);
+			break;
+		case MAC_RX_PARAM_SETUP_REQ:
+			handler.rxParamSetupRequested((args[0] >> 4) & 0x07, args[0] & 0x0F, macCommandFrequency(args + 1));
+			break;
+		case MAC_DEV_STATUS_REQ:
+			handler.devStatusRequested();
+			break;
+		case MAC_NEW_CHANNEL_REQ:
+			handler.newChannelRequested(args[0], macCommandFrequency(args + 1), args[4] & 0x0F, args[4] >> 4);
+			break;
+		case MAC_RX_TIMING_SETUP_REQ:
+			handler.rxTimingSetupRequested(max(args[0] & 0x0F, 1));
+			break;
+		case MAC_TX_PARAM_SETUP_REQ:
+			handler.txParamSetupRequested(args[0] & 0x20, args[0] & 0x10, args[0] & 0x0F);
+			break;
+		case MAC_DL_CHANNEL_REQ:
+			handler.dlChannelRequested(args[0], macCommandFrequency(args + 1));
+			break;
+		case MAC_DEVICE_TIME_ANS:
+			handler.deviceTimeAnswered(args[0] | (args[1] << 8) | ((uint32_t)args[2] << 16) | ((uint32_t)args[3] << 24), args[4]);
+			break;
+		case MAC_PING_SLOT_INFO_ANS:
+			handler.pingSlotInfoAnswered();
+			break;
+		case MAC_PING_SLOT_CHANNEL_REQ:
+			handler.pingSlotChannelRequested(macCommandFrequency(args), args[3] & 0x0F);
+			break;
+		case MAC_BEACON_TIMING_ANS:
+			handler.beaconTimingAnswered(args[0] | (args[1] << 8), args[2]);
+			break;
+		case MAC_BEACON_FREQ_REQ:
+			handler.beaconFreqRequested(macCommandFrequency(args));
+			break;
+		default:
+			break;
+	}
+}
+
+/*
+ * Typed MAC command callbacks
+ *
+ * LMIC applies the commands itself: these callbacks let the application observe them.
+ * Frequencies are in Hz, little-endian fields are decoded.
+ */
+class MACCommandHandler {
+public:
+
+	virtual ~MACCommandHandler() = default;
+
+	/*
+	 * margin = demodulation margin of the last uplink (dB above the demodulation floor)
+	 * gwCount = number of gateways which received it
+	 */
+	virtual void linkCheckAnswered(uint8_t margin, uint8_t gwCount) {
+	}
+
+	virtual void linkADRRequested(uint8_t dataRate, uint8_t txPower, uint16_t chMask, uint8_t chMaskCntl, uint8_t nbTrans) {
+	}
+
+	/*
+	 * aggregated duty cycle = 1 / 2^maxDCycle
+	 */
+	virtual void dutyCycleRequested(uint8_t maxDCycle) {
+	}
+
+	virtual void rxParamSetupRequested(uint8_t rx1DrOffset, uint8_t rx2DataRate, uint32_t frequency) {
+	}
+
+	virtual void devStatusRequested() {
+	}
+
+	virtual void newChannelRequested(uint8_t chIndex, uint32_t frequency, uint8_t minDr, uint8_t maxDr) {
+	}
+
+	/*
+	 * delay = RX1 delay in seconds
+	 */
+	virtual void rxTimingSetupRequested(uint8_t delay) {
+	}
+
+	virtual void txParamSetupRequested(bool downlinkDwellTime, bool uplinkDwellTime, uint8_t maxEIRP) {
+	}
+
+	virtual void dlChannelRequested(uint8_t chIndex, uint32_t frequency) {
+	}
+
+	/*
+	 * GPS epoch time of the end of the uplink which carried DeviceTimeReq
+	 * fraction = 1/256 s
+	 */
+	virtual void deviceTimeAnswered(uint32_t seconds, uint8_t fraction) {
+	}
+
+	virtual void pingSlotInfoAnswered() {
+	}
+
+	virtual void pingSlotChannelRequested(uint32_t frequency, uint8_t dataRate) {
+	}
+
+	virtual void beaconTimingAnswered(uint16_t delay, uint8_t channel) {
+	}
+
+	virtual void beaconFreqRequested(uint32_t frequency) {
+	}
+
+	/*
+	 * Dispatches one command to the typed callbacks
+	 */
+	void dispatchMACCommand(uint8_t cid, const uint8_t * args) {
+		leuville::lora::dispatchMACCommand(*this, cid, args);
+	}
+
+	/*
+	 * Dispatches all commands of a FOpts field or of a FPort 0 payload
+	 * Returns false if parsing stopped on an unknown or truncated command
+	 */
+	bool dispatchMACCommands(const uint8_t * data, uint8_t len) {
+		return forEachMACCommand(data, len, [this](uint8_t cid, const uint8_t * args, uint8_t) {
+			dispatchMACCommand(cid, args);
+		});
+	}
+};
+
+/*
+ * Same callbacks as MACCommandHandler, resolved at compile time (CRTP)
+ *
+ * Derived hides the callbacks it needs, they must be public.
+ */
+template <typename Derived>
+class MACCommandCallbacks {
+public:
+
+	void linkCheckAnswered(uint8_t margin, uint8_t gwCount) {
+	}
+
+	void linkADRRequested(uint8_t dataRate, uint8_t txPower, uint16_t chMask, uint8_t chMaskCntl, uint8_t nbTrans) {
+	}
+
+	void dutyCycleRequested(uint8_t maxDCycle) {
+	}
+
+	void rxParamSetupRequested(uint8_t rx1DrOffset, uint8_t rx2DataRate, uint32_t frequency) {
+	}
+
+	void devStatusRequested() {
+	}
+
+	void newChannelRequested(uint8_t chIndex, uint32_t frequency, uint8_t minDr, uint8_t maxDr) {
+	}
+
+	void rxTimingSetupRequested(uint8_t delay) {
+	}
+
+	void txParamSetupRequested(bool downlinkDwellTime, bool uplinkDwellTime, uint8_t maxEIRP) {
+	}
+
+	void dlChannelRequested(uint8_t chIndex, uint32_t frequency) {
+	}
+
+	void deviceTimeAnswered(uint32_t seconds, uint8_t fraction) {
+	}
+
+	void pingSlotInfoAnswered() {
+	}
+
+	void pingSlotChannelRequested(uint32_t frequency, uint8_t dataRate) {
+	}
+
+	void beaconTimingAnswered(uint16_t delay, uint8_t channel) {
+	}
+
+	void beaconFreqRequested(uint32_t frequency) {
+	}
+
+	void dispatchMACCommand(uint8_t cid, const uint8_t * args) {
+		leuville::lora::dispatchMACCommand(static_cast<Derived&>(*this), cid, args);
+	}
+
+	bool dispatchMACCommands(const uint8_t * data, uint8_t len) {
+		return forEachMACCommand(data, len, [this](uint8_t cid, const uint8_t * args, uint8_t) {
+			dispatchMACCommand(cid, args);
+		});
+	}
+};
+
+}
+}
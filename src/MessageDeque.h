@@ -0,0 +1,713 @@
+/*
+ * Module: MessageDeque
+ *
+ * Function: fixed-size double-ended queue used to store LoRaWAN uplink messages
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+namespace leuville {
+namespace lora {
+
+/*
+ * Weight of an item of len payload bytes for a key, e.g. the airtime of its frame at a data rate
+ */
+using ItemWeight = uint32_t (*)(uint8_t key, uint8_t len);
+
+/*
+ * Running total of the weights of the items of a deque, for the key of the last query
+ *
+ * The deque adds and removes the weight of each item it stores or removes;
+ * the total is computed again, from all the items, when the key changes.
+ */
+class WeightTotal {
+public:
+
+	void setWeight(ItemWeight weight) {
+		_weight = weight;
+		_valid = false;
+	}
+
+	void add(uint8_t len) {
+		if (_valid) {
+			_total += _weight(_key, len);
+		}
+	}
+
+	void remove(uint8_t len) {
+		if (_valid) {
+			_total -= _weight(_key, len);
+		}
+	}
+
+	/*
+	 * Total for key, 0 without ItemWeight
+	 * queue.forEachLength(f) calls f(len) for each item of the deque
+	 */
+	template <typename Q>
+	uint32_t get(uint8_t key, const Q & queue) {
+		if (_weight == nullptr) {
+			return 0;
+		}
+		if (!_valid || key != _key) {
+			_key = key;
+			_total = 0;
+			_valid = true;
+			queue.forEachLength([this](uint8_t len) { _total += _weight(_key, len); });
+		}
+		return _total;
+	}
+
+private:
+
+	ItemWeight 	_weight = nullptr;
+	uint32_t 	_total = 0;
+	uint8_t 	_key = 0;
+	bool 		_valid = false;
+};
+
+/*
+ * How ArenaDeque stores the members of T which follow _buf: LEN bytes, the first one is _len
+ *
+ * Members are copied as is by default; a specialisation may store a compact record header.
+ */
+template <typename T>
+struct ArenaRecord {
+	static constexpr uint16_t LEN = sizeof(T) - sizeof(T::_buf);
+
+	static void pack(const T & item, uint8_t * dest) {
+		memcpy(dest, (const uint8_t*)&item + sizeof(T::_buf), LEN);
+	}
+
+	static void unpack(const uint8_t * src, T & item) {
+		memcpy((uint8_t*)&item + sizeof(T::_buf), src, LEN);
+	}
+};
+
+/*
+ * Fixed-size ring of T objects
+ *
+ * front = most recent item, back = oldest item
+ * Unlike ArrayDeque, items may be accessed by position from the back,
+ * which is needed to send several messages in one frame.
+ *
+ * When the deque is full, the overflow policy decides which end is kept:
+ * - KEEP_FRONT: push_front() removes the back item (oldest) then pushes
+ * - KEEP_BACK: push_front() is rejected
+ *
+ * An item is built outside of the ring, in the staging item given by setStaging() (reserve_front/commit_front),
+ * so that the stored items are untouched until commit_front(), even if the deque is full.
+ * PriorityDeque gives one staging item to all its deques.
+ *
+ * weight() gives the total weight of the items (see setWeight()): the _len of a stored item must not change.
+ */
+template <typename T, uint8_t SIZ>
+class MessageDeque {
+public:
+
+	using value_type = T;
+
+	enum {
+		KEEP_FRONT,
+		KEEP_BACK
+	};
+
+	MessageDeque(uint8_t policy = KEEP_FRONT) : _policy(policy) {
+	}
+
+	uint8_t size() const {
+		return _size;
+	}
+
+	static constexpr uint8_t capacity() {
+		return SIZ;
+	}
+
+	bool empty() const {
+		return _size == 0;
+	}
+
+	bool full() const {
+		return _size == SIZ;
+	}
+
+	/*
+	 * true if count items may be pushed to the front without removing any item,
+	 * or, evict = true, by removing back items which are not among them
+	 */
+	bool fits(uint8_t count, uint16_t bytes, bool evict = false) const {
+		return count <= (evict ? SIZ : SIZ - _size);
+	}
+
+	uint8_t policy() const {
+		return _policy;
+	}
+
+	void setPolicy(uint8_t policy) {
+		_policy = policy;
+	}
+
+	void setWeight(ItemWeight weight) {
+		_weights.setWeight(weight);
+	}
+
+	/*
+	 * Total weight of the items for key, kept up to date while the key does not change
+	 */
+	uint32_t weight(uint8_t key) {
+		return _weights.get(key, *this);
+	}
+
+	template <typename F>
+	void forEachLength(F f) const {
+		for (uint8_t pos = 0; pos < _size; pos++) {
+			f(_items[index(pos)]._len);
+		}
+	}
+
+	/*
+	 * Pushes item to the front (most recent side)
+	 *
+	 * Returns true if item queued, false otherwise
+	 */
+	bool push_front(const T & item) {
+		if (full()) {
+			if (_policy == KEEP_BACK) {
+				return false;
+			}
+			pop_back();
+		}
+		_items[index(_size)] = item;
+		_size += 1;
+		_weights.add(item._len);
+		return true;
+	}
+
+	/*
+	 * Pushes item to the back (oldest side)
+	 *
+	 * Returns true if item queued, false otherwise
+	 */
+	bool push_back(const T & item) {
+		if (full()) {
+			if (_policy == KEEP_FRONT) {
+				return false;
+			}
+			pop_front();
+		}
+		_back = (_back == 0 ? SIZ - 1 : _back - 1);
+		_items[_back] = item;
+		_size += 1;
+		_weights.add(item._len);
+		return true;
+	}
+
+	/*
+	 * Item used by reserve_front(), which may be shared by several deques
+	 */
+	void setStaging(T * staging) {
+		_staging = staging;
+	}
+
+	/*
+	 * Returns the staging item, to be filled as the next front item, nullptr if there is none
+	 * The item is stored by commit_front(), dropped if commit_front() is not called.
+	 * No other reserve_front() may occur on the deques which share the staging item before commit_front().
+	 */
+	T * reserve_front() {
+		return _staging;
+	}
+
+	/*
+	 * Stores a copy of the staging item at the front
+	 *
+	 * Returns true if item queued, false otherwise
+	 */
+	bool commit_front() {
+		return _staging != nullptr && push_front(*_staging);
+	}
+
+	bool pop_front() {
+		if (empty()) {
+			return false;
+		}
+		_weights.remove(_items[index(_size - 1)]._len);
+		_size -= 1;
+		return true;
+	}
+
+	bool pop_back() {
+		if (empty()) {
+			return false;
+		}
+		_weights.remove(_items[_back]._len);
+		_back = index(1);
+		_size -= 1;
+		return true;
+	}
+
+	/*
+	 * Removes item pos, counted from the back: the older items move one slot towards the front
+	 */
+	bool erase(uint8_t pos) {
+		if (pos >= _size) {
+			return false;
+		}
+		_weights.remove(_items[index(pos)]._len);
+		for (uint8_t i = pos; i > 0; i--) {
+			_items[index(i)] = _items[index(i - 1)];
+		}
+		_back = index(1);
+		_size -= 1;
+		return true;
+	}
+
+	/*
+	 * Returns item at position pos, counted from the back (0 = oldest)
+	 * or nullptr if there is no such item
+	 */
+	T * backPtr(uint8_t pos = 0) {
+		return (pos < _size ? &_items[index(pos)] : nullptr);
+	}
+
+	T * frontPtr() {
+		return (_size > 0 ? &_items[index(_size - 1)] : nullptr);
+	}
+
+	/*
+	 * Payload length of item pos, counted from the back
+	 */
+	uint8_t lengthAt(uint8_t pos) const {
+		return (pos < _size ? _items[index(pos)]._len : 0);
+	}
+
+	/*
+	 * Items are modified in place: nothing to write back
+	 */
+	void sync(uint8_t pos = 0) {
+	}
+
+private:
+
+	T 		_items[SIZ];
+	uint8_t _back = 0;
+	uint8_t _size = 0;
+	uint8_t _policy;
+	T * 	_staging = nullptr;
+
+	WeightTotal _weights;
+
+	uint8_t index(uint8_t pos) const {
+		return (_back + pos) % SIZ;
+	}
+};
+
+/*
+ * Byte ring of variable-size records, with the same interface as MessageDeque
+ *
+ * T must be trivially copyable and start with its payload buffer _buf,
+ * immediately followed by the payload length _len (see Message).
+ * A record stores the members of T which follow _buf as given by ArenaRecord<T>, then _len payload bytes,
+ * so a short message costs a few bytes instead of sizeof(T).
+ *
+ * Items are returned through a view owned by each ArenaDeque: a pointer given by backPtr(),
+ * frontPtr() or reserve_front() is valid until the next such call on the same deque,
+ * and changes made through it are stored by sync().
+ *
+ * Overflow policy: as many back (KEEP_FRONT) or front (KEEP_BACK) records as needed are removed.
+ */
+template <typename T, uint16_t BYTES>
+class ArenaDeque {
+public:
+
+	using value_type = T;
+
+	enum {
+		KEEP_FRONT,
+		KEEP_BACK
+	};
+
+	ArenaDeque(uint8_t policy = KEEP_FRONT) : _policy(policy) {
+	}
+
+	uint8_t size() const {
+		return _count;
+	}
+
+	bool empty() const {
+		return _count == 0;
+	}
+
+	/*
+	 * true if even an empty record cannot be stored
+	 */
+	bool full() const {
+		return BYTES - _used < Record::LEN;
+	}
+
+	/*
+	 * true if count items carrying bytes payload bytes may be pushed to the front without removing any record,
+	 * or, evict = true, by removing back records which are not among them
+	 */
+	bool fits(uint8_t count, uint16_t bytes, bool evict = false) const {
+		uint32_t len = (uint32_t)count * Record::LEN + bytes;
+		return len <= (uint32_t)(evict ? BYTES : BYTES - _used) && count <= UINT8_MAX - (evict ? 0 : _count);
+	}
+
+	uint8_t policy() const {
+		return _policy;
+	}
+
+	void setPolicy(uint8_t policy) {
+		_policy = policy;
+	}
+
+	void setWeight(ItemWeight weight) {
+		_weights.setWeight(weight);
+	}
+
+	/*
+	 * Total weight of the records for key, kept up to date while the key does not change
+	 */
+	uint32_t weight(uint8_t key) {
+		return _weights.get(key, *this);
+	}
+
+	template <typename F>
+	void forEachLength(F f) const {
+		uint16_t pos = _tail;
+		for (uint8_t i = 0; i < _count; i++) {
+			f(_ring[pos]);
+			pos = wrap(pos + recordLen(pos));
+		}
+	}
+
+	bool push_front(const T & item) {
+		uint16_t len = Record::LEN + item._len;
+		if (len > BYTES || _count == UINT8_MAX) {
+			return false;
+		}
+		while (BYTES - _used < len) {
+			if (_policy == KEEP_BACK) {
+				return false;
+			}
+			pop_back();
+		}
+		store(_head, item);
+		_head = wrap(_head + len);
+		_used += len;
+		_count += 1;
+		_weights.add(item._len);
+		return true;
+	}
+
+	bool push_back(const T & item) {
+		uint16_t len = Record::LEN + item._len;
+		if (len > BYTES || _count == UINT8_MAX) {
+			return false;
+		}
+		while (BYTES - _used < len) {
+			if (_policy == KEEP_FRONT) {
+				return false;
+			}
+			pop_front();
+		}
+		_tail = wrap(_tail + BYTES - len);
+		store(_tail, item);
+		_used += len;
+		_count += 1;
+		_weights.add(item._len);
+		return true;
+	}
+
+	bool pop_front() {
+		if (empty()) {
+			return false;
+		}
+		uint16_t pos = offset(_count - 1);
+		_weights.remove(_ring[pos]);
+		_used -= recordLen(pos);
+		_head = pos;
+		_count -= 1;
+		return true;
+	}
+
+	bool pop_back() {
+		if (empty()) {
+			return false;
+		}
+		_weights.remove(_ring[_tail]);
+		uint16_t len = recordLen(_tail);
+		_tail = wrap(_tail + len);
+		_used -= len;
+		_count -= 1;
+		return true;
+	}
+
+	/*
+	 * Removes record pos, counted from the back: the older records move over it, towards the front
+	 */
+	bool erase(uint8_t pos) {
+		if (pos >= _count) {
+			return false;
+		}
+		uint16_t start = offset(pos);
+		uint16_t len = recordLen(start);
+		_weights.remove(_ring[start]);
+		for (uint16_t i = wrap(start + BYTES - _tail); i > 0; i--) {
+			_ring[wrap(_tail + i - 1 + len)] = _ring[wrap(_tail + i - 1)];
+		}
+		_tail = wrap(_tail + len);
+		_used -= len;
+		_count -= 1;
+		return true;
+	}
+
+	T * backPtr(uint8_t pos = 0) {
+		if (pos >= _count) {
+			return nullptr;
+		}
+		uint16_t start = offset(pos);
+		uint8_t header[Record::LEN];
+		read(start, header, Record::LEN);
+		Record::unpack(header, _view);
+		read(wrap(start + Record::LEN), _view._buf, _view._len);
+		return &_view;
+	}
+
+	T * frontPtr() {
+		return (_count > 0 ? backPtr(_count - 1) : nullptr);
+	}
+
+	/*
+	 * Payload length of record pos, counted from the back, read without the view
+	 */
+	uint8_t lengthAt(uint8_t pos) const {
+		return (pos < _count ? _ring[offset(pos)] : 0);
+	}
+
+	/*
+	 * Writes back the members of the view (payload excepted, _len unchanged) into record pos
+	 */
+	void sync(uint8_t pos = 0) {
+		if (pos < _count) {
+			uint8_t header[Record::LEN];
+			Record::pack(_view, header);
+			write(offset(pos), header, Record::LEN);
+		}
+	}
+
+	/*
+	 * The view is used as staging area: commit_front() copies it into the ring
+	 */
+	T * reserve_front() {
+		return &_view;
+	}
+
+	bool commit_front() {
+		return push_front(_view);
+	}
+
+private:
+
+	using Record = ArenaRecord<T>;
+
+	T 			_view;
+
+	uint8_t 	_ring[BYTES];
+	uint16_t 	_head = 0;	// where the next front record starts
+	uint16_t 	_tail = 0;	// where the back record starts
+	uint16_t 	_used = 0;
+	uint8_t 	_count = 0;
+	uint8_t 	_policy;
+
+	WeightTotal _weights;
+
+	static uint16_t wrap(uint16_t pos) {
+		return pos % BYTES;
+	}
+
+	uint16_t recordLen(uint16_t pos) const {
+		return Record::LEN + _ring[pos];	// _len is the first byte of a record
+	}
+
+	/*
+	 * start of record pos, counted from the back
+	 */
+	uint16_t offset(uint8_t pos) const {
+		uint16_t start = _tail;
+		for (uint8_t i = 0; i < pos; i++) {
+			start = wrap(start + recordLen(start));
+		}
+		return start;
+	}
+
+	void store(uint16_t pos, const T & item) {
+		uint8_t header[Record::LEN];
+		Record::pack(item, header);
+		write(pos, header, Record::LEN);
+		write(wrap(pos + Record::LEN), item._buf, item._len);
+	}
+
+	void write(uint16_t pos, const uint8_t * src, uint16_t len) {
+		for (uint16_t i = 0; i < len; i++) {
+			_ring[wrap(pos + i)] = src[i];
+		}
+	}
+
+	void read(uint16_t pos, uint8_t * dest, uint16_t len) const {
+		for (uint16_t i = 0; i < len; i++) {
+			dest[i] = _ring[wrap(pos + i)];
+		}
+	}
+};
+
+/*
+ * Staging item of the deques of a PriorityDeque: one for all the classes of MessageDeque,
+ * none for ArenaDeque which builds items in the view of each deque
+ */
+template <typename Q>
+struct SharedStaging {
+	void attach(Q & queue) {
+	}
+};
+
+template <typename T, uint8_t SIZ>
+struct SharedStaging<MessageDeque<T, SIZ>> {
+	T _item;
+
+	void attach(MessageDeque<T, SIZ> & queue) {
+		queue.setStaging(&_item);
+	}
+};
+
+/*
+ * Set of deques, one per priority class
+ *
+ * Items are dispatched highest class first, FIFO within a class.
+ * Each class has its own overflow policy.
+ * The class of an item is given by its _priority member, clamped to CLASSES-1.
+ */
+template <typename Q, uint8_t CLASSES>
+class PriorityDeque {
+public:
+
+	using value_type = typename Q::value_type;
+	using queue_type = Q;
+
+	enum {
+		KEEP_FRONT	= Q::KEEP_FRONT,
+		KEEP_BACK	= Q::KEEP_BACK
+	};
+
+	PriorityDeque(uint8_t policy = KEEP_FRONT) {
+		for (Q & queue : _queues) {
+			queue.setPolicy(policy);
+			_staging.attach(queue);
+		}
+	}
+
+	PriorityDeque(const PriorityDeque &) = delete;
+	PriorityDeque & operator=(const PriorityDeque &) = delete;
+
+	static constexpr uint8_t classes() {
+		return CLASSES;
+	}
+
+	static constexpr uint8_t classOf(uint8_t priority) {
+		return (priority < CLASSES ? priority : CLASSES - 1);
+	}
+
+	/*
+	 * Deque of a given priority class
+	 */
+	Q & operator[](uint8_t cls) {
+		return _queues[classOf(cls)];
+	}
+
+	/*
+	 * Items of all classes: up to CLASSES * 255
+	 */
+	uint16_t size() const {
+		uint16_t total = 0;
+		for (const Q & queue : _queues) {
+			total += queue.size();
+		}
+		return total;
+	}
+
+	bool empty() const {
+		for (const Q & queue : _queues) {
+			if (!queue.empty()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void setPolicy(uint8_t cls, uint8_t policy) {
+		_queues[classOf(cls)].setPolicy(policy);
+	}
+
+	void setWeight(ItemWeight weight) {
+		for (Q & queue : _queues) {
+			queue.setWeight(weight);
+		}
+	}
+
+	/*
+	 * Total weight of the items of all classes for key
+	 */
+	uint32_t weight(uint8_t key) {
+		uint32_t total = 0;
+		for (Q & queue : _queues) {
+			total += queue.weight(key);
+		}
+		return total;
+	}
+
+	/*
+	 * Highest class holding at least one item, 0 if all classes are empty
+	 */
+	uint8_t topClass() const {
+		for (uint8_t cls = CLASSES; cls > 0; cls--) {
+			if (!_queues[cls - 1].empty()) {
+				return cls - 1;
+			}
+		}
+		return 0;
+	}
+
+	bool push_front(const value_type & item) {
+		return _queues[classOf(item._priority)].push_front(item);
+	}
+
+	bool push_back(const value_type & item) {
+		return _queues[classOf(item._priority)].push_back(item);
+	}
+
+	/*
+	 * Back (oldest) items of the highest non-empty class
+	 */
+	value_type * backPtr(uint8_t pos = 0) {
+		return _queues[topClass()].backPtr(pos);
+	}
+
+	bool pop_back() {
+		return _queues[topClass()].pop_back();
+	}
+
+private:
+
+	Q 					_queues[CLASSES];
+	SharedStaging<Q> 	_staging;
+};
+
+}
+}
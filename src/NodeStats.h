@@ -0,0 +1,168 @@
+/*
+ * Module: NodeStats
+ *
+ * Function: performance counters of LMICWrapper (queue, latency, duty cycle, acknowledgements)
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+// latency histogram: bucket 0 = less than 1 s, bucket i = [2^(i-1), 2^i[ s, last bucket = above
+// 8 buckets: NodeStats::SIZE = 51 bytes, the max payload at SF12 (EU868) and of the default LMIC frame buffer
+#ifndef LEUVILLE_LORA_LATENCY_BUCKETS
+#define LEUVILLE_LORA_LATENCY_BUCKETS 8
+#endif
+
+// FPort used by LMICWrapper::sendStats()
+#ifndef LEUVILLE_LORA_STATS_FPORT
+#define LEUVILLE_LORA_STATS_FPORT 200
+#endif
+
+namespace leuville {
+namespace lora {
+
+/*
+ * Counters maintained by LMICWrapper, see LMICWrapper::stats()
+ *
+ * Counters wrap around, the application may reset them after each sendStats().
+ */
+struct NodeStats {
+
+	static constexpr uint8_t VERSION = 3;
+
+	// index of _txErrors for a LMIC_setTxData2() error
+	enum : uint8_t {
+		TX_BUSY = 0,
+		TX_TOO_LARGE,
+		TX_NOT_FEASIBLE,
+		TX_FAILED,
+		TX_ERRORS
+	};
+
+	// serialized size, in bytes
+	static constexpr uint8_t SIZE = 3 + 10 * 2 + TX_ERRORS * 2 + 4 + LEUVILLE_LORA_LATENCY_BUCKETS * 2;
+
+	uint8_t 	_maxDepth = 0;				// queue depth high-water mark
+	uint16_t 	_dropsRecent = 0;			// oldest messages removed by KEEP_RECENT queues
+	uint16_t 	_dropsOld = 0;				// messages rejected by KEEP_OLD queues
+	uint16_t 	_dropsAirtime = 0;			// messages rejected by AIRTIME_REJECT
+	uint16_t 	_frames = 0;				// frames given to LMIC
+	uint16_t 	_retransmissions = 0;		// messages sent again, not completed by isTxCompleted()
+	uint16_t 	_confirmed = 0;				// confirmed messages sent
+	uint16_t 	_acknowledged = 0;			// confirmed messages acknowledged
+	uint16_t 	_dropsRetry = 0;			// messages dropped by their RetryPolicy (max attempts or TTL)
+	uint16_t 	_logErrors = 0;				// uplink log records not written, or skipped by the replay (other format)
+	uint16_t 	_rejected = 0;				// messages too large for a frame (TX_REJECTED) or fragment sets too large for their queue
+	uint16_t 	_txErrors[TX_ERRORS] = { 0 };
+	uint32_t 	_dutyWait = 0;				// total wait imposed by the duty cycle, in ms
+	uint16_t 	_latency[LEUVILLE_LORA_LATENCY_BUCKETS] = { 0 };	// enqueue to EV_TXCOMPLETE
+
+	void reset() {
+		*this = NodeStats();
+	}
+
+	// saturated at 255: the queues of all classes may hold more items
+	void depth(uint16_t size) {
+		_maxDepth = max(_maxDepth, (uint8_t)min(size, (uint16_t)UINT8_MAX));
+	}
+
+	void txError(int error) {
+		if (error < 0) {
+			_txErrors[min(-error - 1, TX_ERRORS - 1)] += 1;
+		}
+	}
+
+	void latency(uint32_t ms) {
+		uint8_t bucket = 0;
+		for (uint32_t s = ms / 1000; s > 0 && bucket < LEUVILLE_LORA_LATENCY_BUCKETS - 1; s >>= 1) {
+			bucket += 1;
+		}
+		_latency[bucket] += 1;
+	}
+
+	/*
+	 * Acknowledged confirmed messages, per thousand
+	 */
+	uint16_t ackRatio() const {
+		return (_confirmed == 0 ? 1000 : (uint32_t)_acknowledged * 1000 / _confirmed);
+	}
+
+	/*
+	 * Little-endian image of the counters, preceded by VERSION and the number of latency buckets
+	 *
+	 * Returns the number of bytes written, 0 if buf is too small
+	 */
+	uint8_t serialize(uint8_t * buf, uint8_t max) const {
+		if (max < SIZE) {
+			return 0;
+		}
+		uint8_t pos = 0;
+		buf[pos++] = VERSION;
+		buf[pos++] = LEUVILLE_LORA_LATENCY_BUCKETS;
+		buf[pos++] = _maxDepth;
+		for (uint16_t value : { _dropsRecent, _dropsOld, _dropsAirtime, _frames, _retransmissions, _confirmed, _acknowledged, _dropsRetry, _logErrors, _rejected }) {
+			pos = put(buf, pos, value, 2);
+		}
+		for (uint16_t value : _txErrors) {
+			pos = put(buf, pos, value, 2);
+		}
+		pos = put(buf, pos, _dutyWait, 4);
+		for (uint16_t value : _latency) {
+			pos = put(buf, pos, value, 2);
+		}
+		return pos;
+	}
+
+	/*
+	 * Reads the image written by serialize(), on the receiving side
+	 *
+	 * Returns false if len does not match or if the image has another VERSION or number of latency buckets
+	 */
+	bool deserialize(const uint8_t * buf, uint8_t len) {
+		if (len != SIZE || buf[0] != VERSION || buf[1] != LEUVILLE_LORA_LATENCY_BUCKETS) {
+			return false;
+		}
+		uint8_t pos = 2;
+		_maxDepth = buf[pos++];
+		for (uint16_t * value : { &_dropsRecent, &_dropsOld, &_dropsAirtime, &_frames, &_retransmissions, &_confirmed, &_acknowledged, &_dropsRetry, &_logErrors, &_rejected }) {
+			*value = get(buf, pos, 2);
+			pos += 2;
+		}
+		for (uint16_t & value : _txErrors) {
+			value = get(buf, pos, 2);
+			pos += 2;
+		}
+		_dutyWait = get(buf, pos, 4);
+		pos += 4;
+		for (uint16_t & value : _latency) {
+			value = get(buf, pos, 2);
+			pos += 2;
+		}
+		return true;
+	}
+
+private:
+
+	static uint32_t get(const uint8_t * buf, uint8_t pos, uint8_t len) {
+		uint32_t value = 0;
+		for (uint8_t i = 0; i < len; i++) {
+			value |= (uint32_t)buf[pos + i] << (8 * i);
+		}
+		return value;
+	}
+
+	static uint8_t put(uint8_t * buf, uint8_t pos, uint32_t value, uint8_t len) {
+		for (uint8_t i = 0; i < len; i++) {
+			buf[pos++] = (uint8_t)(value >> (8 * i));
+		}
+		return pos;
+	}
+};
+
+}
+}
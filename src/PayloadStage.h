@@ -0,0 +1,300 @@
+/*
+ * Module: PayloadStage
+ *
+ * Function: transformation of uplink payloads between the FIFO and LMIC (delta encoding)
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <lmic.h>
+
+// a keyframe is sent at least every LEUVILLE_DELTA_KEYFRAME frames
+#ifndef LEUVILLE_DELTA_KEYFRAME
+#define LEUVILLE_DELTA_KEYFRAME 16
+#endif
+
+// number of frames kept by DeltaDecoder, a reference is never older than that
+#ifndef LEUVILLE_DELTA_HISTORY
+#define LEUVILLE_DELTA_HISTORY 8
+#endif
+
+namespace leuville {
+namespace lora {
+
+/*
+ * Payload stage plugged into LMICWrapper (see setPayloadStage())
+ *
+ * Messages are queued as given by send(), the stage encodes each of them when it is sent,
+ * then is told of its completion. Typed isTxCompleted() callbacks still see the original payload.
+ *
+ * encode() may advance the state of the stage (sequence numbers...). A payload encoded but not given
+ * to LMIC (frame deferred by the airtime budget, refused by LMIC, left out of an aggregated frame)
+ * must not count: LMICWrapper then restores the checkpoint() taken before its encoding.
+ */
+class PayloadStage {
+public:
+
+	virtual ~PayloadStage() = default;
+
+	/*
+	 * Encodes len bytes of in into out (max bytes)
+	 * tag is stored with the message and given back to completed()
+	 *
+	 * Returns the encoded length, 0 if the payload cannot be encoded
+	 */
+	virtual uint8_t encode(const uint8_t * in, uint8_t len, uint8_t * out, uint8_t max, uint8_t & tag) = 0;
+
+	/*
+	 * Max number of bytes encode() adds to a payload, reserved in each fragment
+	 */
+	virtual uint8_t overhead() const {
+		return 0;
+	}
+
+	/*
+	 * State of the stage before an encode(), given back to restore()
+	 */
+	virtual uint32_t checkpoint() const {
+		return 0;
+	}
+
+	virtual void restore(uint32_t checkpoint) {
+	}
+
+	/*
+	 * Called on TX completion of a payload given to encode()
+	 */
+	virtual void completed(const uint8_t * in, uint8_t len, uint8_t tag, bool acknowledged) {
+	}
+};
+
+/*
+ * Zigzag varints: small signed values take one byte
+ */
+struct Varint {
+
+	static constexpr uint8_t zigzag(int8_t value) {
+		return (uint8_t)(((uint8_t)value << 1) ^ (value >> 7));
+	}
+
+	static constexpr int8_t unzigzag(uint8_t value) {
+		return (int8_t)((value >> 1) ^ -(value & 1));
+	}
+
+	/*
+	 * Returns the new position, 0 if out is too small
+	 */
+	static uint8_t write(uint8_t * out, uint8_t pos, uint8_t max, uint16_t value) {
+		do {
+			if (pos >= max) {
+				return 0;
+			}
+			out[pos++] = (value & 0x7F) | (value > 0x7F ? 0x80 : 0);
+			value >>= 7;
+		} while (value > 0);
+		return pos;
+	}
+
+	/*
+	 * Returns the new position, 0 if in is truncated or the value does not fit
+	 */
+	static uint8_t read(const uint8_t * in, uint8_t pos, uint8_t len, uint16_t & value) {
+		value = 0;
+		for (uint8_t shift = 0; shift < 16; shift += 7) {
+			if (pos >= len) {
+				return 0;
+			}
+			uint8_t b = in[pos++];
+			value |= (uint16_t)(b & 0x7F) << shift;
+			if ((b & 0x80) == 0) {
+				return pos;
+			}
+		}
+		return 0;
+	}
+};
+
+/*
+ * Delta encoding against the last acknowledged payload
+ *
+ * Keyframe = [seq] then the payload
+ * Delta 	= [0x80 | seq][reference seq][varint length] then (varint skip, zigzag varint delta) pairs:
+ * 			  skip unchanged bytes, then add delta to the next byte of the reference (0 beyond its end)
+ *
+ * seq counts frames modulo 128. Only an acknowledged payload becomes the reference,
+ * so the network side always holds it even if other frames are lost:
+ * unconfirmed uplinks are therefore always sent as keyframes until one confirmed uplink is acknowledged.
+ * A keyframe is sent when the delta is not shorter, every LEUVILLE_DELTA_KEYFRAME frames,
+ * and when the reference is older than LEUVILLE_DELTA_HISTORY frames.
+ */
+class DeltaStage : public PayloadStage {
+public:
+
+	static constexpr uint8_t DELTA = 0x80;
+
+	virtual uint8_t encode(const uint8_t * in, uint8_t len, uint8_t * out, uint8_t max, uint8_t & tag) override {
+		uint8_t seq = _seq;
+		_seq = (_seq + 1) & 0x7F;
+		tag = seq;
+		uint8_t deltaLen = 0;
+		if (_refValid && _sinceKeyframe + 1 < LEUVILLE_DELTA_KEYFRAME && ((seq - _refSeq) & 0x7F) < LEUVILLE_DELTA_HISTORY) {
+			deltaLen = encodeDelta(in, len, out, max, seq);
+		}
+		if (deltaLen > 0 && deltaLen < len + 1) {
+			_sinceKeyframe += 1;
+			return deltaLen;
+		}
+		if (len + 1 > max) {
+			return 0;
+		}
+		out[0] = seq;
+		memcpy(out + 1, in, len);
+		_sinceKeyframe = 0;
+		return len + 1;
+	}
+
+	/*
+	 * A keyframe adds its sequence number, a delta is sent only if shorter
+	 */
+	virtual uint8_t overhead() const override {
+		return 1;
+	}
+
+	virtual uint32_t checkpoint() const override {
+		return _seq | (_sinceKeyframe << 8);
+	}
+
+	virtual void restore(uint32_t checkpoint) override {
+		_seq = checkpoint & 0x7F;
+		_sinceKeyframe = checkpoint >> 8;
+	}
+
+	virtual void completed(const uint8_t * in, uint8_t len, uint8_t tag, bool acknowledged) override {
+		if (acknowledged && len <= sizeof(_ref)) {
+			memcpy(_ref, in, len);
+			_refLen = len;
+			_refSeq = tag;
+			_refValid = true;
+		}
+	}
+
+	/*
+	 * Next frames are keyframes until an acknowledgement
+	 */
+	void reset() {
+		_refValid = false;
+	}
+
+private:
+
+	uint8_t _ref[MAX_FRAME_LEN];	// payloads of LMICWrapper, MAX_MESSAGE_LEN bytes at most
+	uint8_t _refLen = 0;
+	uint8_t _refSeq = 0;
+	bool 	_refValid = false;
+	uint8_t _seq = 0;
+	uint8_t _sinceKeyframe = 0;
+
+	uint8_t encodeDelta(const uint8_t * in, uint8_t len, uint8_t * out, uint8_t max, uint8_t seq) {
+		if (max < 2) {
+			return 0;
+		}
+		out[0] = DELTA | seq;
+		out[1] = _refSeq;
+		uint8_t pos = Varint::write(out, 2, max, len);
+		uint16_t skip = 0;
+		for (uint8_t i = 0; pos > 0 && i < len; i++) {
+			uint8_t ref = (i < _refLen ? _ref[i] : 0);
+			if (in[i] == ref) {
+				skip += 1;
+				continue;
+			}
+			pos = Varint::write(out, pos, max, skip);
+			if (pos > 0) {
+				pos = Varint::write(out, pos, max, Varint::zigzag((int8_t)(in[i] - ref)));
+			}
+			skip = 0;
+		}
+		return pos;
+	}
+};
+
+/*
+ * Decoder of DeltaStage frames, for the network side (or a host test)
+ *
+ * Keeps the last LEUVILLE_DELTA_HISTORY payloads to resolve references.
+ */
+class DeltaDecoder {
+public:
+
+	/*
+	 * Decodes a frame into out (UINT8_MAX bytes at least), outLen is set to the payload length
+	 *
+	 * Returns false if the frame is malformed or its reference is unknown
+	 */
+	bool decode(const uint8_t * in, uint8_t len, uint8_t * out, uint8_t & outLen) {
+		if (len == 0) {
+			return false;
+		}
+		uint8_t seq = in[0] & 0x7F;
+		if ((in[0] & DeltaStage::DELTA) == 0) {
+			outLen = len - 1;
+			memcpy(out, in + 1, outLen);
+		} else if (!decodeDelta(in, len, out, outLen)) {
+			return false;
+		}
+		Entry & entry = _history[seq % LEUVILLE_DELTA_HISTORY];
+		memcpy(entry._payload, out, outLen);
+		entry._len = outLen;
+		entry._seq = seq;
+		entry._valid = true;
+		return true;
+	}
+
+private:
+
+	struct Entry {
+		uint8_t _payload[UINT8_MAX];
+		uint8_t _len = 0;
+		uint8_t _seq = 0;
+		bool 	_valid = false;
+	};
+
+	Entry _history[LEUVILLE_DELTA_HISTORY];
+
+	bool decodeDelta(const uint8_t * in, uint8_t len, uint8_t * out, uint8_t & outLen) {
+		if (len < 3) {
+			return false;
+		}
+		uint8_t refSeq = in[1] & 0x7F;
+		const Entry & ref = _history[refSeq % LEUVILLE_DELTA_HISTORY];
+		uint16_t value;
+		uint8_t pos = Varint::read(in, 2, len, value);
+		if (!ref._valid || ref._seq != refSeq || pos == 0 || value > UINT8_MAX) {
+			return false;
+		}
+		outLen = value;
+		for (uint16_t i = 0; i < outLen; i++) {
+			out[i] = (i < ref._len ? ref._payload[i] : 0);
+		}
+		uint16_t i = 0;
+		while (pos < len) {
+			uint16_t skip, delta;
+			pos = Varint::read(in, pos, len, skip);
+			if (pos == 0 || (pos = Varint::read(in, pos, len, delta)) == 0 || i + skip >= outLen || delta > UINT8_MAX) {
+				return false;
+			}
+			i += skip;
+			out[i] += Varint::unzigzag(delta);
+			i += 1;
+		}
+		return true;
+	}
+};
+
+}
+}
@@ -0,0 +1,116 @@
+/*
+ * Module: PortDispatch
+ *
+ * Function: downlinks dispatched by FPort to typed handlers, resolved at compile time
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <LMICWrapper.h>
+
+namespace leuville {
+namespace lora {
+
+/*
+ * Binds an application FPort to a codec and a member function of the endnode Node
+ *
+ * Codec provides Downlink and decodeDownlink(), like the GenericEndnode codecs
+ * (ProtobufCodec, JsonCodec, CayenneLPPCodec, RawCodec...). HANDLER is called if the payload is decoded:
+ *
+ *		void Node::handler(const Codec::Downlink & payload, const DownstreamMessage & message);
+ */
+template <uint8_t PORT, typename Codec, typename Node,
+	void (Node::*HANDLER)(const typename Codec::Downlink &, const DownstreamMessage &)>
+struct OnPort {
+
+	static_assert(PORT > 0 && PORT < 224, "application FPort expected (1..223)");
+
+	static constexpr uint8_t port = PORT;
+
+	/*
+	 * Returns false if message is not for PORT, nothing is decoded then
+	 */
+	static bool dispatch(Node & node, const DownstreamMessage & message) {
+		if (message._port != PORT) {
+			return false;
+		}
+		typename Codec::Downlink payload{};
+		if (Codec::decodeDownlink(message._buf, message._len, payload)) {
+			(node.*HANDLER)(payload, message);
+		}
+		return true;
+	}
+};
+
+/*
+ * true if port is one of the following ports
+ */
+constexpr bool portIn(uint8_t) {
+	return false;
+}
+
+template <typename... Ports>
+constexpr bool portIn(uint8_t port, uint8_t first, Ports... others) {
+	return port == first || portIn(port, others...);
+}
+
+/*
+ * true if no FPort is given twice
+ */
+constexpr bool distinctPorts() {
+	return true;
+}
+
+template <typename... Ports>
+constexpr bool distinctPorts(uint8_t first, Ports... others) {
+	return !portIn(first, others...) && distinctPorts(others...);
+}
+
+/*
+ * Dispatch table of OnPort bindings: only the codec and handler of the downlink FPort are used
+ *
+ * Typically called from downlinkReceived(), where the handlers of the endnode are known:
+ *
+ *		void downlinkReceived(const DownstreamMessage & message) override {
+ *			using Ports = PortDispatcher<
+ *				OnPort<10, ConfigCodec, EndNode, &EndNode::configReceived>,
+ *				OnPort<11, RawCodec, EndNode, &EndNode::commandReceived>
+ *			>;
+ *			if (!Ports::dispatch(*this, message)) {
+ *				// FPort not bound
+ *			}
+ *		}
+ */
+template <typename... Bindings>
+struct PortDispatcher {
+
+	static_assert(distinctPorts(Bindings::port...), "FPort bound twice");
+
+	/*
+	 * Returns false if no binding matches the FPort of message
+	 */
+	template <typename Node>
+	static bool dispatch(Node & node, const DownstreamMessage & message) {
+		return dispatchTo<Node, Bindings...>(node, message);
+	}
+
+private:
+
+	// bindings tried in turn, the first one which matches the FPort stops the search
+	template <typename Node>
+	static bool dispatchTo(Node &, const DownstreamMessage &) {
+		return false;
+	}
+
+	template <typename Node, typename First, typename... Others>
+	static bool dispatchTo(Node & node, const DownstreamMessage & message) {
+		return First::dispatch(node, message) || dispatchTo<Node, Others...>(node, message);
+	}
+};
+
+}
+}
@@ -10,7 +10,7 @@
 
 #pragma once
 
-#include <LMICWrapper.h>
+#include <GenericEndnode.h>
 
 #include <pb_encode.h>
 #include <pb_decode.h>
@@ -32,82 +32,114 @@ size_t encode(const PBType & src, const pb_msgdesc_t * fields, Message & dest) {
 	return dest._len;
 }
 
+/*
+ * Builds dest object using nanopb from a raw buffer
+ */
+template <typename PBType>
+bool decode(const uint8_t * buf, uint8_t len, const pb_msgdesc_t* fields, PBType & dest) {
+	pb_istream_t stream = pb_istream_from_buffer(buf, len);
+	return pb_decode(&stream, fields, &dest);
+}
+
 /*
  * Builds dest object using nanopb from src raw message
  */
 template <typename PBType>
 bool decode(const Message& src, const pb_msgdesc_t* fields, PBType & dest) {
-	pb_istream_t stream = pb_istream_from_buffer(src._buf, src._len);
-	return pb_decode(&stream, fields, &dest);
+	return decode(src._buf, src._len, fields, dest);
 }
 
 /*
- * ENDNODE abstract base class with ProtocolBuffer (nanopb) mechanisms
+ * Builds dest object using nanopb straight from the received frame
+ */
+template <typename PBType>
+bool decode(const DownstreamMessage& src, const pb_msgdesc_t* fields, PBType & dest) {
+	return decode(src._buf, src._len, fields, dest);
+}
+
+/*
+ * GenericEndnode codec for nanopb types
  * U = uplink message nanopb type
  * D = downlink message nanopb type
  */
 template <typename U, const pb_msgdesc_t* UFIELDS, typename D, const pb_msgdesc_t* DFIELDS>
-class ProtobufEndnode: public LMICWrapper {
-public:
+struct ProtobufCodec {
+
+	using Source = U;
+	using Uplink = U;
+	using Downlink = D;
+
+	static constexpr bool ACK = true;
 
-	using LMICWrapper::LMICWrapper;
-	
 	/*
-	 * Build an UpstreamMessage filled with encoded bytes from payload
-	 * This message is stored in the double-ended queue managed by LMICWrapper.
-	 * Back of this deque is sent after call to runLoopOnce()
-	 *
-	 * fields parameter provides the way to send partial message
+	 * Encoded once, straight into dest: the stream is bounded by maxPayload, the max payload of the current data rate
+	 * (MAX_MESSAGE_LEN if fragmentation is enabled). A message which overflows it is SEND_PAYLOAD_TOO_LARGE.
 	 */
-	virtual bool send(const U & payload, bool ackRequested = true, const pb_msgdesc_t* fields = UFIELDS) {
-		UpstreamMessage upMessage;
-		upMessage._ackRequested = ackRequested;
-		if (encode(payload, fields, upMessage)) {
-			return LMICWrapper::send(upMessage);
-		} else {
-			return false;
+	static LMICWrapper::SendError encode(const U & src, Message & dest, uint8_t maxPayload, const pb_msgdesc_t* fields = UFIELDS) {
+		pb_ostream_t stream = pb_ostream_from_buffer(dest._buf, min((size_t)maxPayload, sizeof(dest._buf)));
+		if (!pb_encode(&stream, fields, &src)) {
+			dest._len = 0;
+			return (overflowed(stream, src, fields) ? LMICWrapper::SEND_PAYLOAD_TOO_LARGE : LMICWrapper::SEND_ENCODING_FAILED);
 		}
+		dest._len = stream.bytes_written;
+		return LMICWrapper::SEND_OK;
 	}
 
-	/*
-	 * Send completion policy
-	 * message is decoded to its original format
-	 */
-	virtual bool isTxCompleted(const UpstreamMessage & message) override {
-		U payload;
-		decode(message, UFIELDS, payload);
-		return isTxCompleted(payload, message);
-	};
+	static bool decodeUplink(const uint8_t * buf, uint8_t len, U & dest) {
+		return decode(buf, len, UFIELDS, dest);
+	}
 
-	/*
-	 * Default send completion policy
-	 * 
-	 * Message is decoded before
-	 * Override if needed
-	 */
-	virtual bool isTxCompleted(const U & message, const UpstreamMessage & rawMessage) {
-		return LMICWrapper::isTxCompleted(rawMessage);
-	};
+	static bool decodeDownlink(const uint8_t * buf, uint8_t len, D & dest) {
+		return decode(buf, len, DFIELDS, dest);
+	}
+
+private:
 
 	/*
-	 * Downlink message arrival callback
-	 * 
-	 * Message is decoded before
-	 * Override if needed
+	 * true if pb_encode() failed because the stream is full ("stream full" error of pb_write()),
+	 * measured again without error messages (PB_NO_ERRMSG): on failures only
 	 */
-	virtual void downlinkReceived(const D& message, const DownstreamMessage & rawMessage) {
+	static bool overflowed(pb_ostream_t & stream, const U & src, const pb_msgdesc_t* fields) {
+		#if defined(PB_NO_ERRMSG)
+		size_t len;
+		return pb_get_encoded_size(&len, fields, &src) && len > stream.max_size;
+		#else
+		return strcmp(PB_GET_ERROR(&stream), "stream full") == 0;
+		#endif
 	}
+};
+
+/*
+ * ENDNODE abstract base class with ProtocolBuffer (nanopb) mechanisms
+ * U = uplink message nanopb type
+ * D = downlink message nanopb type
+ * Derived = optional endnode class, see GenericEndnode
+ */
+template <typename U, const pb_msgdesc_t* UFIELDS, typename D, const pb_msgdesc_t* DFIELDS, typename Derived = void>
+class ProtobufEndnode: public GenericEndnode<ProtobufCodec<U, UFIELDS, D, DFIELDS>, Derived> {
+public:
+
+	using Codec = ProtobufCodec<U, UFIELDS, D, DFIELDS>;
+	using Base = GenericEndnode<Codec, Derived>;
+
+	using Base::Base;
+	using Base::send;
 
 	/*
-	 * Downlink message arrival callback
+	 * Encodes a partial message: fields replaces UFIELDS
 	 */
-	virtual void downlinkReceived(const DownstreamMessage& message) override {
-		D payload;
-		if (decode(message, DFIELDS, payload)) {
-			downlinkReceived(payload, message);
+	virtual bool send(const U & payload, bool ackRequested, const pb_msgdesc_t* fields, uint8_t fport = 1, uint8_t priority = 0) {
+		UpstreamMessage * upMessage = this->reserve(ackRequested, fport, priority);
+		if (upMessage == nullptr) {
+			return false;
+		}
+		LMICWrapper::SendError error = Codec::encode(payload, *upMessage, this->maxMessageLen(), fields);
+		if (error != LMICWrapper::SEND_OK) {
+			this->rollback(error);
+			return false;
 		}
+		return this->commit();
 	}
-
 };
 
 }
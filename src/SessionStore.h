@@ -0,0 +1,262 @@
+/*
+ * Module: SessionStore
+ *
+ * Function: LoRaWAN session persistence, to skip OTAA join after a reset
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <lmic.h>
+#include <Storage.h>
+
+// uplink frame counters reserved by each session save
+#ifndef LEUVILLE_LORA_FCNT_GAP
+#define LEUVILLE_LORA_FCNT_GAP 32
+#endif
+
+namespace leuville {
+namespace lora {
+
+/*
+ * LoRaWAN session state: keys, frame counters, channel plan, data rate and RX parameters
+ */
+struct LoRaWanSession {
+	u4_t 		_netId = 0;
+	devaddr_t 	_devAddr = 0;
+	u1_t 		_nwkSKey[16] = { 0 };
+	u1_t 		_appSKey[16] = { 0 };
+	u4_t 		_seqnoUp = 0;
+	u4_t 		_seqnoDn = 0;
+	dr_t 		_datarate = 0;
+	s1_t 		_adrTxPow = 0;
+	u1_t 		_rxDelay = 0;
+	u1_t 		_rx1DrOffset = 0;
+	dr_t 		_dn2Dr = 0;
+	u4_t 		_dn2Freq = 0;
+	#if CFG_LMIC_EU_like
+	u4_t 		_channelFreq[MAX_CHANNELS] = { 0 };
+	u2_t 		_channelDrMap[MAX_CHANNELS] = { 0 };
+	#endif
+	decltype(lmic_t::channelMap) _channelMap = { };
+
+	/*
+	 * Copies the current LMIC session
+	 *
+	 * The saved uplink counter is fcntGap frames ahead: frames sent after the save
+	 * never reuse a counter once the session is restored.
+	 * The downlink counter is saved as is, LMICWrapper saves the session after each downlink.
+	 */
+	void capture(u4_t fcntGap = LEUVILLE_LORA_FCNT_GAP) {
+		LMIC_getSessionKeys(&_netId, &_devAddr, _nwkSKey, _appSKey);
+		_seqnoUp = LMIC.seqnoUp + fcntGap;
+		_seqnoDn = LMIC.seqnoDn;
+		_datarate = LMIC.datarate;
+		_adrTxPow = LMIC.adrTxPow;
+		_rxDelay = LMIC.rxDelay;
+		_rx1DrOffset = LMIC.rx1DrOffset;
+		_dn2Dr = LMIC.dn2Dr;
+		_dn2Freq = LMIC.dn2Freq;
+		#if CFG_LMIC_EU_like
+		memcpy(_channelFreq, LMIC.channelFreq, sizeof(_channelFreq));
+		memcpy(_channelDrMap, LMIC.channelDrMap, sizeof(_channelDrMap));
+		#endif
+		memcpy(&_channelMap, &LMIC.channelMap, sizeof(_channelMap));
+	}
+
+	/*
+	 * Resumes the session, after LMIC_reset()
+	 */
+	void restore() const {
+		LMIC_setSession(_netId, _devAddr, const_cast<u1_t*>(_nwkSKey), const_cast<u1_t*>(_appSKey));
+		#if CFG_LMIC_EU_like
+		memcpy(LMIC.channelFreq, _channelFreq, sizeof(_channelFreq));
+		memcpy(LMIC.channelDrMap, _channelDrMap, sizeof(_channelDrMap));
+		#endif
+		memcpy(&LMIC.channelMap, &_channelMap, sizeof(_channelMap));
+		LMIC.seqnoUp = _seqnoUp;
+		LMIC.seqnoDn = _seqnoDn;
+		LMIC.rxDelay = _rxDelay;
+		LMIC.rx1DrOffset = _rx1DrOffset;
+		LMIC.dn2Dr = _dn2Dr;
+		LMIC.dn2Freq = _dn2Freq;
+		LMIC_setDrTxpow(_datarate, _adrTxPow);
+	}
+};
+
+/*
+ * Where LoRaWanSession is saved
+ */
+class SessionStore {
+public:
+
+	virtual ~SessionStore() = default;
+
+	virtual bool load(LoRaWanSession & session) = 0;
+
+	virtual bool save(const LoRaWanSession & session) = 0;
+
+	virtual void clear() = 0;
+};
+
+/*
+ * Saves the session into a ring of Storage pages, which levels flash wear
+ *
+ * Record = [0x5E][size][sequence number, 4 bytes][size bytes][crc8]. Records are written one after the other;
+ * when a record does not fit in the current page, the next page of the ring is erased and receives it.
+ * The valid record with the highest sequence number is the saved session: a record of another size
+ * (a firmware with a different LoRaWanSession layout) or an empty one (written by clear()) means no session.
+ */
+class StorageSessionStore : public SessionStore {
+public:
+
+	/*
+	 * pages = number of Storage pages used from addr, which starts a page
+	 * With one page, the saved session is lost if a reset interrupts a save which erases it.
+	 */
+	StorageSessionStore(Storage & storage, uint32_t addr = 0, uint8_t pages = 2)
+		: _storage(storage), _addr(addr), _pages(pages)
+	{}
+
+	virtual bool load(LoRaWanSession & session) override {
+		scan();
+		return _found && _lastSize == sizeof(LoRaWanSession)
+			&& _storage.read(_last + HEADER_LEN, (uint8_t*)&session, sizeof(LoRaWanSession));
+	}
+
+	virtual bool save(const LoRaWanSession & session) override {
+		return append((const uint8_t*)&session, sizeof(LoRaWanSession));
+	}
+
+	/*
+	 * Writes an empty record, unless there is no saved session
+	 */
+	virtual void clear() override {
+		if (!_scanned) {
+			scan();
+		}
+		if (_found && _lastSize > 0) {
+			append(nullptr, 0);
+		}
+	}
+
+private:
+
+	static constexpr uint8_t MAGIC = 0x5E;
+	static constexpr uint8_t HEADER_LEN = 6;
+
+	static_assert(sizeof(LoRaWanSession) <= UINT8_MAX, "LoRaWanSession too large");
+
+	Storage & 	_storage;
+	uint32_t 	_addr;
+	uint8_t 	_pages;
+
+	bool 		_scanned = false;
+	bool 		_found = false;		// a valid record exists
+	uint32_t 	_last = 0;			// address of the last record
+	uint8_t 	_lastSize = 0;
+	uint32_t 	_seq = 0;			// its sequence number
+	uint32_t 	_next = 0;			// where the next record may be written, 0 = in the next page
+
+	/*
+	 * Finds the last valid record
+	 */
+	void scan() {
+		_scanned = true;
+		_found = false;
+		_next = 0;
+		const uint16_t pageSize = _storage.pageSize();
+		for (uint8_t page = 0; page < _pages; page++) {
+			uint32_t start = _addr + (uint32_t)page * pageSize;
+			for (uint32_t pos = start; pos + HEADER_LEN + 1 <= start + pageSize; ) {
+				uint8_t header[HEADER_LEN];
+				if (!_storage.read(pos, header, HEADER_LEN) || header[0] != MAGIC || pos + HEADER_LEN + header[1] + 1 > start + pageSize) {
+					break;
+				}
+				uint8_t crc = crc8(0, header, HEADER_LEN);
+				uint8_t chunk[16];
+				for (uint16_t done = 0; done < header[1]; done += sizeof(chunk)) {
+					uint8_t len = min((uint16_t)sizeof(chunk), (uint16_t)(header[1] - done));
+					_storage.read(pos + HEADER_LEN + done, chunk, len);
+					crc = crc8(crc, chunk, len);
+				}
+				uint8_t stored;
+				if (!_storage.read(pos + HEADER_LEN + header[1], &stored, 1) || stored != crc) {
+					break;	// torn record: nothing valid after it in this page
+				}
+				uint32_t seq = header[2] | (header[3] << 8) | (header[4] << 16) | ((uint32_t)header[5] << 24);
+				pos += HEADER_LEN + header[1] + 1;
+				if (!_found || seq > _seq) {
+					_found = true;
+					_last = pos - (HEADER_LEN + header[1] + 1);
+					_lastSize = header[1];
+					_seq = seq;
+					_next = pos;
+				}
+			}
+		}
+	}
+
+	/*
+	 * true if len bytes from addr are erased
+	 */
+	bool erased(uint32_t addr, uint16_t len) {
+		uint8_t chunk[16];
+		for (uint16_t done = 0; done < len; done += sizeof(chunk)) {
+			uint8_t n = min((uint16_t)sizeof(chunk), (uint16_t)(len - done));
+			if (!_storage.read(addr + done, chunk, n)) {
+				return false;
+			}
+			for (uint8_t i = 0; i < n; i++) {
+				if (chunk[i] != 0xFF) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	bool append(const uint8_t * data, uint8_t size) {
+		if (!_scanned) {
+			scan();
+		}
+		const uint16_t pageSize = _storage.pageSize();
+		const uint16_t len = HEADER_LEN + size + 1;
+		if (_pages == 0 || len > pageSize) {
+			return false;
+		}
+		uint32_t page = (_found ? (_last - _addr) / pageSize : 0);
+		uint32_t addr = _next;
+		if (addr == 0 || addr + len > _addr + (page + 1) * pageSize || !erased(addr, len)) {
+			// the page of the last record is full: the next one is erased
+			page = (_found ? (page + 1) % _pages : 0);
+			addr = _addr + page * pageSize;
+			if (!_storage.erase(addr)) {
+				return false;
+			}
+		}
+		uint32_t seq = (_found ? _seq + 1 : 1);
+		uint8_t header[HEADER_LEN] = { MAGIC, size, (uint8_t)seq, (uint8_t)(seq >> 8), (uint8_t)(seq >> 16), (uint8_t)(seq >> 24) };
+		uint8_t crc = crc8(crc8(0, header, HEADER_LEN), data, size);
+		bool ok = _storage.write(addr, header, HEADER_LEN)
+			&& (size == 0 || _storage.write(addr + HEADER_LEN, data, size))
+			&& _storage.write(addr + HEADER_LEN + size, &crc, 1);
+		_storage.flush();
+		if (ok) {
+			_found = true;
+			_last = addr;
+			_lastSize = size;
+			_seq = seq;
+			_next = addr + len;
+		} else {
+			_next = 0;
+		}
+		return ok;
+	}
+};
+
+}
+}
@@ -0,0 +1,254 @@
+/*
+ * Module: Storage
+ *
+ * Function: non-volatile storage used to persist LMICWrapper state
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#if !defined(ARDUINO)
+#include <cstdio>
+#endif
+
+namespace leuville {
+namespace lora {
+
+/*
+ * CRC-8 (polynomial 0x07) used to validate stored records
+ */
+inline uint8_t crc8(uint8_t crc, const uint8_t * data, uint16_t len) {
+	for (uint16_t i = 0; data != nullptr && i < len; i++) {
+		crc ^= data[i];
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1);
+		}
+	}
+	return crc;
+}
+
+/*
+ * Flash-like storage: a byte array divided into pages
+ *
+ * - erase() sets a whole page to 0xFF
+ * - write() may only program bytes which are erased (0xFF)
+ */
+class Storage {
+public:
+
+	virtual ~Storage() = default;
+
+	/*
+	 * Total size, in bytes (multiple of pageSize())
+	 */
+	virtual uint32_t size() = 0;
+
+	/*
+	 * Erase unit, in bytes
+	 */
+	virtual uint16_t pageSize() = 0;
+
+	virtual bool read(uint32_t addr, uint8_t * dest, uint16_t len) = 0;
+
+	virtual bool write(uint32_t addr, const uint8_t * src, uint16_t len) = 0;
+
+	/*
+	 * Erases the page which contains addr
+	 */
+	virtual bool erase(uint32_t addr) = 0;
+
+	/*
+	 * Makes previous writes durable
+	 */
+	virtual void flush() {
+	}
+};
+
+#if defined(ARDUINO_ARCH_SAMD) && !defined(__SAMD51__)
+/*
+ * SAMD21 internal flash storage
+ *
+ * SIZE bytes are reserved in the program flash, aligned on NVM rows.
+ * A page of this storage is PAGE_ROWS NVM rows (256 bytes each).
+ * The region is part of the firmware image, zero-initialised: an upload fills it with zeros, not erased (0xFF) bytes.
+ * Its pages therefore hold no valid UplinkLog header, and each one is erased before its first write.
+ * Storages with the same parameters share their region: use distinct IDs for distinct regions.
+ */
+template <uint32_t SIZE = 8192, uint8_t PAGE_ROWS = 4, uint8_t ID = 0>
+class SAMDFlashStorage : public Storage {
+public:
+
+	static constexpr uint16_t ROW_SIZE = 256;
+	static constexpr uint16_t NVM_PAGE_SIZE = 64;
+
+	static_assert(SIZE % (ROW_SIZE * PAGE_ROWS) == 0, "SIZE must be a multiple of the page size");
+
+	virtual uint32_t size() override {
+		return SIZE;
+	}
+
+	virtual uint16_t pageSize() override {
+		return ROW_SIZE * PAGE_ROWS;
+	}
+
+	virtual bool read(uint32_t addr, uint8_t * dest, uint16_t len) override {
+		if (addr + len > SIZE) {
+			return false;
+		}
+		const volatile uint8_t * src = _flash + addr;
+		for (uint16_t i = 0; i < len; i++) {
+			dest[i] = src[i];
+		}
+		return true;
+	}
+
+	/*
+	 * Programs whole 32-bit words through the NVM page buffer
+	 * Bytes of partial words outside [addr, addr+len[ are rewritten with their current value.
+	 */
+	virtual bool write(uint32_t addr, const uint8_t * src, uint16_t len) override {
+		if (addr + len > SIZE) {
+			return false;
+		}
+		// manual page writes, the setting of the core is restored afterwards
+		uint8_t manw = NVMCTRL->CTRLB.bit.MANW;
+		NVMCTRL->CTRLB.bit.MANW = 1;
+		uint32_t end = addr + len;
+		uint32_t word = addr & ~3UL;
+		while (word < end) {
+			// page buffer clear
+			NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_PBC;
+			waitReady();
+			uint32_t pageEnd = (word & ~(uint32_t)(NVM_PAGE_SIZE - 1)) + NVM_PAGE_SIZE;
+			for (; word < end && word < pageEnd; word += 4) {
+				uint8_t bytes[4];
+				for (uint8_t i = 0; i < 4; i++) {
+					uint32_t pos = word + i;
+					bytes[i] = (pos >= addr && pos < end ? src[pos - addr] : _flash[pos]);
+				}
+				*(volatile uint32_t *)(_flash + word) = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+			}
+			// write page
+			NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_WP;
+			waitReady();
+		}
+		NVMCTRL->CTRLB.bit.MANW = manw;
+		return true;
+	}
+
+	virtual bool erase(uint32_t addr) override {
+		if (addr >= SIZE) {
+			return false;
+		}
+		uint32_t page = addr - (addr % pageSize());
+		for (uint8_t row = 0; row < PAGE_ROWS; row++) {
+			NVMCTRL->ADDR.reg = ((uint32_t)(_flash + page + row * ROW_SIZE)) / 2;
+			NVMCTRL->CTRLA.reg = NVMCTRL_CTRLA_CMDEX_KEY | NVMCTRL_CTRLA_CMD_ER;
+			waitReady();
+		}
+		return true;
+	}
+
+private:
+
+	// defined below the class: a template static member is emitted once, like an inline variable
+	__attribute__((__aligned__(ROW_SIZE))) static const volatile uint8_t _flash[SIZE];
+
+	static void waitReady() {
+		while (NVMCTRL->INTFLAG.bit.READY == 0) {
+		}
+	}
+};
+
+template <uint32_t SIZE, uint8_t PAGE_ROWS, uint8_t ID>
+const volatile uint8_t SAMDFlashStorage<SIZE, PAGE_ROWS, ID>::_flash[SIZE] = { };
+#endif
+
+#if !defined(ARDUINO)
+/*
+ * File-backed storage, for host builds
+ *
+ * The file is created and erased if it does not exist.
+ */
+class FileStorage : public Storage {
+public:
+
+	FileStorage(const char * path, uint32_t size = 8192, uint16_t pageSize = 1024)
+		: _size(size), _pageSize(pageSize)
+	{
+		_file = fopen(path, "r+b");
+		if (_file == nullptr) {
+			_file = fopen(path, "w+b");
+			for (uint32_t addr = 0; _file != nullptr && addr < _size; addr += _pageSize) {
+				erase(addr);
+			}
+		}
+	}
+
+	virtual ~FileStorage() {
+		if (_file != nullptr) {
+			fclose(_file);
+		}
+	}
+
+	bool isOpen() const {
+		return _file != nullptr;
+	}
+
+	virtual uint32_t size() override {
+		return _size;
+	}
+
+	virtual uint16_t pageSize() override {
+		return _pageSize;
+	}
+
+	virtual bool read(uint32_t addr, uint8_t * dest, uint16_t len) override {
+		return _file != nullptr && addr + len <= _size
+			&& fseek(_file, addr, SEEK_SET) == 0
+			&& fread(dest, 1, len, _file) == len;
+	}
+
+	virtual bool write(uint32_t addr, const uint8_t * src, uint16_t len) override {
+		return _file != nullptr && addr + len <= _size
+			&& fseek(_file, addr, SEEK_SET) == 0
+			&& fwrite(src, 1, len, _file) == len;
+	}
+
+	virtual bool erase(uint32_t addr) override {
+		if (_file == nullptr || addr >= _size) {
+			return false;
+		}
+		uint8_t erased[64];
+		memset(erased, 0xFF, sizeof(erased));
+		uint32_t page = addr - (addr % _pageSize);
+		for (uint16_t done = 0; done < _pageSize; done += sizeof(erased)) {
+			uint16_t len = min((uint16_t)sizeof(erased), (uint16_t)(_pageSize - done));
+			if (!write(page + done, erased, len)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	virtual void flush() override {
+		if (_file != nullptr) {
+			fflush(_file);
+		}
+	}
+
+private:
+
+	FILE * 		_file = nullptr;
+	uint32_t 	_size;
+	uint16_t 	_pageSize;
+};
+#endif
+
+}
+}
@@ -0,0 +1,308 @@
+/*
+ * Module: UplinkLog
+ *
+ * Function: append-only log which makes the LMICWrapper uplink queue survive resets
+ *
+ * Copyright and license: See accompanying LICENSE file.
+ *
+ * Author: Laurent Nel
+ */
+
+#pragma once
+
+#include <Storage.h>
+
+// size of the RAM buffer which batches records before they are written to storage
+#ifndef LEUVILLE_LORA_LOG_BATCH
+#define LEUVILLE_LORA_LOG_BATCH 128
+#endif
+
+namespace leuville {
+namespace lora {
+
+/*
+ * Circular log of queue operations stored in Storage pages
+ *
+ * Page = [0xA5][0x5A][sequence number, 4 bytes] then records
+ * Record = [type][len][len bytes][crc8]; 0xFF type marks the free space of a page
+ *
+ * The queue is rebuilt by replaying the records from the last complete snapshot
+ * (BEGIN, PUSH..., END). Pages are written in turn, which levels flash wear;
+ * a page older than the last snapshot is erased when the log wraps onto it.
+ * A snapshot is due when less than half of the pages are free (see needsSnapshot()),
+ * so the storage should be at least twice as large as a full queue.
+ *
+ * Records are buffered in RAM (LEUVILLE_LORA_LOG_BATCH bytes) and written by commit(),
+ * or when the buffer is full.
+ */
+class UplinkLog {
+public:
+
+	// record types, the high nibble of a type holds a queue number
+	enum : uint8_t {
+		PUSH	= 0x01,
+		POP		= 0x02,
+		BEGIN	= 0x03,
+		END		= 0x04,
+		ERASE	= 0x05,		// data = position of the removed item, from the back
+		FREE	= 0xFF
+	};
+
+	UplinkLog(Storage & storage) : _storage(storage) {
+	}
+
+	/*
+	 * Finds the end of the log and the last complete snapshot
+	 * Starts a new log if the storage holds none.
+	 *
+	 * Returns false if the storage is too small
+	 */
+	bool open() {
+		_pageSize = _storage.pageSize();
+		_pages = _storage.size() / _pageSize;
+		_bufLen = 0;
+		if (_pages < 2 || _pageSize < HEADER_LEN + 3 + UINT8_MAX) {
+			return false;
+		}
+		// current page = highest sequence number
+		bool found = false;
+		for (uint16_t page = 0; page < _pages; page++) {
+			uint32_t seq;
+			if (readHeader(page, seq) && (!found || seq > _seq)) {
+				found = true;
+				_page = page;
+				_seq = seq;
+			}
+		}
+		if (!found) {
+			_page = 0;
+			_seq = 0;
+			return startPage(0, 1);
+		}
+		// oldest page = end of the chain of consecutive sequence numbers
+		_startPage = _page;
+		for (uint16_t n = 1; n < _pages; n++) {
+			uint16_t page = (_page + _pages - n) % _pages;
+			uint32_t seq;
+			if (!readHeader(page, seq) || seq != _seq - n) {
+				break;
+			}
+			_startPage = page;
+		}
+		_startOffset = HEADER_LEN;
+		// replay starts at the last complete snapshot
+		uint16_t beginPage = 0, beginOffset = 0;
+		bool inSnapshot = false;
+		_offset = HEADER_LEN;
+		scan(_startPage, HEADER_LEN, [&](uint16_t page, uint16_t offset, uint8_t type, const uint8_t *, uint8_t len) {
+			if ((type & 0x0F) == BEGIN) {
+				inSnapshot = true;
+				beginPage = page;
+				beginOffset = offset;
+			} else if ((type & 0x0F) == END && inSnapshot) {
+				inSnapshot = false;
+				_startPage = beginPage;
+				_startOffset = beginOffset;
+			}
+			if (page == _page) {
+				_offset = offset + RECORD_LEN(len);
+			}
+		});
+		if (_offset < _pageSize && !isFree(_page, _offset)) {
+			// torn record: never write after it
+			_offset = _pageSize;
+		}
+		return true;
+	}
+
+	/*
+	 * Calls apply(type, data, len) for each record since the last complete snapshot
+	 */
+	template <typename F>
+	void replay(F apply) {
+		commit();
+		scan(_startPage, _startOffset, [&](uint16_t, uint16_t, uint8_t type, const uint8_t * data, uint8_t len) {
+			apply(type, data, len);
+		});
+	}
+
+	/*
+	 * Adds a record made of two data segments
+	 *
+	 * Returns false if the log is full: a snapshot should have been written before
+	 */
+	bool append(uint8_t type, const uint8_t * data1 = nullptr, uint8_t len1 = 0, const uint8_t * data2 = nullptr, uint8_t len2 = 0) {
+		uint16_t len = len1 + len2;
+		if (len > UINT8_MAX) {
+			return false;
+		}
+		if (_offset + _bufLen + RECORD_LEN(len) > _pageSize) {
+			uint16_t next = (_page + 1) % _pages;
+			if (!commit() || next == _startPage || !startPage(next, _seq + 1)) {
+				return false;
+			}
+		}
+		if (_bufLen + RECORD_LEN(len) > LEUVILLE_LORA_LOG_BATCH && !commit()) {
+			return false;
+		}
+		if ((type & 0x0F) == BEGIN) {
+			_beginPage = _page;
+			_beginOffset = _offset + _bufLen;
+		}
+		uint8_t header[2] = { type, (uint8_t)len };
+		uint8_t crc = crc8(0, header, 2);
+		crc = crc8(crc, data1, len1);
+		crc = crc8(crc, data2, len2);
+		bool written = buffer(header, 2) && buffer(data1, len1) && buffer(data2, len2) && buffer(&crc, 1);
+		if (written && (type & 0x0F) == END) {
+			written = commit();
+			if (written) {
+				_startPage = _beginPage;
+				_startOffset = _beginOffset;
+			}
+		}
+		return written;
+	}
+
+	/*
+	 * Writes buffered records to storage
+	 *
+	 * Returns false if the storage refused them: they are lost
+	 */
+	bool commit() {
+		bool written = true;
+		if (_bufLen > 0) {
+			written = _storage.write(address(_page, _offset), _buf, _bufLen);
+			_storage.flush();
+			_offset += _bufLen;
+			_bufLen = 0;
+		}
+		return written;
+	}
+
+	/*
+	 * Number of bytes waiting for commit()
+	 */
+	uint16_t pending() const {
+		return _bufLen;
+	}
+
+	/*
+	 * true if the queue content should be logged again (BEGIN, PUSH..., END)
+	 * so that older pages may be reused
+	 */
+	bool needsSnapshot() const {
+		uint16_t used = (_page + _pages - _startPage) % _pages + 1;
+		return (_pages - used) * 2 < _pages;
+	}
+
+private:
+
+	static constexpr uint8_t HEADER_LEN = 6;
+
+	static constexpr uint16_t RECORD_LEN(uint16_t len) {
+		return len + 3;
+	}
+
+	Storage & 	_storage;
+	uint16_t 	_pageSize = 0;
+	uint16_t 	_pages = 0;
+
+	// write position
+	uint16_t 	_page = 0;
+	uint16_t 	_offset = HEADER_LEN;
+	uint32_t 	_seq = 0;
+
+	// replay position
+	uint16_t 	_startPage = 0;
+	uint16_t 	_startOffset = HEADER_LEN;
+
+	// last BEGIN record
+	uint16_t 	_beginPage = 0;
+	uint16_t 	_beginOffset = HEADER_LEN;
+
+	uint8_t 	_buf[LEUVILLE_LORA_LOG_BATCH];
+	uint16_t 	_bufLen = 0;
+
+	uint32_t address(uint16_t page, uint16_t offset) const {
+		return (uint32_t)page * _pageSize + offset;
+	}
+
+	bool buffer(const uint8_t * data, uint8_t len) {
+		if (data == nullptr) {
+			return true;
+		}
+		if (_bufLen + len > LEUVILLE_LORA_LOG_BATCH) {
+			// record larger than the batch buffer
+			bool written = commit() && _storage.write(address(_page, _offset), data, len);
+			_offset += len;
+			return written;
+		}
+		memcpy(_buf + _bufLen, data, len);
+		_bufLen += len;
+		return true;
+	}
+
+	bool startPage(uint16_t page, uint32_t seq) {
+		uint8_t header[HEADER_LEN] = { 0xA5, 0x5A, (uint8_t)seq, (uint8_t)(seq >> 8), (uint8_t)(seq >> 16), (uint8_t)(seq >> 24) };
+		if (!_storage.erase(address(page, 0)) || !_storage.write(address(page, 0), header, HEADER_LEN)) {
+			return false;
+		}
+		_storage.flush();
+		if (_startPage == page) {
+			// a fresh log, or the replay start was never written
+			_startOffset = HEADER_LEN;
+		}
+		_page = page;
+		_seq = seq;
+		_offset = HEADER_LEN;
+		return true;
+	}
+
+	bool readHeader(uint16_t page, uint32_t & seq) {
+		uint8_t header[HEADER_LEN];
+		if (!_storage.read(address(page, 0), header, HEADER_LEN) || header[0] != 0xA5 || header[1] != 0x5A) {
+			return false;
+		}
+		seq = header[2] | (header[3] << 8) | ((uint32_t)header[4] << 16) | ((uint32_t)header[5] << 24);
+		return true;
+	}
+
+	bool isFree(uint16_t page, uint16_t offset) {
+		uint8_t type = 0;
+		return _storage.read(address(page, offset), &type, 1) && type == FREE;
+	}
+
+	/*
+	 * Calls visit(page, offset, type, data, len) for each valid record from (page, offset)
+	 * to the end of the current page
+	 */
+	template <typename F>
+	void scan(uint16_t page, uint16_t offset, F visit) {
+		uint8_t data[UINT8_MAX + 1];
+		for (;;) {
+			while (offset + RECORD_LEN(0) <= _pageSize) {
+				uint8_t header[2];
+				if (!_storage.read(address(page, offset), header, 2) || header[0] == FREE
+					|| offset + RECORD_LEN(header[1]) > _pageSize
+					|| !_storage.read(address(page, offset + 2), data, header[1] + 1)) {
+					break;
+				}
+				uint8_t crc = crc8(crc8(0, header, 2), data, header[1]);
+				if (crc != data[header[1]]) {
+					break;
+				}
+				visit(page, offset, header[0], data, header[1]);
+				offset += RECORD_LEN(header[1]);
+			}
+			if (page == _page) {
+				return;
+			}
+			page = (page + 1) % _pages;
+			offset = HEADER_LEN;
+		}
+	}
+};
+
+}
+}